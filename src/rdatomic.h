@@ -200,4 +200,66 @@ static RD_INLINE int64_t RD_UNUSED rd_atomic64_set(rd_atomic64_t *ra, int64_t v)
 #endif
 }
 
+
+/**
+ * @brief Pointer atomics used by lock-free data structures.
+ *
+ * RD_ATOMICPTR_LOCKFREE is set to 1 if the compiler provides
+ * lock-free pointer compare-and-swap and exchange, else 0 in which
+ * case these functions must not be used.
+ */
+#if defined(_MSC_VER)
+#define RD_ATOMICPTR_LOCKFREE 1
+#elif HAVE_ATOMICS_32 && !defined(__SUNPRO_C)
+#define RD_ATOMICPTR_LOCKFREE 1
+#else
+#define RD_ATOMICPTR_LOCKFREE 0
+#endif
+
+#if RD_ATOMICPTR_LOCKFREE
+static RD_INLINE RD_UNUSED void *rd_atomicptr_get (void **ptr) {
+#ifdef _MSC_VER
+        return *(void * volatile *)ptr;
+#elif HAVE_ATOMICS_32_SYNC
+        __sync_synchronize();
+        return *(void * volatile *)ptr;
+#else
+        return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+#endif
+}
+
+/**
+ * @returns 1 if \p *ptr was \p oldval and has been set to \p newval,
+ *          else 0.
+ */
+static RD_INLINE RD_UNUSED int rd_atomicptr_cas (void **ptr,
+                                                 void *oldval, void *newval) {
+#ifdef _MSC_VER
+        return InterlockedCompareExchangePointer(ptr, newval, oldval) ==
+                oldval;
+#elif HAVE_ATOMICS_32_SYNC
+        return __sync_bool_compare_and_swap(ptr, oldval, newval);
+#else
+        return __atomic_compare_exchange_n(ptr, &oldval, newval, 0,
+                                           __ATOMIC_SEQ_CST,
+                                           __ATOMIC_SEQ_CST);
+#endif
+}
+
+/**
+ * @brief Set \p *ptr to \p newval.
+ * @returns the previous value.
+ */
+static RD_INLINE RD_UNUSED void *rd_atomicptr_xchg (void **ptr, void *newval) {
+#ifdef _MSC_VER
+        return InterlockedExchangePointer(ptr, newval);
+#elif HAVE_ATOMICS_32_SYNC
+        __sync_synchronize();
+        return __sync_lock_test_and_set(ptr, newval);
+#else
+        return __atomic_exchange_n(ptr, newval, __ATOMIC_SEQ_CST);
+#endif
+}
+#endif /* RD_ATOMICPTR_LOCKFREE */
+
 #endif /* _RDATOMIC_H_ */
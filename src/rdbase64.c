@@ -0,0 +1,105 @@
+/*
+ * librdkafka - Apache Kafka C library
+ *
+ * Copyright (c) 2020 Magnus Edenhill
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "rdbase64.h"
+
+#if WITH_SSL
+#include <openssl/evp.h>
+#else
+#error "WITH_SSL (OpenSSL) is required for Base64"
+#endif
+
+
+/**
+ * @brief Base64 encode binary input \p in
+ * @returns a newly allocated, base64-encoded string or NULL on error.
+ */
+char *rd_base64_encode (const rd_chariov_t *in) {
+        char *ret;
+        size_t ret_len, max_len;
+
+        /* OpenSSL takes an |int| argument so the input cannot exceed that. */
+        if (in->size > INT_MAX) {
+                return NULL;
+        }
+
+        /* This does not overflow given the |INT_MAX| bound, above. */
+        max_len = (((in->size + 2) / 3) * 4) + 1;
+        ret = rd_malloc(max_len);
+        if (ret == NULL) {
+                return NULL;
+        }
+
+        ret_len = EVP_EncodeBlock((uint8_t*)ret, (uint8_t*)in->ptr, (int)in->size);
+        assert(ret_len < max_len);
+        ret[ret_len] = 0;
+
+        return ret;
+}
+
+
+/**
+ * @brief Base64 decode input string \p in. Ignores leading and trailing
+ *         whitespace.
+ * @returns -1 on invalid Base64, or 0 on successes in which case a
+ *         newly allocated binary string is set in out (and size).
+ */
+int rd_base64_decode (const rd_chariov_t *in, rd_chariov_t *out) {
+        size_t ret_len;
+
+        /* OpenSSL takes an |int| argument, so |in->size| must not exceed
+         * that. */
+        if (in->size % 4 != 0 || in->size > INT_MAX) {
+                return -1;
+        }
+
+        ret_len = ((in->size / 4) * 3);
+        out->ptr = rd_malloc(ret_len+1);
+
+        if (EVP_DecodeBlock((uint8_t*)out->ptr, (uint8_t*)in->ptr,
+                            (int)in->size) == -1) {
+                free(out->ptr);
+                out->ptr = NULL;
+                return -1;
+        }
+
+        /* EVP_DecodeBlock will pad the output with trailing NULs and count
+         * them in the return value. */
+        if (in->size > 1 && in->ptr[in->size-1] == '=') {
+          if (in->size > 2 && in->ptr[in->size-2] == '=') {
+                  ret_len -= 2;
+          } else {
+                  ret_len -= 1;
+          }
+        }
+
+        out->ptr[ret_len] = 0;
+        out->size = ret_len;
+
+        return 0;
+}
@@ -587,6 +587,25 @@ void rd_buf_push (rd_buf_t *rbuf, const void *payload, size_t size,
 }
 
 
+/**
+ * @brief Append externally allocated, empty, memory \p mem of \p size bytes
+ *        as a writable segment at the end of the buffer, to be filled
+ *        by subsequent writes.
+ *
+ * @param free_cb is used to free \p mem when the buffer is destroyed,
+ *        or NULL.
+ */
+void rd_buf_push_writable (rd_buf_t *rbuf, void *mem, size_t size,
+                           void (*free_cb)(void *)) {
+        rd_segment_t *seg;
+
+        seg = rd_buf_alloc_segment0(rbuf, 0);
+        seg->seg_p    = mem;
+        seg->seg_size = size;
+        seg->seg_free = free_cb;
+
+        rd_buf_append_segment(rbuf, seg);
+}
 
 
 
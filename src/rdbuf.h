@@ -186,6 +186,8 @@ size_t rd_buf_write_update (rd_buf_t *rbuf, size_t absof,
                             const void *payload, size_t size);
 void rd_buf_push (rd_buf_t *rbuf, const void *payload, size_t size,
                   void (*free_cb)(void *));
+void rd_buf_push_writable (rd_buf_t *rbuf, void *mem, size_t size,
+                           void (*free_cb)(void *));
 
 
 size_t rd_buf_get_writable (rd_buf_t *rbuf, void **p);
@@ -134,6 +134,9 @@ static void rd_kafka_global_init0 (void) {
         atexit(rd_shared_ptrs_dump);
 #endif
 	mtx_init(&rd_kafka_global_lock, mtx_plain);
+        rd_atomic64_init(&rd_kafka_topic_gen, 0);
+        rd_atomic64_init(&rd_kafka_fetch_budget_process.used, 0);
+        rd_atomic32_init(&rd_kafka_fetch_budget_process.member_cnt, 0);
 #if ENABLE_DEVEL
 	rd_atomic32_init(&rd_kafka_op_cnt, 0);
 #endif
@@ -859,6 +862,10 @@ void rd_kafka_destroy_final (rd_kafka_t *rk) {
 
         rd_kafka_metadata_cache_destroy(rk);
 
+        rd_kafka_regex_cache_destroy(&rk->rk_regex_cache);
+
+        rd_kafka_topic_hash_destroy(rk);
+
         /* Terminate SASL provider */
         if (rk->rk_conf.sasl.provider)
                 rd_kafka_sasl_term(rk);
@@ -899,6 +906,7 @@ void rd_kafka_destroy_final (rd_kafka_t *rk) {
         if (rk->rk_type == RD_KAFKA_PRODUCER) {
 		cnd_destroy(&rk->rk_curr_msgs.cnd);
 		mtx_destroy(&rk->rk_curr_msgs.lock);
+                rd_kafka_msgpool_destroy(&rk->rk_msgpool);
 	}
 
         if (rk->rk_fatal.errstr) {
@@ -1165,6 +1173,13 @@ static void rd_kafka_destroy_internal (rd_kafka_t *rk) {
 
         rd_list_destroy(&wait_thrds);
 
+        /* Destroy the worker pool after the broker threads are gone
+         * since they are the only job submitters. */
+        if (rk->rk_workpool) {
+                rd_kafka_workpool_destroy(rk->rk_workpool);
+                rk->rk_workpool = NULL;
+        }
+
         /* Destroy mock cluster */
         if (rk->rk_mock.cluster)
                 rd_kafka_mock_cluster_destroy(rk->rk_mock.cluster);
@@ -1253,28 +1268,14 @@ static RD_INLINE void rd_kafka_stats_emit_avg (struct _stats_emit *st,
 }
 
 /**
- * Emit stats for toppar
+ * @returns the partition's consumer lag, or -1 if not known.
+ *
+ * @locks_required rd_kafka_toppar_lock(rktp)
  */
-static RD_INLINE void rd_kafka_stats_emit_toppar (struct _stats_emit *st,
-                                                  struct _stats_total *total,
-                                                  rd_kafka_toppar_t *rktp,
-                                                  int first) {
-        rd_kafka_t *rk = rktp->rktp_rkt->rkt_rk;
+static int64_t rd_kafka_stats_consumer_lag (rd_kafka_t *rk,
+                                            rd_kafka_toppar_t *rktp) {
         int64_t end_offset;
         int64_t consumer_lag = -1;
-        struct offset_stats offs;
-        int32_t broker_id = -1;
-
-        rd_kafka_toppar_lock(rktp);
-
-        if (rktp->rktp_broker) {
-                rd_kafka_broker_lock(rktp->rktp_broker);
-                broker_id = rktp->rktp_broker->rkb_nodeid;
-                rd_kafka_broker_unlock(rktp->rktp_broker);
-        }
-
-        /* Grab a copy of the latest finalized offset stats */
-        offs = rktp->rktp_offsets_fin;
 
         end_offset = (rk->rk_conf.isolation_level == RD_KAFKA_READ_COMMITTED)
                 ? rktp->rktp_ls_offset
@@ -1292,10 +1293,38 @@ static RD_INLINE void rd_kafka_stats_emit_toppar (struct _stats_emit *st,
                 consumer_lag = end_offset -
                         RD_MAX(rktp->rktp_app_offset,
                                rktp->rktp_committed_offset);
-                if (unlikely(consumer_lag) < 0)
+                if (unlikely(consumer_lag < 0))
                         consumer_lag = 0;
         }
 
+        return consumer_lag;
+}
+
+/**
+ * Emit stats for toppar
+ */
+static RD_INLINE void rd_kafka_stats_emit_toppar (struct _stats_emit *st,
+                                                  struct _stats_total *total,
+                                                  rd_kafka_toppar_t *rktp,
+                                                  int first) {
+        rd_kafka_t *rk = rktp->rktp_rkt->rkt_rk;
+        int64_t consumer_lag;
+        struct offset_stats offs;
+        int32_t broker_id = -1;
+
+        rd_kafka_toppar_lock(rktp);
+
+        if (rktp->rktp_broker) {
+                rd_kafka_broker_lock(rktp->rktp_broker);
+                broker_id = rktp->rktp_broker->rkb_nodeid;
+                rd_kafka_broker_unlock(rktp->rktp_broker);
+        }
+
+        /* Grab a copy of the latest finalized offset stats */
+        offs = rktp->rktp_offsets_fin;
+
+        consumer_lag = rd_kafka_stats_consumer_lag(rk, rktp);
+
 	_st_printf("%s\"%"PRId32"\": { "
 		   "\"partition\":%"PRId32", "
 		   "\"broker\":%"PRId32", "
@@ -1329,7 +1358,10 @@ static RD_INLINE void rd_kafka_stats_emit_toppar (struct _stats_emit *st,
                    "\"msgs_inflight\": %"PRId32", "
                    "\"next_ack_seq\": %"PRId32", "
                    "\"next_err_seq\": %"PRId32", "
-                   "\"acked_msgid\": %"PRIu64
+                   "\"acked_msgid\": %"PRIu64", "
+                   "\"enq_lock_waits\": %"PRIu64", "
+                   "\"enq_lock_wait_us\": %"PRIu64", "
+                   "\"linger_us\": %"PRId64
                    "} ",
 		   first ? "" : ", ",
 		   rktp->rktp_partition,
@@ -1368,7 +1400,12 @@ static RD_INLINE void rd_kafka_stats_emit_toppar (struct _stats_emit *st,
                    rd_atomic32_get(&rktp->rktp_msgs_inflight),
                    rktp->rktp_eos.next_ack_seq,
                    rktp->rktp_eos.next_err_seq,
-                   rktp->rktp_eos.acked_msgid);
+                   rktp->rktp_eos.acked_msgid,
+                   rd_atomic64_get(&rktp->rktp_c.enq_lock_waits),
+                   rd_atomic64_get(&rktp->rktp_c.enq_lock_wait_us),
+                   rk->rk_conf.linger_adaptive_target_ms ?
+                   rd_atomic64_get(&rktp->rktp_linger.us) :
+                   rk->rk_conf.buffering_max_us);
 
         if (total) {
                 total->txmsgs      += rd_atomic64_get(&rktp->rktp_c.tx_msgs);
@@ -1588,6 +1625,41 @@ static void rd_kafka_stats_emit_all (rd_kafka_t *rk) {
 
                 rd_kafka_stats_emit_broker_reqs(st, rkb);
 
+                _st_printf("\"fetch_session\": { "
+                           "\"full\":%"PRIu64", "
+                           "\"incremental\":%"PRIu64", "
+                           "\"errors\":%"PRIu64", "
+                           "\"omitted_partitions\":%"PRIu64", "
+                           "\"bytes_saved\":%"PRIu64" }, ",
+                           rd_atomic64_get(&rkb->rkb_c.fetch_session.full),
+                           rd_atomic64_get(&rkb->rkb_c.fetch_session.
+                                           incremental),
+                           rd_atomic64_get(&rkb->rkb_c.fetch_session.errors),
+                           rd_atomic64_get(&rkb->rkb_c.fetch_session.omitted),
+                           rd_atomic64_get(&rkb->rkb_c.fetch_session.
+                                           bytes_saved));
+
+                if (rkb->rkb_recv_pool) {
+                        rd_kafka_buf_pool_t *rbp = rkb->rkb_recv_pool;
+                        int free_cnt;
+
+                        mtx_lock(&rbp->rbp_lock);
+                        free_cnt = rbp->rbp_free_cnt;
+                        mtx_unlock(&rbp->rbp_lock);
+
+                        _st_printf("\"rxpool\": { "
+                                   "\"seg_size\":%"PRIusz", "
+                                   "\"alloc\":%"PRIu64", "
+                                   "\"reuse\":%"PRIu64", "
+                                   "\"free\":%d, "
+                                   "\"inuse\":%"PRId32" }, ",
+                                   rbp->rbp_seg_size,
+                                   rd_atomic64_get(&rbp->rbp_c_alloc),
+                                   rd_atomic64_get(&rbp->rbp_c_reuse),
+                                   free_cnt,
+                                   rd_atomic32_get(&rbp->rbp_inuse));
+                }
+
                 _st_printf("\"toppars\":{ "/*open toppars*/);
 
 		TAILQ_FOREACH(rktp, &rkb->rkb_toppars, rktp_rkblink) {
@@ -1695,6 +1767,53 @@ static void rd_kafka_stats_emit_all (rd_kafka_t *rk) {
                            rk->rk_eos.epoch_cnt);
         }
 
+        if (rk->rk_msgpool.rkmp_enabled) {
+                int pool_cnt;
+                size_t pool_size;
+
+                rd_kafka_msgpool_stats(&rk->rk_msgpool,
+                                       &pool_cnt, &pool_size);
+                _st_printf(", \"msgpool\": { "
+                           "\"hits\": %"PRId64", "
+                           "\"misses\": %"PRId64", "
+                           "\"cnt\": %d, "
+                           "\"size\": %"PRIusz" "
+                           "}",
+                           rd_atomic64_get(&rk->rk_msgpool.rkmp_hits),
+                           rd_atomic64_get(&rk->rk_msgpool.rkmp_misses),
+                           pool_cnt, pool_size);
+        }
+
+        if (rk->rk_fetch_budget.fb)
+                _st_printf(", \"fetch_budget\": { "
+                           "\"max\": %"PRId64", "
+                           "\"used\": %"PRId64", "
+                           "\"shared_used\": %"PRId64", "
+                           "\"partitions\": %"PRId32", "
+                           "\"held\": %"PRId64" "
+                           "}",
+                           rk->rk_fetch_budget.max,
+                           rd_atomic64_get(&rk->rk_fetch_budget.local.used),
+                           rd_atomic64_get(&rk->rk_fetch_budget.fb->used),
+                           rd_atomic32_get(&rk->rk_fetch_budget.local.
+                                           member_cnt),
+                           rd_atomic64_get(&rk->rk_fetch_budget.c_held));
+
+#if WITH_SASL_SCRAM
+        {
+                int64_t derived_cnt, cached_cnt, keys_cnt;
+
+                if (rd_kafka_sasl_scram_stats(rk, &derived_cnt, &cached_cnt,
+                                              &keys_cnt))
+                        _st_printf(", \"sasl_scram\": { "
+                                   "\"keys_derived\": %"PRId64", "
+                                   "\"keys_cached\": %"PRId64", "
+                                   "\"keys_cnt\": %"PRId64" "
+                                   "}",
+                                   derived_cnt, cached_cnt, keys_cnt);
+        }
+#endif
+
         if ((err = rd_atomic32_get(&rk->rk_fatal.err)))
                 _st_printf(", \"fatal\": { "
                            "\"error\": \"%s\", "
@@ -1738,6 +1857,344 @@ static void rd_kafka_stats_emit_all (rd_kafka_t *rk) {
 }
 
 
+/**
+ * @name Statistics snapshots
+ * @{
+ */
+
+/**
+ * @brief Statistics snapshot container.
+ *
+ * An incremental snapshot only exposes the changed partitions but keeps
+ * the counters of all partitions, so that it can be the base of the
+ * next incremental snapshot in turn.
+ */
+typedef struct rd_kafka_stats_snapshot_s {
+        rd_kafka_stats_t stats;             /**< Public snapshot,
+                                             *   must be first. */
+        int all_topic_cnt;                  /**< Number of topics in
+                                             *   all_topics */
+        rd_kafka_stats_topic_t *all_topics; /**< All topics and partitions,
+                                             *   ordered by name.
+                                             *   Same as stats.topics unless
+                                             *   incremental. */
+} rd_kafka_stats_snapshot_t;
+
+
+static int rd_kafka_stats_topic_cmp (const void *_a, const void *_b) {
+        const rd_kafka_stats_topic_t *a = _a, *b = _b;
+        return strcmp(a->topic, b->topic);
+}
+
+static int rd_kafka_stats_partition_cmp (const void *_a, const void *_b) {
+        const rd_kafka_stats_partition_t *a = _a, *b = _b;
+        return RD_CMP(a->partition, b->partition);
+}
+
+
+/**
+ * @brief Copy \p rktp's counters to \p sp, which must be zeroed
+ *        (partition snapshots are compared with memcmp()).
+ *
+ * @locks rd_kafka_toppar_lock() is acquired and released.
+ */
+static void rd_kafka_stats_snapshot_toppar (rd_kafka_t *rk,
+                                            rd_kafka_stats_partition_t *sp,
+                                            rd_kafka_toppar_t *rktp) {
+        rd_kafka_toppar_lock(rktp);
+
+        sp->partition = rktp->rktp_partition;
+        sp->broker = -1;
+        if (rktp->rktp_broker) {
+                rd_kafka_broker_lock(rktp->rktp_broker);
+                sp->broker = rktp->rktp_broker->rkb_nodeid;
+                rd_kafka_broker_unlock(rktp->rktp_broker);
+        }
+        sp->leader = rktp->rktp_leader_id;
+        sp->desired = !!(rktp->rktp_flags & RD_KAFKA_TOPPAR_F_DESIRED);
+        sp->unknown = !!(rktp->rktp_flags & RD_KAFKA_TOPPAR_F_UNKNOWN);
+        sp->msgq_cnt = rd_kafka_msgq_len(&rktp->rktp_msgq);
+        sp->msgq_bytes = rd_kafka_msgq_size(&rktp->rktp_msgq);
+        sp->fetchq_cnt = rd_kafka_q_len(rktp->rktp_fetchq);
+        sp->fetchq_size = rd_kafka_q_size(rktp->rktp_fetchq);
+        sp->query_offset = rktp->rktp_query_offset;
+        sp->next_offset = rktp->rktp_offsets_fin.fetch_offset;
+        sp->app_offset = rktp->rktp_app_offset;
+        sp->stored_offset = rktp->rktp_stored_offset;
+        sp->committed_offset = rktp->rktp_committed_offset;
+        sp->eof_offset = rktp->rktp_offsets_fin.eof_offset;
+        sp->lo_offset = rktp->rktp_lo_offset;
+        sp->hi_offset = rktp->rktp_hi_offset;
+        sp->ls_offset = rktp->rktp_ls_offset;
+        sp->consumer_lag = rd_kafka_stats_consumer_lag(rk, rktp);
+        sp->txmsgs = rd_atomic64_get(&rktp->rktp_c.tx_msgs);
+        sp->txbytes = rd_atomic64_get(&rktp->rktp_c.tx_msg_bytes);
+        sp->rxmsgs = rd_atomic64_get(&rktp->rktp_c.rx_msgs);
+        sp->rxbytes = rd_atomic64_get(&rktp->rktp_c.rx_msg_bytes);
+        sp->msgs = rk->rk_type == RD_KAFKA_PRODUCER ?
+                rd_atomic64_get(&rktp->rktp_c.producer_enq_msgs) :
+                rd_atomic64_get(&rktp->rktp_c.rx_msgs);
+        sp->rx_ver_drops = rd_atomic64_get(&rktp->rktp_c.rx_ver_drops);
+        sp->msgs_inflight = rd_atomic32_get(&rktp->rktp_msgs_inflight);
+
+        rd_kafka_toppar_unlock(rktp);
+}
+
+
+/**
+ * @brief Snapshot \p rkt's partitions (but not the UA partition) to \p st
+ *        and add their counters to the totals in \p stats.
+ *
+ * @locks rd_kafka_topic_rdlock() is acquired and released.
+ */
+static void rd_kafka_stats_snapshot_topic (rd_kafka_t *rk,
+                                           rd_kafka_stats_t *stats,
+                                           rd_kafka_stats_topic_t *st,
+                                           rd_kafka_itopic_t *rkt) {
+        shptr_rd_kafka_toppar_t *s_rktp;
+        int i, cnt, desp_cnt;
+
+        rd_kafka_topic_rdlock(rkt);
+
+        st->topic = RD_KAFKAP_STR_DUP(rkt->rkt_topic);
+        st->metadata_age = rkt->rkt_ts_metadata ?
+                (rd_clock() - rkt->rkt_ts_metadata) / 1000 : 0;
+
+        desp_cnt = rd_list_cnt(&rkt->rkt_desp);
+        cnt = rkt->rkt_partition_cnt + desp_cnt;
+        if (cnt > 0)
+                st->partitions = rd_calloc(cnt, sizeof(*st->partitions));
+
+        for (i = 0 ; i < rkt->rkt_partition_cnt ; i++)
+                rd_kafka_stats_snapshot_toppar(
+                        rk, &st->partitions[st->partition_cnt++],
+                        rd_kafka_toppar_s2i(rkt->rkt_p[i]));
+
+        RD_LIST_FOREACH(s_rktp, &rkt->rkt_desp, i)
+                rd_kafka_stats_snapshot_toppar(
+                        rk, &st->partitions[st->partition_cnt++],
+                        rd_kafka_toppar_s2i(s_rktp));
+
+        rd_kafka_topic_rdunlock(rkt);
+
+        /* Desired partitions are not necessarily ordered,
+         * nor beyond the known partitions. */
+        if (desp_cnt > 0)
+                qsort(st->partitions, st->partition_cnt,
+                      sizeof(*st->partitions), rd_kafka_stats_partition_cmp);
+
+        for (i = 0 ; i < st->partition_cnt ; i++) {
+                stats->txmsgs      += st->partitions[i].txmsgs;
+                stats->txmsg_bytes += st->partitions[i].txbytes;
+                stats->rxmsgs      += st->partitions[i].rxmsgs;
+                stats->rxmsg_bytes += st->partitions[i].rxbytes;
+        }
+}
+
+
+/**
+ * @brief Expose only the partitions of \p snap whose counters differ
+ *        from those in \p prev.
+ */
+static void
+rd_kafka_stats_snapshot_diff (rd_kafka_stats_snapshot_t *snap,
+                              const rd_kafka_stats_snapshot_t *prev) {
+        rd_kafka_stats_t *stats = &snap->stats;
+        int i, j;
+
+        stats->incremental = 1;
+        stats->topic_cnt = 0;
+        stats->topics = NULL;
+
+        if (snap->all_topic_cnt == 0)
+                return;
+
+        stats->topics = rd_calloc(snap->all_topic_cnt,
+                                  sizeof(*stats->topics));
+
+        for (i = 0 ; i < snap->all_topic_cnt ; i++) {
+                const rd_kafka_stats_topic_t *st = &snap->all_topics[i];
+                const rd_kafka_stats_topic_t *pst = NULL;
+                rd_kafka_stats_topic_t *dst;
+
+                if (prev->all_topic_cnt > 0)
+                        pst = bsearch(st, prev->all_topics,
+                                      prev->all_topic_cnt,
+                                      sizeof(*prev->all_topics),
+                                      rd_kafka_stats_topic_cmp);
+
+                dst = &stats->topics[stats->topic_cnt];
+
+                for (j = 0 ; j < st->partition_cnt ; j++) {
+                        const rd_kafka_stats_partition_t *sp =
+                                &st->partitions[j];
+                        const rd_kafka_stats_partition_t *psp = NULL;
+
+                        if (pst && pst->partition_cnt > 0)
+                                psp = bsearch(sp, pst->partitions,
+                                              pst->partition_cnt,
+                                              sizeof(*pst->partitions),
+                                              rd_kafka_stats_partition_cmp);
+
+                        if (psp && !memcmp(sp, psp, sizeof(*sp)))
+                                continue; /* Unchanged */
+
+                        if (!dst->partitions) {
+                                dst->topic = st->topic;
+                                dst->metadata_age = st->metadata_age;
+                                dst->partitions = rd_malloc(
+                                        sizeof(*dst->partitions) *
+                                        st->partition_cnt);
+                        }
+
+                        dst->partitions[dst->partition_cnt++] = *sp;
+                }
+
+                if (dst->partition_cnt > 0)
+                        stats->topic_cnt++;
+        }
+}
+
+
+const rd_kafka_stats_t *rd_kafka_stats_snapshot (rd_kafka_t *rk,
+                                                 const rd_kafka_stats_t *prev) {
+        rd_kafka_stats_snapshot_t *snap;
+        rd_kafka_stats_t *stats;
+        rd_kafka_broker_t *rkb;
+        rd_kafka_itopic_t *rkt;
+        shptr_rd_kafka_itopic_t **s_rkts = NULL;
+        int i, cnt;
+
+        snap = rd_calloc(1, sizeof(*snap));
+        stats = &snap->stats;
+
+        rd_kafka_curr_msgs_get(rk, &stats->msg_cnt, &stats->msg_size);
+        stats->msg_max = rk->rk_curr_msgs.max_cnt;
+        stats->msg_size_max = rk->rk_curr_msgs.max_size;
+        stats->replyq = rd_kafka_q_len(rk->rk_rep);
+
+        /* Only copy the broker counters and grab references to the
+         * topics while holding the handle lock. */
+        rd_kafka_rdlock(rk);
+
+        stats->ts = rd_clock();
+        stats->time = (int64_t)time(NULL);
+
+        cnt = 0;
+        TAILQ_FOREACH(rkb, &rk->rk_brokers, rkb_link)
+                cnt++;
+        if (cnt > 0)
+                stats->brokers = rd_calloc(cnt, sizeof(*stats->brokers));
+
+        TAILQ_FOREACH(rkb, &rk->rk_brokers, rkb_link) {
+                rd_kafka_stats_broker_t *sb =
+                        &stats->brokers[stats->broker_cnt++];
+
+                rd_kafka_broker_lock(rkb);
+                sb->name = rd_strdup(rkb->rkb_name);
+                sb->nodeid = rkb->rkb_nodeid;
+                sb->state = rd_kafka_broker_state_names[rkb->rkb_state];
+                sb->stateage = rkb->rkb_ts_state ?
+                        stats->ts - rkb->rkb_ts_state : 0;
+                rd_kafka_broker_unlock(rkb);
+
+                sb->outbuf_cnt = rd_atomic32_get(&rkb->rkb_outbufs.rkbq_cnt);
+                sb->outbuf_msg_cnt =
+                        rd_atomic32_get(&rkb->rkb_outbufs.rkbq_msg_cnt);
+                sb->waitresp_cnt =
+                        rd_atomic32_get(&rkb->rkb_waitresps.rkbq_cnt);
+                sb->waitresp_msg_cnt =
+                        rd_atomic32_get(&rkb->rkb_waitresps.rkbq_msg_cnt);
+                sb->tx = rd_atomic64_get(&rkb->rkb_c.tx);
+                sb->txbytes = rd_atomic64_get(&rkb->rkb_c.tx_bytes);
+                sb->txerrs = rd_atomic64_get(&rkb->rkb_c.tx_err);
+                sb->txretries = rd_atomic64_get(&rkb->rkb_c.tx_retries);
+                sb->req_timeouts = rd_atomic64_get(&rkb->rkb_c.req_timeouts);
+                sb->rx = rd_atomic64_get(&rkb->rkb_c.rx);
+                sb->rxbytes = rd_atomic64_get(&rkb->rkb_c.rx_bytes);
+                sb->rxerrs = rd_atomic64_get(&rkb->rkb_c.rx_err);
+                sb->rxcorriderrs = rd_atomic64_get(&rkb->rkb_c.rx_corrid_err);
+                sb->rxpartial = rd_atomic64_get(&rkb->rkb_c.rx_partial);
+                sb->zbuf_grow = rd_atomic64_get(&rkb->rkb_c.zbuf_grow);
+                sb->buf_grow = rd_atomic64_get(&rkb->rkb_c.buf_grow);
+                sb->wakeups = rd_atomic64_get(&rkb->rkb_c.wakeups);
+                sb->connects = rd_atomic32_get(&rkb->rkb_c.connects);
+                sb->disconnects = rd_atomic32_get(&rkb->rkb_c.disconnects);
+
+                stats->tx       += sb->tx;
+                stats->tx_bytes += sb->txbytes;
+                stats->rx       += sb->rx;
+                stats->rx_bytes += sb->rxbytes;
+        }
+
+        cnt = 0;
+        TAILQ_FOREACH(rkt, &rk->rk_topics, rkt_link)
+                cnt++;
+        if (cnt > 0)
+                s_rkts = rd_malloc(sizeof(*s_rkts) * cnt);
+
+        TAILQ_FOREACH(rkt, &rk->rk_topics, rkt_link)
+                s_rkts[snap->all_topic_cnt++] = rd_kafka_topic_keep(rkt);
+
+        rd_kafka_rdunlock(rk);
+
+        /* Partition counters are copied one topic and partition lock
+         * at a time. */
+        if (snap->all_topic_cnt > 0)
+                snap->all_topics = rd_calloc(snap->all_topic_cnt,
+                                             sizeof(*snap->all_topics));
+
+        for (i = 0 ; i < snap->all_topic_cnt ; i++) {
+                rd_kafka_stats_snapshot_topic(rk, stats, &snap->all_topics[i],
+                                              rd_kafka_topic_s2i(s_rkts[i]));
+                rd_kafka_topic_destroy0(s_rkts[i]);
+        }
+
+        RD_IF_FREE(s_rkts, rd_free);
+
+        if (snap->all_topic_cnt > 1)
+                qsort(snap->all_topics, snap->all_topic_cnt,
+                      sizeof(*snap->all_topics), rd_kafka_stats_topic_cmp);
+
+        if (prev)
+                rd_kafka_stats_snapshot_diff(
+                        snap, (const rd_kafka_stats_snapshot_t *)prev);
+        else {
+                stats->topic_cnt = snap->all_topic_cnt;
+                stats->topics = snap->all_topics;
+        }
+
+        return stats;
+}
+
+
+void rd_kafka_stats_destroy (const rd_kafka_stats_t *stats) {
+        rd_kafka_stats_snapshot_t *snap = (rd_kafka_stats_snapshot_t *)stats;
+        int i;
+
+        if (snap->stats.incremental) {
+                /* Topic names are owned by all_topics */
+                for (i = 0 ; i < snap->stats.topic_cnt ; i++)
+                        rd_free(snap->stats.topics[i].partitions);
+                RD_IF_FREE(snap->stats.topics, rd_free);
+        }
+
+        for (i = 0 ; i < snap->all_topic_cnt ; i++) {
+                rd_free(snap->all_topics[i].topic);
+                RD_IF_FREE(snap->all_topics[i].partitions, rd_free);
+        }
+        RD_IF_FREE(snap->all_topics, rd_free);
+
+        for (i = 0 ; i < snap->stats.broker_cnt ; i++)
+                rd_free(snap->stats.brokers[i].name);
+        RD_IF_FREE(snap->stats.brokers, rd_free);
+
+        rd_free(snap);
+}
+
+/**@}*/
+
+
 /**
  * @brief 1 second generic timer.
  *
@@ -2003,6 +2460,8 @@ rd_kafka_t *rd_kafka_new (rd_kafka_type_t type, rd_kafka_conf_t *app_conf,
         rd_atomic64_init(&rk->rk_ts_last_poll, INT64_MAX);
 
 	rk->rk_rep = rd_kafka_q_new(rk);
+        if (rk->rk_conf.lockfree_enqueue)
+                rd_kafka_q_mpsc_enable(rk->rk_rep);
 	rk->rk_ops = rd_kafka_q_new(rk);
         rk->rk_ops->rkq_serve = rd_kafka_poll_cb;
         rk->rk_ops->rkq_opaque = rk;
@@ -2015,8 +2474,10 @@ rd_kafka_t *rd_kafka_new (rd_kafka_type_t type, rd_kafka_conf_t *app_conf,
 
 	TAILQ_INIT(&rk->rk_brokers);
 	TAILQ_INIT(&rk->rk_topics);
+        rk->rk_topic_gen = rd_atomic64_add(&rd_kafka_topic_gen, 1);
         rd_kafka_timers_init(&rk->rk_timers, rk);
         rd_kafka_metadata_cache_init(rk);
+        rd_kafka_regex_cache_init(&rk->rk_regex_cache);
 
 	if (rk->rk_conf.dr_cb || rk->rk_conf.dr_msg_cb)
 		rk->rk_conf.enabled_events |= RD_KAFKA_EVENT_DR;
@@ -2062,6 +2523,8 @@ rd_kafka_t *rd_kafka_new (rd_kafka_type_t type, rd_kafka_conf_t *app_conf,
         /* Config fixups */
         rk->rk_conf.queued_max_msg_bytes =
                 (int64_t)rk->rk_conf.queued_max_msg_kbytes * 1000ll;
+        rk->rk_conf.queued_max_total_bytes =
+                (int64_t)rk->rk_conf.queued_max_total_kbytes * 1000ll;
 
 	/* Enable api.version.request=true if fallback.broker.version
 	 * indicates a supporting broker. */
@@ -2086,8 +2549,16 @@ rd_kafka_t *rd_kafka_new (rd_kafka_type_t type, rd_kafka_conf_t *app_conf,
                                 (size_t)rk->rk_conf.
                                 queue_buffering_max_kbytes * 1024;
                 }
+
+                rd_kafka_msgpool_init(&rk->rk_msgpool,
+                                      rk->rk_conf.msgpool_enable ?
+                                      (size_t)rk->rk_conf.
+                                      msgpool_max_kbytes * 1024 : 0);
         }
 
+        if (rk->rk_type == RD_KAFKA_CONSUMER)
+                rd_kafka_fetch_budget_init(rk);
+
         if (rd_kafka_assignors_init(rk, errstr, errstr_size) == -1) {
                 ret_err = RD_KAFKA_RESP_ERR__INVALID_ARG;
                 ret_errno = EINVAL;
@@ -2178,6 +2649,22 @@ rd_kafka_t *rd_kafka_new (rd_kafka_type_t type, rd_kafka_conf_t *app_conf,
         pthread_sigmask(SIG_SETMASK, &newset, &oldset);
 #endif
 
+        /* Create the compression worker pool, if configured.
+         * Do this after blocking signals so that the worker threads
+         * inherit the blocked signal set. */
+        if (rk->rk_conf.compression_threads > 0 &&
+            !(rk->rk_workpool = rd_kafka_workpool_new(
+                      rk->rk_conf.compression_threads,
+                      errstr, errstr_size))) {
+                ret_err = RD_KAFKA_RESP_ERR__CRIT_SYS_RESOURCE;
+                ret_errno = errno;
+#ifndef _MSC_VER
+                /* Restore sigmask of caller */
+                pthread_sigmask(SIG_SETMASK, &oldset, NULL);
+#endif
+                goto fail;
+        }
+
         mtx_lock(&rk->rk_init_lock);
 
         /* Create background thread and queue if background_event_cb()
@@ -3473,8 +3960,7 @@ rd_kafka_poll_cb (rd_kafka_t *rk, rd_kafka_q_t *rkq, rd_kafka_op_t *rko,
 		while ((rkm = TAILQ_FIRST(&rko->rko_u.dr.msgq.rkmq_msgs))) {
                         rd_kafka_message_t *rkmessage;
 
-			TAILQ_REMOVE(&rko->rko_u.dr.msgq.rkmq_msgs,
-				     rkm, rkm_link);
+			rd_kafka_msgq_deq(&rko->rko_u.dr.msgq, rkm, 0);
 
                         rkmessage = rd_kafka_message_get_from_rkm(rko, rkm);
 
@@ -3942,6 +3942,190 @@ void rd_kafka_metadata_destroy(const struct rd_kafka_metadata *metadata);
 
 
 
+/**
+* @name Statistics snapshot API
+* @{
+*
+* Typed counters, sampled on demand, as an alternative to the JSON
+* statistics emitted every \c statistics.interval.ms.
+*
+* A snapshot holds the same counters as the JSON statistics, see
+* STATISTICS.md for their descriptions, but no window averages
+* (\c rtt, \c int_latency, \c batchsize, etc.) since those are reset
+* each time they are emitted as JSON.
+*
+* Taking a snapshot neither formats any text nor holds the client's
+* locks for longer than it takes to copy each broker's and partition's
+* counters, which makes it suitable for sampling at a high frequency.
+*/
+
+
+/**
+ * @brief Broker statistics snapshot
+ */
+typedef struct rd_kafka_stats_broker {
+        char       *name;           /**< Broker name */
+        int32_t     nodeid;         /**< Broker id, -1 for bootstraps */
+        const char *state;          /**< Broker state */
+        int64_t     stateage;       /**< Time since last state change
+                                     *   (microseconds) */
+        int32_t     outbuf_cnt;     /**< Requests awaiting transmission */
+        int32_t     outbuf_msg_cnt; /**< Messages awaiting transmission */
+        int32_t     waitresp_cnt;   /**< Requests in-flight */
+        int32_t     waitresp_msg_cnt; /**< Messages in-flight */
+        uint64_t    tx;             /**< Requests sent */
+        uint64_t    txbytes;        /**< Bytes sent */
+        uint64_t    txerrs;         /**< Transmission errors */
+        uint64_t    txretries;      /**< Request retries */
+        uint64_t    req_timeouts;   /**< Requests timed out */
+        uint64_t    rx;             /**< Responses received */
+        uint64_t    rxbytes;        /**< Bytes received */
+        uint64_t    rxerrs;         /**< Receive errors */
+        uint64_t    rxcorriderrs;   /**< Unmatched correlation ids */
+        uint64_t    rxpartial;      /**< Partial MessageSets received */
+        uint64_t    zbuf_grow;      /**< Decompression buffer grows */
+        uint64_t    buf_grow;       /**< Buffer grows */
+        uint64_t    wakeups;        /**< Broker thread poll wakeups */
+        int32_t     connects;       /**< Connection attempts */
+        int32_t     disconnects;    /**< Disconnects */
+} rd_kafka_stats_broker_t;
+
+/**
+ * @brief Partition statistics snapshot
+ *
+ * Offsets are -1001 (RD_KAFKA_OFFSET_INVALID) when not known.
+ */
+typedef struct rd_kafka_stats_partition {
+        int32_t     partition;      /**< Partition id */
+        int32_t     broker;         /**< Broker the partition is handled by,
+                                     *   or -1 */
+        int32_t     leader;         /**< Current leader broker id */
+        int         desired;        /**< Partition is explicitly desired
+                                     *   by the application */
+        int         unknown;        /**< Partition is not seen in topic
+                                     *   metadata from broker */
+        int         msgq_cnt;       /**< Messages waiting in the partition
+                                     *   queue */
+        size_t      msgq_bytes;     /**< Size of \p msgq_cnt messages */
+        int         fetchq_cnt;     /**< Pre-fetched messages */
+        uint64_t    fetchq_size;    /**< Pre-fetched bytes */
+        int64_t     query_offset;   /**< Current/Last logical offset
+                                     *   query */
+        int64_t     next_offset;    /**< Next offset to fetch */
+        int64_t     app_offset;     /**< Offset of last message passed to
+                                     *   application + 1 */
+        int64_t     stored_offset;  /**< Offset to be committed */
+        int64_t     committed_offset; /**< Last committed offset */
+        int64_t     eof_offset;     /**< Last PARTITION_EOF offset */
+        int64_t     lo_offset;      /**< Partition's low watermark offset */
+        int64_t     hi_offset;      /**< Partition's high watermark
+                                     *   offset */
+        int64_t     ls_offset;      /**< Partition's last stable offset */
+        int64_t     consumer_lag;   /**< Difference between \p hi_offset
+                                     *   (or \p ls_offset) and the
+                                     *   highest of \p app_offset and
+                                     *   \p committed_offset, or -1 */
+        uint64_t    txmsgs;         /**< Messages sent */
+        uint64_t    txbytes;        /**< Bytes sent */
+        uint64_t    rxmsgs;         /**< Messages consumed (not including
+                                     *   ignored messages) */
+        uint64_t    rxbytes;        /**< Bytes consumed */
+        uint64_t    msgs;           /**< Messages produced or received */
+        uint64_t    rx_ver_drops;   /**< Dropped outdated messages */
+        int32_t     msgs_inflight;  /**< Messages in-flight to/from
+                                     *   broker */
+} rd_kafka_stats_partition_t;
+
+/**
+ * @brief Topic statistics snapshot
+ */
+typedef struct rd_kafka_stats_topic {
+        char       *topic;          /**< Topic name */
+        int64_t     metadata_age;   /**< Age of metadata from broker for
+                                     *   this topic (milliseconds) */
+        int         partition_cnt;  /**< Number of partitions in
+                                     *   \p partitions */
+        rd_kafka_stats_partition_t *partitions; /**< Partitions, ordered
+                                                 *   by partition id */
+} rd_kafka_stats_topic_t;
+
+/**
+ * @brief Statistics snapshot, see rd_kafka_stats_snapshot().
+ */
+typedef struct rd_kafka_stats {
+        int64_t     ts;             /**< librdkafka's internal monotonic
+                                     *   clock (microseconds) */
+        int64_t     time;           /**< Wall clock time in seconds since
+                                     *   the epoch */
+        int         replyq;         /**< Ops waiting in the queue for the
+                                     *   application to call
+                                     *   rd_kafka_poll() */
+        unsigned int msg_cnt;       /**< Messages in producer queues */
+        size_t      msg_size;       /**< Size of messages in producer
+                                     *   queues */
+        unsigned int msg_max;       /**< \c queue.buffering.max.messages */
+        size_t      msg_size_max;   /**< \c queue.buffering.max.kbytes */
+
+        uint64_t    tx;             /**< Requests sent to all brokers */
+        uint64_t    tx_bytes;       /**< Bytes sent to all brokers */
+        uint64_t    rx;             /**< Responses received from all
+                                     *   brokers */
+        uint64_t    rx_bytes;       /**< Bytes received from all
+                                     *   brokers */
+        uint64_t    txmsgs;         /**< Messages produced, all
+                                     *   partitions */
+        uint64_t    txmsg_bytes;    /**< Message bytes produced, all
+                                     *   partitions */
+        uint64_t    rxmsgs;         /**< Messages consumed, all
+                                     *   partitions */
+        uint64_t    rxmsg_bytes;    /**< Message bytes consumed, all
+                                     *   partitions */
+
+        int         broker_cnt;     /**< Number of brokers in \p brokers */
+        rd_kafka_stats_broker_t *brokers; /**< Brokers */
+
+        int         topic_cnt;      /**< Number of topics in \p topics */
+        rd_kafka_stats_topic_t *topics; /**< Topics, ordered by name */
+
+        int         incremental;    /**< Only partitions whose counters
+                                     *   changed since the \p prev snapshot
+                                     *   are included, and only topics
+                                     *   with such partitions. */
+} rd_kafka_stats_t;
+
+
+/**
+ * @brief Take a snapshot of the client's statistics counters.
+ *
+ * @param rk Client instance.
+ * @param prev Optional previous snapshot (of the same \p rk) to make an
+ *             incremental snapshot: only partitions whose counters
+ *             differ from those at the time of \p prev are included.
+ *             Broker and total counters are always included.
+ *             \p prev may itself be incremental, and remains owned by
+ *             the application.
+ *
+ * @returns a new snapshot that must be freed with
+ *          rd_kafka_stats_destroy().
+ *
+ * @remark This API does not require \c statistics.interval.ms to be
+ *         configured.
+ */
+RD_EXPORT
+const rd_kafka_stats_t *rd_kafka_stats_snapshot (rd_kafka_t *rk,
+                                                 const rd_kafka_stats_t *prev);
+
+/**
+ * @brief Free a snapshot returned by rd_kafka_stats_snapshot().
+ */
+RD_EXPORT
+void rd_kafka_stats_destroy (const rd_kafka_stats_t *stats);
+
+
+/**@}*/
+
+
+
 /**
 * @name Client group information
 * @{
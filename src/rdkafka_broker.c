@@ -113,6 +113,9 @@ rd_kafka_broker_needs_connection (rd_kafka_broker_t *rkb) {
 
 static void rd_kafka_broker_handle_purge_queues (rd_kafka_broker_t *rkb,
                                                  rd_kafka_op_t *rko);
+static void rd_kafka_fetch_session_reset (rd_kafka_broker_t *rkb,
+                                          rd_bool_t forget,
+                                          const char *reason);
 
 
 
@@ -355,6 +358,232 @@ int rd_kafka_broker_get_state (rd_kafka_broker_t *rkb) {
 }
 
 
+/**
+ * @name In-flight request (rkb_waitresps) index
+ *
+ * rkb_waitresps keeps the in-flight requests in send order, this index
+ * provides O(1) lookup by CorrId for matching responses and a min-heap
+ * on rkbuf_ts_timeout so that timeout scans only visit expired requests.
+ *
+ * CorrIds are assigned sequentially per connection, so in-flight requests
+ * spread evenly over the ring buckets: a bucket chain only grows beyond
+ * one request when a long-running request is still in flight while more
+ * than ring_size newer requests have been sent.
+ *
+ * All in-flight requests must be enqueued and dequeued through
+ * rd_kafka_waitresp_enq() and rd_kafka_waitresp_deq().
+ *
+ * @locality broker thread
+ * @{
+ */
+
+#define rd_kafka_waitresp_bucket(rkb,corrid)                            \
+        (&(rkb)->rkb_waitresp_idx.ring[(uint32_t)(corrid) &             \
+                                       (uint32_t)((rkb)->rkb_waitresp_idx. \
+                                                  ring_size - 1)])
+
+/**
+ * @brief Grow the CorrId ring to \p size buckets (power of two).
+ */
+static void rd_kafka_waitresp_ring_resize (rd_kafka_broker_t *rkb, int size) {
+        rd_kafka_buf_t **old = rkb->rkb_waitresp_idx.ring;
+        int old_size = rkb->rkb_waitresp_idx.ring_size;
+        int i;
+
+        rkb->rkb_waitresp_idx.ring = rd_calloc(size, sizeof(*old));
+        rkb->rkb_waitresp_idx.ring_size = size;
+
+        for (i = 0 ; i < old_size ; i++) {
+                rd_kafka_buf_t *rkbuf, *next;
+
+                for (rkbuf = old[i] ; rkbuf ; rkbuf = next) {
+                        rd_kafka_buf_t **bucket =
+                                rd_kafka_waitresp_bucket(rkb,
+                                                         rkbuf->rkbuf_corrid);
+                        next = rkbuf->rkbuf_corrid_next;
+                        rkbuf->rkbuf_corrid_next = *bucket;
+                        *bucket = rkbuf;
+                }
+        }
+
+        if (old)
+                rd_free(old);
+}
+
+static RD_INLINE void rd_kafka_waitresp_heap_set (rd_kafka_broker_t *rkb,
+                                                  int idx,
+                                                  rd_kafka_buf_t *rkbuf) {
+        rkb->rkb_waitresp_idx.heap[idx] = rkbuf;
+        rkbuf->rkbuf_timeout_idx = idx;
+}
+
+/**
+ * @brief Move the request at heap index \p idx towards the root until
+ *        the heap invariant holds.
+ */
+static void rd_kafka_waitresp_heap_up (rd_kafka_broker_t *rkb, int idx) {
+        rd_kafka_buf_t **heap = rkb->rkb_waitresp_idx.heap;
+        rd_kafka_buf_t *rkbuf = heap[idx];
+
+        while (idx > 0) {
+                int parent = (idx - 1) / 2;
+
+                if (heap[parent]->rkbuf_ts_timeout <= rkbuf->rkbuf_ts_timeout)
+                        break;
+
+                rd_kafka_waitresp_heap_set(rkb, idx, heap[parent]);
+                idx = parent;
+        }
+
+        rd_kafka_waitresp_heap_set(rkb, idx, rkbuf);
+}
+
+/**
+ * @brief Move the request at heap index \p idx towards the leaves until
+ *        the heap invariant holds.
+ */
+static void rd_kafka_waitresp_heap_down (rd_kafka_broker_t *rkb, int idx) {
+        rd_kafka_buf_t **heap = rkb->rkb_waitresp_idx.heap;
+        int cnt = rkb->rkb_waitresp_idx.heap_cnt;
+        rd_kafka_buf_t *rkbuf = heap[idx];
+
+        while (1) {
+                int child = idx * 2 + 1;
+
+                if (child >= cnt)
+                        break;
+
+                if (child + 1 < cnt &&
+                    heap[child+1]->rkbuf_ts_timeout <
+                    heap[child]->rkbuf_ts_timeout)
+                        child++;
+
+                if (rkbuf->rkbuf_ts_timeout <= heap[child]->rkbuf_ts_timeout)
+                        break;
+
+                rd_kafka_waitresp_heap_set(rkb, idx, heap[child]);
+                idx = child;
+        }
+
+        rd_kafka_waitresp_heap_set(rkb, idx, rkbuf);
+}
+
+
+/**
+ * @brief Enqueue sent request \p rkbuf on rkb_waitresps and index it.
+ */
+static void rd_kafka_waitresp_enq (rd_kafka_broker_t *rkb,
+                                   rd_kafka_buf_t *rkbuf) {
+        rd_kafka_buf_t **bucket;
+
+        /* Keep the ring at least as large as the number of
+         * in-flight requests. */
+        if (rkb->rkb_waitresp_idx.heap_cnt >= rkb->rkb_waitresp_idx.ring_size)
+                rd_kafka_waitresp_ring_resize(
+                        rkb, RD_MAX(64, rkb->rkb_waitresp_idx.ring_size * 2));
+
+        if (rkb->rkb_waitresp_idx.heap_cnt ==
+            rkb->rkb_waitresp_idx.heap_size) {
+                rkb->rkb_waitresp_idx.heap_size =
+                        RD_MAX(64, rkb->rkb_waitresp_idx.heap_size * 2);
+                rkb->rkb_waitresp_idx.heap =
+                        rd_realloc(rkb->rkb_waitresp_idx.heap,
+                                   sizeof(*rkb->rkb_waitresp_idx.heap) *
+                                   rkb->rkb_waitresp_idx.heap_size);
+        }
+
+        rd_kafka_bufq_enq(&rkb->rkb_waitresps, rkbuf);
+
+        bucket = rd_kafka_waitresp_bucket(rkb, rkbuf->rkbuf_corrid);
+        rkbuf->rkbuf_corrid_next = *bucket;
+        *bucket = rkbuf;
+
+        rd_kafka_waitresp_heap_set(rkb, rkb->rkb_waitresp_idx.heap_cnt++,
+                                   rkbuf);
+        rd_kafka_waitresp_heap_up(rkb, rkbuf->rkbuf_timeout_idx);
+}
+
+
+/**
+ * @brief Dequeue request \p rkbuf from rkb_waitresps and the index.
+ */
+static void rd_kafka_waitresp_deq (rd_kafka_broker_t *rkb,
+                                   rd_kafka_buf_t *rkbuf) {
+        rd_kafka_buf_t **rkbufp, *last;
+        int idx = rkbuf->rkbuf_timeout_idx;
+
+        rd_kafka_bufq_deq(&rkb->rkb_waitresps, rkbuf);
+
+        for (rkbufp = rd_kafka_waitresp_bucket(rkb, rkbuf->rkbuf_corrid) ;
+             *rkbufp != rkbuf ;
+             rkbufp = &(*rkbufp)->rkbuf_corrid_next)
+                rd_assert(*rkbufp != NULL);
+        *rkbufp = rkbuf->rkbuf_corrid_next;
+        rkbuf->rkbuf_corrid_next = NULL;
+
+        rd_assert(idx >= 0 && idx < rkb->rkb_waitresp_idx.heap_cnt &&
+                  rkb->rkb_waitresp_idx.heap[idx] == rkbuf);
+
+        last = rkb->rkb_waitresp_idx.heap[--rkb->rkb_waitresp_idx.heap_cnt];
+        if (idx < rkb->rkb_waitresp_idx.heap_cnt) {
+                rd_kafka_waitresp_heap_set(rkb, idx, last);
+                if (idx > 0 &&
+                    last->rkbuf_ts_timeout <
+                    rkb->rkb_waitresp_idx.heap[(idx - 1) / 2]->
+                    rkbuf_ts_timeout)
+                        rd_kafka_waitresp_heap_up(rkb, idx);
+                else
+                        rd_kafka_waitresp_heap_down(rkb, idx);
+        }
+
+        rkbuf->rkbuf_timeout_idx = -1;
+}
+
+
+/**
+ * @returns the in-flight request with CorrId \p corrid, or NULL.
+ *          The request is not dequeued.
+ */
+static rd_kafka_buf_t *rd_kafka_waitresp_lookup (rd_kafka_broker_t *rkb,
+                                                 int32_t corrid) {
+        rd_kafka_buf_t *rkbuf;
+
+        if (unlikely(!rkb->rkb_waitresp_idx.ring_size))
+                return NULL;
+
+        for (rkbuf = *rd_kafka_waitresp_bucket(rkb, corrid) ; rkbuf ;
+             rkbuf = rkbuf->rkbuf_corrid_next)
+                if (rkbuf->rkbuf_corrid == corrid)
+                        return rkbuf;
+
+        return NULL;
+}
+
+
+/**
+ * @brief Move all in-flight requests to \p rkbq and clear the index.
+ */
+static void rd_kafka_waitresp_move (rd_kafka_broker_t *rkb,
+                                    rd_kafka_bufq_t *rkbq) {
+        int i;
+
+        rd_kafka_bufq_concat(rkbq, &rkb->rkb_waitresps);
+
+        for (i = 0 ; i < rkb->rkb_waitresp_idx.heap_cnt ; i++) {
+                rkb->rkb_waitresp_idx.heap[i]->rkbuf_corrid_next = NULL;
+                rkb->rkb_waitresp_idx.heap[i]->rkbuf_timeout_idx = -1;
+        }
+        rkb->rkb_waitresp_idx.heap_cnt = 0;
+
+        if (rkb->rkb_waitresp_idx.ring)
+                memset(rkb->rkb_waitresp_idx.ring, 0,
+                       sizeof(*rkb->rkb_waitresp_idx.ring) *
+                       rkb->rkb_waitresp_idx.ring_size);
+}
+
+/**@}*/
+
+
 /**
  * Failure propagation to application.
  * Will tear down connection to broker and trigger a reconnect.
@@ -474,7 +703,7 @@ void rd_kafka_broker_fail (rd_kafka_broker_t *rkb,
 	 */
 	rd_kafka_bufq_init(&tmpq_waitresp);
 	rd_kafka_bufq_init(&tmpq);
-	rd_kafka_bufq_concat(&tmpq_waitresp, &rkb->rkb_waitresps);
+	rd_kafka_waitresp_move(rkb, &tmpq_waitresp);
 	rd_kafka_bufq_concat(&tmpq, &rkb->rkb_outbufs);
         rd_atomic32_init(&rkb->rkb_blocking_request_cnt, 0);
 
@@ -497,6 +726,9 @@ void rd_kafka_broker_fail (rd_kafka_broker_t *rkb,
 	 */
 	rd_kafka_bufq_connection_reset(rkb, &rkb->rkb_outbufs);
 
+        /* The next FetchRequest on the new connection is a full fetch. */
+        rd_kafka_fetch_session_reset(rkb, rd_false, "connection down");
+
 	/* Extra debugging for tracking termination-hang issues:
 	 * show what is keeping this broker from decommissioning. */
 	if (rd_kafka_terminating(rkb->rkb_rk) &&
@@ -584,9 +816,12 @@ void rd_kafka_broker_conn_closed (rd_kafka_broker_t *rkb,
  * @brief Purge requests in \p rkbq matching request \p ApiKey
  *        and partition \p rktp.
  *
+ * Unsent multi-partition ProduceRequests are rebuilt without
+ * \p rktp's MessageSet.
+ *
  * @warning ApiKey must be RD_KAFKAP_Produce
  *
- * @returns the number of purged buffers.
+ * @returns the number of purged buffers and MessageSets.
  *
  * @locality broker thread
  */
@@ -604,14 +839,27 @@ rd_kafka_broker_bufq_purge_by_toppar (rd_kafka_broker_t *rkb,
         TAILQ_FOREACH_SAFE(rkbuf, &rkbq->rkbq_bufs, rkbuf_link, tmp) {
 
                 if (rkbuf->rkbuf_reqhdr.ApiKey != ApiKey ||
-                    rd_kafka_toppar_s2i(rkbuf->rkbuf_u.Produce.
-                                        batch.s_rktp) != rktp||
                     /* Skip partially sent buffers and let them transmit.
                      * The alternative would be to kill the connection here,
                      * which is more drastic and costly. */
                     rd_slice_offset(&rkbuf->rkbuf_reader) > 0)
                         continue;
 
+                if (rkbuf->rkbuf_u.Produce.parts) {
+                        /* Multi-partition requests also carry other
+                         * partitions' messages: only take out this
+                         * partition's MessageSet. */
+                        if (rd_kafka_ProduceRequest_purge_part(rkb, rkbq,
+                                                               rkbuf, rktp,
+                                                               err))
+                                cnt++;
+                        continue;
+                }
+
+                if (rd_kafka_toppar_s2i(rkbuf->rkbuf_u.Produce.
+                                        batch.s_rktp) != rktp)
+                        continue;
+
                 rd_kafka_bufq_deq(rkbq, rkbuf);
 
                 rd_kafka_buf_callback(rkb->rkb_rk, rkb, err, NULL, rkbuf);
@@ -622,12 +870,99 @@ rd_kafka_broker_bufq_purge_by_toppar (rd_kafka_broker_t *rkb,
 }
 
 
+/**
+ * @brief Time out a single buffer found by
+ *        rd_kafka_broker_bufq_timeout_scan(): dequeue it from \p rkbq,
+ *        log it and trigger its callback.
+ *
+ * @param cnt The number of buffers timed out so far in this scan.
+ * @param holbp Head of line blocking candidate, see below.
+ *
+ * @locality broker thread
+ */
+static void rd_kafka_broker_buf_timeout (rd_kafka_broker_t *rkb,
+                                         int is_waitresp_q,
+                                         rd_kafka_bufq_t *rkbq,
+                                         rd_kafka_buf_t *rkbuf,
+                                         int *partial_cntp,
+                                         rd_kafka_resp_err_t err,
+                                         rd_ts_t now,
+                                         const char *description,
+                                         int log_first_n,
+                                         int cnt,
+                                         const rd_kafka_buf_t **holbp) {
+
+        if (partial_cntp && rd_slice_offset(&rkbuf->rkbuf_reader) > 0)
+                (*partial_cntp)++;
+
+        /* Convert rkbuf_ts_sent to elapsed time since request */
+        if (rkbuf->rkbuf_ts_sent)
+                rkbuf->rkbuf_ts_sent = now - rkbuf->rkbuf_ts_sent;
+        else
+                rkbuf->rkbuf_ts_sent = now - rkbuf->rkbuf_ts_enq;
+
+        if (is_waitresp_q)
+                rd_kafka_waitresp_deq(rkb, rkbuf);
+        else
+                rd_kafka_bufq_deq(rkbq, rkbuf);
+
+        if (now && cnt < log_first_n) {
+                char holbstr[128];
+                const rd_kafka_buf_t *holb = *holbp;
+                /* Head of line blocking:
+                 * If this is not the first request in queue, but the
+                 * initial first request did not time out,
+                 * it typically means the first request is a
+                 * long-running blocking one, holding up the
+                 * sub-sequent requests.
+                 * In this case log what is likely holding up the
+                 * requests and what caused this request to time out. */
+                if (holb && holb == TAILQ_FIRST(&rkbq->rkbq_bufs)) {
+                        rd_snprintf(holbstr, sizeof(holbstr),
+                                    ": possibly held back by "
+                                    "preceeding%s %sRequest with "
+                                    "timeout in %dms",
+                                    (holb->rkbuf_flags &
+                                     RD_KAFKA_OP_F_BLOCKING) ?
+                                    " blocking" : "",
+                                    rd_kafka_ApiKey2str(holb->
+                                                        rkbuf_reqhdr.
+                                                        ApiKey),
+                                    (int)((holb->rkbuf_ts_timeout -
+                                           now) / 1000));
+                        /* Only log the HOLB once */
+                        *holbp = NULL;
+                } else {
+                        *holbstr = '\0';
+                }
+
+                rd_rkb_log(rkb, LOG_NOTICE, "REQTMOUT",
+                           "Timed out %sRequest %s "
+                           "(after %"PRId64"ms, timeout #%d)%s",
+                           rd_kafka_ApiKey2str(rkbuf->rkbuf_reqhdr.
+                                               ApiKey),
+                           description, rkbuf->rkbuf_ts_sent/1000, cnt,
+                           holbstr);
+        }
+
+        if (is_waitresp_q && rkbuf->rkbuf_flags & RD_KAFKA_OP_F_BLOCKING
+            && rd_atomic32_sub(&rkb->rkb_blocking_request_cnt, 1) == 0)
+                rd_kafka_brokers_broadcast_state_change(rkb->rkb_rk);
+
+        rd_kafka_buf_callback(rkb->rkb_rk, rkb, err, NULL, rkbuf);
+}
+
+
 /**
  * Scan bufq for buffer timeouts, trigger buffer callback on timeout.
  *
  * If \p partial_cntp is non-NULL any partially sent buffers will increase
  * the provided counter by 1.
  *
+ * For rkb_waitresps (\p is_waitresp_q) with a \p now clock and no
+ * \p ApiKey filter only the expired requests are visited, in timeout
+ * order, through the in-flight request index.
+ *
  * @param ApiKey Only match requests with this ApiKey, or -1 for all.
  * @param now If 0, all buffers will time out, else the current clock.
  * @param description "N requests timed out <description>", e.g., "in flight".
@@ -649,11 +984,23 @@ static int rd_kafka_broker_bufq_timeout_scan (rd_kafka_broker_t *rkb,
                                               int log_first_n) {
 	rd_kafka_buf_t *rkbuf, *tmp;
 	int cnt = 0;
-        int idx = -1;
         const rd_kafka_buf_t *holb = TAILQ_FIRST(&rkbq->rkbq_bufs);
 
+        if (is_waitresp_q && now && ApiKey == -1) {
+                rd_dassert(rkbq == &rkb->rkb_waitresps);
+
+                while (rkb->rkb_waitresp_idx.heap_cnt > 0 &&
+                       (rkbuf = rkb->rkb_waitresp_idx.heap[0])->
+                       rkbuf_ts_timeout <= now)
+                        rd_kafka_broker_buf_timeout(rkb, is_waitresp_q, rkbq,
+                                                    rkbuf, partial_cntp, err,
+                                                    now, description,
+                                                    log_first_n, cnt++,
+                                                    &holb);
+                return cnt;
+        }
+
 	TAILQ_FOREACH_SAFE(rkbuf, &rkbq->rkbq_bufs, rkbuf_link, tmp) {
-                idx++;
 
 		if (likely(now && rkbuf->rkbuf_ts_timeout > now))
 			continue;
@@ -661,61 +1008,10 @@ static int rd_kafka_broker_bufq_timeout_scan (rd_kafka_broker_t *rkb,
                 if (ApiKey != -1 && rkbuf->rkbuf_reqhdr.ApiKey != ApiKey)
                         continue;
 
-                if (partial_cntp && rd_slice_offset(&rkbuf->rkbuf_reader) > 0)
-                        (*partial_cntp)++;
-
-		/* Convert rkbuf_ts_sent to elapsed time since request */
-		if (rkbuf->rkbuf_ts_sent)
-			rkbuf->rkbuf_ts_sent = now - rkbuf->rkbuf_ts_sent;
-		else
-			rkbuf->rkbuf_ts_sent = now - rkbuf->rkbuf_ts_enq;
-
-		rd_kafka_bufq_deq(rkbq, rkbuf);
-
-                if (now && cnt < log_first_n) {
-                        char holbstr[128];
-                        /* Head of line blocking:
-                         * If this is not the first request in queue, but the
-                         * initial first request did not time out,
-                         * it typically means the first request is a
-                         * long-running blocking one, holding up the
-                         * sub-sequent requests.
-                         * In this case log what is likely holding up the
-                         * requests and what caused this request to time out. */
-                        if (holb && holb == TAILQ_FIRST(&rkbq->rkbq_bufs)) {
-                                rd_snprintf(holbstr, sizeof(holbstr),
-                                            ": possibly held back by "
-                                            "preceeding%s %sRequest with "
-                                            "timeout in %dms",
-                                            (holb->rkbuf_flags &
-                                             RD_KAFKA_OP_F_BLOCKING) ?
-                                            " blocking" : "",
-                                            rd_kafka_ApiKey2str(holb->
-                                                                rkbuf_reqhdr.
-                                                                ApiKey),
-                                            (int)((holb->rkbuf_ts_timeout -
-                                                   now) / 1000));
-                                /* Only log the HOLB once */
-                                holb = NULL;
-                        } else {
-                                *holbstr = '\0';
-                        }
-
-                        rd_rkb_log(rkb, LOG_NOTICE, "REQTMOUT",
-                                   "Timed out %sRequest %s "
-                                   "(after %"PRId64"ms, timeout #%d)%s",
-                                   rd_kafka_ApiKey2str(rkbuf->rkbuf_reqhdr.
-                                                       ApiKey),
-                                   description, rkbuf->rkbuf_ts_sent/1000, cnt,
-                                   holbstr);
-                }
-
-                if (is_waitresp_q && rkbuf->rkbuf_flags & RD_KAFKA_OP_F_BLOCKING
-		    && rd_atomic32_sub(&rkb->rkb_blocking_request_cnt, 1) == 0)
-			rd_kafka_brokers_broadcast_state_change(rkb->rkb_rk);
-
-                rd_kafka_buf_callback(rkb->rkb_rk, rkb, err, NULL, rkbuf);
-		cnt++;
+                rd_kafka_broker_buf_timeout(rkb, is_waitresp_q, rkbq, rkbuf,
+                                            partial_cntp, err, now,
+                                            description, log_first_n, cnt++,
+                                            &holb);
 	}
 
 	return cnt;
@@ -789,16 +1085,24 @@ static void rd_kafka_broker_timeout_scan (rd_kafka_broker_t *rkb, rd_ts_t now) {
 
 
 
+/**
+ * @brief Send the remaining contents of \p slice_cnt \p slices
+ *        (one per request) to the broker in a single transport write.
+ *
+ * @returns the number of bytes sent, or -1 on failure.
+ */
 static ssize_t
-rd_kafka_broker_send (rd_kafka_broker_t *rkb, rd_slice_t *slice) {
+rd_kafka_broker_send (rd_kafka_broker_t *rkb,
+                      rd_slice_t **slices, int slice_cnt) {
 	ssize_t r;
 	char errstr[128];
+        int i;
 
 	rd_kafka_assert(rkb->rkb_rk, rkb->rkb_state >= RD_KAFKA_BROKER_STATE_UP);
 	rd_kafka_assert(rkb->rkb_rk, rkb->rkb_transport);
 
-        r = rd_kafka_transport_send(rkb->rkb_transport, slice,
-                                    errstr, sizeof(errstr));
+        r = rd_kafka_transport_sendv(rkb->rkb_transport, slices, slice_cnt,
+                                     errstr, sizeof(errstr));
 
 	if (r == -1) {
 		rd_kafka_broker_fail(rkb, LOG_ERR, RD_KAFKA_RESP_ERR__TRANSPORT,
@@ -808,7 +1112,12 @@ rd_kafka_broker_send (rd_kafka_broker_t *rkb, rd_slice_t *slice) {
 	}
 
 	rd_atomic64_add(&rkb->rkb_c.tx_bytes, r);
-	rd_atomic64_add(&rkb->rkb_c.tx, 1);
+
+        /* Count the requests completed by this write, the first one
+         * is always counted to retain the single request semantics. */
+        for (i = 1 ; i < slice_cnt && !rd_slice_remains(slices[i-1]) ; i++)
+                ;
+	rd_atomic64_add(&rkb->rkb_c.tx, i);
 	return r;
 }
 
@@ -928,30 +1237,7 @@ static void rd_kafka_broker_buf_enq0 (rd_kafka_broker_t *rkb,
         rd_atomic32_add(&rkb->rkb_outbufs.rkbq_cnt, 1);
         if (rkbuf->rkbuf_reqhdr.ApiKey == RD_KAFKAP_Produce)
                 rd_atomic32_add(&rkb->rkb_outbufs.rkbq_msg_cnt,
-                                rd_kafka_msgq_len(&rkbuf->rkbuf_batch.msgq));
-}
-
-
-/**
- * Finalize a stuffed rkbuf for sending to broker.
- */
-static void rd_kafka_buf_finalize (rd_kafka_t *rk, rd_kafka_buf_t *rkbuf) {
-        size_t totsize;
-
-        /* Calculate total request buffer length. */
-        totsize = rd_buf_len(&rkbuf->rkbuf_buf) - 4;
-
-        /* Set up a buffer reader for sending the buffer. */
-        rd_slice_init_full(&rkbuf->rkbuf_reader, &rkbuf->rkbuf_buf);
-
-        /**
-         * Update request header fields
-         */
-        /* Total reuqest length */
-        rd_kafka_buf_update_i32(rkbuf, 0, (int32_t)totsize);
-
-        /* ApiVersion */
-        rd_kafka_buf_update_i16(rkbuf, 4+2, rkbuf->rkbuf_reqhdr.ApiVersion);
+                                rd_kafka_buf_Produce_msgcnt(rkbuf));
 }
 
 
@@ -1445,32 +1731,54 @@ rd_kafka_broker_t *rd_kafka_broker_controller (rd_kafka_t *rk, int state,
 
 
 
+/**
+ * @brief Update the smoothed ProduceRequest round-trip time and its mean
+ *        deviation with the \p rtt sample, as in RFC 6298.
+ *
+ * @locality broker thread
+ */
+static void rd_kafka_broker_produce_rtt_update (rd_kafka_broker_t *rkb,
+                                                rd_ts_t rtt) {
+        rd_ts_t err;
+
+        if (unlikely(!rkb->rkb_produce_rtt.srtt)) {
+                rkb->rkb_produce_rtt.srtt   = rtt;
+                rkb->rkb_produce_rtt.rttvar = rtt / 2;
+                return;
+        }
+
+        err = rtt - rkb->rkb_produce_rtt.srtt;
+        rkb->rkb_produce_rtt.rttvar +=
+                ((err < 0 ? -err : err) - rkb->rkb_produce_rtt.rttvar) / 4;
+        rkb->rkb_produce_rtt.srtt += err / 8;
+}
+
+
 /**
  * Find a waitresp (rkbuf awaiting response) by the correlation id.
  */
 static rd_kafka_buf_t *rd_kafka_waitresp_find (rd_kafka_broker_t *rkb,
 					       int32_t corrid) {
 	rd_kafka_buf_t *rkbuf;
-	rd_ts_t now = rd_clock();
 
 	rd_kafka_assert(rkb->rkb_rk, thrd_is_current(rkb->rkb_thread));
 
-	TAILQ_FOREACH(rkbuf, &rkb->rkb_waitresps.rkbq_bufs, rkbuf_link)
-		if (rkbuf->rkbuf_corrid == corrid) {
-			/* Convert ts_sent to RTT */
-			rkbuf->rkbuf_ts_sent = now - rkbuf->rkbuf_ts_sent;
-			rd_avg_add(&rkb->rkb_avg_rtt, rkbuf->rkbuf_ts_sent);
+        if (!(rkbuf = rd_kafka_waitresp_lookup(rkb, corrid)))
+                return NULL;
 
-                        if (rkbuf->rkbuf_flags & RD_KAFKA_OP_F_BLOCKING &&
-			    rd_atomic32_sub(&rkb->rkb_blocking_request_cnt,
-					    1) == 1)
-				rd_kafka_brokers_broadcast_state_change(
-					rkb->rkb_rk);
+        /* Convert ts_sent to RTT */
+        rkbuf->rkbuf_ts_sent = rd_clock() - rkbuf->rkbuf_ts_sent;
+        rd_avg_add(&rkb->rkb_avg_rtt, rkbuf->rkbuf_ts_sent);
 
-			rd_kafka_bufq_deq(&rkb->rkb_waitresps, rkbuf);
-			return rkbuf;
-		}
-	return NULL;
+        if (rkbuf->rkbuf_reqhdr.ApiKey == RD_KAFKAP_Produce)
+                rd_kafka_broker_produce_rtt_update(rkb, rkbuf->rkbuf_ts_sent);
+
+        if (rkbuf->rkbuf_flags & RD_KAFKA_OP_F_BLOCKING &&
+            rd_atomic32_sub(&rkb->rkb_blocking_request_cnt, 1) == 1)
+                rd_kafka_brokers_broadcast_state_change(rkb->rkb_rk);
+
+        rd_kafka_waitresp_deq(rkb, rkbuf);
+        return rkbuf;
 }
 
 
@@ -1617,11 +1925,16 @@ int rd_kafka_recv (rd_kafka_broker_t *rkb) {
 
 		rkbuf->rkbuf_totlen -= 4; /*CorrId*/
 
-		if (rkbuf->rkbuf_totlen > 0) {
-			/* Allocate another buffer that fits all data (short of
-			 * the common response header). We want all
-			 * data to be in contigious memory. */
+		if (rkbuf->rkbuf_totlen >= RD_KAFKA_BUF_POOL_SEG_SIZE) {
+                        /* Receive large responses into fixed-size pool
+                         * segments rather than one huge allocation. */
+                        rd_kafka_buf_pool_write_ensure(rkb->rkb_recv_pool,
+                                                       &rkbuf->rkbuf_buf,
+                                                       rkbuf->rkbuf_totlen);
 
+                } else if (rkbuf->rkbuf_totlen > 0) {
+			/* Allocate another buffer that fits all data (short of
+			 * the common response header) in contigious memory. */
                         rd_buf_write_ensure_contig(&rkbuf->rkbuf_buf,
                                                    rkbuf->rkbuf_totlen);
 		}
@@ -2209,6 +2522,83 @@ rd_kafka_broker_request_supported (rd_kafka_broker_t *rkb,
 }
 
 
+/**
+ * @brief Set the CorrId header field of \p rkbuf, unless this is the
+ *        latter part of a partial send in which case the corrid has
+ *        already been set.
+ *
+ * Due to how SSL_write() will accept a buffer but still
+ * return 0 in some cases we can't rely on the buffer offset
+ * but need to use corrid to check this. SSL_write() expects
+ * us to send the same buffer again when 0 is returned.
+ *
+ * @locality broker thread
+ */
+static void rd_kafka_broker_buf_set_corrid (rd_kafka_broker_t *rkb,
+                                            rd_kafka_buf_t *rkbuf) {
+        if (rkbuf->rkbuf_corrid == 0 ||
+            rkbuf->rkbuf_connid != rkb->rkb_connid) {
+                rd_assert(rd_slice_offset(&rkbuf->rkbuf_reader) == 0);
+                rkbuf->rkbuf_corrid = ++rkb->rkb_corrid;
+                rd_kafka_buf_update_i32(rkbuf, 4+2+2,
+                                        rkbuf->rkbuf_corrid);
+                rkbuf->rkbuf_connid = rkb->rkb_connid;
+        } else if (rd_slice_offset(&rkbuf->rkbuf_reader) >
+                   RD_KAFKAP_REQHDR_SIZE) {
+                rd_kafka_assert(NULL,
+                                rkbuf->rkbuf_connid == rkb->rkb_connid);
+        }
+}
+
+
+/**
+ * @brief Write the head-of-line request \p rkbuf to the broker,
+ *        along with up to socket.send.batch.max - 1 directly following
+ *        requests in the output queue, using a single gathering write.
+ *
+ * Following requests are only included while there is room for them
+ * in the in-flight window, and only in the UP state so that
+ * handshake and authentication requests are always sent one by one.
+ * Requests left partially or not at all written remain at the
+ * head of the output queue and are resumed by the next rd_kafka_send().
+ *
+ * @returns the number of bytes sent, or -1 on failure.
+ *
+ * @locality broker thread
+ */
+static ssize_t rd_kafka_broker_send_outbufs (rd_kafka_broker_t *rkb,
+                                             rd_kafka_buf_t *rkbuf) {
+        int batch_max = rkb->rkb_rk->rk_conf.socket_send_batch_max;
+        int inflight  = rd_kafka_bufq_cnt(&rkb->rkb_waitresps);
+        rd_slice_t **slices;
+        int cnt = 0;
+
+        if (batch_max <= 1 || rkb->rkb_state != RD_KAFKA_BROKER_STATE_UP) {
+                rd_slice_t *slice = &rkbuf->rkbuf_reader;
+                return rd_kafka_broker_send(rkb, &slice, 1);
+        }
+
+        slices = rd_alloca(sizeof(*slices) * batch_max);
+
+        while (1) {
+                slices[cnt++] = &rkbuf->rkbuf_reader;
+
+                if (cnt == batch_max ||
+                    inflight + cnt >= rkb->rkb_max_inflight)
+                        break;
+
+                rkbuf = TAILQ_NEXT(rkbuf, rkbuf_link);
+                if (!rkbuf ||
+                    !rd_kafka_broker_request_supported(rkb, rkbuf))
+                        break;
+
+                rd_kafka_broker_buf_set_corrid(rkb, rkbuf);
+        }
+
+        return rd_kafka_broker_send(rkb, slices, cnt);
+}
+
+
 /**
  * Send queued messages to broker
  *
@@ -2249,25 +2639,7 @@ int rd_kafka_send (rd_kafka_broker_t *rkb) {
                         continue;
                 }
 
-		/* Set CorrId header field, unless this is the latter part
-		 * of a partial send in which case the corrid has already
-		 * been set.
-		 * Due to how SSL_write() will accept a buffer but still
-		 * return 0 in some cases we can't rely on the buffer offset
-		 * but need to use corrid to check this. SSL_write() expects
-		 * us to send the same buffer again when 0 is returned.
-		 */
-		if (rkbuf->rkbuf_corrid == 0 ||
-		    rkbuf->rkbuf_connid != rkb->rkb_connid) {
-                        rd_assert(rd_slice_offset(&rkbuf->rkbuf_reader) == 0);
-			rkbuf->rkbuf_corrid = ++rkb->rkb_corrid;
-			rd_kafka_buf_update_i32(rkbuf, 4+2+2,
-						rkbuf->rkbuf_corrid);
-			rkbuf->rkbuf_connid = rkb->rkb_connid;
-		} else if (pre_of > RD_KAFKAP_REQHDR_SIZE) {
-			rd_kafka_assert(NULL,
-					rkbuf->rkbuf_connid == rkb->rkb_connid);
-                }
+                rd_kafka_broker_buf_set_corrid(rkb, rkbuf);
 
 		if (0) {
 			rd_rkb_dbg(rkb, PROTOCOL, "SEND",
@@ -2279,9 +2651,14 @@ int rd_kafka_send (rd_kafka_broker_t *rkb) {
                                    pre_of, rd_slice_size(&rkbuf->rkbuf_reader));
 		}
 
-                if ((r = rd_kafka_broker_send(rkb, &rkbuf->rkbuf_reader)) == -1)
+                /* The request may already have been fully written
+                 * by a previous batched send. */
+                if (rd_slice_remains(&rkbuf->rkbuf_reader) > 0 &&
+                    rd_kafka_broker_send_outbufs(rkb, rkbuf) == -1)
                         return -1;
 
+                r = (ssize_t)(rd_slice_offset(&rkbuf->rkbuf_reader) - pre_of);
+
                 now = rd_clock();
                 rkb->rkb_ts_tx_last = now;
 
@@ -2334,7 +2711,7 @@ int rd_kafka_send (rd_kafka_broker_t *rkb) {
 		/* Put buffer on response wait list unless we are not
 		 * expecting a response (required_acks=0). */
 		if (!(rkbuf->rkbuf_flags & RD_KAFKA_OP_F_NO_RESPONSE))
-			rd_kafka_bufq_enq(&rkb->rkb_waitresps, rkbuf);
+			rd_kafka_waitresp_enq(rkb, rkbuf);
 		else { /* Call buffer callback for delivery report. */
                         rd_kafka_buf_callback(rkb->rkb_rk, rkb, 0, NULL, rkbuf);
                 }
@@ -3218,16 +3595,90 @@ static void rd_kafka_broker_internal_serve (rd_kafka_broker_t *rkb,
 /**
  * @returns the number of requests that may be enqueued before
  *          queue.backpressure.threshold is reached.
+ *
+ * Held back requests that will be packed into multi-partition
+ * ProduceRequests only count once they fill a whole request.
  */
 
 static RD_INLINE unsigned int
 rd_kafka_broker_outbufs_space (rd_kafka_broker_t *rkb) {
         int r = rkb->rkb_rk->rk_conf.queue_backpressure_thres -
-                rd_atomic32_get(&rkb->rkb_outbufs.rkbq_cnt);
+                rd_atomic32_get(&rkb->rkb_outbufs.rkbq_cnt) -
+                (rd_kafka_bufq_cnt(&rkb->rkb_produce_deferred) /
+                 rkb->rkb_rk->rk_conf.produce_request_max_partitions);
         return r < 0 ? 0 : (unsigned int)r;
 }
 
 
+/**
+ * @brief Calculate the linger time for \p rktp.
+ *
+ * With `linger.adaptive.target.ms` disabled this is `linger.ms`.
+ *
+ * Otherwise the linger time is the time it takes, at the partition's
+ * observed arrival rate, for a full batch (`batch.num.messages`) to
+ * accumulate, capped by the latency budget: the configured target minus
+ * the estimated 99th percentile ProduceRequest round-trip time
+ * (srtt + 4 * rttvar), and by `linger.ms`.
+ * If no messages are in-flight for the partition and less than one
+ * more message is expected to arrive within the budget, lingering would
+ * only add latency and the linger time is 0.
+ *
+ * @locality broker thread
+ */
+static rd_ts_t rd_kafka_toppar_linger_us (rd_kafka_broker_t *rkb,
+                                          rd_kafka_toppar_t *rktp,
+                                          rd_ts_t now) {
+        const rd_kafka_conf_t *conf = &rkb->rkb_rk->rk_conf;
+        rd_ts_t elapsed, budget, fill, linger;
+        double rate;
+
+        if (likely(!conf->linger_adaptive_target_ms))
+                return conf->buffering_max_us;
+
+        /* Sample the arrival rate at most every 10ms and smooth it. */
+        elapsed = now - rktp->rktp_linger.ts_sample;
+        if (elapsed >= 10*1000) {
+                int64_t enq_msgs = rd_atomic64_get(&rktp->rktp_c.
+                                                   producer_enq_msgs);
+
+                rate = (double)(enq_msgs - rktp->rktp_linger.enq_msgs) *
+                        1000000.0 / (double)elapsed;
+
+                if (rktp->rktp_linger.ts_sample)
+                        rktp->rktp_linger.rate =
+                                (rktp->rktp_linger.rate * 0.7) + (rate * 0.3);
+
+                rktp->rktp_linger.ts_sample = now;
+                rktp->rktp_linger.enq_msgs  = enq_msgs;
+        }
+
+        rate = rktp->rktp_linger.rate;
+
+        budget = ((rd_ts_t)conf->linger_adaptive_target_ms * 1000) -
+                (rkb->rkb_produce_rtt.srtt + 4 * rkb->rkb_produce_rtt.rttvar);
+        if (budget < 0)
+                budget = 0;
+        else if (budget > conf->buffering_max_us)
+                budget = conf->buffering_max_us;
+
+        if (rate * (double)budget < 1000000.0 &&
+            !rd_atomic32_get(&rktp->rktp_msgs_inflight)) {
+                /* Low load with an idle pipeline: send right away. */
+                linger = 0;
+        } else {
+                fill = rate > 0.0 ?
+                        (rd_ts_t)((double)conf->batch_num_messages *
+                                  1000000.0 / rate) : budget;
+                linger = RD_MIN(fill, budget);
+        }
+
+        rd_atomic64_set(&rktp->rktp_linger.us, linger);
+
+        return linger;
+}
+
+
 /**
  * @brief Serve a toppar for producing.
  *
@@ -3252,6 +3703,7 @@ static int rd_kafka_toppar_producer_serve (rd_kafka_broker_t *rkb,
         int max_requests;
         int reqcnt;
         int inflight = 0;
+        rd_ts_t linger_us;
 
         /* By limiting the number of not-yet-sent buffers (rkb_outbufs) we
          * provide a backpressure mechanism to the producer loop
@@ -3450,6 +3902,10 @@ static int rd_kafka_toppar_producer_serve (rd_kafka_broker_t *rkb,
                 return 0;
         }
 
+        /* Calculate the linger time, also when the batch is full,
+         * to keep the adaptive linger arrival rate current. */
+        linger_us = rd_kafka_toppar_linger_us(rkb, rktp, now);
+
         /* Attempt to fill the batch size, but limit
          * our waiting to queue.buffering.max.ms
          * and batch.num.messages. */
@@ -3458,8 +3914,7 @@ static int rd_kafka_toppar_producer_serve (rd_kafka_broker_t *rkb,
 
                 /* Calculate maximum wait-time to honour
                  * queue.buffering.max.ms contract. */
-                wait_max = rd_kafka_msg_enq_time(rkm) +
-                        rkb->rkb_rk->rk_conf.buffering_max_us;
+                wait_max = rd_kafka_msg_enq_time(rkm) + linger_us;
 
                 if (wait_max > now) {
                         /* Wait for more messages or queue.buffering.max.ms
@@ -3498,6 +3953,23 @@ static int rd_kafka_toppar_producer_serve (rd_kafka_broker_t *rkb,
 
 
 
+/**
+ * @brief Enqueue the ProduceRequests held back in the current produce
+ *        pass in order, once their compression jobs (if any) are done.
+ *
+ * @locality broker thread
+ */
+static void
+rd_kafka_broker_produce_deferred_enq (rd_kafka_broker_t *rkb) {
+        rd_kafka_buf_t *rkbuf;
+
+        TAILQ_FOREACH(rkbuf, &rkb->rkb_produce_deferred.rkbq_bufs, rkbuf_link)
+                rd_kafka_msgset_compress_done(rkbuf);
+
+        rd_kafka_ProduceRequests_enq(rkb, &rkb->rkb_produce_deferred);
+}
+
+
 /**
  * @brief Produce from all toppars assigned to this broker.
  *
@@ -3514,6 +3986,7 @@ static int rd_kafka_broker_produce_toppars (rd_kafka_broker_t *rkb,
         int cnt = 0;
         rd_ts_t ret_next_wakeup = *next_wakeup;
         rd_kafka_pid_t pid = RD_KAFKA_PID_INITIALIZER;
+        rd_kafka_workpool_group_t wpg;
 
         /* Round-robin serve each toppar. */
         rktp = rkb->rkb_active_toppar_next;
@@ -3531,6 +4004,13 @@ static int rd_kafka_broker_produce_toppars (rd_kafka_broker_t *rkb,
                         return 0;
         }
 
+        /* Offload MessageSet compression of this pass to the
+         * worker pool, if enabled. */
+        if (rkb->rkb_rk->rk_workpool) {
+                rd_kafka_workpool_group_init(&wpg);
+                rkb->rkb_produce_wpg = &wpg;
+        }
+
         do {
                 rd_ts_t this_next_wakeup = ret_next_wakeup;
 
@@ -3547,6 +4027,14 @@ static int rd_kafka_broker_produce_toppars (rd_kafka_broker_t *rkb,
                                            rktp, rktp_activelink)) !=
                  rkb->rkb_active_toppar_next);
 
+        if (rkb->rkb_produce_wpg) {
+                rkb->rkb_produce_wpg = NULL;
+                rd_kafka_workpool_group_wait(rkb->rkb_rk->rk_workpool, &wpg);
+        }
+
+        if (rd_kafka_bufq_cnt(&rkb->rkb_produce_deferred) > 0)
+                rd_kafka_broker_produce_deferred_enq(rkb);
+
         /* Update next starting toppar to produce in round-robin list. */
         rd_kafka_broker_active_toppar_next(
                 rkb,
@@ -3730,6 +4218,478 @@ rd_kafka_fetch_preferred_replica_handle (rd_kafka_toppar_t *rktp,
                 rkb, rktp, RD_KAFKA_RESP_ERR_REPLICA_NOT_AVAILABLE);
 }
 
+/**
+ * Minimum MessageSet size to offload parsing to the worker pool for,
+ * smaller MessageSets are parsed in place since the job hand-over
+ * would cost more than the decompression itself.
+ */
+#define RD_KAFKA_FETCH_PARSE_JOB_MIN_SIZE  4096
+
+/**
+ * @brief Parsing of one partition's MessageSet in a FetchResponse on the
+ *        worker pool, see compression.threads.
+ */
+typedef struct rd_kafka_fetch_parse_job_s {
+        rd_kafka_workpool_job_t job;            /**< Must be first */
+        rd_kafka_buf_t *rkbuf;                  /**< Shadow buffer of the
+                                                 *   MessageSet. */
+        rd_kafka_buf_t *request;
+        shptr_rd_kafka_toppar_t *s_rktp;
+        rd_kafka_aborted_txns_t *aborted_txns;
+        const struct rd_kafka_toppar_ver *tver;
+        rd_kafka_resp_err_t err;                /**< Parse result */
+} rd_kafka_fetch_parse_job_t;
+
+
+/**
+ * @brief Worker pool job: parse the partition's MessageSet, enqueuing
+ *        its messages on the partition's fetch queue.
+ *
+ * This is safe to run outside the broker thread since the broker thread
+ * does not touch the partition until the job group has been waited for,
+ * and each partition appears at most once in a FetchResponse.
+ *
+ * @locality any thread
+ */
+static void rd_kafka_fetch_parse_job_run (rd_kafka_workpool_job_t *job) {
+        rd_kafka_fetch_parse_job_t *pjob = (rd_kafka_fetch_parse_job_t *)job;
+
+        pjob->err = rd_kafka_msgset_parse(pjob->rkbuf, pjob->request,
+                                          rd_kafka_toppar_s2i(pjob->s_rktp),
+                                          pjob->aborted_txns, pjob->tver);
+}
+
+
+/**
+ * @brief Offload parsing of the MessageSet at the current read position
+ *        of \p rkbuf (narrowed to the MessageSet) to the worker pool,
+ *        if it is a compressed MsgVersion 2 MessageSet worth offloading.
+ *
+ * On success the MessageSet is skipped in \p rkbuf and ownership of
+ * \p aborted_txns is transferred to the job.
+ *
+ * @returns rd_true if the parsing was offloaded, else rd_false in which
+ *          case the caller parses the MessageSet itself.
+ *
+ * @locality broker thread
+ */
+static rd_bool_t
+rd_kafka_fetch_parse_submit (rd_kafka_broker_t *rkb,
+                             rd_kafka_workpool_group_t *wpg,
+                             rd_list_t *jobs,
+                             rd_kafka_buf_t *rkbuf,
+                             rd_kafka_buf_t *request,
+                             rd_kafka_toppar_t *rktp,
+                             rd_kafka_aborted_txns_t *aborted_txns,
+                             const struct rd_kafka_toppar_ver *tver) {
+        rd_kafka_fetch_parse_job_t *pjob;
+        size_t of = rd_slice_offset(&rkbuf->rkbuf_reader);
+        size_t size = rd_slice_remains(&rkbuf->rkbuf_reader);
+        int8_t MagicByte;
+        int16_t Attributes;
+
+        if (size < RD_KAFKA_FETCH_PARSE_JOB_MIN_SIZE ||
+            !rd_slice_peek(&rkbuf->rkbuf_reader, of + 8+4+4,
+                           &MagicByte, sizeof(MagicByte)) ||
+            MagicByte != 2 ||
+            !rd_slice_peek(&rkbuf->rkbuf_reader,
+                           of + RD_KAFKAP_MSGSET_V2_OF_Attributes,
+                           &Attributes, sizeof(Attributes)) ||
+            !(be16toh(Attributes) & RD_KAFKA_MSG_ATTR_COMPRESSION_MASK))
+                return rd_false;
+
+        pjob = rd_calloc(1, sizeof(*pjob));
+
+        /* Let the job (and the messages parsed from it) reference
+         * the MessageSet memory, which may span multiple receive
+         * segments, through a shadow buffer that keeps the response
+         * buffer alive. */
+        pjob->rkbuf = rd_kafka_buf_new_shadow_slice(rkbuf);
+        pjob->rkbuf->rkbuf_rkb = rkb;
+        rd_kafka_broker_keep(rkb);
+        rd_slice_read(&rkbuf->rkbuf_reader, NULL, size);
+
+        pjob->request = request;
+        pjob->s_rktp = rd_kafka_toppar_keep(rktp);
+        pjob->aborted_txns = aborted_txns;
+        pjob->tver = tver;
+
+        rd_list_add(jobs, pjob);
+
+        rd_kafka_workpool_submit(rkb->rkb_rk->rk_workpool, wpg, &pjob->job,
+                                 rd_kafka_fetch_parse_job_run);
+
+        return rd_true;
+}
+
+
+/**
+ * @brief Wait for the offloaded MessageSet parse jobs of a FetchResponse
+ *        to finish and handle their results.
+ *
+ * @locality broker thread
+ */
+static void rd_kafka_fetch_parse_jobs_done (rd_kafka_broker_t *rkb,
+                                            rd_kafka_workpool_group_t *wpg,
+                                            rd_list_t *jobs) {
+        rd_kafka_fetch_parse_job_t *pjob;
+        int i;
+
+        rd_kafka_workpool_group_wait(rkb->rkb_rk->rk_workpool, wpg);
+
+        RD_LIST_FOREACH(pjob, jobs, i) {
+                /* On error: back off the fetcher for this partition */
+                if (unlikely(pjob->err))
+                        rd_kafka_toppar_fetch_backoff(
+                                rkb, rd_kafka_toppar_s2i(pjob->s_rktp),
+                                pjob->err);
+
+                if (pjob->aborted_txns)
+                        rd_kafka_aborted_txns_destroy(pjob->aborted_txns);
+                rd_kafka_toppar_destroy(pjob->s_rktp);
+                rd_kafka_buf_destroy(pjob->rkbuf);
+                rd_free(pjob);
+        }
+
+        rd_list_destroy(jobs);
+}
+
+
+/**
+ * @brief Partition in a broker's fetch session (KIP-227),
+ *        see rkb_fetch_session.
+ */
+typedef struct rd_kafka_fetch_session_part_s {
+        rd_kafka_toppar_t *rktp;
+        shptr_rd_kafka_toppar_t *s_rktp;
+        int64_t fetch_offset;  /**< FetchOffset last sent to the broker */
+        int32_t max_bytes;     /**< MaxBytes last sent to the broker */
+        rd_bool_t seen;        /**< Partition is still fetchable:
+                                *   set while building a FetchRequest. */
+} rd_kafka_fetch_session_part_t;
+
+static void rd_kafka_fetch_session_part_destroy (void *ptr) {
+        rd_kafka_fetch_session_part_t *part = ptr;
+        rd_kafka_toppar_destroy(part->s_rktp);
+        rd_free(part);
+}
+
+/**
+ * @brief Fetch session partition comparator by toppar (for lookups).
+ */
+static int rd_kafka_fetch_session_part_cmp (const void *_a, const void *_b) {
+        const rd_kafka_fetch_session_part_t *a = _a, *b = _b;
+        return RD_CMP((uintptr_t)a->rktp, (uintptr_t)b->rktp);
+}
+
+/**
+ * @brief Fetch session partition comparator by topic name and partition
+ *        (for grouping partitions per topic on the wire).
+ */
+static int rd_kafka_fetch_session_part_topic_cmp (const void *_a,
+                                                  const void *_b) {
+        const rd_kafka_fetch_session_part_t *a = _a, *b = _b;
+        int r;
+
+        if (a->rktp->rktp_rkt != b->rktp->rktp_rkt &&
+            (r = rd_kafkap_str_cmp(a->rktp->rktp_rkt->rkt_topic,
+                                   b->rktp->rktp_rkt->rkt_topic)))
+                return r;
+
+        return RD_CMP(a->rktp->rktp_partition, b->rktp->rktp_partition);
+}
+
+
+/**
+ * @brief Reset the broker's fetch session so that the next FetchRequest
+ *        is a full fetch.
+ *
+ * @param forget If true the broker no longer knows the session (e.g.,
+ *               FETCH_SESSION_ID_NOT_FOUND), else the session id is kept
+ *               so that the next full FetchRequest closes it on the broker.
+ *
+ * @locality broker thread
+ */
+static void rd_kafka_fetch_session_reset (rd_kafka_broker_t *rkb,
+                                          rd_bool_t forget,
+                                          const char *reason) {
+        if (rkb->rkb_fetch_session.epoch > 0) {
+                rd_rkb_dbg(rkb, FETCH, "FETCHSESS",
+                           "Resetting fetch session %"PRId32" at epoch "
+                           "%"PRId32" with %d partition(s): %s",
+                           rkb->rkb_fetch_session.id,
+                           rkb->rkb_fetch_session.epoch,
+                           rd_list_cnt(&rkb->rkb_fetch_session.parts),
+                           reason);
+        }
+
+        if (forget)
+                rkb->rkb_fetch_session.id = 0;
+        rkb->rkb_fetch_session.epoch = 0;
+
+        rd_list_destroy(&rkb->rkb_fetch_session.parts);
+        rd_list_init(&rkb->rkb_fetch_session.parts, 0,
+                     rd_kafka_fetch_session_part_destroy);
+}
+
+
+/**
+ * @brief Check if \p rktp needs to be included in the FetchRequest being
+ *        built and update its fetch session state accordingly.
+ *
+ * Partitions not yet in the session are added to \p new_parts.
+ *
+ * @returns rd_true if the partition must be included in the request,
+ *          or rd_false if it is unchanged in an incremental fetch.
+ *
+ * @locality broker thread
+ */
+static rd_bool_t
+rd_kafka_fetch_session_part_update (rd_kafka_broker_t *rkb,
+                                    rd_kafka_toppar_t *rktp,
+                                    rd_bool_t incremental,
+                                    rd_list_t *new_parts) {
+        rd_kafka_fetch_session_part_t skel = { .rktp = rktp }, *part;
+
+        part = rd_list_find(&rkb->rkb_fetch_session.parts, &skel,
+                            rd_kafka_fetch_session_part_cmp);
+        if (!part) {
+                part = rd_calloc(1, sizeof(*part));
+                part->rktp = rktp;
+                part->s_rktp = rd_kafka_toppar_keep(rktp);
+                part->seen = rd_true;
+                part->fetch_offset = rktp->rktp_offsets.fetch_offset;
+                part->max_bytes = rktp->rktp_fetch_msg_max_bytes;
+                rd_list_add(new_parts, part);
+                return rd_true;
+        }
+
+        part->seen = rd_true;
+
+        if (incremental &&
+            part->fetch_offset == rktp->rktp_offsets.fetch_offset &&
+            part->max_bytes == rktp->rktp_fetch_msg_max_bytes)
+                return rd_false;
+
+        part->fetch_offset = rktp->rktp_offsets.fetch_offset;
+        part->max_bytes = rktp->rktp_fetch_msg_max_bytes;
+
+        return rd_true;
+}
+
+
+/**
+ * @brief Is session partition \p elem still fetchable, for rd_list_apply().
+ */
+static int rd_kafka_fetch_session_part_seen (void *elem, void *opaque) {
+        rd_kafka_fetch_session_part_t *part = elem;
+        rd_list_t *forgotten = opaque;
+
+        if (!part->seen) {
+                rd_list_add(forgotten, part);
+                return 0;
+        }
+
+        part->seen = rd_false;
+        return 1;
+}
+
+
+/**
+ * @brief Write the ForgottenTopics list of a FetchRequest and commit the
+ *        fetch session's partitions: partitions no longer fetchable are
+ *        removed from the session and the partitions in \p new_parts
+ *        are added.
+ *
+ * @locality broker thread
+ */
+static void rd_kafka_fetch_session_commit (rd_kafka_broker_t *rkb,
+                                           rd_kafka_buf_t *rkbuf,
+                                           rd_list_t *new_parts) {
+        rd_list_t forgotten;
+        rd_kafka_fetch_session_part_t *part;
+        size_t of_TopicCnt, of_PartCnt = 0;
+        int TopicCnt = 0, PartCnt = 0;
+        rd_kafka_itopic_t *rkt_last = NULL;
+        int i;
+
+        /* Partitions in the session that were not seen when building
+         * this request are no longer fetchable from this broker. */
+        rd_list_init(&forgotten, 0, rd_kafka_fetch_session_part_destroy);
+        rd_list_apply(&rkb->rkb_fetch_session.parts,
+                      rd_kafka_fetch_session_part_seen, &forgotten);
+
+        /* A full fetch starts out with an empty session
+         * and thus has no ForgottenTopics. */
+        rd_dassert(rkbuf->rkbuf_u.Fetch.Epoch > 0 ||
+                   rd_list_empty(&forgotten));
+
+        rd_list_sort(&forgotten, rd_kafka_fetch_session_part_topic_cmp);
+
+        /* ForgottenTopicsCnt */
+        of_TopicCnt = rd_kafka_buf_write_i32(rkbuf, 0);
+
+        RD_LIST_FOREACH(part, &forgotten, i) {
+                if (part->rktp->rktp_rkt != rkt_last) {
+                        if (rkt_last)
+                                rd_kafka_buf_update_i32(rkbuf, of_PartCnt,
+                                                        PartCnt);
+                        /* Topic */
+                        rd_kafka_buf_write_kstr(rkbuf,
+                                                part->rktp->rktp_rkt->
+                                                rkt_topic);
+                        /* PartitionCnt */
+                        of_PartCnt = rd_kafka_buf_write_i32(rkbuf, 0);
+                        PartCnt = 0;
+                        TopicCnt++;
+                        rkt_last = part->rktp->rktp_rkt;
+                }
+
+                /* Partition */
+                rd_kafka_buf_write_i32(rkbuf, part->rktp->rktp_partition);
+                PartCnt++;
+
+                rd_rkb_dbg(rkb, FETCH, "FETCHSESS",
+                           "Removing %.*s [%"PRId32"] from fetch "
+                           "session %"PRId32,
+                           RD_KAFKAP_STR_PR(part->rktp->rktp_rkt->rkt_topic),
+                           part->rktp->rktp_partition,
+                           rkb->rkb_fetch_session.id);
+        }
+
+        if (rkt_last)
+                rd_kafka_buf_update_i32(rkbuf, of_PartCnt, PartCnt);
+        rd_kafka_buf_update_i32(rkbuf, of_TopicCnt, TopicCnt);
+
+        rd_list_destroy(&forgotten);
+
+        RD_LIST_FOREACH(part, new_parts, i)
+                part->seen = rd_false;
+        rd_list_copy_to(&rkb->rkb_fetch_session.parts, new_parts, NULL, NULL);
+        rd_list_sort(&rkb->rkb_fetch_session.parts,
+                     rd_kafka_fetch_session_part_cmp);
+}
+
+
+/**
+ * @brief Update the broker's fetch session from the top-level
+ *        ErrorCode and SessionId of a FetchResponse.
+ *
+ * @locality broker thread
+ */
+static void
+rd_kafka_fetch_session_handle_response (rd_kafka_broker_t *rkb,
+                                        const rd_kafka_buf_t *request,
+                                        rd_kafka_resp_err_t err,
+                                        int32_t SessionId) {
+        int32_t Epoch = request->rkbuf_u.Fetch.Epoch;
+
+        if (Epoch == -1)
+                return; /* Sessionless fetch */
+
+        switch (err)
+        {
+        case RD_KAFKA_RESP_ERR_NO_ERROR:
+                break;
+
+        case RD_KAFKA_RESP_ERR_FETCH_SESSION_ID_NOT_FOUND:
+                /* Evicted by the broker: create a new session. */
+                rd_atomic64_add(&rkb->rkb_c.fetch_session.errors, 1);
+                rd_kafka_fetch_session_reset(rkb, rd_true/*forget*/,
+                                             rd_kafka_err2str(err));
+                return;
+
+        default:
+                /* The broker did not advance the session (or we can't
+                 * know if it did): close it with a full fetch. */
+                rd_atomic64_add(&rkb->rkb_c.fetch_session.errors, 1);
+                rd_kafka_fetch_session_reset(rkb, rd_false,
+                                             rd_kafka_err2str(err));
+                return;
+        }
+
+        if (Epoch == 0) {
+                /* Full fetch: SessionId 0 means the broker did not
+                 * create a session (e.g., its session cache is full),
+                 * try again on the next full fetch. */
+                rkb->rkb_fetch_session.id = SessionId;
+                if (SessionId != 0) {
+                        rkb->rkb_fetch_session.epoch = 1;
+                        rd_rkb_dbg(rkb, FETCH, "FETCHSESS",
+                                   "Created fetch session %"PRId32
+                                   " with %d partition(s)",
+                                   SessionId,
+                                   rd_list_cnt(&rkb->rkb_fetch_session.
+                                               parts));
+                } else
+                        rd_kafka_fetch_session_reset(rkb, rd_true,
+                                                     "no session created "
+                                                     "by broker");
+
+        } else if (SessionId != rkb->rkb_fetch_session.id) {
+                char tmp[64];
+                rd_snprintf(tmp, sizeof(tmp),
+                            "SessionId %"PRId32" in response",
+                            SessionId);
+                rd_atomic64_add(&rkb->rkb_c.fetch_session.errors, 1);
+                rd_kafka_fetch_session_reset(rkb, rd_false, tmp);
+
+        } else {
+                /* Incremental fetch: next epoch, wrapping to 1. */
+                rkb->rkb_fetch_session.epoch =
+                        Epoch == INT32_MAX ? 1 : Epoch + 1;
+        }
+}
+
+
+/**
+ * @brief Signal end of partition for fetched partitions that were not
+ *        included in an incremental FetchResponse: the broker omits
+ *        partitions with no new data and unchanged end offsets, so the
+ *        last end offset seen is still current.
+ *
+ * @locality broker thread
+ */
+static void rd_kafka_fetch_omitted_eof (rd_kafka_broker_t *rkb,
+                                        const rd_kafka_buf_t *request) {
+        struct rd_kafka_toppar_ver *tver;
+        int i;
+
+        RD_LIST_FOREACH(tver, request->rkbuf_rktp_vers, i) {
+                rd_kafka_toppar_t *rktp = rd_kafka_toppar_s2i(tver->s_rktp);
+                int64_t fetch_offset = rktp->rktp_offsets.fetch_offset;
+                rd_bool_t eof;
+
+                if (tver->seen || fetch_offset < 0)
+                        continue;
+
+                rd_kafka_toppar_lock(rktp);
+                eof = rktp->rktp_broker == rkb &&
+                        tver->version >= rktp->rktp_fetch_version &&
+                        rktp->rktp_ls_offset == fetch_offset &&
+                        rktp->rktp_offsets.eof_offset != fetch_offset;
+                rd_kafka_toppar_unlock(rktp);
+
+                if (!eof)
+                        continue;
+
+                rktp->rktp_offsets.eof_offset = fetch_offset;
+
+                if (!rkb->rkb_rk->rk_conf.enable_partition_eof)
+                        continue;
+
+                rd_dassert(tver->version > 0);
+                rd_kafka_q_op_err(rktp->rktp_fetchq,
+                                  RD_KAFKA_OP_CONSUMER_ERR,
+                                  RD_KAFKA_RESP_ERR__PARTITION_EOF,
+                                  tver->version, rktp, fetch_offset,
+                                  "%s",
+                                  rd_kafka_err2str(
+                                          RD_KAFKA_RESP_ERR__PARTITION_EOF));
+        }
+}
+
+
 /**
  * Parses and handles a Fetch reply.
  * Returns 0 on success or an error code on failure.
@@ -3742,6 +4702,14 @@ rd_kafka_fetch_reply_handle (rd_kafka_broker_t *rkb,
         const int log_decode_errors = LOG_ERR;
         shptr_rd_kafka_itopic_t *s_rkt = NULL;
         int16_t ErrorCode = RD_KAFKA_RESP_ERR_NO_ERROR;
+        rd_kafka_workpool_group_t wpg;
+        rd_list_t parse_jobs; /* rd_kafka_fetch_parse_job_t *:
+                               * MessageSets parsed on the worker pool */
+
+        if (rkb->rkb_rk->rk_workpool) {
+                rd_kafka_workpool_group_init(&wpg);
+                rd_list_init(&parse_jobs, 0, NULL);
+        }
 
 	if (rd_kafka_buf_ApiVersion(request) >= 1) {
 		int32_t Throttle_Time;
@@ -3755,6 +4723,9 @@ rd_kafka_fetch_reply_handle (rd_kafka_broker_t *rkb,
                 int32_t SessionId;
                 rd_kafka_buf_read_i16(rkbuf, &ErrorCode);
                 rd_kafka_buf_read_i32(rkbuf, &SessionId);
+
+                rd_kafka_fetch_session_handle_response(rkb, request,
+                                                       ErrorCode, SessionId);
         }
 
 	rd_kafka_buf_read_i32(rkbuf, &TopicArrayCnt);
@@ -3908,6 +4879,28 @@ rd_kafka_fetch_reply_handle (rd_kafka_broker_t *rkb,
 
                         rktp = rd_kafka_toppar_s2i(s_rktp);
 
+                        /* Look up the toppar's fetch version at the time
+                         * of the request. */
+                        tver_skel.s_rktp = s_rktp;
+                        tver = rd_list_find(request->rkbuf_rktp_vers,
+                                            &tver_skel,
+                                            rd_kafka_toppar_ver_cmp);
+                        if (unlikely(!tver)) {
+                                rd_rkb_dbg(rkb, MSG, "FETCH",
+                                           "%.*s [%"PRId32"]: "
+                                           "partition not fetched in "
+                                           "request: ignoring",
+                                           RD_KAFKAP_STR_PR(&topic),
+                                           hdr.Partition);
+                                rd_kafka_toppar_destroy(s_rktp); /* from get */
+                                rd_kafka_buf_skip(rkbuf, hdr.MessageSetSize);
+                                if (aborted_txns)
+                                        rd_kafka_aborted_txns_destroy(
+                                                aborted_txns);
+                                continue;
+                        }
+                        tver->seen = rd_true;
+
                         rd_kafka_toppar_lock(rktp);
                         rktp->rktp_lo_offset = hdr.LogStartOffset;
                         rktp->rktp_hi_offset = hdr.HighwaterMarkOffset;
@@ -3974,11 +4967,6 @@ rd_kafka_fetch_reply_handle (rd_kafka_broker_t *rkb,
                          * created (due to partition count decreasing and
                          * then increasing again, which can happen in
                          * desynchronized clusters): if so ignore it. */
-			tver_skel.s_rktp = s_rktp;
-			tver = rd_list_find(request->rkbuf_rktp_vers,
-					    &tver_skel,
-					    rd_kafka_toppar_ver_cmp);
-			rd_kafka_assert(NULL, tver);
                         if (rd_kafka_toppar_s2i(tver->s_rktp) != rktp ||
                             tver->version < fetch_version) {
                                 rd_rkb_dbg(rkb, MSG, "DROP",
@@ -4162,6 +5150,19 @@ rd_kafka_fetch_reply_handle (rd_kafka_broker_t *rkb,
                                 rd_kafka_buf_check_len(rkbuf,
                                                        hdr.MessageSetSize);
 
+                        /* Parse messages on the worker pool, if enabled,
+                         * to decompress partitions in parallel. */
+                        if (rkb->rkb_rk->rk_workpool &&
+                            rd_kafka_fetch_parse_submit(rkb, &wpg,
+                                                        &parse_jobs,
+                                                        rkbuf, request, rktp,
+                                                        aborted_txns, tver)) {
+                                rd_slice_widen(&rkbuf->rkbuf_reader,
+                                               &save_slice);
+                                rd_kafka_toppar_destroy(s_rktp); /* from get */
+                                continue;
+                        }
+
                         /* Parse messages */
                         err = rd_kafka_msgset_parse(
                                 rkbuf, request, rktp, aborted_txns, tver);
@@ -4195,9 +5196,17 @@ rd_kafka_fetch_reply_handle (rd_kafka_broker_t *rkb,
 		RD_NOTREACHED();
 	}
 
+        if (rkb->rkb_rk->rk_workpool)
+                rd_kafka_fetch_parse_jobs_done(rkb, &wpg, &parse_jobs);
+
+        if (request->rkbuf_u.Fetch.Epoch > 0 && !ErrorCode)
+                rd_kafka_fetch_omitted_eof(rkb, request);
+
 	return 0;
 
 err_parse:
+        if (rkb->rkb_rk->rk_workpool)
+                rd_kafka_fetch_parse_jobs_done(rkb, &wpg, &parse_jobs);
         if (s_rkt)
                 rd_kafka_topic_destroy0(s_rkt);
 	rd_rkb_dbg(rkb, MSG, "BADMSG", "Bad message (Fetch v%d): "
@@ -4230,6 +5239,11 @@ static void rd_kafka_broker_fetch_reply (rd_kafka_t *rk,
 
                 rd_rkb_dbg(rkb, MSG, "FETCH", "Fetch reply: %s",
                            rd_kafka_err2str(err));
+
+                /* The broker may or may not have processed the request:
+                 * start over with a full fetch. */
+                rd_kafka_fetch_session_reset(rkb, rd_false,
+                                             rd_kafka_err2str(err));
 		switch (err)
 		{
 		case RD_KAFKA_RESP_ERR_UNKNOWN_TOPIC_OR_PART:
@@ -4286,6 +5300,14 @@ static int rd_kafka_broker_fetch_toppars (rd_kafka_broker_t *rkb, rd_ts_t now) {
 	int PartitionArrayCnt = 0;
 	rd_kafka_itopic_t *rkt_last = NULL;
         int16_t ApiVersion = 0;
+        rd_list_t new_parts;         /* Partitions added to the fetch
+                                      * session by this request */
+        rd_kafka_itopic_t *rkt_full_last = NULL;
+        size_t full_size = 0;        /* Size of the Topics array of
+                                      * a full fetch */
+        size_t of_Topics;
+        size_t part_size;
+        int omitted = 0;
 
 	/* Create buffer and segments:
 	 *   1 x ReplicaId MaxWaitTime MinBytes TopicArrayCnt
@@ -4339,22 +5361,48 @@ static int rd_kafka_broker_fetch_toppars (rd_kafka_broker_t *rkb, rd_ts_t now) {
 	rd_kafka_buf_write_i32(rkbuf, rkb->rkb_rk->rk_conf.fetch_min_bytes);
 
         if (rd_kafka_buf_ApiVersion(rkbuf) >= 4) {
-                /* MaxBytes */
-                rd_kafka_buf_write_i32(rkbuf,
-                                       rkb->rkb_rk->rk_conf.fetch_max_bytes);
+                /* MaxBytes: no more than what is left of the
+                 * fetch memory budget. The broker will still return
+                 * at least one MessageSet if it is larger. */
+                rd_kafka_buf_write_i32(
+                        rkbuf,
+                        (int32_t)RD_MAX(1, RD_MIN(
+                                        (int64_t)rkb->rkb_rk->rk_conf.
+                                        fetch_max_bytes,
+                                        rd_kafka_fetch_budget_remains(
+                                                rkb->rkb_rk))));
                 /* IsolationLevel */
                 rd_kafka_buf_write_i8(rkbuf, rkb->rkb_rk->rk_conf.isolation_level);
         }
 
+        /* Fetch session (KIP-227) */
+        rkbuf->rkbuf_u.Fetch.SessionId = 0;
+        rkbuf->rkbuf_u.Fetch.Epoch = -1;
+        if (rd_kafka_buf_ApiVersion(rkbuf) >= 7 &&
+            rkb->rkb_rk->rk_conf.enable_fetch_sessions) {
+                if (rkb->rkb_fetch_session.epoch == 0)
+                        /* Full fetch: start with an empty session */
+                        rd_kafka_fetch_session_reset(rkb, rd_false,
+                                                     "full fetch");
+                rkbuf->rkbuf_u.Fetch.SessionId = rkb->rkb_fetch_session.id;
+                rkbuf->rkbuf_u.Fetch.Epoch = rkb->rkb_fetch_session.epoch;
+                rd_list_init(&new_parts, 0, NULL);
+        }
+
         if (rd_kafka_buf_ApiVersion(rkbuf) >= 7) {
                 /* SessionId */
-                rd_kafka_buf_write_i32(rkbuf, 0);
+                rd_kafka_buf_write_i32(rkbuf, rkbuf->rkbuf_u.Fetch.SessionId);
                 /* Epoch */
-                rd_kafka_buf_write_i32(rkbuf, -1);
+                rd_kafka_buf_write_i32(rkbuf, rkbuf->rkbuf_u.Fetch.Epoch);
         }
 
 	/* Write zero TopicArrayCnt but store pointer for later update */
 	of_TopicArrayCnt = rd_kafka_buf_write_i32(rkbuf, 0);
+        of_Topics = rd_buf_write_pos(&rkbuf->rkbuf_buf);
+
+        /* Partition+CurrentLeaderEpoch+FetchOffset+LogStartOffset+MaxBytes */
+        part_size = 4 + (rd_kafka_buf_ApiVersion(rkbuf) >= 9 ? 4 : 0) + 8 +
+                (rd_kafka_buf_ApiVersion(rkbuf) >= 5 ? 8 : 0) + 4;
 
         /* Prepare map for storing the fetch version for each partition,
          * this will later be checked in Fetch response to purge outdated
@@ -4370,6 +5418,38 @@ static int rd_kafka_broker_fetch_toppars (rd_kafka_broker_t *rkb, rd_ts_t now) {
         do {
 		struct rd_kafka_toppar_ver *tver;
 
+                /* We must have a valid fetch offset when we get here */
+                rd_dassert(rktp->rktp_offsets.fetch_offset >= 0);
+
+		/* Add toppar + op version mapping.
+                 * This is done for partitions omitted from an incremental
+                 * fetch as well since they may be included in the
+                 * response. */
+		tver = rd_list_add(rkbuf->rkbuf_rktp_vers, NULL);
+		tver->s_rktp = rd_kafka_toppar_keep(rktp);
+		tver->version = rktp->rktp_fetch_version;
+                tver->seen = rd_false;
+
+		cnt++;
+
+                if (rkt_full_last != rktp->rktp_rkt) {
+                        /* Topic+PartitionArrayCnt */
+                        full_size += 2 +
+                                RD_KAFKAP_STR_LEN(rktp->rktp_rkt->rkt_topic) +
+                                4;
+                        rkt_full_last = rktp->rktp_rkt;
+                }
+                full_size += part_size;
+
+                if (rkbuf->rkbuf_u.Fetch.Epoch != -1 &&
+                    !rd_kafka_fetch_session_part_update(
+                            rkb, rktp, rkbuf->rkbuf_u.Fetch.Epoch > 0,
+                            &new_parts)) {
+                        /* Unchanged partition in incremental fetch */
+                        omitted++;
+                        continue;
+                }
+
 		if (rkt_last != rktp->rktp_rkt) {
 			if (rkt_last != NULL) {
 				/* Update PartitionArrayCnt */
@@ -4411,23 +5491,46 @@ static int rd_kafka_broker_fetch_toppars (rd_kafka_broker_t *rkb, rd_ts_t now) {
 			   rktp->rktp_partition,
                            rktp->rktp_offsets.fetch_offset,
 			   rktp->rktp_fetch_version);
-
-                /* We must have a valid fetch offset when we get here */
-                rd_dassert(rktp->rktp_offsets.fetch_offset >= 0);
-
-		/* Add toppar + op version mapping. */
-		tver = rd_list_add(rkbuf->rkbuf_rktp_vers, NULL);
-		tver->s_rktp = rd_kafka_toppar_keep(rktp);
-		tver->version = rktp->rktp_fetch_version;
-
-		cnt++;
 	} while ((rktp = CIRCLEQ_LOOP_NEXT(&rkb->rkb_active_toppars,
                                            rktp, rktp_activelink)) !=
                  rkb->rkb_active_toppar_next);
 
-        if (rd_kafka_buf_ApiVersion(rkbuf) >= 7) {
-                /* Length of the ForgottenTopics list (KIP-227). Broker
-                 * use only - not used by the consumer. */
+	if (rkt_last != NULL) {
+		/* Update last topic's PartitionArrayCnt */
+		rd_kafka_buf_update_i32(rkbuf,
+					of_PartitionArrayCnt,
+					PartitionArrayCnt);
+	}
+
+	/* Update TopicArrayCnt */
+	rd_kafka_buf_update_i32(rkbuf, of_TopicArrayCnt, TopicArrayCnt);
+
+        if (rkbuf->rkbuf_u.Fetch.Epoch != -1) {
+                size_t size;
+
+                /* ForgottenTopics: partitions no longer fetched
+                 * from this broker. */
+                rd_kafka_fetch_session_commit(rkb, rkbuf, &new_parts);
+                rd_list_destroy(&new_parts);
+
+                if (rkbuf->rkbuf_u.Fetch.Epoch > 0) {
+                        /* Don't count the ForgottenTopicsCnt. */
+                        size = rd_buf_write_pos(&rkbuf->rkbuf_buf) -
+                                of_Topics - 4;
+
+                        rd_atomic64_add(&rkb->rkb_c.fetch_session.incremental,
+                                        1);
+                        rd_atomic64_add(&rkb->rkb_c.fetch_session.omitted,
+                                        omitted);
+                        if (full_size > size)
+                                rd_atomic64_add(&rkb->rkb_c.fetch_session.
+                                                bytes_saved,
+                                                full_size - size);
+                } else
+                        rd_atomic64_add(&rkb->rkb_c.fetch_session.full, 1);
+
+        } else if (rd_kafka_buf_ApiVersion(rkbuf) >= 7) {
+                /* Length of the ForgottenTopics list (KIP-227). */
                 rd_kafka_buf_write_i32(rkbuf, 0);
         }
 
@@ -4444,23 +5547,23 @@ static int rd_kafka_broker_fetch_toppars (rd_kafka_broker_t *rkb, rd_ts_t now) {
                 CIRCLEQ_LOOP_NEXT(&rkb->rkb_active_toppars,
                                   rktp, rktp_activelink) : NULL);
 
-	rd_rkb_dbg(rkb, FETCH, "FETCH", "Fetch %i/%i/%i toppar(s)",
-                   cnt, rkb->rkb_active_toppar_cnt, rkb->rkb_toppar_cnt);
+        if (rkbuf->rkbuf_u.Fetch.Epoch != -1)
+                rd_rkb_dbg(rkb, FETCH, "FETCH",
+                           "Fetch %i/%i/%i toppar(s) in fetch session "
+                           "%"PRId32" epoch %"PRId32" (%d omitted)",
+                           cnt, rkb->rkb_active_toppar_cnt,
+                           rkb->rkb_toppar_cnt,
+                           rkbuf->rkbuf_u.Fetch.SessionId,
+                           rkbuf->rkbuf_u.Fetch.Epoch, omitted);
+        else
+                rd_rkb_dbg(rkb, FETCH, "FETCH", "Fetch %i/%i/%i toppar(s)",
+                           cnt, rkb->rkb_active_toppar_cnt,
+                           rkb->rkb_toppar_cnt);
 	if (!cnt) {
 		rd_kafka_buf_destroy(rkbuf);
 		return cnt;
 	}
 
-	if (rkt_last != NULL) {
-		/* Update last topic's PartitionArrayCnt */
-		rd_kafka_buf_update_i32(rkbuf,
-					of_PartitionArrayCnt,
-					PartitionArrayCnt);
-	}
-
-	/* Update TopicArrayCnt */
-	rd_kafka_buf_update_i32(rkbuf, of_TopicArrayCnt, TopicArrayCnt);
-
         /* Consider Fetch requests blocking if fetch.wait.max.ms >= 1s */
         if (rkb->rkb_rk->rk_conf.fetch_wait_max_ms >= 1000)
                 rkbuf->rkbuf_flags |= RD_KAFKA_OP_F_BLOCKING;
@@ -4638,6 +5741,14 @@ static void rd_kafka_broker_serve (rd_kafka_broker_t *rkb, int timeout_ms) {
          * to be up. */
         rkb->rkb_persistconn.internal = 0;
 
+        /* Requests enqueued while the connection was going down, such as
+         * another broker's "broker down" metadata refresh, did not trigger
+         * a sparse connection and may hold back the producer
+         * (queue.buffering.backpressure.threshold) from moving any
+         * messages to the xmit queue: they need the connection too. */
+        if (rd_kafka_bufq_cnt(&rkb->rkb_outbufs) > 0)
+                rkb->rkb_persistconn.internal++;
+
         if (rkb->rkb_source == RD_KAFKA_INTERNAL)
                 rd_kafka_broker_internal_serve(rkb, abs_timeout);
         else if (rkb->rkb_rk->rk_type == RD_KAFKA_PRODUCER)
@@ -4882,7 +5993,14 @@ void rd_kafka_broker_destroy_final (rd_kafka_broker_t *rkb) {
 
         rd_kafka_assert(rkb->rkb_rk, thrd_is_current(rkb->rkb_thread));
         rd_kafka_assert(rkb->rkb_rk, TAILQ_EMPTY(&rkb->rkb_outbufs.rkbq_bufs));
+        rd_kafka_assert(rkb->rkb_rk,
+                        TAILQ_EMPTY(&rkb->rkb_produce_deferred.rkbq_bufs));
         rd_kafka_assert(rkb->rkb_rk, TAILQ_EMPTY(&rkb->rkb_waitresps.rkbq_bufs));
+        rd_kafka_assert(rkb->rkb_rk, rkb->rkb_waitresp_idx.heap_cnt == 0);
+        if (rkb->rkb_waitresp_idx.ring)
+                rd_free(rkb->rkb_waitresp_idx.ring);
+        if (rkb->rkb_waitresp_idx.heap)
+                rd_free(rkb->rkb_waitresp_idx.heap);
         rd_kafka_assert(rkb->rkb_rk, TAILQ_EMPTY(&rkb->rkb_retrybufs.rkbq_bufs));
         rd_kafka_assert(rkb->rkb_rk, TAILQ_EMPTY(&rkb->rkb_toppars));
 
@@ -4901,6 +6019,10 @@ void rd_kafka_broker_destroy_final (rd_kafka_broker_t *rkb) {
 	if (rkb->rkb_recv_buf)
 		rd_kafka_buf_destroy(rkb->rkb_recv_buf);
 
+        rd_list_destroy(&rkb->rkb_fetch_session.parts);
+
+        rd_kafka_buf_pool_destroy(rkb->rkb_recv_pool);
+
 	if (rkb->rkb_rsal)
 		rd_sockaddr_list_destroy(rkb->rkb_rsal);
 
@@ -4993,9 +6115,17 @@ rd_kafka_broker_t *rd_kafka_broker_add (rd_kafka_t *rk,
 	TAILQ_INIT(&rkb->rkb_toppars);
         CIRCLEQ_INIT(&rkb->rkb_active_toppars);
 	rd_kafka_bufq_init(&rkb->rkb_outbufs);
+        rd_kafka_bufq_init(&rkb->rkb_produce_deferred);
+        rd_list_init(&rkb->rkb_fetch_session.parts, 0,
+                     rd_kafka_fetch_session_part_destroy);
+        rkb->rkb_recv_pool = rd_kafka_buf_pool_new(
+                RD_KAFKA_BUF_POOL_SEG_SIZE,
+                (size_t)rk->rk_conf.recv_pool_bytes);
 	rd_kafka_bufq_init(&rkb->rkb_waitresps);
 	rd_kafka_bufq_init(&rkb->rkb_retrybufs);
 	rkb->rkb_ops = rd_kafka_q_new(rk);
+        if (rk->rk_conf.lockfree_enqueue)
+                rd_kafka_q_mpsc_enable(rkb->rkb_ops);
         rd_avg_init(&rkb->rkb_avg_int_latency, RD_AVG_GAUGE, 0, 100*1000, 2,
                     rk->rk_conf.stats_interval_ms ? 1 : 0);
         rd_avg_init(&rkb->rkb_avg_outbuf_latency, RD_AVG_GAUGE, 0, 100*1000, 2,
@@ -5929,10 +7059,260 @@ rd_kafka_broker_persistent_connection_del (rd_kafka_broker_t *rkb,
 }
 
 
+/**
+ * @brief Verify the rkb_waitresp_idx heap invariant and back-pointers.
+ */
+static int rd_ut_waitresp_idx_verify (rd_kafka_broker_t *rkb) {
+        int i;
+
+        RD_UT_ASSERT(rkb->rkb_waitresp_idx.heap_cnt ==
+                     rd_kafka_bufq_cnt(&rkb->rkb_waitresps),
+                     "heap has %d requests, waitresps %d",
+                     rkb->rkb_waitresp_idx.heap_cnt,
+                     rd_kafka_bufq_cnt(&rkb->rkb_waitresps));
+
+        for (i = 0 ; i < rkb->rkb_waitresp_idx.heap_cnt ; i++) {
+                const rd_kafka_buf_t *rkbuf = rkb->rkb_waitresp_idx.heap[i];
+
+                RD_UT_ASSERT(rkbuf->rkbuf_timeout_idx == i,
+                             "heap[%d] has index %d",
+                             i, rkbuf->rkbuf_timeout_idx);
+                RD_UT_ASSERT(i == 0 ||
+                             rkb->rkb_waitresp_idx.heap[(i - 1) / 2]->
+                             rkbuf_ts_timeout <= rkbuf->rkbuf_ts_timeout,
+                             "heap[%d] times out before its parent", i);
+        }
+
+        return 0;
+}
+
+/**
+ * @brief Unittest for the in-flight request index: lookups by CorrId,
+ *        out-of-order responses, a lingering request spanning more
+ *        CorrIds than there are ring buckets, and expired-only timeout
+ *        scans.
+ */
+static int rd_ut_waitresp_idx (void) {
+        rd_kafka_broker_t rkb = RD_ZERO_INIT;
+        rd_kafka_bufq_t tmpq;
+        rd_kafka_buf_t **rkbufs, *rkbuf, *lingering;
+        const int cnt = 10000;
+        int32_t corrid = 0;
+        rd_ts_t now = 1000000, last = 0;
+        int i, expired = 0, exp_expired = 0;
+
+        rd_kafka_bufq_init(&rkb.rkb_waitresps);
+        rd_kafka_bufq_init(&tmpq);
+        rkbufs = rd_calloc(cnt, sizeof(*rkbufs));
+
+        /* A request that stays in flight while cnt*2 newer requests
+         * are sent and answered. */
+        lingering = rd_kafka_buf_new(0, 0);
+        lingering->rkbuf_reqhdr.ApiKey = RD_KAFKAP_JoinGroup;
+        lingering->rkbuf_corrid = ++corrid;
+        lingering->rkbuf_ts_timeout = now + 3600*1000*1000LL;
+        rd_kafka_waitresp_enq(&rkb, lingering);
+
+        for (i = 0 ; i < cnt * 2 ; i++) {
+                rkbuf = rd_kafka_buf_new(0, 0);
+                rkbuf->rkbuf_reqhdr.ApiKey = RD_KAFKAP_Fetch;
+                rkbuf->rkbuf_corrid = ++corrid;
+                rkbuf->rkbuf_ts_timeout = now + rd_jitter(1, 1000) * 1000;
+                rd_kafka_waitresp_enq(&rkb, rkbuf);
+                RD_UT_ASSERT(rd_kafka_waitresp_lookup(&rkb, corrid) == rkbuf,
+                             "CorrId %"PRId32" not found", corrid);
+                rd_kafka_waitresp_deq(&rkb, rkbuf);
+                rd_kafka_buf_destroy(rkbuf);
+        }
+
+        RD_UT_ASSERT(rd_kafka_waitresp_lookup(&rkb, 1) == lingering,
+                     "lingering request not found");
+
+        /* Fill up the in-flight queue */
+        for (i = 0 ; i < cnt ; i++) {
+                rkbufs[i] = rd_kafka_buf_new(0, 0);
+                rkbufs[i]->rkbuf_reqhdr.ApiKey = RD_KAFKAP_Fetch;
+                rkbufs[i]->rkbuf_corrid = ++corrid;
+                rkbufs[i]->rkbuf_ts_timeout = now +
+                        rd_jitter(1, 1000) * 1000;
+                rd_kafka_waitresp_enq(&rkb, rkbufs[i]);
+        }
+
+        if (rd_ut_waitresp_idx_verify(&rkb))
+                return 1;
+
+        /* Responses for every third request, in reverse order */
+        for (i = cnt - 1 ; i >= 0 ; i--) {
+                rd_kafka_buf_t *found;
+
+                found = rd_kafka_waitresp_lookup(&rkb,
+                                                 rkbufs[i]->rkbuf_corrid);
+                RD_UT_ASSERT(found == rkbufs[i],
+                             "CorrId %"PRId32": found %p, expected %p",
+                             rkbufs[i]->rkbuf_corrid, found, rkbufs[i]);
+
+                if (i % 3)
+                        continue;
+
+                rd_kafka_waitresp_deq(&rkb, rkbufs[i]);
+                RD_UT_ASSERT(!rd_kafka_waitresp_lookup(
+                                     &rkb, rkbufs[i]->rkbuf_corrid),
+                             "CorrId %"PRId32" still found after dequeue",
+                             rkbufs[i]->rkbuf_corrid);
+                rd_kafka_buf_destroy(rkbufs[i]);
+                rkbufs[i] = NULL;
+        }
+
+        RD_UT_ASSERT(!rd_kafka_waitresp_lookup(&rkb, corrid + 1),
+                     "unknown CorrId should not be found");
+
+        if (rd_ut_waitresp_idx_verify(&rkb))
+                return 1;
+
+        /* Time out the requests expiring within the first 500ms,
+         * in timeout order. */
+        now += 500 * 1000;
+        for (i = 0 ; i < cnt ; i++)
+                if (rkbufs[i] && rkbufs[i]->rkbuf_ts_timeout <= now)
+                        exp_expired++;
+
+        while (rkb.rkb_waitresp_idx.heap_cnt > 0 &&
+               (rkbuf = rkb.rkb_waitresp_idx.heap[0])->rkbuf_ts_timeout <=
+               now) {
+                RD_UT_ASSERT(rkbuf->rkbuf_ts_timeout >= last,
+                             "timeouts popped out of order");
+                last = rkbuf->rkbuf_ts_timeout;
+                rd_kafka_waitresp_deq(&rkb, rkbuf);
+                rd_kafka_bufq_enq(&tmpq, rkbuf);
+                expired++;
+        }
+
+        RD_UT_ASSERT(expired == exp_expired,
+                     "expected %d expired requests, not %d",
+                     exp_expired, expired);
+
+        if (rd_ut_waitresp_idx_verify(&rkb))
+                return 1;
+
+        /* Connection teardown moves the remaining requests */
+        rd_kafka_waitresp_move(&rkb, &tmpq);
+        RD_UT_ASSERT(rkb.rkb_waitresp_idx.heap_cnt == 0,
+                     "heap not empty after move");
+        RD_UT_ASSERT(!rd_kafka_waitresp_lookup(&rkb, 1),
+                     "lingering request found after move");
+        RD_UT_ASSERT(rd_kafka_bufq_cnt(&tmpq) == 1 + cnt - (cnt + 2) / 3,
+                     "expected %d requests in tmpq, not %d",
+                     1 + cnt - (cnt + 2) / 3, rd_kafka_bufq_cnt(&tmpq));
+
+        while ((rkbuf = TAILQ_FIRST(&tmpq.rkbq_bufs))) {
+                rd_kafka_bufq_deq(&tmpq, rkbuf);
+                rd_kafka_buf_destroy(rkbuf);
+        }
+
+        rd_free(rkb.rkb_waitresp_idx.ring);
+        rd_free(rkb.rkb_waitresp_idx.heap);
+        rd_free(rkbufs);
+
+        RD_UT_PASS();
+}
+
+
+/**
+ * @brief Verify that responses received into receive pool segments can be
+ *        read across segment boundaries, sliced into shadow buffers, and
+ *        that the segments are returned to the pool for reuse.
+ */
+static int rd_ut_recv_pool (void) {
+        const size_t seg_size = 1000;
+        const size_t totlen = seg_size * 3 + 123;
+        rd_kafka_buf_pool_t *rbp;
+        rd_kafka_buf_t *rkbuf, *shadow;
+        char *payload;
+        const char *p;
+        size_t i;
+        int pass;
+
+        /* Keep at most two free segments */
+        rbp = rd_kafka_buf_pool_new(seg_size, seg_size * 2);
+
+        payload = rd_malloc(totlen);
+        for (i = 0 ; i < totlen ; i++)
+                payload[i] = (char)(i % 251);
+
+        for (pass = 0 ; pass < 2 ; pass++) {
+                rkbuf = rd_kafka_buf_new(0, 0);
+                rd_kafka_buf_pool_write_ensure(rbp, &rkbuf->rkbuf_buf, totlen);
+                RD_UT_ASSERT(rd_atomic32_get(&rbp->rbp_inuse) == 3,
+                             "expected 3 segments in use, not %"PRId32,
+                             rd_atomic32_get(&rbp->rbp_inuse));
+                RD_UT_ASSERT(rd_buf_write_remains(&rkbuf->rkbuf_buf) == totlen,
+                             "expected %"PRIusz" writable bytes, not %"PRIusz,
+                             totlen, rd_buf_write_remains(&rkbuf->rkbuf_buf));
+
+                rd_buf_write(&rkbuf->rkbuf_buf, payload, totlen);
+                rd_slice_init_full(&rkbuf->rkbuf_reader, &rkbuf->rkbuf_buf);
+
+                /* Contiguous read within the first segment */
+                p = rd_kafka_buf_read_contig(rkbuf, 100);
+                RD_UT_ASSERT(p && !memcmp(p, payload, 100),
+                             "contiguous read mismatch");
+
+                /* Read straddling the first two segments is copied */
+                p = rd_kafka_buf_read_contig(rkbuf, seg_size);
+                RD_UT_ASSERT(p && !memcmp(p, payload + 100, seg_size),
+                             "straddling read mismatch");
+                RD_UT_ASSERT(rkbuf->rkbuf_contig_copies &&
+                             rd_list_cnt(rkbuf->rkbuf_contig_copies) == 1,
+                             "expected one contiguous copy");
+
+                /* Shadow the remainder, which spans three segments */
+                shadow = rd_kafka_buf_new_shadow_slice(rkbuf);
+                rd_slice_read(&rkbuf->rkbuf_reader, NULL,
+                              totlen - 100 - seg_size);
+                rd_kafka_buf_destroy(rkbuf);
+
+                RD_UT_ASSERT(rd_slice_remains(&shadow->rkbuf_reader) ==
+                             totlen - 100 - seg_size,
+                             "shadow length mismatch");
+                for (i = 100 + seg_size ; i < totlen ; i++) {
+                        char c;
+                        rd_slice_read(&shadow->rkbuf_reader, &c, 1);
+                        RD_UT_ASSERT(c == payload[i],
+                                     "shadow mismatch at offset %"PRIusz, i);
+                }
+
+                /* Segments are released with the shadow's parent */
+                RD_UT_ASSERT(rd_atomic32_get(&rbp->rbp_inuse) == 3,
+                             "segments released before shadow buffer");
+                rd_kafka_buf_destroy(shadow);
+                RD_UT_ASSERT(rd_atomic32_get(&rbp->rbp_inuse) == 0,
+                             "expected no segments in use, not %"PRId32,
+                             rd_atomic32_get(&rbp->rbp_inuse));
+                RD_UT_ASSERT(rbp->rbp_free_cnt == 2,
+                             "expected 2 free segments, not %d",
+                             rbp->rbp_free_cnt);
+        }
+
+        RD_UT_ASSERT(rd_atomic64_get(&rbp->rbp_c_alloc) == 4,
+                     "expected 4 segment allocations, not %"PRId64,
+                     rd_atomic64_get(&rbp->rbp_c_alloc));
+        RD_UT_ASSERT(rd_atomic64_get(&rbp->rbp_c_reuse) == 2,
+                     "expected 2 segment reuses, not %"PRId64,
+                     rd_atomic64_get(&rbp->rbp_c_reuse));
+
+        rd_free(payload);
+        rd_kafka_buf_pool_destroy(rbp);
+
+        RD_UT_PASS();
+}
+
+
 int unittest_broker (void) {
         int fails = 0;
 
         fails += rd_ut_reconnect_backoff();
+        fails += rd_ut_waitresp_idx();
+        fails += rd_ut_recv_pool();
 
         return fails;
 }
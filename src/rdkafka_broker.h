@@ -84,6 +84,25 @@ struct rd_kafka_broker_s { /* rd_kafka_broker_t */
 	rd_ts_t             rkb_ts_fetch_backoff;
 	int                 rkb_fetching;
 
+        /**
+         * Fetch session (KIP-227), see enable.fetch.sessions.
+         * Locality: broker thread
+         */
+        struct {
+                int32_t   id;     /**< Broker-assigned SessionId,
+                                   *   0 if there is no session. */
+                int32_t   epoch;  /**< Epoch of the next FetchRequest:
+                                   *   0 = full fetch that (re)creates
+                                   *   the session, closing session \c id
+                                   *   (if any),
+                                   *   >0 = incremental fetch. */
+                rd_list_t parts;  /**< Partitions in the session with
+                                   *   the fetch position last sent to
+                                   *   the broker
+                                   *   (rd_kafka_fetch_session_part_t *),
+                                   *   sorted by toppar. */
+        } rkb_fetch_session;
+
 	enum {
 		RD_KAFKA_BROKER_STATE_INIT,
 		RD_KAFKA_BROKER_STATE_DOWN,
@@ -156,6 +175,21 @@ struct rd_kafka_broker_s { /* rd_kafka_broker_t */
 
                 rd_atomic64_t reqtype[RD_KAFKAP__NUM]; /**< Per request-type
                                                         *   counter */
+
+                /** Fetch sessions (KIP-227) */
+                struct {
+                        rd_atomic64_t full;        /**< Full FetchRequests */
+                        rd_atomic64_t incremental; /**< Incremental
+                                                    *   FetchRequests */
+                        rd_atomic64_t errors;      /**< Session errors and
+                                                    *   resets */
+                        rd_atomic64_t omitted;     /**< Partitions omitted
+                                                    *   from incremental
+                                                    *   FetchRequests */
+                        rd_atomic64_t bytes_saved; /**< FetchRequest bytes
+                                                    *   saved by omitting
+                                                    *   partitions */
+                } fetch_session;
 	} rkb_c;
 
         int                 rkb_req_timeouts;  /* Current value */
@@ -173,20 +207,57 @@ struct rd_kafka_broker_s { /* rd_kafka_broker_t */
         rd_kafka_t         *rkb_rk;
 
 	rd_kafka_buf_t     *rkb_recv_buf;
+        rd_kafka_buf_pool_t *rkb_recv_pool; /**< Segment pool for large
+                                             *   responses */
 
 	int                 rkb_max_inflight;   /* Maximum number of in-flight
 						 * requests to broker.
 						 * Compared to rkb_waitresps length.*/
 	rd_kafka_bufq_t     rkb_outbufs;
 	rd_kafka_bufq_t     rkb_waitresps;
+        /** Index of rkb_waitresps for O(1) response matching and
+         *  timeout scans that only visit expired requests,
+         *  maintained by rd_kafka_waitresp_enq()/_deq(). */
+        struct {
+                rd_kafka_buf_t **ring;      /**< Buckets indexed by
+                                             *   CorrId & (ring_size-1),
+                                             *   chained through
+                                             *   rkbuf_corrid_next. */
+                int              ring_size;
+                rd_kafka_buf_t **heap;      /**< Binary min-heap ordered
+                                             *   by rkbuf_ts_timeout. */
+                int              heap_cnt;
+                int              heap_size;
+        } rkb_waitresp_idx;
 	rd_kafka_bufq_t     rkb_retrybufs;
 
+        rd_kafka_workpool_group_t *rkb_produce_wpg; /**< Compression job
+                                                     *   group of the current
+                                                     *   produce pass, or NULL
+                                                     *   if compression is not
+                                                     *   offloaded. */
+        rd_kafka_bufq_t     rkb_produce_deferred; /**< ProduceRequests held
+                                                   *   back until the
+                                                   *   compression jobs of the
+                                                   *   current produce pass
+                                                   *   are done, in order. */
+
 	rd_avg_t            rkb_avg_int_latency;/* Current internal latency period*/
         rd_avg_t            rkb_avg_outbuf_latency; /**< Current latency
                                                      *   between buf_enq0
                                                      *   and writing to socket
                                                      */
 	rd_avg_t            rkb_avg_rtt;        /* Current RTT period */
+
+        /** Smoothed ProduceRequest round-trip time (srtt) and its mean
+         *   deviation (rttvar) in microseconds, calculated as in
+         *   RFC 6298 regardless of statistics being enabled.
+         *   Used by adaptive linger.
+         *   @locality broker thread */
+        struct {
+                rd_ts_t srtt;
+                rd_ts_t rttvar;
+        } rkb_produce_rtt;
 	rd_avg_t            rkb_avg_throttle;   /* Current throttle period */
 
         /* These are all protected by rkb_lock */
@@ -54,6 +54,8 @@ void rd_kafka_buf_destroy_final (rd_kafka_buf_t *rkbuf) {
 
         case RD_KAFKAP_Produce:
                 rd_kafka_msgbatch_destroy(&rkbuf->rkbuf_batch);
+                if (rkbuf->rkbuf_u.Produce.parts)
+                        rd_list_destroy(rkbuf->rkbuf_u.Produce.parts);
                 break;
         }
 
@@ -71,11 +73,25 @@ void rd_kafka_buf_destroy_final (rd_kafka_buf_t *rkbuf) {
         if (rkbuf->rkbuf_rkb)
                 rd_kafka_broker_destroy(rkbuf->rkbuf_rkb);
 
+        if (rkbuf->rkbuf_contig_copies)
+                rd_list_destroy(rkbuf->rkbuf_contig_copies);
+
+        if (rkbuf->rkbuf_parent)
+                rd_kafka_buf_destroy(rkbuf->rkbuf_parent);
+
         rd_refcnt_destroy(&rkbuf->rkbuf_refcnt);
 
 	rd_free(rkbuf);
 }
 
+/**
+ * @brief Drop a reference to the buffer, for use as free_cb.
+ */
+void rd_kafka_buf_destroy_free (void *ptr) {
+        rd_kafka_buf_t *rkbuf = ptr;
+        rd_kafka_buf_destroy(rkbuf);
+}
+
 
 
 /**
@@ -186,12 +202,256 @@ rd_kafka_buf_t *rd_kafka_buf_new_shadow (const void *ptr, size_t size,
 
 
 
+/**
+ * @brief Create a read-only shadow buffer referencing the remaining data
+ *        at \p parent's read position, which may span multiple segments,
+ *        without copying it.
+ *
+ * A reference is held on \p parent for the lifetime of the shadow buffer.
+ */
+rd_kafka_buf_t *rd_kafka_buf_new_shadow_slice (rd_kafka_buf_t *parent) {
+        rd_kafka_buf_t *rkbuf;
+        rd_slice_t slice = parent->rkbuf_reader;
+        const void *p;
+        size_t rlen;
+
+        rkbuf = rd_calloc(1, sizeof(*rkbuf));
+
+        rkbuf->rkbuf_reqhdr.ApiKey = RD_KAFKAP_None;
+
+        rd_buf_init(&rkbuf->rkbuf_buf, 0, 0);
+        while ((rlen = rd_slice_reader(&slice, &p)))
+                rd_buf_push(&rkbuf->rkbuf_buf, p, rlen, NULL);
+
+        rkbuf->rkbuf_totlen = rd_buf_len(&rkbuf->rkbuf_buf);
+
+        rd_slice_init_full(&rkbuf->rkbuf_reader, &rkbuf->rkbuf_buf);
+
+        rd_refcnt_init(&rkbuf->rkbuf_refcnt, 1);
+
+        rkbuf->rkbuf_parent = parent;
+        rd_kafka_buf_keep(parent);
+
+        return rkbuf;
+}
+
+
+/**
+ * @brief Read \p size bytes from the buffer's reader and return a pointer
+ *        to them in contiguous memory.
+ *
+ * The returned pointer points into the buffer itself unless the data spans
+ * multiple segments, in which case it is copied to memory owned by the
+ * buffer. Either way the memory remains valid for the buffer's lifetime.
+ *
+ * @returns the contiguous memory, or NULL if there are fewer than
+ *          \p size bytes remaining, in which case the read position is
+ *          not updated.
+ */
+const void *rd_kafka_buf_read_contig (rd_kafka_buf_t *rkbuf, size_t size) {
+        const void *p;
+        void *copy;
+
+        if (likely((p = rd_slice_ensure_contig(&rkbuf->rkbuf_reader, size)) !=
+                   NULL))
+                return p;
+
+        if (rd_slice_remains(&rkbuf->rkbuf_reader) < size)
+                return NULL;
+
+        copy = rd_malloc(size);
+        rd_slice_read(&rkbuf->rkbuf_reader, copy, size);
+
+        if (!rkbuf->rkbuf_contig_copies)
+                rkbuf->rkbuf_contig_copies = rd_list_new(1, rd_free);
+        rd_list_add(rkbuf->rkbuf_contig_copies, copy);
+
+        return copy;
+}
+
+
+
+/**
+ * @name Receive buffer segment pool
+ * @{
+ */
+
+/**
+ * @brief Pool segment header, immediately followed by the segment payload.
+ */
+typedef struct rd_kafka_buf_pool_seg_s {
+        rd_kafka_buf_pool_t *rbps_pool;
+        struct rd_kafka_buf_pool_seg_s *rbps_next; /**< Free list link */
+} rd_kafka_buf_pool_seg_t;
+
+
+/**
+ * @brief Create a new segment pool keeping up to \p max_bytes worth of free
+ *        segments of \p seg_size bytes.
+ */
+rd_kafka_buf_pool_t *rd_kafka_buf_pool_new (size_t seg_size,
+                                            size_t max_bytes) {
+        rd_kafka_buf_pool_t *rbp = rd_calloc(1, sizeof(*rbp));
+
+        mtx_init(&rbp->rbp_lock, mtx_plain);
+        rd_refcnt_init(&rbp->rbp_refcnt, 1);
+        rbp->rbp_seg_size = seg_size;
+        rbp->rbp_max_free = (int)RD_MIN(max_bytes / seg_size, INT_MAX);
+        rd_atomic32_init(&rbp->rbp_inuse, 0);
+        rd_atomic64_init(&rbp->rbp_c_alloc, 0);
+        rd_atomic64_init(&rbp->rbp_c_reuse, 0);
+
+        return rbp;
+}
+
+
+/**
+ * @brief Drop a reference to the pool, freeing it and its free segments
+ *        when the last reference is gone.
+ */
+void rd_kafka_buf_pool_destroy (rd_kafka_buf_pool_t *rbp) {
+        rd_kafka_buf_pool_seg_t *rbps;
+
+        if (rd_refcnt_sub(&rbp->rbp_refcnt) > 0)
+                return;
+
+        while ((rbps = rbp->rbp_free)) {
+                rbp->rbp_free = rbps->rbps_next;
+                rd_free(rbps);
+        }
+
+        mtx_destroy(&rbp->rbp_lock);
+        rd_refcnt_destroy(&rbp->rbp_refcnt);
+        rd_free(rbp);
+}
+
+
+/**
+ * @brief Segment free callback: return the segment to its pool,
+ *        or free it if the pool is full.
+ *
+ * @locality any thread
+ */
+static void rd_kafka_buf_pool_seg_free (void *p) {
+        rd_kafka_buf_pool_seg_t *rbps = ((rd_kafka_buf_pool_seg_t *)p) - 1;
+        rd_kafka_buf_pool_t *rbp = rbps->rbps_pool;
+
+        rd_atomic32_sub(&rbp->rbp_inuse, 1);
+
+        mtx_lock(&rbp->rbp_lock);
+        if (rbp->rbp_free_cnt < rbp->rbp_max_free) {
+                rbps->rbps_next = rbp->rbp_free;
+                rbp->rbp_free = rbps;
+                rbp->rbp_free_cnt++;
+                rbps = NULL;
+        }
+        mtx_unlock(&rbp->rbp_lock);
+
+        if (rbps)
+                rd_free(rbps);
+
+        rd_kafka_buf_pool_destroy(rbp);
+}
+
+
+/**
+ * @brief Get a segment from the pool, or allocate a new one.
+ *
+ * @returns the segment payload pointer.
+ */
+static void *rd_kafka_buf_pool_seg_get (rd_kafka_buf_pool_t *rbp) {
+        rd_kafka_buf_pool_seg_t *rbps;
+
+        mtx_lock(&rbp->rbp_lock);
+        if ((rbps = rbp->rbp_free)) {
+                rbp->rbp_free = rbps->rbps_next;
+                rbp->rbp_free_cnt--;
+        }
+        mtx_unlock(&rbp->rbp_lock);
+
+        if (rbps) {
+                rd_atomic64_add(&rbp->rbp_c_reuse, 1);
+        } else {
+                rbps = rd_malloc(sizeof(*rbps) + rbp->rbp_seg_size);
+                rbps->rbps_pool = rbp;
+                rd_atomic64_add(&rbp->rbp_c_alloc, 1);
+        }
+
+        rd_atomic32_add(&rbp->rbp_inuse, 1);
+        rd_refcnt_add(&rbp->rbp_refcnt);
+
+        return rbps + 1;
+}
+
+
+/**
+ * @brief Ensure \p size bytes are available for writing at the end of
+ *        \p rbuf by appending pool segments, and an exactly sized
+ *        segment for any remainder smaller than the pool's segment size.
+ *
+ * @remark The buffer's write position must be at its end.
+ */
+void rd_kafka_buf_pool_write_ensure (rd_kafka_buf_pool_t *rbp,
+                                     rd_buf_t *rbuf, size_t size) {
+        size_t remains = rd_buf_write_remains(rbuf);
+
+        while (remains + rbp->rbp_seg_size <= size) {
+                rd_buf_push_writable(rbuf, rd_kafka_buf_pool_seg_get(rbp),
+                                     rbp->rbp_seg_size,
+                                     rd_kafka_buf_pool_seg_free);
+                remains += rbp->rbp_seg_size;
+        }
+
+        if (remains < size)
+                rd_buf_write_ensure(rbuf, size, size);
+}
+
+/**@}*/
+
+
+
+/**
+ * Finalize a stuffed rkbuf for sending to broker.
+ */
+void rd_kafka_buf_finalize (rd_kafka_t *rk, rd_kafka_buf_t *rkbuf) {
+        size_t totsize;
+
+        /* Calculate total request buffer length. */
+        totsize = rd_buf_len(&rkbuf->rkbuf_buf) - 4;
+
+        /* Set up a buffer reader for sending the buffer. */
+        rd_slice_init_full(&rkbuf->rkbuf_reader, &rkbuf->rkbuf_buf);
+
+        /**
+         * Update request header fields
+         */
+        /* Total reuqest length */
+        rd_kafka_buf_update_i32(rkbuf, 0, (int32_t)totsize);
+
+        /* ApiVersion */
+        rd_kafka_buf_update_i16(rkbuf, 4+2, rkbuf->rkbuf_reqhdr.ApiVersion);
+}
+
+
 void rd_kafka_bufq_enq (rd_kafka_bufq_t *rkbufq, rd_kafka_buf_t *rkbuf) {
 	TAILQ_INSERT_TAIL(&rkbufq->rkbq_bufs, rkbuf, rkbuf_link);
         rd_atomic32_add(&rkbufq->rkbq_cnt, 1);
         if (rkbuf->rkbuf_reqhdr.ApiKey == RD_KAFKAP_Produce)
                 rd_atomic32_add(&rkbufq->rkbq_msg_cnt,
-                                rd_kafka_msgq_len(&rkbuf->rkbuf_batch.msgq));
+                                rd_kafka_buf_Produce_msgcnt(rkbuf));
+}
+
+/**
+ * @brief Insert \p rkbuf before \p before in \p rkbufq.
+ */
+void rd_kafka_bufq_insert_before (rd_kafka_bufq_t *rkbufq,
+                                  rd_kafka_buf_t *before,
+                                  rd_kafka_buf_t *rkbuf) {
+        TAILQ_INSERT_BEFORE(before, rkbuf, rkbuf_link);
+        rd_atomic32_add(&rkbufq->rkbq_cnt, 1);
+        if (rkbuf->rkbuf_reqhdr.ApiKey == RD_KAFKAP_Produce)
+                rd_atomic32_add(&rkbufq->rkbq_msg_cnt,
+                                rd_kafka_buf_Produce_msgcnt(rkbuf));
 }
 
 void rd_kafka_bufq_deq (rd_kafka_bufq_t *rkbufq, rd_kafka_buf_t *rkbuf) {
@@ -200,7 +460,7 @@ void rd_kafka_bufq_deq (rd_kafka_bufq_t *rkbufq, rd_kafka_buf_t *rkbuf) {
 	rd_atomic32_sub(&rkbufq->rkbq_cnt, 1);
         if (rkbuf->rkbuf_reqhdr.ApiKey == RD_KAFKAP_Produce)
                 rd_atomic32_sub(&rkbufq->rkbq_msg_cnt,
-                                rd_kafka_msgq_len(&rkbuf->rkbuf_batch.msgq));
+                                rd_kafka_buf_Produce_msgcnt(rkbuf));
 }
 
 void rd_kafka_bufq_init(rd_kafka_bufq_t *rkbufq) {
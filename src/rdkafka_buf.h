@@ -351,8 +351,7 @@ rd_tmpabuf_write_str0 (const char *func, int line,
                 if (RD_KAFKAP_STR_IS_NULL(kstr))                        \
                         (kstr)->str = NULL;                             \
                 else if (!((kstr)->str =                                \
-                           rd_slice_ensure_contig(&rkbuf->rkbuf_reader, \
-                                                     _klen)))           \
+                           rd_kafka_buf_read_contig(rkbuf, _klen)))     \
                         rd_kafka_buf_check_len(rkbuf, _klen);           \
         } while (0)
 
@@ -397,8 +396,7 @@ rd_tmpabuf_write_str0 (const char *func, int line,
                 } else if (RD_KAFKAP_BYTES_LEN(kbytes) == 0)            \
                         (kbytes)->data = "";                            \
                 else if (!((kbytes)->data =                             \
-                           rd_slice_ensure_contig(&(rkbuf)->rkbuf_reader, \
-                                                  _klen)))              \
+                           rd_kafka_buf_read_contig(rkbuf, _klen)))     \
                         rd_kafka_buf_check_len(rkbuf, _klen);           \
         } while (0)
 
@@ -410,7 +408,7 @@ rd_tmpabuf_write_str0 (const char *func, int line,
 #define rd_kafka_buf_read_ptr(rkbuf,ptr,size) do {                      \
                 size_t _klen = size;                                    \
                 if (!(*(ptr) = (void *)                                 \
-                      rd_slice_ensure_contig(&(rkbuf)->rkbuf_reader, _klen))) \
+                      rd_kafka_buf_read_contig(rkbuf, _klen)))          \
                         rd_kafka_buf_check_len(rkbuf, _klen);           \
         } while (0)
 
@@ -432,8 +430,8 @@ rd_tmpabuf_write_str0 (const char *func, int line,
                 } else if (RD_KAFKAP_BYTES_LEN(kbytes) == 0)            \
                         (kbytes)->data = "";                            \
                 else if (!((kbytes)->data =                             \
-                           rd_slice_ensure_contig(&(rkbuf)->rkbuf_reader, \
-                                                  (size_t)_len2)))      \
+                           rd_kafka_buf_read_contig(rkbuf,              \
+                                                    (size_t)_len2)))    \
                         rd_kafka_buf_check_len(rkbuf, _len2);           \
         } while (0)
 
@@ -474,6 +472,10 @@ struct rd_kafka_buf_s { /* rd_kafka_buf_t */
 
 	int32_t rkbuf_corrid;
 
+        /* rkb_waitresps index, see rd_kafka_waitresp_enq() */
+        struct rd_kafka_buf_s *rkbuf_corrid_next; /**< CorrId ring chain */
+        int     rkbuf_timeout_idx;  /**< Index in timeout heap */
+
 	rd_ts_t rkbuf_ts_retry;    /* Absolute send retry time */
 
 	int     rkbuf_flags; /* RD_KAFKA_OP_F */
@@ -518,6 +520,15 @@ struct rd_kafka_buf_s { /* rd_kafka_buf_t */
 
         struct rd_kafka_broker_s *rkbuf_rkb;
 
+        struct rd_kafka_buf_s *rkbuf_parent; /**< Buffer whose memory this
+                                              *   shadow buffer references,
+                                              *   released on destroy. */
+
+        rd_list_t *rkbuf_contig_copies; /**< Contiguous copies of reads
+                                         *   spanning segments, see
+                                         *   rd_kafka_buf_read_contig().
+                                         *   (void *), lazily created. */
+
 	rd_refcnt_t rkbuf_refcnt;
 	void   *rkbuf_opaque;
 
@@ -601,11 +612,51 @@ struct rd_kafka_buf_s { /* rd_kafka_buf_t */
                 } Metadata;
                 struct {
                         rd_kafka_msgbatch_t batch; /**< MessageSet/batch */
+                        size_t MessageSetSize;     /**< Final MessageSetSize,
+                                                    *   set on finalize. */
+                        size_t MessageSetOffset;   /**< Buffer offset of the
+                                                    *   MessageSet, set on
+                                                    *   finalize. */
+                        struct rd_kafka_msgset_compress_job_s *compress_job;
+                        /**< Outstanding compression job on the
+                         *   worker pool, see compression.threads.
+                         *   The MessageSet is not finalized until
+                         *   rd_kafka_msgset_compress_done()
+                         *   has been called. */
+                        rd_list_t *parts;  /**< Multi-partition
+                                            *   ProduceRequest: the
+                                            *   single-partition
+                                            *   ProduceRequests
+                                            *   (rd_kafka_buf_t *) whose
+                                            *   MessageSets it carries, see
+                                            *   produce.request.max.partitions.
+                                            *   NULL for single-partition
+                                            *   requests. */
+                        int msgcnt;        /**< Multi-partition
+                                            *   ProduceRequest: total number
+                                            *   of messages in parts. */
                 } Produce;
+                struct {
+                        int32_t SessionId; /**< Fetch session id sent
+                                            *   (KIP-227). */
+                        int32_t Epoch;     /**< Fetch session epoch sent:
+                                            *   -1 = sessionless,
+                                            *   0 = full fetch (re)creating
+                                            *   the session,
+                                            *   >0 = incremental fetch. */
+                } Fetch;
         } rkbuf_u;
 
 #define rkbuf_batch rkbuf_u.Produce.batch
 
+/**
+ * @returns the number of messages in a ProduceRequest.
+ */
+#define rd_kafka_buf_Produce_msgcnt(rkbuf)                              \
+        ((rkbuf)->rkbuf_u.Produce.parts ?                               \
+         (rkbuf)->rkbuf_u.Produce.msgcnt :                              \
+         rd_kafka_msgq_len(&(rkbuf)->rkbuf_batch.msgq))
+
         const char *rkbuf_uflow_mitigation; /**< Buffer read underflow
                                              *   human readable mitigation
                                              *   string (const memory).
@@ -630,6 +681,43 @@ typedef struct rd_kafka_bufq_s {
 
 #define rd_kafka_bufq_cnt(rkbq) rd_atomic32_get(&(rkbq)->rkbq_cnt)
 
+
+/**
+ * @brief Size of the fixed-size segments large responses are received into,
+ *        see rd_kafka_buf_pool_t.
+ */
+#define RD_KAFKA_BUF_POOL_SEG_SIZE  (1024*1024)
+
+/**
+ * @brief Pool of fixed-size receive buffer segments.
+ *
+ * Responses larger than the segment size are received into a chain of
+ * segments (rd_kafka_buf_pool_write_ensure()) rather than one contiguous
+ * allocation of the entire response. Segments are returned to the pool,
+ * from any thread, when the response buffer is destroyed, and reused
+ * by subsequent responses.
+ *
+ * The pool is reference counted by its owner and by each segment
+ * handed out, so it outlives its broker as long as any segment is in use,
+ * e.g., by consumed messages.
+ */
+typedef struct rd_kafka_buf_pool_s {
+        mtx_t         rbp_lock;      /**< Protects rbp_free* */
+        rd_refcnt_t   rbp_refcnt;
+        size_t        rbp_seg_size;  /**< Segment payload size */
+        int           rbp_max_free;  /**< Max number of free segments kept */
+        struct rd_kafka_buf_pool_seg_s *rbp_free; /**< Free segments */
+        int           rbp_free_cnt;  /**< Number of free segments */
+        rd_atomic32_t rbp_inuse;     /**< Segments in use */
+        rd_atomic64_t rbp_c_alloc;   /**< Segments allocated */
+        rd_atomic64_t rbp_c_reuse;   /**< Segments reused from the pool */
+} rd_kafka_buf_pool_t;
+
+rd_kafka_buf_pool_t *rd_kafka_buf_pool_new (size_t seg_size, size_t max_bytes);
+void rd_kafka_buf_pool_destroy (rd_kafka_buf_pool_t *rbp);
+void rd_kafka_buf_pool_write_ensure (rd_kafka_buf_pool_t *rbp,
+                                     rd_buf_t *rbuf, size_t size);
+
 /**
  * @brief Set buffer's request timeout to relative \p timeout_ms measured
  *        from the time the buffer is sent on the underlying socket.
@@ -689,6 +777,7 @@ rd_kafka_buf_set_abs_timeout0 (rd_kafka_buf_t *rkbuf, int timeout_ms,
                                  rd_kafka_buf_destroy_final(rkbuf))
 
 void rd_kafka_buf_destroy_final (rd_kafka_buf_t *rkbuf);
+void rd_kafka_buf_destroy_free (void *ptr);
 void rd_kafka_buf_push0 (rd_kafka_buf_t *rkbuf, const void *buf, size_t len,
                          int allow_crc_calc, void (*free_cb) (void *));
 #define rd_kafka_buf_push(rkbuf,buf,len,free_cb)                        \
@@ -700,8 +789,15 @@ rd_kafka_buf_t *rd_kafka_buf_new_request (rd_kafka_broker_t *rkb, int16_t ApiKey
                                           int segcnt, size_t size);
 rd_kafka_buf_t *rd_kafka_buf_new_shadow (const void *ptr, size_t size,
                                          void (*free_cb) (void *));
+rd_kafka_buf_t *rd_kafka_buf_new_shadow_slice (rd_kafka_buf_t *parent);
+const void *rd_kafka_buf_read_contig (rd_kafka_buf_t *rkbuf, size_t size);
+void rd_kafka_buf_finalize (rd_kafka_t *rk, rd_kafka_buf_t *rkbuf);
+
 void rd_kafka_bufq_enq (rd_kafka_bufq_t *rkbufq, rd_kafka_buf_t *rkbuf);
 void rd_kafka_bufq_deq (rd_kafka_bufq_t *rkbufq, rd_kafka_buf_t *rkbuf);
+void rd_kafka_bufq_insert_before (rd_kafka_bufq_t *rkbufq,
+                                  rd_kafka_buf_t *before,
+                                  rd_kafka_buf_t *rkbuf);
 void rd_kafka_bufq_init(rd_kafka_bufq_t *rkbufq);
 void rd_kafka_bufq_concat (rd_kafka_bufq_t *dst, rd_kafka_bufq_t *src);
 void rd_kafka_bufq_purge (rd_kafka_broker_t *rkb,
@@ -128,6 +128,13 @@ static RD_INLINE int rd_kafka_prop2idx (const struct rd_kafka_property *prop) {
         return prop->offset;
 }
 
+/* The property offsets index the anyconf modified bitmap: fail the build,
+ * rather than abort at runtime, if a config struct outgrows it. */
+typedef char rd_kafka_conf_props_idx_max_check[
+        sizeof(struct rd_kafka_conf_s) <= RD_KAFKA_CONF_PROPS_IDX_MAX &&
+        sizeof(struct rd_kafka_topic_conf_s) <= RD_KAFKA_CONF_PROPS_IDX_MAX ?
+        1 : -1];
+
 
 
 /**
@@ -214,7 +221,9 @@ rd_kafka_conf_validate_partitioner (const struct rd_kafka_property *prop,
                 !strcmp(val, "consistent") ||
                 !strcmp(val, "consistent_random") ||
                 !strcmp(val, "murmur2") ||
-                !strcmp(val, "murmur2_random");
+                !strcmp(val, "murmur2_random") ||
+                !strcmp(val, "consistent_sticky") ||
+                !strcmp(val, "murmur2_sticky");
 }
 
 
@@ -294,6 +303,15 @@ static const struct rd_kafka_property rd_kafka_properties[] = {
           "for protocol overhead; the value is adjusted automatically "
           "unless the configuration property is explicitly set.",
 	  1000, INT_MAX, 100000000 },
+        { _RK_GLOBAL, "receive.buffer.pool.bytes", _RK_C_INT,
+          _RK(recv_pool_bytes),
+          "Protocol responses of 1 MiB or larger (typically FetchResponses) "
+          "are received into a chain of fixed-size 1 MiB buffer segments "
+          "rather than one contiguous allocation of the entire response. "
+          "This is the maximum amount of free segment memory each broker "
+          "connection keeps for reuse by subsequent responses rather than "
+          "returning it to the allocator. 0 disables reuse.",
+          0, INT_MAX, 16*1024*1024 },
 	{ _RK_GLOBAL, "max.in.flight.requests.per.connection", _RK_C_INT,
 	  _RK(max_inflight),
 	  "Maximum number of in-flight requests per broker connection. "
@@ -388,6 +406,20 @@ static const struct rd_kafka_property rd_kafka_properties[] = {
 	  _RK(socket_sndbuf_size),
 	  "Broker socket send buffer size. System default is used if 0.",
 	  0, 100000000, 0 },
+	{ _RK_GLOBAL, "socket.send.batch.max", _RK_C_INT,
+	  _RK(socket_send_batch_max),
+	  "Maximum number of queued requests to write to a broker "
+	  "connection with a single gathering sendmsg() system call, "
+	  "reducing the number of system calls when many requests are "
+	  "queued for the same broker. "
+	  "Batching is only performed on plaintext connections on "
+	  "platforms providing sendmsg(), other connections fall back to "
+	  "writing one request at a time. "
+	  "The producer only queues up to "
+	  "`queue.buffering.backpressure.threshold` ProduceRequests per "
+	  "broker, which also bounds the batch. "
+	  "A value of 1 disables batching.",
+	  1, 1000, 1 },
 	{ _RK_GLOBAL, "socket.receive.buffer.bytes", _RK_C_INT,
 	  _RK(socket_rcvbuf_size),
 	  "Broker socket receive buffer size. System default is used if 0.",
@@ -434,6 +466,16 @@ static const struct rd_kafka_property rd_kafka_properties[] = {
           "it needs to communicate with. When disabled the client "
           "will maintain connections to all brokers in the cluster.",
           0, 1, 1 },
+        { _RK_GLOBAL, "enable.lockfree.enqueue", _RK_C_BOOL,
+          _RK(lockfree_enqueue),
+          "Use lock-free multi-producer enqueues for the broker op queues, "
+          "the main reply queue, the consumer queue and the producer's "
+          "partition message queues. Op enqueuers will then only take the "
+          "queue lock to wake up a waiting queue consumer, and message "
+          "enqueuers take the partition lock once per burst of messages "
+          "rather than once per message. "
+          "Ignored on platforms without pointer atomics.",
+          0, 1, 0 },
         { _RK_GLOBAL|_RK_DEPRECATED, "reconnect.backoff.jitter.ms", _RK_C_INT,
           _RK(reconnect_jitter_ms),
           "No longer used. See `reconnect.backoff.ms` and "
@@ -710,6 +752,19 @@ static const struct rd_kafka_property rd_kafka_properties[] = {
           _RK(ssl.cert_verify_cb),
           "Callback to verify the broker certificate chain."
         },
+        { _RK_GLOBAL, "ssl.ktls.enable", _RK_C_BOOL,
+          _RK(ssl.ktls_enable),
+          "Let the kernel encrypt TLS records (kTLS) once the SSL "
+          "handshake is done, so that requests are written to the socket "
+          "with plain gathering `sendmsg()` calls and received data is "
+          "decrypted by the kernel. "
+          "Falls back to user-space TLS, per connection, when the "
+          "kernel or the negotiated cipher does not support kTLS. "
+          "Requires Linux and OpenSSL >= 3.0 built with kTLS support, "
+          "ignored otherwise. Enable `debug=security` to see if the "
+          "offload is in effect.",
+          0, 1, 0
+        },
 #endif /* WITH_SSL */
 
         /* Point user in the right direction if they try to apply
@@ -956,6 +1011,35 @@ static const struct rd_kafka_property rd_kafka_properties[] = {
 	  "This value may be overshot by fetch.message.max.bytes. "
 	  "This property has higher priority than queued.min.messages.",
           1, INT_MAX/1024, 0x100000/*1GB*/ },
+        { _RK_GLOBAL|_RK_CONSUMER|_RK_MED, "queued.max.total.kbytes",
+          _RK_C_INT,
+          _RK(queued_max_total_kbytes),
+          "Maximum number of kilobytes of fetched messages held by the "
+          "consumer across all partitions, whether in the local consumer "
+          "queues or not yet destroyed by the application. "
+          "When this budget is exhausted no more partitions are fetched, "
+          "and as it runs low partitions holding more than an even share "
+          "of it (the budget divided by the number of partitions being "
+          "consumed) are held back in favour of the others. "
+          "The budget may be overshot by up to one fetch response per "
+          "broker. "
+          "This applies in addition to queued.max.messages.kbytes. "
+          "0 disables the budget.",
+          0, INT_MAX/1024, 0 },
+        { _RK_GLOBAL|_RK_CONSUMER, "queued.max.total.kbytes.scope",
+          _RK_C_S2I,
+          _RK(queued_max_total_scope),
+          "Scope of the `queued.max.total.kbytes` budget: "
+          "`client` - the budget applies to this client instance only. "
+          "`process` - memory held by all consumer instances in the process "
+          "that use this scope counts towards the budget, allowing several "
+          "consumers to share one memory limit. Each instance enforces its "
+          "own `queued.max.total.kbytes` against the shared usage.",
+          .vdef = RD_KAFKA_FETCH_BUDGET_SCOPE_CLIENT,
+          .s2i = {
+                        { RD_KAFKA_FETCH_BUDGET_SCOPE_CLIENT, "client" },
+                        { RD_KAFKA_FETCH_BUDGET_SCOPE_PROCESS, "process" }
+                } },
         { _RK_GLOBAL|_RK_CONSUMER, "fetch.wait.max.ms", _RK_C_INT,
 	  _RK(fetch_wait_max_ms),
 	  "Maximum time the broker may wait to fill the response "
@@ -997,6 +1081,18 @@ static const struct rd_kafka_property rd_kafka_properties[] = {
 	  "How long to postpone the next fetch request for a "
 	  "topic+partition in case of a fetch error.",
 	  0, 300*1000, 500 },
+        { _RK_GLOBAL|_RK_CONSUMER, "enable.fetch.sessions", _RK_C_BOOL,
+          _RK(enable_fetch_sessions),
+          "Use incremental fetch sessions (KIP-227) with brokers that "
+          "support them (FetchRequest v7 and later): only partitions whose "
+          "fetch position or fetch size changed since the previous "
+          "FetchRequest to a broker are sent, and the broker only returns "
+          "partitions that have data or changed state. "
+          "This reduces request and response sizes and broker CPU usage "
+          "for consumers with many assigned partitions. "
+          "The consumer falls back to full FetchRequests if the broker "
+          "evicts the session.",
+          0, 1, 1 },
         { _RK_GLOBAL|_RK_CONSUMER|_RK_DEPRECATED, "offset.store.method",
           _RK_C_S2I,
           _RK(offset_store_method),
@@ -1104,6 +1200,24 @@ static const struct rd_kafka_property rd_kafka_properties[] = {
 	  .dmin = 0, .dmax = 900.0*1000.0, .ddef = 0.5 },
         { _RK_GLOBAL|_RK_PRODUCER|_RK_HIGH, "linger.ms", _RK_C_ALIAS,
           .sdef = "queue.buffering.max.ms" },
+        { _RK_GLOBAL|_RK_PRODUCER|_RK_MED, "linger.adaptive.target.ms",
+          _RK_C_INT,
+          _RK(linger_adaptive_target_ms),
+          "Enables adaptive linger when set to a non-zero value: "
+          "the linger time of each partition is adjusted between 0 and "
+          "`linger.ms` to keep the produce latency (linger time plus "
+          "the 99th percentile produce request round-trip time to the "
+          "partition leader) within this target, in milliseconds. "
+          "The linger time is derived from the partition's observed "
+          "message arrival rate and its number of in-flight messages: "
+          "under low load messages are sent without lingering, "
+          "while under high load the linger time grows to build larger "
+          "batches. "
+          "`linger.ms` is the upper bound. "
+          "The linger time in use is reported per partition in the "
+          "statistics (`linger_us`). "
+          "0 = disabled: always linger for `linger.ms`.",
+          0, 900*1000, 0 },
         { _RK_GLOBAL|_RK_PRODUCER|_RK_HIGH, "message.send.max.retries",
           _RK_C_INT,
 	  _RK(max_retries),
@@ -1152,15 +1266,69 @@ static const struct rd_kafka_property rd_kafka_properties[] = {
 		} },
         { _RK_GLOBAL|_RK_PRODUCER|_RK_MED, "compression.type", _RK_C_ALIAS,
           .sdef = "compression.codec" },
+        { _RK_GLOBAL, "compression.threads", _RK_C_INT,
+          _RK(compression_threads),
+          "Number of worker threads to compress and decompress "
+          "MessageSets on. "
+          "Producer: the MessageSets of all partitions that a broker "
+          "thread produces to in one pass are compressed in parallel on "
+          "the worker threads (and the broker thread itself), and the "
+          "ProduceRequests are enqueued for transmission in their original "
+          "order once all of them are compressed. "
+          "This lifts the per-broker-connection compression throughput "
+          "cap of one CPU core when producing to many partitions. "
+          "Consumer: the compressed MessageSets of all partitions in a "
+          "FetchResponse are decompressed and parsed in parallel, "
+          "each partition's messages are still enqueued in order. "
+          "0 = (de)compress on the broker thread.",
+          0, 128, 0 },
         { _RK_GLOBAL|_RK_PRODUCER|_RK_MED, "batch.num.messages", _RK_C_INT,
 	  _RK(batch_num_messages),
 	  "Maximum number of messages batched in one MessageSet. "
 	  "The total MessageSet size is also limited by message.max.bytes.",
 	  1, 1000000, 10000 },
+        { _RK_GLOBAL|_RK_PRODUCER, "produce.request.max.partitions",
+          _RK_C_INT,
+          _RK(produce_request_max_partitions),
+          "Maximum number of partitions to pack into one ProduceRequest. "
+          "The MessageSets of partitions on the same broker that are ready "
+          "to be sent in the same pass are sent in a single ProduceRequest, "
+          "which saves request overhead and in-flight request slots when "
+          "producing to many partitions. "
+          "The total size of the packed MessageSets is limited by "
+          "message.max.bytes. "
+          "1 = one ProduceRequest per partition MessageSet.",
+          1, 10000, 1 },
 	{ _RK_GLOBAL|_RK_PRODUCER, "delivery.report.only.error", _RK_C_BOOL,
 	  _RK(dr_err_only),
 	  "Only provide delivery reports for failed messages.",
 	  0, 1, 0 },
+        { _RK_GLOBAL|_RK_PRODUCER, "produce.zerocopy", _RK_C_BOOL,
+          _RK(produce_zerocopy),
+          "Pass the payload of messages that were not produced with "
+          "RD_KAFKA_MSG_F_COPY by reference all the way to the socket, "
+          "regardless of `message.copy.max.bytes`, instead of copying "
+          "it to the ProduceRequest buffer. "
+          "Only applies to uncompressed MessageSets on non-SSL "
+          "connections. "
+          "This avoids a memory copy for large payloads at the expense "
+          "of larger iovecs.",
+          0, 1, 0 },
+        { _RK_GLOBAL|_RK_PRODUCER, "message.pool.enable", _RK_C_BOOL,
+          _RK(msgpool_enable),
+          "Allocate produced messages from a per-instance, size-classed "
+          "message pool instead of allocating and freeing each message "
+          "separately. Messages (including copied payload and key) "
+          "are returned to the pool when their delivery report has been "
+          "served. Messages larger than 64 KiB are always allocated "
+          "separately.",
+          0, 1, 0 },
+        { _RK_GLOBAL|_RK_PRODUCER, "message.pool.max.kbytes", _RK_C_INT,
+          _RK(msgpool_max_kbytes),
+          "Maximum total size of free message allocations kept cached "
+          "in the message pool. "
+          "Requires `message.pool.enable=true`.",
+          1, INT_MAX/1024, 16*1024 },
 	{ _RK_GLOBAL|_RK_PRODUCER, "dr_cb", _RK_C_PTR,
 	  _RK(dr_cb),
 	  "Delivery report callback (set with rd_kafka_conf_set_dr_cb())" },
@@ -1233,7 +1401,9 @@ static const struct rd_kafka_property rd_kafka_properties[] = {
           "`consistent` - CRC32 hash of key (Empty and NULL keys are mapped to single partition), "
           "`consistent_random` - CRC32 hash of key (Empty and NULL keys are randomly partitioned), "
           "`murmur2` - Java Producer compatible Murmur2 hash of key (NULL keys are mapped to single partition), "
-          "`murmur2_random` - Java Producer compatible Murmur2 hash of key (NULL keys are randomly partitioned. This is functionally equivalent to the default partitioner in the Java Producer.).",
+          "`murmur2_random` - Java Producer compatible Murmur2 hash of key (NULL keys are randomly partitioned. This is functionally equivalent to the default partitioner in the Java Producer.), "
+          "`consistent_sticky` - CRC32 hash of key (Empty and NULL keys stick to one partition until its batch is full or `linger.ms` has elapsed, then switch to another, which yields larger batches than random partitioning), "
+          "`murmur2_sticky` - Java Producer compatible Murmur2 hash of key (NULL keys stick to one partition until its batch is full or `linger.ms` has elapsed. This is functionally equivalent to the default partitioner in the Java Producer since KIP-480.).",
           .sdef = "consistent_random",
           .validate = rd_kafka_conf_validate_partitioner },
 	{ _RK_TOPIC|_RK_PRODUCER, "partitioner_cb", _RK_C_PTR,
@@ -3404,6 +3574,12 @@ const char *rd_kafka_topic_conf_finalize (rd_kafka_type_t cltype,
                     conf->buffering_max_us)
                         return "`message.timeout.ms` must be greater than "
                                 "`linger.ms`";
+
+                if (tconf->message_timeout_ms != 0 &&
+                    conf->linger_adaptive_target_ms >=
+                    tconf->message_timeout_ms)
+                        return "`message.timeout.ms` must be greater than "
+                                "`linger.adaptive.target.ms`";
         }
 
 
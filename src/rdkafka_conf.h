@@ -154,9 +154,17 @@ typedef enum {
         RD_KAFKA_SSL_ENDPOINT_ID_HTTPS,  /**< RFC2818 */
 } rd_kafka_ssl_endpoint_id_t;
 
+
+typedef enum {
+        RD_KAFKA_FETCH_BUDGET_SCOPE_CLIENT,  /**< Per client instance */
+        RD_KAFKA_FETCH_BUDGET_SCOPE_PROCESS, /**< Shared by all consumer
+                                              *   instances in the process */
+} rd_kafka_fetch_budget_scope_t;
+
 /* Increase in steps of 64 as needed.
- * This must be larger than sizeof(rd_kafka_[topic_]conf_t) */
-#define RD_KAFKA_CONF_PROPS_IDX_MAX (64*26)
+ * This must be larger than sizeof(rd_kafka_[topic_]conf_t),
+ * which is checked at compile time in rdkafka_conf.c. */
+#define RD_KAFKA_CONF_PROPS_IDX_MAX (64*28)
 
 /**
  * @struct rd_kafka_anyconf_t
@@ -186,6 +194,7 @@ struct rd_kafka_conf_s {
 	int     max_msg_size;
 	int     msg_copy_max_size;
         int     recv_max_msg_size;
+        int     recv_pool_bytes;
 	int     max_inflight;
 	int     metadata_request_timeout_ms;
 	int     metadata_refresh_interval_ms;
@@ -199,6 +208,7 @@ struct rd_kafka_conf_s {
 	int     socket_timeout_ms;
 	int     socket_blocking_max_ms;
 	int     socket_sndbuf_size;
+        int     socket_send_batch_max;
 	int     socket_rcvbuf_size;
         int     socket_keepalive;
 	int     socket_nagle_disable;
@@ -211,6 +221,7 @@ struct rd_kafka_conf_s {
         int     reconnect_backoff_max_ms;
         int     reconnect_jitter_ms;
         int     sparse_connections;
+        int     lockfree_enqueue;
         int     sparse_connect_intvl;
 	int     api_version_request;
 	int     api_version_request_timeout_ms;
@@ -240,6 +251,7 @@ struct rd_kafka_conf_s {
                 char *keystore_password;
                 int   endpoint_identification;
                 int   enable_verify;
+                int   ktls_enable;
                 int (*cert_verify_cb) (rd_kafka_t *rk,
                                        const char *broker_name,
                                        int32_t broker_id,
@@ -322,11 +334,15 @@ struct rd_kafka_conf_s {
 	int    queued_min_msgs;
         int    queued_max_msg_kbytes;
         int64_t queued_max_msg_bytes;
+        int    queued_max_total_kbytes;
+        int64_t queued_max_total_bytes;
+        rd_kafka_fetch_budget_scope_t queued_max_total_scope;
 	int    fetch_wait_max_ms;
         int    fetch_msg_max_bytes;
         int    fetch_max_bytes;
 	int    fetch_min_bytes;
 	int    fetch_error_backoff_ms;
+        int    enable_fetch_sessions;
         char  *group_id_str;
         char  *group_instance_id;
 
@@ -376,12 +392,19 @@ struct rd_kafka_conf_s {
 	int    queue_buffering_max_kbytes;
         double buffering_max_ms_dbl; /**< This is the configured value */
 	rd_ts_t buffering_max_us;    /**< This is the value used in the code */
+        int    linger_adaptive_target_ms; /**< Adaptive linger target
+                                           *   produce latency, 0=off. */
         int    queue_backpressure_thres;
 	int    max_retries;
 	int    retry_backoff_ms;
 	int    batch_num_messages;
 	rd_kafka_compression_t compression_codec;
 	int    dr_err_only;
+        int    msgpool_enable;
+        int    msgpool_max_kbytes;
+        int    produce_zerocopy;
+        int    compression_threads;
+        int    produce_request_max_partitions;
 
 	/* Message delivery report callback.
 	 * Called once for each produced message, either on
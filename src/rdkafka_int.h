@@ -94,6 +94,7 @@ typedef RD_SHARED_PTR_TYPE(, struct rd_kafka_itopic_s) shptr_rd_kafka_itopic_t;
 #include "rdkafka_conf.h"
 #include "rdkafka_transport.h"
 #include "rdkafka_timer.h"
+#include "rdkafka_workpool.h"
 #include "rdkafka_assignor.h"
 #include "rdkafka_metadata.h"
 #include "rdkafka_mock.h"
@@ -150,6 +151,16 @@ rd_kafka_idemp_state2str (rd_kafka_idemp_state_t state) {
 
 
 
+/**
+ * @brief Consumer fetch memory budget usage (queued.max.total.kbytes).
+ */
+typedef struct rd_kafka_fetch_budget_s {
+        rd_atomic64_t used;       /**< Bytes of fetched messages held */
+        rd_atomic32_t member_cnt; /**< Partitions being consumed */
+} rd_kafka_fetch_budget_t;
+
+
+
 /**
  * Kafka handle, internal representation of the application's rd_kafka_t.
  */
@@ -189,6 +200,17 @@ struct rd_kafka_s {
 
 	TAILQ_HEAD(, rd_kafka_itopic_s)  rk_topics;
 	int              rk_topic_cnt;
+        /**< Topic name hash index of rk_topics, chained through
+         *   rkt_hash_next. Protected by rk_lock. */
+        struct {
+                struct rd_kafka_itopic_s **buckets;
+                int                        size;  /**< Number of buckets */
+        } rk_topic_hash;
+        int64_t          rk_topic_gen;     /**< Changes whenever a topic is
+                                            *   removed from rk_topics, used
+                                            *   to validate the per-thread
+                                            *   producev() topic cache.
+                                            *   Protected by rk_lock. */
 
         struct rd_kafka_cgrp_s *rk_cgrp;
 
@@ -270,6 +292,7 @@ struct rd_kafka_s {
 	struct rd_kafka_metadata *rk_full_metadata; /* Last full metadata. */
 	rd_ts_t          rk_ts_full_metadata;       /* Timesstamp of .. */
         struct rd_kafka_metadata_cache rk_metadata_cache; /* Metadata cache */
+        rd_kafka_regex_cache_t rk_regex_cache; /**< Compiled topic regexes */
 
         char            *rk_clusterid;      /* ClusterId from metadata */
         int32_t          rk_controllerid;   /* ControllerId from metadata */
@@ -311,6 +334,20 @@ struct rd_kafka_s {
 		size_t max_size; /* Max limit */
 	} rk_curr_msgs;
 
+        rd_kafka_msgpool_t rk_msgpool; /**< Producer message pool */
+
+        /**< Consumer fetch memory budget (queued.max.total.kbytes) */
+        struct {
+                rd_kafka_fetch_budget_t *fb; /**< The budget enforced:
+                                              *   &.local or the process-wide
+                                              *   budget. NULL if disabled. */
+                rd_kafka_fetch_budget_t local; /**< This instance's usage */
+                int64_t max;                 /**< Budget in bytes */
+                rd_atomic64_t c_held;        /**< Number of times a partition
+                                              *   was held back by the
+                                              *   budget. */
+        } rk_fetch_budget;
+
         rd_kafka_timers_t rk_timers;
 	thrd_t rk_thread;
 
@@ -338,6 +375,12 @@ struct rd_kafka_s {
                                    *   purposes. */
         } rk_background;
 
+        rd_kafka_workpool_t *rk_workpool; /**< Worker pool for offloading
+                                           *   message set (de)compression
+                                           *   from the broker threads,
+                                           *   see compression.threads.
+                                           *   NULL if not enabled. */
+
 
         /*
          * Logs, events or actions to rate limit / suppress
@@ -645,12 +645,16 @@ rd_kafka_metadata_topic_match (rd_kafka_t *rk, rd_list_t *tinfos,
         int ti;
         size_t cnt = 0;
         const struct rd_kafka_metadata *metadata;
+        rd_kafka_topic_matcher_t *rktm;
 
+        /* Look up the compiled regexes once rather than for each topic */
+        rktm = rd_kafka_topic_matcher_new(rk, &rk->rk_regex_cache, match);
 
         rd_kafka_rdlock(rk);
         metadata = rk->rk_full_metadata;
         if (!metadata) {
                 rd_kafka_rdunlock(rk);
+                rd_kafka_topic_matcher_destroy(rktm);
                 return 0;
         }
 
@@ -660,6 +664,10 @@ rd_kafka_metadata_topic_match (rd_kafka_t *rk, rd_list_t *tinfos,
                 const char *topic = metadata->topics[ti].topic;
                 int i;
 
+                /* Skip topics that can't match any subscription */
+                if (!rd_kafka_topic_matcher_candidate(rktm, topic))
+                        continue;
+
                 /* Ignore topics in blacklist */
                 if (rk->rk_conf.topic_blacklist &&
                     rd_kafka_pattern_match(rk->rk_conf.topic_blacklist, topic))
@@ -667,8 +675,7 @@ rd_kafka_metadata_topic_match (rd_kafka_t *rk, rd_list_t *tinfos,
 
                 /* Scan for matches */
                 for (i = 0 ; i < match->cnt ; i++) {
-                        if (!rd_kafka_topic_match(rk,
-                                                  match->elems[i].topic, topic))
+                        if (!rd_kafka_topic_matcher_match(rktm, i, topic))
                                 continue;
 
                         if (metadata->topics[ti].err)
@@ -683,6 +690,8 @@ rd_kafka_metadata_topic_match (rd_kafka_t *rk, rd_list_t *tinfos,
         }
         rd_kafka_rdunlock(rk);
 
+        rd_kafka_topic_matcher_destroy(rktm);
+
         return cnt;
 }
 
@@ -656,6 +656,11 @@ static void rd_kafka_mock_connection_close (rd_kafka_mock_connection_t *mconn,
         if (mconn->rxbuf)
                 rd_kafka_buf_destroy(mconn->rxbuf);
 
+        RD_IF_FREE(mconn->sasl.mechanism, rd_free);
+        RD_IF_FREE(mconn->sasl.client_first_bare, rd_free);
+        RD_IF_FREE(mconn->sasl.server_first, rd_free);
+        RD_IF_FREE(mconn->sasl.nonce, rd_free);
+
         rd_kafka_mock_cluster_io_del(mconn->broker->cluster,
                                      mconn->transport->rktrans_s);
         TAILQ_REMOVE(&mconn->broker->connections, mconn, link);
@@ -1066,10 +1071,6 @@ static int rd_kafka_mock_cluster_io_poll (rd_kafka_mock_cluster_t *mcluster,
                 return -1;
         }
 
-        /* Serve ops, if any */
-        rd_kafka_q_serve(mcluster->ops, RD_POLL_NOWAIT, 0,
-                         RD_KAFKA_Q_CB_CALLBACK, NULL, NULL);
-
         /* Handle IO events, if any, and if not terminating */
         for (i = 0 ; mcluster->run  && r > 0 && i < mcluster->fd_cnt ; i++) {
                 if (!mcluster->fds[i].revents)
@@ -1082,6 +1083,14 @@ static int rd_kafka_mock_cluster_io_poll (rd_kafka_mock_cluster_t *mcluster,
                 r--;
         }
 
+        /* Serve ops, if any.
+         * This is done after the op wakeup fd has been drained by
+         * the IO handler above, otherwise the wakeup for an op enqueued
+         * after the queue was served would be lost and the op would not
+         * be served until the poll times out. */
+        rd_kafka_q_serve(mcluster->ops, RD_POLL_NOWAIT, 0,
+                         RD_KAFKA_Q_CB_CALLBACK, NULL, NULL);
+
         return 0;
 }
 
@@ -1156,12 +1165,84 @@ static void rd_kafka_mock_broker_listen_io (rd_kafka_mock_cluster_t *mcluster,
 }
 
 
+/**
+ * @brief Create a new fetch partition for \p topic and \p partition.
+ */
+rd_kafka_mock_fetch_part_t *
+rd_kafka_mock_fetch_part_new (const rd_kafkap_str_t *topic,
+                              int32_t partition) {
+        rd_kafka_mock_fetch_part_t *mfpart;
+        size_t tlen = (size_t)RD_KAFKAP_STR_LEN(topic);
+
+        mfpart = rd_calloc(1, sizeof(*mfpart) + tlen + 1);
+        mfpart->topic = (char *)(mfpart+1);
+        memcpy(mfpart->topic, topic->str, tlen);
+        mfpart->topic[tlen] = '\0';
+        mfpart->partition = partition;
+        mfpart->fetch_offset = -1;
+        mfpart->hwm = -1;
+        mfpart->lso = -1;
+        mfpart->log_start = -1;
+
+        return mfpart;
+}
+
+void rd_kafka_mock_fetch_part_destroy (void *ptr) {
+        rd_free(ptr);
+}
+
+
+/**
+ * @brief Find fetch session by id.
+ */
+rd_kafka_mock_fetch_session_t *
+rd_kafka_mock_fetch_session_find (rd_kafka_mock_broker_t *mrkb,
+                                  int32_t id) {
+        rd_kafka_mock_fetch_session_t *mfs;
+
+        TAILQ_FOREACH(mfs, &mrkb->fetch_sessions, link)
+                if (mfs->id == id)
+                        return mfs;
+
+        return NULL;
+}
+
+
+/**
+ * @brief Create a new (empty) fetch session on broker \p mrkb.
+ */
+rd_kafka_mock_fetch_session_t *
+rd_kafka_mock_fetch_session_new (rd_kafka_mock_broker_t *mrkb) {
+        rd_kafka_mock_fetch_session_t *mfs;
+
+        mfs = rd_calloc(1, sizeof(*mfs));
+        mfs->id = ++mrkb->fetch_session_next_id;
+        mfs->epoch = 1;
+        rd_list_init(&mfs->parts, 0, rd_kafka_mock_fetch_part_destroy);
+        TAILQ_INSERT_TAIL(&mrkb->fetch_sessions, mfs, link);
+
+        return mfs;
+}
+
+
+void rd_kafka_mock_fetch_session_destroy (rd_kafka_mock_broker_t *mrkb,
+                                          rd_kafka_mock_fetch_session_t *mfs) {
+        TAILQ_REMOVE(&mrkb->fetch_sessions, mfs, link);
+        rd_list_destroy(&mfs->parts);
+        rd_free(mfs);
+}
+
+
 static void rd_kafka_mock_broker_destroy (rd_kafka_mock_broker_t *mrkb) {
         rd_kafka_mock_connection_t *mconn;
+        rd_kafka_mock_fetch_session_t *mfs;
 
         while ((mconn = TAILQ_FIRST(&mrkb->connections)))
                 rd_kafka_mock_connection_close(mconn, "Destroying broker");
 
+        while ((mfs = TAILQ_FIRST(&mrkb->fetch_sessions)))
+                rd_kafka_mock_fetch_session_destroy(mrkb, mfs);
+
         rd_kafka_mock_cluster_io_del(mrkb->cluster, mrkb->listen_s);
         rd_close(mrkb->listen_s);
 
@@ -1240,6 +1321,7 @@ rd_kafka_mock_broker_new (rd_kafka_mock_cluster_t *mcluster,
                     "%s", rd_sockaddr2str(&sin, 0));
 
         TAILQ_INIT(&mrkb->connections);
+        TAILQ_INIT(&mrkb->fetch_sessions);
 
         TAILQ_INSERT_TAIL(&mcluster->brokers, mrkb, link);
         mcluster->broker_cnt++;
@@ -1453,6 +1535,19 @@ rd_kafka_mock_broker_set_rack (rd_kafka_mock_cluster_t *mcluster,
 }
 
 
+rd_kafka_resp_err_t
+rd_kafka_mock_broker_disconnect (rd_kafka_mock_cluster_t *mcluster,
+                                 int32_t broker_id) {
+        rd_kafka_op_t *rko = rd_kafka_op_new(RD_KAFKA_OP_MOCK);
+
+        rko->rko_u.mock.broker_id = broker_id;
+        rko->rko_u.mock.cmd = RD_KAFKA_MOCK_CMD_BROKER_DISCONNECT;
+
+        return rd_kafka_op_err_destroy(
+                rd_kafka_op_req(mcluster->ops, rko, RD_POLL_INFINITE));
+}
+
+
 
 
 
@@ -1557,6 +1652,18 @@ rd_kafka_mock_cluster_cmd (rd_kafka_mock_cluster_t *mcluster,
                         mrkb->rack = NULL;
                 break;
 
+        case RD_KAFKA_MOCK_CMD_BROKER_DISCONNECT:
+                mrkb = rd_kafka_mock_broker_find(mcluster,
+                                                 rko->rko_u.mock.broker_id);
+                if (!mrkb)
+                        return RD_KAFKA_RESP_ERR_BROKER_NOT_AVAILABLE;
+
+                while (!TAILQ_EMPTY(&mrkb->connections))
+                        rd_kafka_mock_connection_close(
+                                TAILQ_FIRST(&mrkb->connections),
+                                "Disconnected by test");
+                break;
+
         default:
                 rd_assert(!*"unknown mock cmd");
                 break;
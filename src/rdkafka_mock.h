@@ -60,6 +60,9 @@
  *  - Transactional Producer
  *  - Low-level consumer with offset commits (no consumer groups)
  *  - Topic Metadata and auto creation
+ *  - SASL SCRAM authentication, using the sasl.mechanisms, sasl.username
+ *    and sasl.password configured on the rd_kafka_t instance passed to
+ *    rd_kafka_mock_cluster_new() (authentication is not enforced).
  *
  * @remark High-level consumers making use of the balanced consumer groups
  *         are not supported.
@@ -185,6 +188,15 @@ RD_EXPORT rd_kafka_resp_err_t
 rd_kafka_mock_broker_set_rack (rd_kafka_mock_cluster_t *mcluster,
                                int32_t broker_id, const char *rack);
 
+/**
+ * @brief Closes all current client connections to the broker.
+ *
+ * Clients will reconnect as usual.
+ */
+RD_EXPORT rd_kafka_resp_err_t
+rd_kafka_mock_broker_disconnect (rd_kafka_mock_cluster_t *mcluster,
+                                 int32_t broker_id);
+
 /**@}*/
 
 #endif /* _RDKAFKA_MOCK_H_ */
@@ -38,6 +38,14 @@
 #include "rdkafka_mock_int.h"
 #include "rdkafka_transport_int.h"
 #include "rdkafka_offset.h"
+#include "rdkafka_sasl_int.h"
+
+#if WITH_SASL_SCRAM
+#include "rdbase64.h"
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#endif
 
 
 
@@ -164,12 +172,26 @@ static int rd_kafka_mock_handle_Fetch (rd_kafka_mock_connection_t *mconn,
                                        rd_kafka_buf_t *rkbuf) {
         const rd_bool_t log_decode_errors = rd_true;
         rd_kafka_mock_cluster_t *mcluster = mconn->broker->cluster;
+        rd_kafka_mock_broker_t *mrkb = mconn->broker;
         rd_kafka_buf_t *resp = rd_kafka_mock_buf_new_response(rkbuf);
-        rd_kafka_resp_err_t all_err;
+        rd_kafka_resp_err_t all_err, session_err = RD_KAFKA_RESP_ERR_NO_ERROR;
         int32_t ReplicaId, MaxWait, MinBytes, MaxBytes = -1, SessionId = -1,
-                Epoch, TopicsCnt;
+                Epoch = -1, TopicsCnt;
         int8_t IsolationLevel;
         size_t totsize = 0;
+        rd_list_t req_parts;   /* Partitions in request */
+        rd_list_t forgotten;   /* ForgottenTopics partitions in request */
+        rd_kafka_mock_fetch_session_t *mfs = NULL;
+        rd_list_t *fetch_parts;
+        rd_kafka_mock_fetch_part_t *mfpart;
+        rd_bool_t incremental = rd_false;
+        const char *last_topic = NULL;
+        size_t of_TopicsCnt, of_PartitionCnt = 0;
+        int32_t PartitionCnt = 0;
+        int i;
+
+        rd_list_init(&req_parts, 0, rd_kafka_mock_fetch_part_destroy);
+        rd_list_init(&forgotten, 0, rd_kafka_mock_fetch_part_destroy);
 
         rd_kafka_buf_read_i32(rkbuf, &ReplicaId);
         rd_kafka_buf_read_i32(rkbuf, &MaxWait);
@@ -183,52 +205,18 @@ static int rd_kafka_mock_handle_Fetch (rd_kafka_mock_connection_t *mconn,
                 rd_kafka_buf_read_i32(rkbuf, &Epoch);
         }
 
-        if (rkbuf->rkbuf_reqhdr.ApiVersion >= 1) {
-                /* Response: ThrottleTime */
-                rd_kafka_buf_write_i32(resp, 0);
-        }
-
-
-        /* Inject error, if any */
-        all_err = rd_kafka_mock_next_request_error(mcluster,
-                                                   rkbuf->rkbuf_reqhdr.ApiKey);
-
-        if (rkbuf->rkbuf_reqhdr.ApiVersion >= 7) {
-                /* Response: ErrorCode */
-                rd_kafka_buf_write_i16(resp, all_err);
-
-                /* Response: SessionId */
-                rd_kafka_buf_write_i32(resp, SessionId);
-        }
-
         rd_kafka_buf_read_i32(rkbuf, &TopicsCnt);
 
-        /* Response: #Topics */
-        rd_kafka_buf_write_i32(resp, TopicsCnt);
-
         while (TopicsCnt-- > 0) {
                 rd_kafkap_str_t Topic;
-                int32_t PartitionCnt;
-                rd_kafka_mock_topic_t *mtopic;
+                int32_t PartCnt;
 
                 rd_kafka_buf_read_str(rkbuf, &Topic);
-                rd_kafka_buf_read_i32(rkbuf, &PartitionCnt);
-
-                mtopic = rd_kafka_mock_topic_find_by_kstr(mcluster, &Topic);
+                rd_kafka_buf_read_i32(rkbuf, &PartCnt);
 
-                /* Response: Topic */
-                rd_kafka_buf_write_kstr(resp, &Topic);
-                /* Response: #Partitions */
-                rd_kafka_buf_write_i32(resp, PartitionCnt);
-
-                while (PartitionCnt-- > 0) {
+                while (PartCnt-- > 0) {
                         int32_t Partition, CurrentLeaderEpoch, PartMaxBytes;
                         int64_t FetchOffset, LogStartOffset;
-                        rd_kafka_mock_partition_t *mpart = NULL;
-                        rd_kafka_resp_err_t err = all_err;
-                        rd_bool_t on_follower;
-                        size_t partsize = 0;
-                        const rd_kafka_mock_msgset_t *mset = NULL;
 
                         rd_kafka_buf_read_i32(rkbuf, &Partition);
 
@@ -243,135 +231,11 @@ static int rd_kafka_mock_handle_Fetch (rd_kafka_mock_connection_t *mconn,
 
                         rd_kafka_buf_read_i32(rkbuf, &PartMaxBytes);
 
-                        if (mtopic)
-                                mpart = rd_kafka_mock_partition_find(mtopic,
-                                                                     Partition);
-
-                        /* Response: Partition */
-                        rd_kafka_buf_write_i32(resp, Partition);
-
-                        /* Fetch is directed at follower and this is
-                         * the follower broker. */
-                        on_follower = mpart &&
-                                mpart->follower_id == mconn->broker->id;
-
-                        if (!all_err && !mpart)
-                                err = RD_KAFKA_RESP_ERR_UNKNOWN_TOPIC_OR_PART;
-                        else if (!all_err &&
-                                 mpart->leader != mconn->broker &&
-                                 !on_follower)
-                                err = RD_KAFKA_RESP_ERR_NOT_LEADER_FOR_PARTITION;
-
-                        /* Find MessageSet for FetchOffset */
-                        if (!err && FetchOffset != mpart->end_offset) {
-                                if (on_follower &&
-                                    FetchOffset <= mpart->end_offset &&
-                                    FetchOffset > mpart->follower_end_offset)
-                                        err = RD_KAFKA_RESP_ERR_OFFSET_NOT_AVAILABLE;
-                                else if (!(mset = rd_kafka_mock_msgset_find(
-                                                   mpart,
-                                                   FetchOffset,
-                                                   on_follower)))
-                                        err = RD_KAFKA_RESP_ERR_OFFSET_OUT_OF_RANGE;
-                        }
-
-
-                        /* Response: ErrorCode */
-                        rd_kafka_buf_write_i16(resp, err);
-
-                        /* Response: Highwatermark */
-                        rd_kafka_buf_write_i64(resp,
-                                               mpart ?
-                                               (on_follower ?
-                                                mpart->follower_end_offset :
-                                                mpart->end_offset) : -1);
-
-                        if (rkbuf->rkbuf_reqhdr.ApiVersion >= 4) {
-                                /* Response: LastStableOffset */
-                                rd_kafka_buf_write_i64(resp,
-                                                       mpart ?
-                                                       mpart->end_offset : -1);
-                        }
-
-                        if (rkbuf->rkbuf_reqhdr.ApiVersion >= 5) {
-                                /* Response: LogStartOffset */
-                                rd_kafka_buf_write_i64(
-                                        resp,
-                                        !mpart ? -1 :
-                                        (on_follower ?
-                                         mpart->follower_start_offset :
-                                         mpart->start_offset));
-                        }
-
-                        if (rkbuf->rkbuf_reqhdr.ApiVersion >= 4) {
-                                /* Response: #Aborted */
-                                rd_kafka_buf_write_i32(resp, 0);
-                        }
-
-
-                        if (rkbuf->rkbuf_reqhdr.ApiVersion >= 11) {
-                                int32_t PreferredReadReplica =
-                                        mpart &&
-                                        mpart->leader == mconn->broker &&
-                                        mpart->follower_id != -1 ?
-                                        mpart->follower_id : -1;
-
-                                /* Response: PreferredReplica */
-                                rd_kafka_buf_write_i32(
-                                        resp, PreferredReadReplica);
-
-                                if (PreferredReadReplica != -1) {
-                                        /* Don't return any data when
-                                         * PreferredReadReplica is set */
-                                        mset = NULL;
-                                        MaxWait = 0;
-                                }
-                        }
-
-
-                        if (mset &&
-                            partsize < (size_t)PartMaxBytes &&
-                            totsize < (size_t)MaxBytes) {
-                                rd_kafka_dbg(mcluster->rk, MOCK, "MOCK",
-                                             "Broker %"PRId32": "
-                                             "Topic %s [%"PRId32"]: "
-                                             "fetch response at "
-                                             "Offset %"PRId64
-                                             " (requested Offset %"PRId64"): "
-                                             "MessageSet of %"PRId32" bytes",
-                                             mconn->broker->id,
-                                             mtopic->name, mpart->id,
-                                             mset->first_offset, FetchOffset,
-                                             RD_KAFKAP_BYTES_SIZE(&mset->
-                                                                  bytes));
-                                /* Response: Records */
-                                rd_kafka_buf_write_kbytes(resp, &mset->bytes);
-                                partsize += RD_KAFKAP_BYTES_SIZE(&mset->bytes);
-                                totsize += RD_KAFKAP_BYTES_SIZE(&mset->bytes);
-
-                                /* FIXME: Multiple messageSets ? */
-                        } else {
-                                rd_kafka_dbg(mcluster->rk, MOCK, "MOCK",
-                                             "Broker %"PRId32": "
-                                             "Topic %s [%"PRId32"]: empty "
-                                             "fetch response for requested "
-                                             "Offset %"PRId64": "
-                                             "Log start..end Offsets are "
-                                             "%"PRId64"..%"PRId64
-                                             " (follower %"PRId64"..%"PRId64")",
-                                             mconn->broker->id,
-                                             mtopic ? mtopic->name : "n/a",
-                                             mpart ? mpart->id : -1,
-                                             FetchOffset,
-                                             mpart ? mpart->start_offset : -1,
-                                             mpart ? mpart->end_offset : -1,
-                                             mpart ?
-                                             mpart->follower_start_offset : -1,
-                                             mpart ?
-                                             mpart->follower_end_offset : -1);
-                                /* Response: Records: Null */
-                                rd_kafka_buf_write_i32(resp, 0);
-                        }
+                        mfpart = rd_kafka_mock_fetch_part_new(&Topic,
+                                                              Partition);
+                        mfpart->fetch_offset = FetchOffset;
+                        mfpart->max_bytes = PartMaxBytes;
+                        rd_list_add(&req_parts, mfpart);
                 }
         }
 
@@ -386,6 +250,9 @@ static int rd_kafka_mock_handle_Fetch (rd_kafka_mock_connection_t *mconn,
                         while (ForgPartCnt-- > 0) {
                                 int32_t Partition;
                                 rd_kafka_buf_read_i32(rkbuf, &Partition);
+                                rd_list_add(&forgotten,
+                                            rd_kafka_mock_fetch_part_new(
+                                                    &Topic, Partition));
                         }
                 }
         }
@@ -398,6 +265,307 @@ static int rd_kafka_mock_handle_Fetch (rd_kafka_mock_connection_t *mconn,
                 /* Matt might do something sensible with this */
         }
 
+        /* Inject error, if any */
+        all_err = rd_kafka_mock_next_request_error(mcluster,
+                                                   rkbuf->rkbuf_reqhdr.ApiKey);
+
+        /* Fetch sessions (KIP-227) */
+        if (rkbuf->rkbuf_reqhdr.ApiVersion >= 7) {
+                if (all_err ==
+                    RD_KAFKA_RESP_ERR_FETCH_SESSION_ID_NOT_FOUND ||
+                    all_err ==
+                    RD_KAFKA_RESP_ERR_INVALID_FETCH_SESSION_EPOCH) {
+                        /* Injected session error: evict the session */
+                        session_err = all_err;
+                        if ((mfs = rd_kafka_mock_fetch_session_find(
+                                     mrkb, SessionId)))
+                                rd_kafka_mock_fetch_session_destroy(mrkb,
+                                                                    mfs);
+                        mfs = NULL;
+
+                } else if (Epoch == -1 || Epoch == 0) {
+                        /* Full fetch: closes the current session, if any,
+                         * and creates a new one unless sessionless. */
+                        if (SessionId != 0 &&
+                            (mfs = rd_kafka_mock_fetch_session_find(
+                                    mrkb, SessionId)))
+                                rd_kafka_mock_fetch_session_destroy(mrkb,
+                                                                    mfs);
+                        mfs = NULL;
+
+                        if (Epoch == 0) {
+                                mfs = rd_kafka_mock_fetch_session_new(mrkb);
+                                /* Move the request's partitions
+                                 * to the session. */
+                                rd_list_destroy(&mfs->parts);
+                                mfs->parts = req_parts;
+                                rd_list_init(&req_parts, 0,
+                                        rd_kafka_mock_fetch_part_destroy);
+                        }
+
+                } else if (!(mfs = rd_kafka_mock_fetch_session_find(
+                                     mrkb, SessionId))) {
+                        session_err =
+                                RD_KAFKA_RESP_ERR_FETCH_SESSION_ID_NOT_FOUND;
+
+                } else if (Epoch != mfs->epoch) {
+                        session_err =
+                                RD_KAFKA_RESP_ERR_INVALID_FETCH_SESSION_EPOCH;
+                        mfs = NULL;
+
+                } else {
+                        /* Incremental fetch: update the session with the
+                         * changed, added and forgotten partitions. */
+                        RD_LIST_FOREACH(mfpart, &req_parts, i) {
+                                rd_kafka_mock_fetch_part_t *sp;
+                                int j;
+
+                                RD_LIST_FOREACH(sp, &mfs->parts, j) {
+                                        if (sp->partition ==
+                                            mfpart->partition &&
+                                            !strcmp(sp->topic, mfpart->topic))
+                                                break;
+                                }
+
+                                if (sp) {
+                                        sp->fetch_offset =
+                                                mfpart->fetch_offset;
+                                        sp->max_bytes = mfpart->max_bytes;
+                                        rd_kafka_mock_fetch_part_destroy(
+                                                mfpart);
+                                } else
+                                        rd_list_add(&mfs->parts, mfpart);
+                        }
+                        rd_list_clear(&req_parts); /* Moved or freed */
+
+                        RD_LIST_FOREACH(mfpart, &forgotten, i) {
+                                rd_kafka_mock_fetch_part_t *sp;
+                                int j;
+
+                                RD_LIST_FOREACH(sp, &mfs->parts, j) {
+                                        if (sp->partition ==
+                                            mfpart->partition &&
+                                            !strcmp(sp->topic,
+                                                    mfpart->topic)) {
+                                                rd_list_remove_elem(
+                                                        &mfs->parts, j);
+                                                rd_kafka_mock_fetch_part_destroy(
+                                                        sp);
+                                                break;
+                                        }
+                                }
+                        }
+
+                        mfs->epoch = mfs->epoch == INT32_MAX ?
+                                1 : mfs->epoch + 1;
+                        incremental = rd_true;
+                }
+
+                rd_kafka_dbg(mcluster->rk, MOCK, "MOCK",
+                             "Broker %"PRId32": Fetch session %"PRId32
+                             " epoch %"PRId32": %s%s%s "
+                             "(%d partition(s))",
+                             mrkb->id, SessionId, Epoch,
+                             session_err ? "error: " :
+                             (incremental ? "incremental" : "full"),
+                             session_err ? rd_kafka_err2str(session_err) : "",
+                             mfs && !incremental ? " (new session)" : "",
+                             mfs ? rd_list_cnt(&mfs->parts) :
+                             rd_list_cnt(&req_parts));
+        }
+
+        if (session_err) {
+                /* No partitions are returned on session errors */
+                rd_list_destroy(&req_parts);
+                rd_list_init(&req_parts, 0, rd_kafka_mock_fetch_part_destroy);
+        }
+
+        fetch_parts = mfs ? &mfs->parts : &req_parts;
+
+        if (rkbuf->rkbuf_reqhdr.ApiVersion >= 1) {
+                /* Response: ThrottleTime */
+                rd_kafka_buf_write_i32(resp, 0);
+        }
+
+        if (rkbuf->rkbuf_reqhdr.ApiVersion >= 7) {
+                /* Response: ErrorCode */
+                rd_kafka_buf_write_i16(resp,
+                                       session_err ? session_err : all_err);
+
+                /* Response: SessionId */
+                rd_kafka_buf_write_i32(resp, mfs ? mfs->id : 0);
+        }
+
+        /* Response: #Topics */
+        of_TopicsCnt = rd_kafka_buf_write_i32(resp, 0);
+        TopicsCnt = 0;
+
+        RD_LIST_FOREACH(mfpart, fetch_parts, i) {
+                rd_kafka_mock_topic_t *mtopic;
+                rd_kafka_mock_partition_t *mpart = NULL;
+                rd_kafka_resp_err_t err = all_err;
+                rd_bool_t on_follower;
+                const rd_kafka_mock_msgset_t *mset = NULL;
+                int64_t hwm, lso, log_start;
+                int32_t PreferredReadReplica = -1;
+
+                mtopic = rd_kafka_mock_topic_find(mcluster, mfpart->topic);
+                if (mtopic)
+                        mpart = rd_kafka_mock_partition_find(
+                                mtopic, mfpart->partition);
+
+                /* Fetch is directed at follower and this is
+                 * the follower broker. */
+                on_follower = mpart && mpart->follower_id == mrkb->id;
+
+                if (!all_err && !mpart)
+                        err = RD_KAFKA_RESP_ERR_UNKNOWN_TOPIC_OR_PART;
+                else if (!all_err &&
+                         mpart->leader != mrkb &&
+                         !on_follower)
+                        err = RD_KAFKA_RESP_ERR_NOT_LEADER_FOR_PARTITION;
+
+                /* Find MessageSet for FetchOffset */
+                if (!err && mfpart->fetch_offset != mpart->end_offset) {
+                        if (on_follower &&
+                            mfpart->fetch_offset <= mpart->end_offset &&
+                            mfpart->fetch_offset > mpart->follower_end_offset)
+                                err = RD_KAFKA_RESP_ERR_OFFSET_NOT_AVAILABLE;
+                        else if (!(mset = rd_kafka_mock_msgset_find(
+                                           mpart,
+                                           mfpart->fetch_offset,
+                                           on_follower)))
+                                err = RD_KAFKA_RESP_ERR_OFFSET_OUT_OF_RANGE;
+                }
+
+                hwm = mpart ?
+                        (on_follower ?
+                         mpart->follower_end_offset : mpart->end_offset) : -1;
+                lso = mpart ? mpart->end_offset : -1;
+                log_start = !mpart ? -1 :
+                        (on_follower ?
+                         mpart->follower_start_offset : mpart->start_offset);
+
+                if (rkbuf->rkbuf_reqhdr.ApiVersion >= 11 &&
+                    mpart && mpart->leader == mrkb &&
+                    mpart->follower_id != -1) {
+                        PreferredReadReplica = mpart->follower_id;
+                        /* Don't return any data when
+                         * PreferredReadReplica is set */
+                        mset = NULL;
+                        MaxWait = 0;
+                }
+
+                if (mset &&
+                    (mfpart->max_bytes <= 0 || totsize >= (size_t)MaxBytes))
+                        mset = NULL;
+
+                /* Incremental fetches only return partitions with
+                 * data or changes. */
+                if (incremental && !err && !mset &&
+                    PreferredReadReplica == -1 &&
+                    hwm == mfpart->hwm && lso == mfpart->lso &&
+                    log_start == mfpart->log_start)
+                        continue;
+
+                mfpart->hwm = hwm;
+                mfpart->lso = lso;
+                mfpart->log_start = log_start;
+
+                if (!last_topic || strcmp(last_topic, mfpart->topic)) {
+                        if (last_topic)
+                                rd_kafka_buf_update_i32(resp, of_PartitionCnt,
+                                                        PartitionCnt);
+
+                        /* Response: Topic */
+                        rd_kafka_buf_write_str(resp, mfpart->topic, -1);
+                        /* Response: #Partitions */
+                        of_PartitionCnt = rd_kafka_buf_write_i32(resp, 0);
+                        PartitionCnt = 0;
+                        TopicsCnt++;
+                        last_topic = mfpart->topic;
+                }
+
+                PartitionCnt++;
+
+                /* Response: Partition */
+                rd_kafka_buf_write_i32(resp, mfpart->partition);
+
+                /* Response: ErrorCode */
+                rd_kafka_buf_write_i16(resp, err);
+
+                /* Response: Highwatermark */
+                rd_kafka_buf_write_i64(resp, hwm);
+
+                if (rkbuf->rkbuf_reqhdr.ApiVersion >= 4) {
+                        /* Response: LastStableOffset */
+                        rd_kafka_buf_write_i64(resp, lso);
+                }
+
+                if (rkbuf->rkbuf_reqhdr.ApiVersion >= 5) {
+                        /* Response: LogStartOffset */
+                        rd_kafka_buf_write_i64(resp, log_start);
+                }
+
+                if (rkbuf->rkbuf_reqhdr.ApiVersion >= 4) {
+                        /* Response: #Aborted */
+                        rd_kafka_buf_write_i32(resp, 0);
+                }
+
+                if (rkbuf->rkbuf_reqhdr.ApiVersion >= 11) {
+                        /* Response: PreferredReplica */
+                        rd_kafka_buf_write_i32(resp, PreferredReadReplica);
+                }
+
+                if (mset) {
+                        rd_kafka_dbg(mcluster->rk, MOCK, "MOCK",
+                                     "Broker %"PRId32": "
+                                     "Topic %s [%"PRId32"]: "
+                                     "fetch response at "
+                                     "Offset %"PRId64
+                                     " (requested Offset %"PRId64"): "
+                                     "MessageSet of %"PRId32" bytes",
+                                     mrkb->id,
+                                     mtopic->name, mpart->id,
+                                     mset->first_offset,
+                                     mfpart->fetch_offset,
+                                     RD_KAFKAP_BYTES_SIZE(&mset->bytes));
+                        /* Response: Records */
+                        rd_kafka_buf_write_kbytes(resp, &mset->bytes);
+                        totsize += RD_KAFKAP_BYTES_SIZE(&mset->bytes);
+
+                        /* FIXME: Multiple messageSets ? */
+                } else {
+                        rd_kafka_dbg(mcluster->rk, MOCK, "MOCK",
+                                     "Broker %"PRId32": "
+                                     "Topic %s [%"PRId32"]: empty "
+                                     "fetch response for requested "
+                                     "Offset %"PRId64": "
+                                     "Log start..end Offsets are "
+                                     "%"PRId64"..%"PRId64
+                                     " (follower %"PRId64"..%"PRId64")",
+                                     mrkb->id,
+                                     mtopic ? mtopic->name : "n/a",
+                                     mpart ? mpart->id : -1,
+                                     mfpart->fetch_offset,
+                                     mpart ? mpart->start_offset : -1,
+                                     mpart ? mpart->end_offset : -1,
+                                     mpart ?
+                                     mpart->follower_start_offset : -1,
+                                     mpart ?
+                                     mpart->follower_end_offset : -1);
+                        /* Response: Records: Null */
+                        rd_kafka_buf_write_i32(resp, 0);
+                }
+        }
+
+        if (last_topic)
+                rd_kafka_buf_update_i32(resp, of_PartitionCnt, PartitionCnt);
+        rd_kafka_buf_update_i32(resp, of_TopicsCnt, TopicsCnt);
+
+        rd_list_destroy(&req_parts);
+        rd_list_destroy(&forgotten);
+
         /* If there was no data, delay up to MaxWait.
          * This isn't strictly correct since we should cut the wait short
          * and feed newly produced data if a producer writes to the
@@ -411,6 +579,8 @@ static int rd_kafka_mock_handle_Fetch (rd_kafka_mock_connection_t *mconn,
         return 0;
 
  err_parse:
+        rd_list_destroy(&req_parts);
+        rd_list_destroy(&forgotten);
         rd_kafka_buf_destroy(resp);
         return -1;
 }
@@ -1411,6 +1581,397 @@ rd_kafka_mock_handle_EndTxn (rd_kafka_mock_connection_t *mconn,
 }
 
 
+#if WITH_SASL_SCRAM
+/**
+ * @brief Handle SaslHandshakeRequest
+ *
+ * Only the SCRAM mechanism configured on the cluster's rd_kafka_t
+ * instance is supported.
+ */
+static int
+rd_kafka_mock_handle_SaslHandshake (rd_kafka_mock_connection_t *mconn,
+                                    rd_kafka_buf_t *rkbuf) {
+        rd_kafka_mock_cluster_t *mcluster = mconn->broker->cluster;
+        const rd_bool_t log_decode_errors = rd_true;
+        rd_kafka_buf_t *resp = rd_kafka_mock_buf_new_response(rkbuf);
+        const char *mechanisms = mcluster->rk->rk_conf.sasl.mechanisms;
+        rd_bool_t scram = mechanisms &&
+                !strncmp(mechanisms, "SCRAM-SHA-", strlen("SCRAM-SHA-"));
+        rd_kafkap_str_t Mechanism;
+        rd_kafka_resp_err_t err;
+
+        /* Mechanism */
+        rd_kafka_buf_read_str(rkbuf, &Mechanism);
+
+        /* Inject error, if any */
+        err = rd_kafka_mock_next_request_error(mcluster,
+                                               rkbuf->rkbuf_reqhdr.ApiKey);
+
+        if (!err && (!scram || rd_kafkap_str_cmp_str(&Mechanism, mechanisms)))
+                err = RD_KAFKA_RESP_ERR_UNSUPPORTED_SASL_MECHANISM;
+
+        if (!err) {
+                RD_IF_FREE(mconn->sasl.mechanism, rd_free);
+                mconn->sasl.mechanism = RD_KAFKAP_STR_DUP(&Mechanism);
+                mconn->sasl.step = 0;
+        }
+
+        /* Response: ErrorCode */
+        rd_kafka_buf_write_i16(resp, err);
+
+        /* Response: #Mechanisms */
+        rd_kafka_buf_write_i32(resp, scram ? 1 : 0);
+        if (scram)
+                rd_kafka_buf_write_str(resp, mechanisms, -1);
+
+        rd_kafka_mock_connection_send_response(mconn, rkbuf, resp);
+
+        return 0;
+
+ err_parse:
+        rd_kafka_buf_destroy(resp);
+        return -1;
+}
+
+
+/**
+ * @brief Derive the cluster's SCRAM StoredKey and ServerKey from the
+ *        configured sasl.password, once.
+ *
+ * @returns -1 on failure, else 0.
+ */
+static int rd_kafka_mock_sasl_scram_derive (rd_kafka_mock_cluster_t *mcluster) {
+        const EVP_MD *evp = mcluster->rk->rk_conf.sasl.scram_evp;
+        const char *password = mcluster->rk->rk_conf.sasl.password;
+        unsigned char SaltedPassword[EVP_MAX_MD_SIZE];
+        unsigned char ClientKey[EVP_MAX_MD_SIZE];
+        unsigned int size;
+        size_t i;
+        int r = -1;
+
+        if (mcluster->scram.derived)
+                return 0;
+
+        if (!password)
+                password = "";
+
+        size = (unsigned int)EVP_MD_size(evp);
+        rd_assert(size <= sizeof(mcluster->scram.StoredKey));
+
+        for (i = 0 ; i < sizeof(mcluster->scram.salt) ; i++)
+                mcluster->scram.salt[i] = (char)rd_jitter(0, 255);
+        mcluster->scram.itcnt = 4096;
+
+        /* SaltedPassword := Hi(Normalize(password), salt, i) */
+        if (!PKCS5_PBKDF2_HMAC(password, (int)strlen(password),
+                               (const unsigned char *)mcluster->scram.salt,
+                               (int)sizeof(mcluster->scram.salt),
+                               mcluster->scram.itcnt, evp,
+                               (int)size, SaltedPassword))
+                goto done;
+
+        /* ClientKey := HMAC(SaltedPassword, "Client Key")
+         * StoredKey := H(ClientKey)
+         * ServerKey := HMAC(SaltedPassword, "Server Key") */
+        if (!HMAC(evp, SaltedPassword, (int)size,
+                  (const unsigned char *)"Client Key", strlen("Client Key"),
+                  ClientKey, NULL) ||
+            !EVP_Digest(ClientKey, size, mcluster->scram.StoredKey, NULL,
+                        evp, NULL) ||
+            !HMAC(evp, SaltedPassword, (int)size,
+                  (const unsigned char *)"Server Key", strlen("Server Key"),
+                  mcluster->scram.ServerKey, NULL))
+                goto done;
+
+        mcluster->scram.size = size;
+        mcluster->scram.derived = rd_true;
+        r = 0;
+
+ done:
+        OPENSSL_cleanse(SaltedPassword, sizeof(SaltedPassword));
+        OPENSSL_cleanse(ClientKey, sizeof(ClientKey));
+        return r;
+}
+
+
+/**
+ * @returns a newly allocated copy of the value of SCRAM attribute \p attr
+ *          in \p msg of size \p size, or NULL if not found.
+ */
+static char *rd_kafka_mock_sasl_scram_attr (const char *msg, size_t size,
+                                            char attr) {
+        const char *s = msg, *end = msg + size;
+
+        while (s + 2 <= end) {
+                const char *next = memchr(s, ',', (size_t)(end - s));
+
+                if (!next)
+                        next = end;
+
+                if (s[0] == attr && s[1] == '=')
+                        return rd_strndup(s + 2, (size_t)(next - s - 2));
+
+                s = next + 1;
+        }
+
+        return NULL;
+}
+
+
+/**
+ * @brief Process a SCRAM client message and construct the server reply.
+ *
+ * @returns the reply to send to the client (to be freed by the caller),
+ *          or NULL on authentication failure, in which case \p errstr is set.
+ */
+static char *
+rd_kafka_mock_sasl_scram_recv (rd_kafka_mock_connection_t *mconn,
+                               const char *msg, size_t size,
+                               char *errstr, size_t errstr_size) {
+        rd_kafka_mock_cluster_t *mcluster = mconn->broker->cluster;
+        const EVP_MD *evp = mcluster->rk->rk_conf.sasl.scram_evp;
+        char *reply = NULL;
+
+        if (!mconn->sasl.mechanism) {
+                rd_snprintf(errstr, errstr_size,
+                            "SaslHandshake not performed");
+                return NULL;
+        }
+
+        if (mconn->sasl.step == 0) {
+                /* client-first-message: "n,,n=<user>,r=<cnonce>" */
+                const char *username = mcluster->rk->rk_conf.sasl.username;
+                char *user, *cnonce, *salt_b64;
+                char snonce[33];
+                rd_chariov_t salt = { mcluster->scram.salt,
+                                      sizeof(mcluster->scram.salt) };
+                size_t i;
+
+                if (size < 3 || strncmp(msg, "n,,", 3)) {
+                        rd_snprintf(errstr, errstr_size,
+                                    "Unsupported GS2 header");
+                        return NULL;
+                }
+
+                user = rd_kafka_mock_sasl_scram_attr(msg + 3, size - 3, 'n');
+                cnonce = rd_kafka_mock_sasl_scram_attr(msg + 3, size - 3, 'r');
+
+                if (!user || !cnonce || !*cnonce ||
+                    strcmp(user, username ? username : "")) {
+                        rd_snprintf(errstr, errstr_size,
+                                    "Invalid username or nonce");
+                        RD_IF_FREE(user, rd_free);
+                        RD_IF_FREE(cnonce, rd_free);
+                        return NULL;
+                }
+                rd_free(user);
+
+                if (rd_kafka_mock_sasl_scram_derive(mcluster) == -1) {
+                        rd_snprintf(errstr, errstr_size,
+                                    "SCRAM key derivation failed");
+                        rd_free(cnonce);
+                        return NULL;
+                }
+
+                for (i = 0 ; i < sizeof(snonce) - 1 ; i++)
+                        snonce[i] = "abcdefghijklmnopqrstuvwxyz"
+                                "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                                "0123456789"[rd_jitter(0, 61)];
+                snonce[sizeof(snonce) - 1] = '\0';
+
+                RD_IF_FREE(mconn->sasl.client_first_bare, rd_free);
+                RD_IF_FREE(mconn->sasl.nonce, rd_free);
+                RD_IF_FREE(mconn->sasl.server_first, rd_free);
+
+                mconn->sasl.client_first_bare = rd_strndup(msg + 3, size - 3);
+                mconn->sasl.nonce = rd_malloc(strlen(cnonce) +
+                                              sizeof(snonce));
+                rd_snprintf(mconn->sasl.nonce,
+                            strlen(cnonce) + sizeof(snonce),
+                            "%s%s", cnonce, snonce);
+                rd_free(cnonce);
+
+                /* server-first-message: "r=<nonce>,s=<salt>,i=<itcnt>" */
+                salt_b64 = rd_base64_encode(&salt);
+                reply = rd_malloc(strlen(mconn->sasl.nonce) +
+                                  strlen(salt_b64) + 32);
+                rd_snprintf(reply,
+                            strlen(mconn->sasl.nonce) + strlen(salt_b64) + 32,
+                            "r=%s,s=%s,i=%d",
+                            mconn->sasl.nonce, salt_b64,
+                            mcluster->scram.itcnt);
+                rd_free(salt_b64);
+
+                mconn->sasl.server_first = rd_strdup(reply);
+                mconn->sasl.step = 1;
+
+        } else if (mconn->sasl.step == 1) {
+                /* client-final-message: "c=<cbind>,r=<nonce>,p=<proof>" */
+                const char *p;
+                size_t without_proof_len;
+                char *nonce, *proof_b64;
+                rd_chariov_t in, proof = RD_ZERO_INIT;
+                rd_chariov_t AuthMessage;
+                unsigned char ClientSignature[EVP_MAX_MD_SIZE];
+                unsigned char ClientKey[EVP_MAX_MD_SIZE];
+                unsigned char StoredKey[EVP_MAX_MD_SIZE];
+                unsigned char ServerSignature[EVP_MAX_MD_SIZE];
+                rd_chariov_t sig = { (char *)ServerSignature,
+                                     mcluster->scram.size };
+                char *sig_b64;
+                unsigned int i;
+                rd_bool_t ok;
+
+                for (p = msg ; p + 3 <= msg + size ; p++)
+                        if (!strncmp(p, ",p=", 3))
+                                break;
+
+                if (p + 3 > msg + size) {
+                        rd_snprintf(errstr, errstr_size,
+                                    "Missing client proof");
+                        return NULL;
+                }
+                without_proof_len = (size_t)(p - msg);
+
+                /* Like the Kafka broker, only require the client nonce
+                 * to end with the combined nonce. */
+                nonce = rd_kafka_mock_sasl_scram_attr(msg, without_proof_len,
+                                                      'r');
+                ok = nonce && strlen(nonce) >= strlen(mconn->sasl.nonce) &&
+                        !strcmp(nonce + strlen(nonce) -
+                                strlen(mconn->sasl.nonce), mconn->sasl.nonce);
+                RD_IF_FREE(nonce, rd_free);
+                if (!ok) {
+                        rd_snprintf(errstr, errstr_size, "Nonce mismatch");
+                        return NULL;
+                }
+
+                proof_b64 = rd_strndup(p + 3, (size_t)(msg + size - (p + 3)));
+                in.ptr = proof_b64;
+                in.size = strlen(proof_b64);
+                ok = rd_base64_decode(&in, &proof) != -1 &&
+                        proof.size == mcluster->scram.size;
+                rd_free(proof_b64);
+                if (!ok) {
+                        RD_IF_FREE(proof.ptr, rd_free);
+                        rd_snprintf(errstr, errstr_size,
+                                    "Invalid client proof");
+                        return NULL;
+                }
+
+                /* AuthMessage := client-first-message-bare + "," +
+                 *                server-first-message + "," +
+                 *                client-final-message-without-proof */
+                AuthMessage.size = strlen(mconn->sasl.client_first_bare) +
+                        1 + strlen(mconn->sasl.server_first) + 1 +
+                        without_proof_len;
+                AuthMessage.ptr = rd_malloc(AuthMessage.size + 1);
+                rd_snprintf(AuthMessage.ptr, AuthMessage.size + 1,
+                            "%s,%s,%.*s",
+                            mconn->sasl.client_first_bare,
+                            mconn->sasl.server_first,
+                            (int)without_proof_len, msg);
+
+                /* ClientKey := ClientProof XOR
+                 *              HMAC(StoredKey, AuthMessage)
+                 * and verify that H(ClientKey) == StoredKey */
+                ok = HMAC(evp, mcluster->scram.StoredKey,
+                          (int)mcluster->scram.size,
+                          (const unsigned char *)AuthMessage.ptr,
+                          AuthMessage.size, ClientSignature, NULL) != NULL;
+                for (i = 0 ; ok && i < mcluster->scram.size ; i++)
+                        ClientKey[i] = (unsigned char)proof.ptr[i] ^
+                                ClientSignature[i];
+                ok = ok &&
+                        EVP_Digest(ClientKey, mcluster->scram.size,
+                                   StoredKey, NULL, evp, NULL) &&
+                        !memcmp(StoredKey, mcluster->scram.StoredKey,
+                                mcluster->scram.size) &&
+                        HMAC(evp, mcluster->scram.ServerKey,
+                             (int)mcluster->scram.size,
+                             (const unsigned char *)AuthMessage.ptr,
+                             AuthMessage.size, ServerSignature, NULL);
+
+                rd_free(AuthMessage.ptr);
+                rd_free(proof.ptr);
+                OPENSSL_cleanse(ClientKey, sizeof(ClientKey));
+
+                if (!ok) {
+                        rd_snprintf(errstr, errstr_size,
+                                    "Authentication failed");
+                        return NULL;
+                }
+
+                /* server-final-message: "v=<ServerSignature>" */
+                sig_b64 = rd_base64_encode(&sig);
+                reply = rd_malloc(strlen(sig_b64) + 3);
+                rd_snprintf(reply, strlen(sig_b64) + 3, "v=%s", sig_b64);
+                rd_free(sig_b64);
+
+                mconn->sasl.step = 2;
+
+        } else {
+                rd_snprintf(errstr, errstr_size,
+                            "Already authenticated");
+                return NULL;
+        }
+
+        return reply;
+}
+
+
+/**
+ * @brief Handle SaslAuthenticateRequest
+ */
+static int
+rd_kafka_mock_handle_SaslAuthenticate (rd_kafka_mock_connection_t *mconn,
+                                       rd_kafka_buf_t *rkbuf) {
+        rd_kafka_mock_cluster_t *mcluster = mconn->broker->cluster;
+        const rd_bool_t log_decode_errors = rd_true;
+        rd_kafka_buf_t *resp = rd_kafka_mock_buf_new_response(rkbuf);
+        rd_kafkap_bytes_t AuthBytes;
+        rd_kafka_resp_err_t err;
+        char errstr[128] = "";
+        char *reply = NULL;
+
+        /* AuthBytes */
+        rd_kafka_buf_read_bytes(rkbuf, &AuthBytes);
+
+        /* Inject error, if any */
+        err = rd_kafka_mock_next_request_error(mcluster,
+                                               rkbuf->rkbuf_reqhdr.ApiKey);
+
+        if (!err) {
+                reply = rd_kafka_mock_sasl_scram_recv(
+                        mconn, (const char *)AuthBytes.data,
+                        (size_t)RD_KAFKAP_BYTES_LEN(&AuthBytes),
+                        errstr, sizeof(errstr));
+                if (!reply)
+                        err = RD_KAFKA_RESP_ERR_SASL_AUTHENTICATION_FAILED;
+        }
+
+        /* Response: ErrorCode */
+        rd_kafka_buf_write_i16(resp, err);
+        /* Response: ErrorMessage */
+        rd_kafka_buf_write_str(resp, err ? (*errstr ? errstr :
+                                            rd_kafka_err2str(err)) : NULL, -1);
+        /* Response: AuthBytes */
+        rd_kafka_buf_write_bytes(resp, reply ? reply : "",
+                                 reply ? strlen(reply) : 0);
+
+        RD_IF_FREE(reply, rd_free);
+
+        rd_kafka_mock_connection_send_response(mconn, rkbuf, resp);
+
+        return 0;
+
+ err_parse:
+        rd_kafka_buf_destroy(resp);
+        return -1;
+}
+#endif /* WITH_SASL_SCRAM */
+
+
 /**
  * @brief Default request handlers
  */
@@ -1434,6 +1995,12 @@ rd_kafka_mock_api_handlers[RD_KAFKAP__NUM] = {
         [RD_KAFKAP_TxnOffsetCommit] = { 0, 2,
                                         rd_kafka_mock_handle_TxnOffsetCommit },
         [RD_KAFKAP_EndTxn] = { 0, 1, rd_kafka_mock_handle_EndTxn },
+#if WITH_SASL_SCRAM
+        [RD_KAFKAP_SaslHandshake] = { 0, 1,
+                                      rd_kafka_mock_handle_SaslHandshake },
+        [RD_KAFKAP_SaslAuthenticate] = { 0, 0,
+                                         rd_kafka_mock_handle_SaslAuthenticate },
+#endif
 };
 
 
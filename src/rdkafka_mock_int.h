@@ -66,9 +66,43 @@ typedef struct rd_kafka_mock_connection_s {
         struct sockaddr_in peer; /**< Peer address */
         struct rd_kafka_mock_broker_s *broker;
         rd_kafka_timer_t write_tmr; /**< Socket write delay timer */
+
+        /**< SASL authentication state */
+        struct {
+                char *mechanism;         /**< Mechanism from SaslHandshake */
+                int   step;              /**< SCRAM exchange step */
+                char *client_first_bare; /**< SCRAM client-first-message-bare*/
+                char *server_first;      /**< SCRAM server-first-message */
+                char *nonce;             /**< SCRAM client+server nonce */
+        } sasl;
 } rd_kafka_mock_connection_t;
 
 
+/**
+ * @struct Partition in a FetchRequest or mock fetch session (KIP-227).
+ */
+typedef struct rd_kafka_mock_fetch_part_s {
+        char   *topic;         /**< Allocated along with the struct */
+        int32_t partition;
+        int64_t fetch_offset;  /**< Last FetchOffset requested */
+        int32_t max_bytes;     /**< Last MaxBytes requested */
+        int64_t hwm;           /**< Last HighWatermark returned, or -1 */
+        int64_t lso;           /**< Last LastStableOffset returned, or -1 */
+        int64_t log_start;     /**< Last LogStartOffset returned, or -1 */
+} rd_kafka_mock_fetch_part_t;
+
+
+/**
+ * @struct Mock fetch session (KIP-227).
+ */
+typedef struct rd_kafka_mock_fetch_session_s {
+        TAILQ_ENTRY(rd_kafka_mock_fetch_session_s) link;
+        int32_t id;
+        int32_t epoch;     /**< Next expected epoch */
+        rd_list_t parts;   /**< rd_kafka_mock_fetch_part_t * */
+} rd_kafka_mock_fetch_session_t;
+
+
 /**
  * @struct Mock broker
  */
@@ -83,6 +117,9 @@ typedef struct rd_kafka_mock_broker_s {
 
         TAILQ_HEAD(, rd_kafka_mock_connection_s) connections;
 
+        TAILQ_HEAD(, rd_kafka_mock_fetch_session_s) fetch_sessions;
+        int32_t fetch_session_next_id; /**< Last fetch session id */
+
         struct rd_kafka_mock_cluster_s *cluster;
 } rd_kafka_mock_broker_t;
 
@@ -218,6 +255,17 @@ struct rd_kafka_mock_cluster_s {
                 int replication_factor; /**< Auto topic create repl factor */
         } defaults;
 
+        /**< SASL SCRAM server credentials, derived from the sasl.password
+         *   of .rk on first use. */
+        struct {
+                rd_bool_t derived;        /**< Keys have been derived */
+                char salt[16];
+                int  itcnt;               /**< Iteration count */
+                unsigned int size;        /**< Key size */
+                unsigned char StoredKey[64];
+                unsigned char ServerKey[64];
+        } scram;
+
         /**< Dynamic array of IO handlers for corresponding fd in .fds */
         struct {
                 rd_kafka_mock_io_handler_t *cb; /**< Callback */
@@ -287,6 +335,17 @@ rd_kafka_resp_err_t
 rd_kafka_mock_next_request_error (rd_kafka_mock_cluster_t *mcluster,
                                   int16_t ApiKey);
 
+rd_kafka_mock_fetch_part_t *
+rd_kafka_mock_fetch_part_new (const rd_kafkap_str_t *topic, int32_t partition);
+void rd_kafka_mock_fetch_part_destroy (void *ptr);
+rd_kafka_mock_fetch_session_t *
+rd_kafka_mock_fetch_session_find (rd_kafka_mock_broker_t *mrkb,
+                                  int32_t id);
+rd_kafka_mock_fetch_session_t *
+rd_kafka_mock_fetch_session_new (rd_kafka_mock_broker_t *mrkb);
+void rd_kafka_mock_fetch_session_destroy (rd_kafka_mock_broker_t *mrkb,
+                                          rd_kafka_mock_fetch_session_t *mfs);
+
 rd_kafka_resp_err_t
 rd_kafka_mock_partition_log_append (rd_kafka_mock_partition_t *mpart,
                                     const rd_kafkap_bytes_t *bytes,
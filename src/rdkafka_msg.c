@@ -43,14 +43,415 @@
 
 #include <stdarg.h>
 
-void rd_kafka_msg_destroy (rd_kafka_t *rk, rd_kafka_msg_t *rkm) {
+/**
+ * @brief Producer message pool allocation header, prepended to each
+ *        pooled rd_kafka_msg_t.
+ */
+typedef union rd_kafka_msgpool_hdr_u {
+        struct {
+                int16_t klass;  /**< Size class */
+                int16_t shard;  /**< Owning shard */
+        } h;
+        void   *next;           /**< Free list link, when cached. */
+        int64_t align;          /**< Keep rd_kafka_msg_t 8-byte aligned */
+} rd_kafka_msgpool_hdr_t;
+
+#define RD_KAFKA_MSGPOOL_CLASS_SIZE(klass)                      \
+        ((size_t)1 << (RD_KAFKA_MSGPOOL_CLASS_MIN_SHIFT + (klass)))
+
+#define rd_kafka_msgpool_rkm2hdr(rkm) (((rd_kafka_msgpool_hdr_t *)(rkm)) - 1)
+#define rd_kafka_msgpool_hdr2rkm(hdr) \
+        ((rd_kafka_msg_t *)(((rd_kafka_msgpool_hdr_t *)(hdr)) + 1))
+
+/**
+ * Shard assigned to the current thread, or -1 if not yet assigned.
+ * The same shard index is used for all pools (instances) the
+ * thread produces to.
+ */
+static RD_TLS int rd_kafka_msgpool_thread_shard = -1;
+
+
+/**
+ * @brief Initialize the message pool.
+ *
+ * @param max_size is the maximum number of bytes to keep cached
+ *        in the pool, or 0 to disable the pool.
+ */
+void rd_kafka_msgpool_init (rd_kafka_msgpool_t *rkmp, size_t max_size) {
+        int i;
+
+        memset(rkmp, 0, sizeof(*rkmp));
+
+        rkmp->rkmp_enabled  = max_size > 0;
+        rkmp->rkmp_chunks_enabled = rd_true;
+        rkmp->rkmp_max_size = max_size / RD_KAFKA_MSGPOOL_SHARD_CNT;
+        rd_atomic32_init(&rkmp->rkmp_shard_next, 0);
+        rd_atomic64_init(&rkmp->rkmp_hits, 0);
+        rd_atomic64_init(&rkmp->rkmp_misses, 0);
+
+        for (i = 0 ; i < RD_KAFKA_MSGPOOL_SHARD_CNT ; i++)
+                mtx_init(&rkmp->rkmp_shards[i].rkmps_lock, mtx_plain);
+}
+
+
+/**
+ * @brief Free all cached allocations and destroy the pool.
+ *
+ * Pooled messages destroyed after this call are freed with rd_free().
+ */
+void rd_kafka_msgpool_destroy (rd_kafka_msgpool_t *rkmp) {
+        int i, klass;
+
+        if (!rkmp->rkmp_chunks_enabled)
+                return;
+
+        rkmp->rkmp_enabled = rd_false;
+        rkmp->rkmp_chunks_enabled = rd_false;
+
+        for (i = 0 ; i < RD_KAFKA_MSGPOOL_SHARD_CNT ; i++) {
+                rd_kafka_msgpool_shard_t *rkmps = &rkmp->rkmp_shards[i];
+                rd_kafka_msgq_chunk_t *rkmc;
+
+                while ((rkmc = rkmps->rkmps_chunks)) {
+                        rkmps->rkmps_chunks = *(void **)rkmc;
+                        rd_free(rkmc);
+                }
+                rkmps->rkmps_chunk_cnt = 0;
+
+                for (klass = 0 ; klass < RD_KAFKA_MSGPOOL_CLASS_CNT ; klass++) {
+                        rd_kafka_msgpool_hdr_t *hdr;
+
+                        while ((hdr = rkmps->rkmps_free[klass])) {
+                                rkmps->rkmps_free[klass] = hdr->next;
+                                rd_free(hdr);
+                        }
+                        rkmps->rkmps_cnt[klass] = 0;
+                }
+                rkmps->rkmps_size = 0;
+
+                mtx_destroy(&rkmps->rkmps_lock);
+        }
+}
+
+
+/**
+ * @brief Get the current number of cached allocations and their total size.
+ */
+void rd_kafka_msgpool_stats (rd_kafka_msgpool_t *rkmp,
+                             int *cntp, size_t *sizep) {
+        int i, klass;
+
+        *cntp = 0;
+        *sizep = 0;
+
+        if (!rkmp->rkmp_enabled)
+                return;
+
+        for (i = 0 ; i < RD_KAFKA_MSGPOOL_SHARD_CNT ; i++) {
+                rd_kafka_msgpool_shard_t *rkmps = &rkmp->rkmp_shards[i];
+
+                mtx_lock(&rkmps->rkmps_lock);
+                for (klass = 0 ; klass < RD_KAFKA_MSGPOOL_CLASS_CNT ; klass++)
+                        *cntp += rkmps->rkmps_cnt[klass];
+                *sizep += rkmps->rkmps_size;
+                mtx_unlock(&rkmps->rkmps_lock);
+        }
+}
+
+
+/**
+ * @returns the current thread's shard, assigning one on first use.
+ */
+static RD_INLINE int rd_kafka_msgpool_shard (rd_kafka_msgpool_t *rkmp) {
+        int shard;
+
+        if (unlikely((shard = rd_kafka_msgpool_thread_shard) == -1))
+                shard = rd_kafka_msgpool_thread_shard =
+                        (int)((unsigned int)rd_atomic32_add(
+                                      &rkmp->rkmp_shard_next, 1) %
+                              RD_KAFKA_MSGPOOL_SHARD_CNT);
+
+        return shard;
+}
+
+
+/**
+ * @brief Allocate \p size bytes for a new rd_kafka_msg_t (and its trailing
+ *        payload and key copy), from the pool if possible.
+ *
+ * @param flagsp is set to the RD_KAFKA_MSG_F_POOLED or
+ *        RD_KAFKA_MSG_F_FREE_RKM flag, depending on how the memory
+ *        must be released.
+ *
+ * @locality any thread, typically an application thread.
+ */
+static rd_kafka_msg_t *rd_kafka_msgpool_alloc (rd_kafka_msgpool_t *rkmp,
+                                               size_t size, int *flagsp) {
+        rd_kafka_msgpool_shard_t *rkmps;
+        rd_kafka_msgpool_hdr_t *hdr;
+        int klass = 0;
+        int shard;
+
+        size += sizeof(*hdr);
+
+        while (klass < RD_KAFKA_MSGPOOL_CLASS_CNT &&
+               size > RD_KAFKA_MSGPOOL_CLASS_SIZE(klass))
+                klass++;
+
+        if (unlikely(klass == RD_KAFKA_MSGPOOL_CLASS_CNT)) {
+                /* Too large for the pool */
+                rd_atomic64_add(&rkmp->rkmp_misses, 1);
+                *flagsp = RD_KAFKA_MSG_F_FREE_RKM;
+                return rd_malloc(size - sizeof(*hdr));
+        }
+
+        shard = rd_kafka_msgpool_shard(rkmp);
+        rkmps = &rkmp->rkmp_shards[shard];
+
+        mtx_lock(&rkmps->rkmps_lock);
+        if ((hdr = rkmps->rkmps_free[klass])) {
+                rkmps->rkmps_free[klass] = hdr->next;
+                rkmps->rkmps_cnt[klass]--;
+                rkmps->rkmps_size -= RD_KAFKA_MSGPOOL_CLASS_SIZE(klass);
+        }
+        mtx_unlock(&rkmps->rkmps_lock);
+
+        if (likely(hdr != NULL)) {
+                rd_atomic64_add(&rkmp->rkmp_hits, 1);
+        } else {
+                rd_atomic64_add(&rkmp->rkmp_misses, 1);
+                hdr = rd_malloc(RD_KAFKA_MSGPOOL_CLASS_SIZE(klass));
+        }
+
+        hdr->h.klass = (int16_t)klass;
+        hdr->h.shard = (int16_t)shard;
+
+        *flagsp = RD_KAFKA_MSG_F_POOLED;
+
+        return rd_kafka_msgpool_hdr2rkm(hdr);
+}
+
+
+/**
+ * @brief Return a single pooled message \p rkm to its owning shard.
+ */
+static void rd_kafka_msgpool_put (rd_kafka_msgpool_t *rkmp,
+                                  rd_kafka_msg_t *rkm) {
+        rd_kafka_msgpool_hdr_t *hdr = rd_kafka_msgpool_rkm2hdr(rkm);
+        int klass = hdr->h.klass;
+        size_t csize = RD_KAFKA_MSGPOOL_CLASS_SIZE(klass);
+        rd_kafka_msgpool_shard_t *rkmps = &rkmp->rkmp_shards[hdr->h.shard];
+
+        if (rkmp->rkmp_enabled) {
+                mtx_lock(&rkmps->rkmps_lock);
+                if (rkmps->rkmps_size + csize <= rkmp->rkmp_max_size) {
+                        hdr->next = rkmps->rkmps_free[klass];
+                        rkmps->rkmps_free[klass] = hdr;
+                        rkmps->rkmps_cnt[klass]++;
+                        rkmps->rkmps_size += csize;
+                        hdr = NULL;
+                }
+                mtx_unlock(&rkmps->rkmps_lock);
+        }
+
+        if (hdr)
+                rd_free(hdr);
+}
+
+
+/**
+ * @brief Allocate a zeroed msgq chunk, from \p rkmp's free list
+ *        if possible.
+ *
+ * @param rkmp may be NULL, in which case the chunk is not pooled.
+ */
+static rd_kafka_msgq_chunk_t *
+rd_kafka_msgpool_chunk_alloc (rd_kafka_msgpool_t *rkmp) {
+        rd_kafka_msgpool_shard_t *rkmps;
+        rd_kafka_msgq_chunk_t *rkmc;
+        int shard;
+
+        if (!rkmp || !rkmp->rkmp_chunks_enabled) {
+                rkmc = rd_calloc(1, sizeof(*rkmc));
+                rkmc->rkmc_shard = -1;
+                return rkmc;
+        }
+
+        shard = rd_kafka_msgpool_shard(rkmp);
+        rkmps = &rkmp->rkmp_shards[shard];
+
+        mtx_lock(&rkmps->rkmps_lock);
+        if ((rkmc = rkmps->rkmps_chunks)) {
+                rkmps->rkmps_chunks = *(void **)rkmc;
+                rkmps->rkmps_chunk_cnt--;
+        }
+        mtx_unlock(&rkmps->rkmps_lock);
+
+        if (rkmc)
+                memset(rkmc, 0, sizeof(*rkmc));
+        else
+                rkmc = rd_calloc(1, sizeof(*rkmc));
+
+        rkmc->rkmc_shard = shard;
+
+        return rkmc;
+}
+
+
+/**
+ * @brief Return msgq chunk \p rkmc to its owning shard in \p rkmp,
+ *        or free it if it is not pooled or the shard is full.
+ */
+static void rd_kafka_msgpool_chunk_put (rd_kafka_msgpool_t *rkmp,
+                                        rd_kafka_msgq_chunk_t *rkmc) {
+        rd_kafka_msgpool_shard_t *rkmps;
+
+        if (rkmp && rkmp->rkmp_chunks_enabled && rkmc->rkmc_shard != -1) {
+                rkmps = &rkmp->rkmp_shards[rkmc->rkmc_shard];
+
+                mtx_lock(&rkmps->rkmps_lock);
+                if (rkmps->rkmps_chunk_cnt < RD_KAFKA_MSGPOOL_CHUNK_CNT_MAX) {
+                        *(void **)rkmc = rkmps->rkmps_chunks;
+                        rkmps->rkmps_chunks = rkmc;
+                        rkmps->rkmps_chunk_cnt++;
+                        rkmc = NULL;
+                }
+                mtx_unlock(&rkmps->rkmps_lock);
+        }
+
+        if (rkmc)
+                rd_free(rkmc);
+}
+
+
+/**
+ * @returns the message pool of the instance \p rkm belongs to,
+ *          or NULL if \p rkm is not associated with a topic.
+ */
+static RD_INLINE rd_kafka_msgpool_t *
+rd_kafka_msgq_chunk_pool (const rd_kafka_msg_t *rkm) {
+        if (unlikely(!rkm->rkm_rkmessage.rkt))
+                return NULL;
+        return &rd_kafka_topic_a2i(rkm->rkm_rkmessage.rkt)->rkt_rk->
+                rk_msgpool;
+}
+
+
+/**
+ * @brief Batch of pooled messages to return to the pool, used to
+ *        return all messages of a delivery report with a single
+ *        lock per shard.
+ */
+typedef struct rd_kafka_msgpool_batch_s {
+        rd_kafka_msgpool_hdr_t *head[RD_KAFKA_MSGPOOL_SHARD_CNT]
+        [RD_KAFKA_MSGPOOL_CLASS_CNT];
+        int cnt;
+} rd_kafka_msgpool_batch_t;
+
+
+/**
+ * @brief Add pooled message \p rkm to \p batch.
+ */
+static RD_INLINE void
+rd_kafka_msgpool_batch_add (rd_kafka_msgpool_batch_t *batch,
+                            rd_kafka_msg_t *rkm) {
+        rd_kafka_msgpool_hdr_t *hdr = rd_kafka_msgpool_rkm2hdr(rkm);
+        int klass = hdr->h.klass;
+        int shard = hdr->h.shard;
+
+        rd_dassert(klass >= 0 && klass < RD_KAFKA_MSGPOOL_CLASS_CNT);
+        rd_dassert(shard >= 0 && shard < RD_KAFKA_MSGPOOL_SHARD_CNT);
+
+        hdr->next = batch->head[shard][klass];
+        batch->head[shard][klass] = hdr;
+        batch->cnt++;
+}
+
+
+/**
+ * @brief Return all messages in \p batch to their owning shards,
+ *        freeing the allocations that exceed the pool's size limit.
+ *
+ * @locality any thread, typically the application's poll thread.
+ */
+static void rd_kafka_msgpool_batch_put (rd_kafka_msgpool_t *rkmp,
+                                        rd_kafka_msgpool_batch_t *batch) {
+        int shard, klass;
+
+        if (!batch->cnt)
+                return;
+
+        for (shard = 0 ; shard < RD_KAFKA_MSGPOOL_SHARD_CNT ; shard++) {
+                rd_kafka_msgpool_shard_t *rkmps = &rkmp->rkmp_shards[shard];
+                rd_kafka_msgpool_hdr_t *excess = NULL;
+                rd_bool_t locked = rd_false;
+
+                for (klass = 0 ; klass < RD_KAFKA_MSGPOOL_CLASS_CNT ; klass++) {
+                        rd_kafka_msgpool_hdr_t *hdr, *next;
+                        size_t csize = RD_KAFKA_MSGPOOL_CLASS_SIZE(klass);
+
+                        if (!(next = batch->head[shard][klass]))
+                                continue;
+
+                        if (!rkmp->rkmp_enabled) {
+                                /* Pool has been destroyed */
+                                hdr = next;
+                                while (hdr->next)
+                                        hdr = hdr->next;
+                                hdr->next = excess;
+                                excess = next;
+                                continue;
+                        }
+
+                        if (!locked) {
+                                mtx_lock(&rkmps->rkmps_lock);
+                                locked = rd_true;
+                        }
+
+                        while ((hdr = next)) {
+                                next = hdr->next;
+
+                                if (rkmps->rkmps_size + csize >
+                                    rkmp->rkmp_max_size) {
+                                        hdr->next = excess;
+                                        excess = hdr;
+                                        continue;
+                                }
+
+                                hdr->next = rkmps->rkmps_free[klass];
+                                rkmps->rkmps_free[klass] = hdr;
+                                rkmps->rkmps_cnt[klass]++;
+                                rkmps->rkmps_size += csize;
+                        }
+                }
+
+                if (locked)
+                        mtx_unlock(&rkmps->rkmps_lock);
+
+                while (excess) {
+                        rd_kafka_msgpool_hdr_t *hdr = excess;
+                        excess = hdr->next;
+                        rd_free(hdr);
+                }
+        }
+}
+
+
+/**
+ * @brief Release all resources held by \p rkm, except for the
+ *        rd_kafka_msg_t memory itself.
+ *
+ * @returns the rd_kafka_t instance the message belongs to, if known.
+ */
+static RD_INLINE rd_kafka_t *rd_kafka_msg_destroy0 (rd_kafka_t *rk,
+                                                   rd_kafka_msg_t *rkm) {
+
+        if (!rk && rkm->rkm_rkmessage.rkt)
+                rk = rd_kafka_topic_a2i(rkm->rkm_rkmessage.rkt)->rkt_rk;
 
 	if (rkm->rkm_flags & RD_KAFKA_MSG_F_ACCOUNT) {
-		rd_dassert(rk || rkm->rkm_rkmessage.rkt);
-		rd_kafka_curr_msgs_sub(
-			rk ? rk :
-			rd_kafka_topic_a2i(rkm->rkm_rkmessage.rkt)->rkt_rk,
-			1, rkm->rkm_len);
+		rd_dassert(rk);
+		rd_kafka_curr_msgs_sub(rk, 1, rkm->rkm_len);
 	}
 
         if (rkm->rkm_headers)
@@ -63,11 +464,51 @@ void rd_kafka_msg_destroy (rd_kafka_t *rk, rd_kafka_msg_t *rkm) {
 	if (rkm->rkm_flags & RD_KAFKA_MSG_F_FREE && rkm->rkm_payload)
 		rd_free(rkm->rkm_payload);
 
-	if (rkm->rkm_flags & RD_KAFKA_MSG_F_FREE_RKM)
+        return rk;
+}
+
+
+void rd_kafka_msg_destroy (rd_kafka_t *rk, rd_kafka_msg_t *rkm) {
+
+        rk = rd_kafka_msg_destroy0(rk, rkm);
+
+	if (rkm->rkm_flags & RD_KAFKA_MSG_F_POOLED) {
+                rd_assert(rk);
+                rd_kafka_msgpool_put(&rk->rk_msgpool, rkm);
+        } else if (rkm->rkm_flags & RD_KAFKA_MSG_F_FREE_RKM)
 		rd_free(rkm);
 }
 
 
+void rd_kafka_msgq_purge (rd_kafka_t *rk, rd_kafka_msgq_t *rkmq) {
+	rd_kafka_msg_t *rkm, *next;
+        rd_kafka_msgpool_batch_t batch;
+
+        memset(&batch, 0, sizeof(batch));
+
+	next = TAILQ_FIRST(&rkmq->rkmq_msgs);
+	while (next) {
+		rkm = next;
+		next = TAILQ_NEXT(next, rkm_link);
+
+                rk = rd_kafka_msg_destroy0(rk, rkm);
+
+                if (rkm->rkm_flags & RD_KAFKA_MSG_F_POOLED)
+                        rd_kafka_msgpool_batch_add(&batch, rkm);
+                else if (rkm->rkm_flags & RD_KAFKA_MSG_F_FREE_RKM)
+                        rd_free(rkm);
+	}
+
+        if (batch.cnt > 0) {
+                rd_assert(rk);
+                rd_kafka_msgpool_batch_put(&rk->rk_msgpool, &batch);
+        }
+
+        rd_kafka_msgq_chunks_destroy(rk, rkmq);
+	rd_kafka_msgq_init(rkmq);
+}
+
+
 
 /**
  * @brief Create a new Producer message, copying the payload as
@@ -82,8 +523,10 @@ rd_kafka_msg_t *rd_kafka_msg_new00 (rd_kafka_itopic_t *rkt,
 				    char *payload, size_t len,
 				    const void *key, size_t keylen,
 				    void *msg_opaque) {
+        rd_kafka_t *rk = rkt->rkt_rk;
 	rd_kafka_msg_t *rkm;
 	size_t mlen = sizeof(*rkm);
+        int allocflags = RD_KAFKA_MSG_F_FREE_RKM;
 	char *p;
 
 	/* If we are to make a copy of the payload, allocate space for it too */
@@ -96,10 +539,14 @@ rd_kafka_msg_t *rd_kafka_msg_new00 (rd_kafka_itopic_t *rkt,
 
 	/* Note: using rd_malloc here, not rd_calloc, so make sure all fields
 	 *       are properly set up. */
-	rkm                 = rd_malloc(mlen);
+        if (rk->rk_msgpool.rkmp_enabled)
+                rkm = rd_kafka_msgpool_alloc(&rk->rk_msgpool, mlen,
+                                             &allocflags);
+        else
+                rkm = rd_malloc(mlen);
 	rkm->rkm_err        = 0;
 	rkm->rkm_flags      = (RD_KAFKA_MSG_F_PRODUCER |
-                               RD_KAFKA_MSG_F_FREE_RKM | msgflags);
+                               allocflags | msgflags);
 	rkm->rkm_len        = len;
 	rkm->rkm_opaque     = msg_opaque;
 	rkm->rkm_rkmessage.rkt = rd_kafka_topic_keep_a(rkt);
@@ -321,9 +768,8 @@ rd_kafka_resp_err_t rd_kafka_producev (rd_kafka_t *rk, ...) {
                 switch (vtype)
                 {
                 case RD_KAFKA_VTYPE_TOPIC:
-                        s_rkt = rd_kafka_topic_new0(rk,
-                                                    va_arg(ap, const char *),
-                                                    NULL, NULL, 1);
+                        s_rkt = rd_kafka_topic_get_cached(
+                                rk, va_arg(ap, const char *));
                         break;
 
                 case RD_KAFKA_VTYPE_RKT:
@@ -608,30 +1054,196 @@ int rd_kafka_msgq_age_scan (rd_kafka_toppar_t *rktp,
                             rd_kafka_msgq_t *timedout,
                             rd_ts_t now,
                             rd_ts_t *abs_next_timeout) {
-        rd_kafka_msg_t *rkm, *tmp, *first = NULL;
-        int cnt = timedout->rkmq_msg_cnt;
+        const rd_kafka_msgq_chunk_t *rkmc;
+        rd_kafka_msg_t *rkm = NULL;
+        rd_kafka_msgq_t tmpq;
+        int cnt = 0;
+        int64_t bytes = 0;
 
         if (abs_next_timeout)
                 *abs_next_timeout = 0;
 
-        /* Assume messages are added in time sequencial order */
-        TAILQ_FOREACH_SAFE(rkm, &rkmq->rkmq_msgs, rkm_link, tmp) {
-                /* NOTE: this is not true for the deprecated (and soon removed)
-                 *       LIFO queuing strategy. */
-                if (likely(rkm->rkm_ts_timeout > now)) {
-                        if (abs_next_timeout)
-                                *abs_next_timeout = rkm->rkm_ts_timeout;
+        /* Assume messages are added in time sequencial order.
+         * NOTE: this is not true for the deprecated (and soon removed)
+         *       LIFO queuing strategy. */
+
+        /* Skip chunks where all messages have timed out */
+        TAILQ_FOREACH(rkmc, &rkmq->rkmq_chunks, rkmc_link) {
+                if (rkmc->rkmc_ts_timeout_max > now)
+                        break;
+                cnt   += rkmc->rkmc_cnt;
+                bytes += rkmc->rkmc_bytes;
+        }
+
+        /* Find the first message that has not timed out */
+        if (rkmc) {
+                /* The chunk's timeout is an upper bound, so the
+                 * scan may continue into the following chunks. */
+                for (rkm = rkmc->rkmc_first ;
+                     rkm && rkm->rkm_ts_timeout <= now ;
+                     rkm = TAILQ_NEXT(rkm, rkm_link)) {
+                        cnt++;
+                        bytes += rkm->rkm_len+rkm->rkm_key_len;
+                }
+
+                if (rkm && abs_next_timeout)
+                        *abs_next_timeout = rkm->rkm_ts_timeout;
+        }
+
+        if (cnt == 0)
+                return 0;
+
+        if (!rkm) {
+                /* All messages timed out */
+                rd_kafka_msgq_concat(timedout, rkmq);
+                return cnt;
+        }
+
+        /* Move the timed out messages (left part) to the timedout queue */
+        rd_kafka_msgq_split(rkmq, &tmpq, rkm, cnt, bytes);
+        rd_kafka_msgq_concat(timedout, rkmq);
+        rd_kafka_msgq_move(rkmq, &tmpq);
+
+        return cnt;
+}
+
+
+/**
+ * @brief Split chunk \p rkmc of \p rkmq at message \p first_right,
+ *        which must not be the first message of the chunk, moving
+ *        \p first_right and the following messages of the chunk to
+ *        a new chunk.
+ *
+ * @returns the new chunk.
+ */
+static rd_kafka_msgq_chunk_t *
+rd_kafka_msgq_chunk_split (rd_kafka_msgq_t *rkmq,
+                           rd_kafka_msgq_chunk_t *rkmc,
+                           rd_kafka_msg_t *first_right) {
+        rd_kafka_msgq_chunk_t *right;
+        rd_kafka_msg_t *rkm;
+
+        rd_dassert(first_right->rkm_chunk == rkmc);
+        rd_dassert(first_right != rkmc->rkmc_first);
+
+        right = rd_kafka_msgpool_chunk_alloc(
+                rd_kafka_msgq_chunk_pool(first_right));
+        right->rkmc_first = first_right;
+        right->rkmc_last  = rkmc->rkmc_last;
+
+        for (rkm = first_right ; ; rkm = TAILQ_NEXT(rkm, rkm_link)) {
+                rkm->rkm_chunk = right;
+                right->rkmc_cnt++;
+                right->rkmc_bytes += rkm->rkm_len+rkm->rkm_key_len;
+                if (rkm == right->rkmc_last)
                         break;
+        }
+
+        rkmc->rkmc_last = TAILQ_PREV(first_right, rd_kafka_msgs_head_s,
+                                     rkm_link);
+        rkmc->rkmc_cnt   -= right->rkmc_cnt;
+        rkmc->rkmc_bytes -= right->rkmc_bytes;
+        /* Upper bound remains valid for both parts */
+        right->rkmc_ts_timeout_max = rkmc->rkmc_ts_timeout_max;
+
+        TAILQ_INSERT_AFTER(&rkmq->rkmq_chunks, rkmc, right, rkmc_link);
+
+        return right;
+}
+
+
+/**
+ * @brief Allocate a new empty chunk for \p rkm and insert it in \p rkmq's
+ *        chunk list before \p before, or at the tail if \p before is NULL.
+ *
+ * @remark The caller must add \p rkm to the returned chunk.
+ */
+rd_kafka_msgq_chunk_t *rd_kafka_msgq_chunk_new (rd_kafka_msgq_t *rkmq,
+                                                rd_kafka_msgq_chunk_t *before,
+                                                rd_kafka_msg_t *rkm) {
+        rd_kafka_msgq_chunk_t *rkmc;
+
+        rkmc = rd_kafka_msgpool_chunk_alloc(rd_kafka_msgq_chunk_pool(rkm));
+        rkmc->rkmc_first = rkm;
+        rkmc->rkmc_last  = rkm;
+
+        if (before)
+                TAILQ_INSERT_BEFORE(before, rkmc, rkmc_link);
+        else
+                TAILQ_INSERT_TAIL(&rkmq->rkmq_chunks, rkmc, rkmc_link);
+
+        return rkmc;
+}
+
+
+/**
+ * @brief Concatenate the chunks of \p src to \p dst, merging the adjoining
+ *        chunks if they fit in a single chunk.
+ *
+ * @remark Only the chunk lists are modified, the caller must concatenate
+ *         the message lists.
+ */
+void rd_kafka_msgq_chunks_concat (rd_kafka_msgq_t *dst, rd_kafka_msgq_t *src) {
+        rd_kafka_msgq_chunk_t *dlast, *sfirst;
+
+        if (unlikely(!(sfirst = TAILQ_FIRST(&src->rkmq_chunks))))
+                return;
+
+        dlast = TAILQ_LAST(&dst->rkmq_chunks, rd_kafka_msgq_chunks_head_s);
+
+        if (dlast &&
+            dlast->rkmc_cnt + sfirst->rkmc_cnt <= RD_KAFKA_MSGQ_CHUNK_SIZE) {
+                rd_kafka_msg_t *rkm;
+
+                /* Merge the first chunk of src into the last chunk of dst
+                 * to avoid fragmentation from repeated small concats. */
+                for (rkm = sfirst->rkmc_first ; ;
+                     rkm = TAILQ_NEXT(rkm, rkm_link)) {
+                        rkm->rkm_chunk = dlast;
+                        if (rkm == sfirst->rkmc_last)
+                                break;
                 }
 
-                if (!first)
-                        first = rkm;
+                dlast->rkmc_last   = sfirst->rkmc_last;
+                dlast->rkmc_cnt   += sfirst->rkmc_cnt;
+                dlast->rkmc_bytes += sfirst->rkmc_bytes;
+                if (sfirst->rkmc_ts_timeout_max > dlast->rkmc_ts_timeout_max)
+                        dlast->rkmc_ts_timeout_max =
+                                sfirst->rkmc_ts_timeout_max;
 
-                rd_kafka_msgq_deq(rkmq, rkm, 1);
-                rd_kafka_msgq_enq(timedout, rkm);
+                TAILQ_REMOVE(&src->rkmq_chunks, sfirst, rkmc_link);
+                rd_kafka_msgq_chunk_destroy(sfirst, sfirst->rkmc_first);
         }
 
-        return timedout->rkmq_msg_cnt - cnt;
+        TAILQ_CONCAT(&dst->rkmq_chunks, &src->rkmq_chunks, rkmc_link);
+}
+
+
+/**
+ * @brief Return chunk \p rkmc, which must no longer be linked, to the
+ *        message pool of the instance that \p rkm, one of the chunk's
+ *        (former) messages, belongs to.
+ */
+void rd_kafka_msgq_chunk_destroy (rd_kafka_msgq_chunk_t *rkmc,
+                                  const rd_kafka_msg_t *rkm) {
+        rd_kafka_msgpool_chunk_put(rd_kafka_msgq_chunk_pool(rkm), rkmc);
+}
+
+
+/**
+ * @brief Free all chunks of \p rkmq without touching the messages.
+ *
+ * @param rk is the instance the messages belonged to, or NULL.
+ *
+ * @remark Must only be used when the messages are purged.
+ */
+void rd_kafka_msgq_chunks_destroy (rd_kafka_t *rk, rd_kafka_msgq_t *rkmq) {
+        rd_kafka_msgq_chunk_t *rkmc;
+
+        while ((rkmc = TAILQ_FIRST(&rkmq->rkmq_chunks))) {
+                TAILQ_REMOVE(&rkmq->rkmq_chunks, rkmc, rkmc_link);
+                rd_kafka_msgpool_chunk_put(rk ? &rk->rk_msgpool : NULL, rkmc);
+        }
 }
 
 
@@ -639,8 +1251,32 @@ int
 rd_kafka_msgq_enq_sorted0 (rd_kafka_msgq_t *rkmq,
                            rd_kafka_msg_t *rkm,
                            int (*order_cmp) (const void *, const void *)) {
-        TAILQ_INSERT_SORTED(&rkmq->rkmq_msgs, rkm, rd_kafka_msg_t *,
-                            rkm_link, order_cmp);
+        rd_kafka_msg_t *insert_before;
+        rd_kafka_msgq_chunk_t *rkmc;
+
+        insert_before = rd_kafka_msgq_find_pos(rkmq, NULL, rkm, order_cmp,
+                                               NULL, NULL);
+        if (!insert_before)
+                return rd_kafka_msgq_enq(rkmq, rkm);
+
+        rkmc = insert_before->rkm_chunk;
+        if (unlikely(rkmc->rkmc_cnt >= RD_KAFKA_MSGQ_CHUNK_SIZE)) {
+                /* Split full chunk in half */
+                rd_kafka_msg_t *mid = rkmc->rkmc_first;
+                int i;
+
+                for (i = 0 ; i < rkmc->rkmc_cnt / 2 ; i++)
+                        mid = TAILQ_NEXT(mid, rkm_link);
+
+                rd_kafka_msgq_chunk_split(rkmq, rkmc, mid);
+                rkmc = insert_before->rkm_chunk;
+        }
+
+        TAILQ_INSERT_BEFORE(insert_before, rkm, rkm_link);
+        if (rkmc->rkmc_first == insert_before)
+                rkmc->rkmc_first = rkm;
+        rd_kafka_msgq_chunk_add(rkmc, rkm);
+
         rkmq->rkmq_msg_bytes += rkm->rkm_len+rkm->rkm_key_len;
         return ++rkmq->rkmq_msg_cnt;
 }
@@ -657,6 +1293,9 @@ int rd_kafka_msgq_enq_sorted (const rd_kafka_itopic_t *rkt,
  * @brief Find the insert before position (i.e., the msg which comes
  *        after \p rkm sequencially) for message \p rkm.
  *
+ * Whole chunks that sort before \p rkm are skipped using the chunk's
+ * last message, only the chunk containing the insert position is scanned.
+ *
  * @param rkmq insert queue.
  * @param start_pos the element in \p rkmq to start scanning at, or NULL
  *                  to start with the first element.
@@ -680,26 +1319,38 @@ rd_kafka_msg_t *rd_kafka_msgq_find_pos (const rd_kafka_msgq_t *rkmq,
                                         int (*cmp) (const void *,
                                                     const void *),
                                         int *cntp, int64_t *bytesp) {
+        const rd_kafka_msgq_chunk_t *rkmc;
         const rd_kafka_msg_t *curr;
         int cnt = 0;
         int64_t bytes = 0;
 
-        for (curr = start_pos ? start_pos : rd_kafka_msgq_first(rkmq) ;
-             curr ; curr = TAILQ_NEXT(curr, rkm_link)) {
-                if (cmp(rkm, curr) < 0) {
-                        if (cntp) {
-                                *cntp = cnt;
-                                *bytesp = bytes;
-                        }
-                        return (rd_kafka_msg_t *)curr;
-                }
-                if (cntp) {
-                        cnt++;
-                        bytes += rkm->rkm_len+rkm->rkm_key_len;
-                }
+        if (!(curr = start_pos ? start_pos : rd_kafka_msgq_first(rkmq)))
+                return NULL;
+
+        /* Skip chunks whose last message sorts before (or equal to) rkm */
+        for (rkmc = curr->rkm_chunk ;
+             cmp(rkm, rkmc->rkmc_last) >= 0 ;
+             curr = rkmc->rkmc_first) {
+                cnt   += rkmc->rkmc_cnt;
+                bytes += rkmc->rkmc_bytes;
+                if (!(rkmc = TAILQ_NEXT(rkmc, rkmc_link)))
+                        return NULL;
+        }
+
+        /* The insert position is within this chunk */
+        for ( ; ; curr = TAILQ_NEXT(curr, rkm_link)) {
+                if (cmp(rkm, curr) < 0)
+                        break;
+                cnt++;
+                bytes += curr->rkm_len+curr->rkm_key_len;
+        }
+
+        if (cntp) {
+                *cntp = cnt;
+                *bytesp = bytes;
         }
 
-        return NULL;
+        return (rd_kafka_msg_t *)curr;
 }
 
 
@@ -717,10 +1368,18 @@ void rd_kafka_msgq_split (rd_kafka_msgq_t *leftq, rd_kafka_msgq_t *rightq,
                           rd_kafka_msg_t *first_right,
                           int cnt, int64_t bytes) {
         rd_kafka_msg_t *llast;
+        rd_kafka_msgq_chunk_t *rkmc, *lclast;
 
         rd_assert(first_right != TAILQ_FIRST(&leftq->rkmq_msgs));
 
-        llast = TAILQ_PREV(first_right, rd_kafka_msg_head_s, rkm_link);
+        llast = TAILQ_PREV(first_right, rd_kafka_msgs_head_s, rkm_link);
+
+        /* Make first_right the first message of its chunk */
+        rkmc = first_right->rkm_chunk;
+        if (rkmc->rkmc_first != first_right)
+                rkmc = rd_kafka_msgq_chunk_split(leftq, rkmc, first_right);
+
+        lclast = TAILQ_PREV(rkmc, rd_kafka_msgq_chunks_head_s, rkmc_link);
 
         rd_kafka_msgq_init(rightq);
 
@@ -732,6 +1391,14 @@ void rd_kafka_msgq_split (rd_kafka_msgq_t *leftq, rd_kafka_msgq_t *rightq,
         leftq->rkmq_msgs.tqh_last = &llast->rkm_link.tqe_next;
         llast->rkm_link.tqe_next = NULL;
 
+        rightq->rkmq_chunks.tqh_first = rkmc;
+        rightq->rkmq_chunks.tqh_last = leftq->rkmq_chunks.tqh_last;
+
+        rkmc->rkmc_link.tqe_prev = &rightq->rkmq_chunks.tqh_first;
+
+        leftq->rkmq_chunks.tqh_last = &lclast->rkmc_link.tqe_next;
+        lclast->rkmc_link.tqe_next = NULL;
+
         rightq->rkmq_msg_cnt   = leftq->rkmq_msg_cnt - cnt;
         rightq->rkmq_msg_bytes = leftq->rkmq_msg_bytes - bytes;
         leftq->rkmq_msg_cnt    = cnt;
@@ -742,6 +1409,46 @@ void rd_kafka_msgq_split (rd_kafka_msgq_t *leftq, rd_kafka_msgq_t *rightq,
 }
 
 
+/**
+ * @brief Insert all messages of \p srcq before \p insert_before in \p destq.
+ *
+ * @remark The caller must make sure the resulting \p destq is ordered.
+ */
+void rd_kafka_msgq_insert_list_before (rd_kafka_msgq_t *destq,
+                                       rd_kafka_msg_t *insert_before,
+                                       rd_kafka_msgq_t *srcq) {
+        rd_kafka_msgq_chunk_t *rkmc;
+
+        rd_dassert(!TAILQ_EMPTY(&destq->rkmq_msgs));
+        rd_dassert(!TAILQ_EMPTY(&srcq->rkmq_msgs));
+
+        /* Make insert_before the first message of its chunk so that
+         * srcq's chunks can be inserted as a whole. */
+        rkmc = insert_before->rkm_chunk;
+        if (rkmc->rkmc_first != insert_before)
+                rkmc = rd_kafka_msgq_chunk_split(destq, rkmc, insert_before);
+
+        TAILQ_INSERT_LIST_BEFORE(&destq->rkmq_chunks,
+                                 rkmc,
+                                 &srcq->rkmq_chunks,
+                                 rd_kafka_msgq_chunks_head_s,
+                                 rd_kafka_msgq_chunk_t *,
+                                 rkmc_link);
+
+        TAILQ_INSERT_LIST_BEFORE(&destq->rkmq_msgs,
+                                 insert_before,
+                                 &srcq->rkmq_msgs,
+                                 rd_kafka_msgs_head_s,
+                                 rd_kafka_msg_t *,
+                                 rkm_link);
+
+        destq->rkmq_msg_cnt   += srcq->rkmq_msg_cnt;
+        destq->rkmq_msg_bytes += srcq->rkmq_msg_bytes;
+        srcq->rkmq_msg_cnt     = 0;
+        srcq->rkmq_msg_bytes   = 0;
+}
+
+
 /**
  * @brief Set per-message metadata for all messages in \p rkmq
  */
@@ -861,6 +1568,77 @@ int32_t rd_kafka_msg_partitioner_murmur2_random (const rd_kafka_topic_t *rkt,
 }
 
 
+/**
+ * @brief Sticky partitioner for keyless messages.
+ *
+ * Keeps assigning messages to the same partition until that partition's
+ * batch is considered complete: batch.num.messages messages or
+ * message.max.bytes bytes have been assigned, or linger.ms (but at
+ * least 1ms) has passed since the partition was picked.
+ * A new partition is then picked at random among the available partitions,
+ * excluding the current one, so that consecutive keyless messages fill up
+ * one batch at a time instead of being spread thinly over all partitions.
+ *
+ * @returns the partition to use.
+ *
+ * @locks rd_kafka_topic_rdlock() MUST be held.
+ */
+static int32_t rd_kafka_msg_sticky_partition (rd_kafka_itopic_t *rkt,
+                                              const rd_kafka_msg_t *rkm) {
+        rd_kafka_t *rk = rkt->rkt_rk;
+        int32_t partition_cnt = rkt->rkt_partition_cnt;
+        int32_t partition;
+        rd_ts_t linger_us = RD_MAX(rk->rk_conf.buffering_max_us, 1000);
+        rd_ts_t now = rkm->rkm_ts_enq ? rkm->rkm_ts_enq : rd_clock();
+        size_t size = rkm->rkm_len + rkm->rkm_key_len;
+
+        mtx_lock(&rkt->rkt_sticky.lock);
+
+        partition = rkt->rkt_sticky.partition;
+
+        if (unlikely(partition == -1 || partition >= partition_cnt ||
+                     rkt->rkt_sticky.msgcnt >=
+                     rk->rk_conf.batch_num_messages ||
+                     rkt->rkt_sticky.bytes + size >
+                     (size_t)rk->rk_conf.max_msg_size ||
+                     now - rkt->rkt_sticky.ts_start >= linger_us)) {
+                rd_kafka_topic_t *app_rkt = rd_kafka_topic_keep_a(rkt);
+                int32_t prev = partition;
+                int i;
+
+                /* Pick a random available partition other than the
+                 * current one, falling back on any other partition if
+                 * none seem to be available. */
+                partition = -1;
+                for (i = 0 ; i < partition_cnt ; i++) {
+                        int32_t p = rd_jitter(0, partition_cnt-1);
+                        if (partition_cnt > 1 && p == prev)
+                                p = (p + 1) % partition_cnt;
+                        if (partition == -1)
+                                partition = p;
+                        if (rd_kafka_topic_partition_available(app_rkt, p)) {
+                                partition = p;
+                                break;
+                        }
+                }
+
+                rd_kafka_topic_destroy0(rd_kafka_topic_a2s(app_rkt));
+
+                rkt->rkt_sticky.partition = partition;
+                rkt->rkt_sticky.msgcnt = 0;
+                rkt->rkt_sticky.bytes = 0;
+                rkt->rkt_sticky.ts_start = now;
+        }
+
+        rkt->rkt_sticky.msgcnt++;
+        rkt->rkt_sticky.bytes += size;
+
+        mtx_unlock(&rkt->rkt_sticky.lock);
+
+        return partition;
+}
+
+
 /**
  * Assigns a message to a topic partition using a partitioner.
  * Returns RD_KAFKA_RESP_ERR__UNKNOWN_PARTITION or .._UNKNOWN_TOPIC if
@@ -905,7 +1683,13 @@ int rd_kafka_msg_partitioner (rd_kafka_itopic_t *rkt, rd_kafka_msg_t *rkm,
                 }
 
                 /* Partition not assigned, run partitioner. */
-                if (rkm->rkm_partition == RD_KAFKA_PARTITION_UA) {
+                if (rkm->rkm_partition == RD_KAFKA_PARTITION_UA &&
+                    rkt->rkt_sticky.enabled &&
+                    (!rkm->rkm_key ||
+                     (rkt->rkt_sticky.empty_key && !rkm->rkm_key_len))) {
+                        /* Keyless message with sticky partitioner */
+                        partition = rd_kafka_msg_sticky_partition(rkt, rkm);
+                } else if (rkm->rkm_partition == RD_KAFKA_PARTITION_UA) {
                         rd_kafka_topic_t *app_rkt;
                         /* Provide a temporary app_rkt instance to protect
                          * from the case where the application decided to
@@ -1388,6 +2172,8 @@ void rd_kafka_msgq_verify_order0 (const char *function, int line,
         const char *topic = rktp ? rktp->rktp_rkt->rkt_topic->str : "n/a";
         int32_t partition = rktp ? rktp->rktp_partition : -1;
 
+        rd_assert(!rd_kafka_msgq_verify_chunks(rkmq));
+
         if (rd_kafka_msgq_len(rkmq) == 0)
                 return;
 
@@ -1447,6 +2233,97 @@ void rd_kafka_msgq_verify_order0 (const char *function, int line,
 }
 
 
+/**
+ * @brief Verify the chunk index of \p rkmq against its messages.
+ *        For development and unit-test use only.
+ *
+ * @returns the number of inconsistencies found (which are printed).
+ */
+int rd_kafka_msgq_verify_chunks (const rd_kafka_msgq_t *rkmq) {
+        const rd_kafka_msgq_chunk_t *rkmc;
+        const rd_kafka_msg_t *rkm = TAILQ_FIRST(&rkmq->rkmq_msgs);
+        int errcnt = 0;
+        int64_t totcnt = 0, totbytes = 0;
+        int chunkidx = 0;
+
+        TAILQ_FOREACH(rkmc, &rkmq->rkmq_chunks, rkmc_link) {
+                int cnt = 0;
+                int64_t bytes = 0;
+
+                if (rkmc->rkmc_first != rkm) {
+                        printf("msgq %p: chunk #%d (%p): first message %p "
+                               "!= expected %p\n",
+                               rkmq, chunkidx, rkmc, rkmc->rkmc_first, rkm);
+                        return errcnt + 1;
+                }
+
+                for ( ; rkm ; rkm = TAILQ_NEXT(rkm, rkm_link)) {
+                        if (rkm->rkm_chunk != rkmc) {
+                                printf("msgq %p: chunk #%d (%p): message #%d "
+                                       "(%p) belongs to chunk %p\n",
+                                       rkmq, chunkidx, rkmc, cnt, rkm,
+                                       rkm->rkm_chunk);
+                                errcnt++;
+                        }
+
+                        if (rkm->rkm_ts_timeout > rkmc->rkmc_ts_timeout_max) {
+                                printf("msgq %p: chunk #%d (%p): message #%d "
+                                       "timeout %"PRId64" > chunk max "
+                                       "%"PRId64"\n",
+                                       rkmq, chunkidx, rkmc, cnt,
+                                       rkm->rkm_ts_timeout,
+                                       rkmc->rkmc_ts_timeout_max);
+                                errcnt++;
+                        }
+
+                        cnt++;
+                        bytes += rkm->rkm_len+rkm->rkm_key_len;
+
+                        if (rkm == rkmc->rkmc_last ||
+                            cnt > RD_KAFKA_MSGQ_CHUNK_SIZE)
+                                break;
+                }
+
+                if (!rkm || rkm != rkmc->rkmc_last) {
+                        printf("msgq %p: chunk #%d (%p): last message %p "
+                               "not found\n", rkmq, chunkidx, rkmc,
+                               rkmc->rkmc_last);
+                        return errcnt + 1;
+                }
+
+                if (cnt != rkmc->rkmc_cnt || bytes != rkmc->rkmc_bytes) {
+                        printf("msgq %p: chunk #%d (%p): has %d messages "
+                               "(%"PRId64" bytes), expected %d "
+                               "(%"PRId64" bytes)\n",
+                               rkmq, chunkidx, rkmc, rkmc->rkmc_cnt,
+                               rkmc->rkmc_bytes, cnt, bytes);
+                        errcnt++;
+                }
+
+                totcnt   += cnt;
+                totbytes += bytes;
+                rkm = TAILQ_NEXT(rkm, rkm_link);
+                chunkidx++;
+        }
+
+        if (rkm) {
+                printf("msgq %p: message %p not in any chunk\n", rkmq, rkm);
+                errcnt++;
+        }
+
+        if (totcnt != rkmq->rkmq_msg_cnt ||
+            totbytes != rkmq->rkmq_msg_bytes) {
+                printf("msgq %p: chunks have %"PRId64" messages "
+                       "(%"PRId64" bytes), queue has %d (%"PRId64" bytes)\n",
+                       rkmq, totcnt, totbytes, rkmq->rkmq_msg_cnt,
+                       rkmq->rkmq_msg_bytes);
+                errcnt++;
+        }
+
+        return errcnt;
+}
+
+
 
 /**
  * @name Unit tests
@@ -1483,7 +2360,7 @@ void ut_rd_kafka_msgq_purge (rd_kafka_msgq_t *rkmq) {
         TAILQ_FOREACH_SAFE(rkm, &rkmq->rkmq_msgs, rkm_link, tmp)
                 rd_kafka_msg_destroy(NULL, rkm);
 
-
+        rd_kafka_msgq_chunks_destroy(NULL, rkmq);
         rd_kafka_msgq_init(rkmq);
 }
 
@@ -1524,6 +2401,11 @@ static int ut_verify_msgq_order (const char *what,
                 }
         }
 
+        if (rd_kafka_msgq_verify_chunks(rkmq)) {
+                RD_UT_SAY("%s: inconsistent msgq chunks", what);
+                fails++;
+        }
+
         RD_UT_ASSERT(!fails, "See %d previous failure(s)", fails);
         return fails;
 }
@@ -1691,6 +2573,110 @@ static int unittest_msgq_order (const char *what, int fifo,
         ut_rd_kafka_msgq_purge(&sendq2);
         ut_rd_kafka_msgq_purge(&rkmq);
 
+        /* Now with a queue spanning multiple chunks:
+         * sorted insert in random order, retries of messages
+         * scattered over the chunks, and split + concat. */
+        {
+                const int msgcnt = (RD_KAFKA_MSGQ_CHUNK_SIZE * 3) + 17;
+                uint64_t *msgids = rd_malloc(sizeof(*msgids) * msgcnt);
+                rd_kafka_msg_t *split_at;
+                int cnt;
+                int64_t bytes;
+
+                for (i = 0 ; i < msgcnt ; i++)
+                        msgids[i] = (uint64_t)i + 1;
+                rd_array_shuffle(msgids, msgcnt, sizeof(*msgids));
+
+                for (i = 0 ; i < msgcnt ; i++) {
+                        rkm = ut_rd_kafka_msg_new(msgsize);
+                        rkm->rkm_u.producer.msgid = msgids[i];
+                        rd_kafka_msgq_enq_sorted0(&rkmq, rkm, cmp);
+                }
+
+                rd_free(msgids);
+
+                if (ut_verify_msgq_order("chunks: added", &rkmq,
+                                         fifo ? 1 : msgcnt,
+                                         fifo ? msgcnt : 1, rd_true))
+                        return 1;
+
+                /* Move every 5th message to the send queue and retry */
+                rd_kafka_msgq_init(&sendq);
+                i = 0;
+                for (rkm = rd_kafka_msgq_first(&rkmq) ; rkm ; ) {
+                        rd_kafka_msg_t *next = TAILQ_NEXT(rkm, rkm_link);
+                        if (!(i++ % 5)) {
+                                rd_kafka_msgq_deq(&rkmq, rkm, 1);
+                                rd_kafka_msgq_enq(&sendq, rkm);
+                        }
+                        rkm = next;
+                }
+
+                RD_UT_ASSERT(!rd_kafka_msgq_verify_chunks(&rkmq) &&
+                             !rd_kafka_msgq_verify_chunks(&sendq),
+                             "chunks: inconsistent after dequeue");
+
+                rd_kafka_retry_msgq(&rkmq, &sendq, 0, 1000, 0,
+                                    RD_KAFKA_MSG_STATUS_NOT_PERSISTED, cmp);
+
+                RD_UT_ASSERT(rd_kafka_msgq_len(&sendq) == 0,
+                             "sendq should be empty, not contain %d messages",
+                             rd_kafka_msgq_len(&sendq));
+
+                if (ut_verify_msgq_order("chunks: retried", &rkmq,
+                                         fifo ? 1 : msgcnt,
+                                         fifo ? msgcnt : 1, rd_true))
+                        return 1;
+
+                /* Split in the middle of a chunk, after the message
+                 * at index msgcnt/3. */
+                split_at = rd_kafka_msgq_first(&rkmq);
+                for (i = 0 ; i < msgcnt / 3 ; i++)
+                        split_at = TAILQ_NEXT(split_at, rkm_link);
+                split_at = rd_kafka_msgq_find_pos(&rkmq, NULL, split_at, cmp,
+                                                  &cnt, &bytes);
+                RD_UT_ASSERT(split_at && cnt == (msgcnt / 3) + 1 &&
+                             bytes == (int64_t)msgsize * cnt,
+                             "chunks: find_pos returned %d messages, "
+                             "%"PRId64" bytes, expected %d messages",
+                             cnt, bytes, (msgcnt / 3) + 1);
+
+                rd_kafka_msgq_split(&rkmq, &sendq, split_at, cnt, bytes);
+
+                RD_UT_ASSERT(rd_kafka_msgq_len(&rkmq) == cnt &&
+                             rd_kafka_msgq_len(&sendq) == msgcnt - cnt,
+                             "chunks: split into %d+%d messages, "
+                             "expected %d+%d",
+                             rd_kafka_msgq_len(&rkmq),
+                             rd_kafka_msgq_len(&sendq),
+                             cnt, msgcnt - cnt);
+
+                if (ut_verify_msgq_order("chunks: split left", &rkmq,
+                                         fifo ? 1 : msgcnt,
+                                         fifo ? cnt : msgcnt - cnt + 1,
+                                         rd_true) ||
+                    ut_verify_msgq_order("chunks: split right", &sendq,
+                                         fifo ? cnt + 1 : msgcnt - cnt,
+                                         fifo ? msgcnt : 1, rd_true))
+                        return 1;
+
+                rd_kafka_msgq_concat(&rkmq, &sendq);
+
+                if (ut_verify_msgq_order("chunks: concat", &rkmq,
+                                         fifo ? 1 : msgcnt,
+                                         fifo ? msgcnt : 1, rd_true))
+                        return 1;
+
+                RD_UT_ASSERT(rd_kafka_msgq_size(&rkmq) ==
+                             (size_t)msgcnt * msgsize,
+                             "expected msgq size %"PRIusz", not %"PRIusz,
+                             (size_t)msgcnt * msgsize,
+                             rd_kafka_msgq_size(&rkmq));
+
+                ut_rd_kafka_msgq_purge(&sendq);
+                ut_rd_kafka_msgq_purge(&rkmq);
+        }
+
         return 0;
 
 }
@@ -1731,6 +2717,199 @@ static int unittest_msg_seq_wrap (void) {
 }
 
 
+/**
+ * @brief Verify rd_kafka_msgq_age_scan(), including chunks whose timeout
+ *        upper bound is no longer accurate after dequeues.
+ */
+static int unittest_msgq_age_scan (void) {
+        rd_kafka_msgq_t rkmq = RD_KAFKA_MSGQ_INITIALIZER(rkmq);
+        rd_kafka_msgq_t timedout = RD_KAFKA_MSGQ_INITIALIZER(timedout);
+        const int msgcnt = (RD_KAFKA_MSGQ_CHUNK_SIZE * 4) + 3;
+        const size_t msgsize = 100;
+        rd_kafka_msg_t *rkm, *next;
+        rd_ts_t next_timeout, now;
+        int i, cnt;
+
+        /* Message timeouts are 1000+msgid */
+        for (i = 1 ; i <= msgcnt ; i++) {
+                rkm = ut_rd_kafka_msg_new(msgsize);
+                rkm->rkm_u.producer.msgid = i;
+                rkm->rkm_ts_timeout = 1000 + i;
+                rd_kafka_msgq_enq(&rkmq, rkm);
+        }
+
+        /* Nothing timed out */
+        cnt = rd_kafka_msgq_age_scan(NULL, &rkmq, &timedout, 1000,
+                                     &next_timeout);
+        RD_UT_ASSERT(cnt == 0 && next_timeout == 1001,
+                     "expected 0 timed out messages and next timeout 1001, "
+                     "not %d and %"PRId64, cnt, next_timeout);
+
+        /* Time out the first one and a half chunks */
+        cnt = rd_kafka_msgq_age_scan(NULL, &rkmq, &timedout,
+                                     1000 + (RD_KAFKA_MSGQ_CHUNK_SIZE * 3 / 2),
+                                     &next_timeout);
+        RD_UT_ASSERT(cnt == RD_KAFKA_MSGQ_CHUNK_SIZE * 3 / 2 &&
+                     next_timeout == 1001 + cnt,
+                     "expected %d timed out messages and next timeout "
+                     "%d, not %d and %"PRId64,
+                     RD_KAFKA_MSGQ_CHUNK_SIZE * 3 / 2,
+                     1001 + RD_KAFKA_MSGQ_CHUNK_SIZE * 3 / 2,
+                     cnt, next_timeout);
+
+        if (ut_verify_msgq_order("age_scan: timedout", &timedout,
+                                 1, cnt, rd_true) ||
+            ut_verify_msgq_order("age_scan: remaining", &rkmq,
+                                 cnt + 1, msgcnt, rd_true))
+                return 1;
+
+        /* Remove the last message of each remaining chunk, leaving
+         * the chunks' timeout upper bound above the actual timeouts.
+         * The scan must then continue into the next chunk. */
+        for (rkm = rd_kafka_msgq_first(&rkmq) ; rkm ; rkm = next) {
+                next = TAILQ_NEXT(rkm, rkm_link);
+                if (rkm == rkm->rkm_chunk->rkmc_last &&
+                    rkm->rkm_chunk->rkmc_cnt > 1) {
+                        rd_kafka_msgq_deq(&rkmq, rkm, 1);
+                        rd_kafka_msg_destroy(NULL, rkm);
+                }
+        }
+
+        RD_UT_ASSERT(!rd_kafka_msgq_verify_chunks(&rkmq),
+                     "inconsistent chunks after dequeue");
+
+        now = rd_kafka_msgq_first(&rkmq)->rkm_chunk->rkmc_last->
+                rkm_ts_timeout;
+        cnt = rd_kafka_msgq_age_scan(NULL, &rkmq, &timedout, now,
+                                     &next_timeout);
+        RD_UT_ASSERT(cnt > 0 && rd_kafka_msgq_first(&rkmq) &&
+                     next_timeout ==
+                     rd_kafka_msgq_first(&rkmq)->rkm_ts_timeout &&
+                     next_timeout > now,
+                     "unexpected scan result: %d messages, "
+                     "next timeout %"PRId64, cnt, next_timeout);
+
+        RD_UT_ASSERT(!rd_kafka_msgq_verify_chunks(&rkmq) &&
+                     !rd_kafka_msgq_verify_chunks(&timedout),
+                     "inconsistent chunks after scan");
+
+        /* Time out everything */
+        cnt = rd_kafka_msgq_len(&rkmq);
+        i = rd_kafka_msgq_age_scan(NULL, &rkmq, &timedout, INT64_MAX,
+                                   &next_timeout);
+        RD_UT_ASSERT(i == cnt && rd_kafka_msgq_len(&rkmq) == 0 &&
+                     next_timeout == 0,
+                     "expected all %d messages to time out, not %d",
+                     cnt, i);
+
+        RD_UT_ASSERT(!rd_kafka_msgq_verify_chunks(&rkmq) &&
+                     !rd_kafka_msgq_verify_chunks(&timedout),
+                     "inconsistent chunks after full scan");
+
+        ut_rd_kafka_msgq_purge(&timedout);
+
+        RD_UT_PASS();
+}
+
+
+/**
+ * @brief Benchmark chunk-granular operations on a large queue
+ *        against a plain walk of the message list.
+ */
+static int unittest_msgq_large (void) {
+        rd_kafka_msgq_t rkmq = RD_KAFKA_MSGQ_INITIALIZER(rkmq);
+        rd_kafka_msgq_t tmpq, timedout = RD_KAFKA_MSGQ_INITIALIZER(timedout);
+        const int msgcnt = 1000000;
+        const int rounds = 20;
+        const size_t msgsize = 100;
+        rd_kafka_msg_t *rkm, *pos = NULL, *ins;
+        rd_ts_t ts_walk, ts_find, ts;
+        int i, r, cnt = 0;
+        int64_t bytes = 0;
+
+        RD_UT_SAY("Testing msgq operations on %d messages", msgcnt);
+
+        for (i = 1 ; i <= msgcnt ; i++) {
+                rkm = ut_rd_kafka_msg_new(msgsize);
+                rkm->rkm_u.producer.msgid = (uint64_t)i * 2;
+                rkm->rkm_ts_timeout = i;
+                rd_kafka_msgq_enq(&rkmq, rkm);
+        }
+
+        /* Insert position for a message near the tail */
+        ins = ut_rd_kafka_msg_new(msgsize);
+        ins->rkm_u.producer.msgid = ((uint64_t)msgcnt * 2) - 101;
+
+        /* Baseline: walk the message list */
+        ts_walk = rd_clock();
+        for (r = 0 ; r < rounds ; r++) {
+                TAILQ_FOREACH(rkm, &rkmq.rkmq_msgs, rkm_link)
+                        if (rd_kafka_msg_cmp_msgid(ins, rkm) < 0)
+                                break;
+                pos = rkm;
+        }
+        ts_walk = rd_clock() - ts_walk;
+
+        ts_find = rd_clock();
+        for (r = 0 ; r < rounds ; r++) {
+                rkm = rd_kafka_msgq_find_pos(&rkmq, NULL, ins,
+                                             rd_kafka_msg_cmp_msgid,
+                                             &cnt, &bytes);
+                RD_UT_ASSERT(rkm == pos, "find_pos returned %p, not %p",
+                             rkm, pos);
+        }
+        ts_find = rd_clock() - ts_find;
+
+        RD_UT_SAY("find_pos: %.2fus vs message walk: %.2fus",
+                  (double)ts_find / rounds, (double)ts_walk / rounds);
+
+        RD_UT_ASSERT(cnt == msgcnt - 51 &&
+                     bytes == (int64_t)cnt * (int64_t)msgsize,
+                     "find_pos: expected %d messages (%"PRId64" bytes) "
+                     "before position, not %d (%"PRId64")",
+                     msgcnt - 51, (int64_t)(msgcnt - 51) * (int64_t)msgsize,
+                     cnt, bytes);
+
+        /* Sorted (retry) insert near the tail, then split there. */
+        ts = rd_clock();
+        rd_kafka_msgq_enq_sorted0(&rkmq, ins, rd_kafka_msg_cmp_msgid);
+        rd_kafka_msgq_split(&rkmq, &tmpq, ins, cnt, bytes);
+        rd_kafka_msgq_concat(&rkmq, &tmpq);
+        ts = rd_clock() - ts;
+        RD_UT_SAY("enq_sorted + split + concat: %"PRId64"us", ts);
+
+        if (ut_verify_msgq_order("large: after insert", &rkmq, 2,
+                                 (uint64_t)msgcnt * 2, rd_false))
+                return 1;
+
+        /* Time out half of the messages */
+        ts = rd_clock();
+        cnt = rd_kafka_msgq_age_scan(NULL, &rkmq, &timedout,
+                                     msgcnt / 2, NULL);
+        ts = rd_clock() - ts;
+        RD_UT_SAY("age_scan of %d messages: %"PRId64"us", cnt, ts);
+
+        RD_UT_ASSERT(cnt == msgcnt / 2,
+                     "expected %d messages to time out, not %d",
+                     msgcnt / 2, cnt);
+
+        if (!rd_unittest_on_ci)
+                RD_UT_ASSERT(ts_find < ts_walk,
+                             "find_pos (%"PRId64"us) should be faster than "
+                             "walking the messages (%"PRId64"us)",
+                             ts_find, ts_walk);
+        else if (ts_find >= ts_walk)
+                RD_UT_WARN("find_pos (%"PRId64"us) not faster than "
+                           "walking the messages (%"PRId64"us)",
+                           ts_find, ts_walk);
+
+        ut_rd_kafka_msgq_purge(&timedout);
+        ut_rd_kafka_msgq_purge(&rkmq);
+
+        RD_UT_PASS();
+}
+
+
 /**
  * @brief Populate message queue with message ids from lo..hi (inclusive)
  */
@@ -1987,12 +3166,124 @@ unittest_msgq_insert_sort (const char *what,
 }
 
 
+/**
+ * @brief Verify producer message pool size classes, reuse and size limit,
+ *        and the msgq chunk cache.
+ */
+static int unittest_msgpool (void) {
+        rd_kafka_msgpool_t rkmp;
+        rd_kafka_msgpool_batch_t batch;
+        rd_kafka_msg_t *rkms[16];
+        rd_kafka_msgq_chunk_t **rkmcs;
+        rd_kafka_msgpool_shard_t *shard;
+        int flags;
+        int cnt, i;
+        size_t size;
+
+        /* 8 shards * 1024 bytes: room for 4 smallest allocations per shard */
+        rd_kafka_msgpool_init(&rkmp, RD_KAFKA_MSGPOOL_SHARD_CNT * 1024);
+
+        /* Initial allocations are all misses */
+        for (i = 0 ; i < 8 ; i++) {
+                rkms[i] = rd_kafka_msgpool_alloc(&rkmp, sizeof(*rkms[i]),
+                                                 &flags);
+                RD_UT_ASSERT(flags == RD_KAFKA_MSG_F_POOLED,
+                             "expected pooled allocation, not 0x%x", flags);
+                RD_UT_ASSERT(rd_kafka_msgpool_rkm2hdr(rkms[i])->h.klass == 0,
+                             "expected smallest size class");
+                memset(rkms[i], 0xaa, sizeof(*rkms[i]));
+        }
+
+        /* Too large for the pool */
+        rkms[8] = rd_kafka_msgpool_alloc(&rkmp, 1024*1024, &flags);
+        RD_UT_ASSERT(flags == RD_KAFKA_MSG_F_FREE_RKM,
+                     "expected non-pooled allocation, not 0x%x", flags);
+        rd_free(rkms[8]);
+
+        RD_UT_ASSERT(rd_atomic64_get(&rkmp.rkmp_hits) == 0,
+                     "expected 0 hits");
+        RD_UT_ASSERT(rd_atomic64_get(&rkmp.rkmp_misses) == 9,
+                     "expected 9 misses, not %"PRId64,
+                     rd_atomic64_get(&rkmp.rkmp_misses));
+
+        /* Return all in bulk: only 4 fit in this thread's shard,
+         * the remaining ones are freed. */
+        memset(&batch, 0, sizeof(batch));
+        for (i = 0 ; i < 8 ; i++)
+                rd_kafka_msgpool_batch_add(&batch, rkms[i]);
+        rd_kafka_msgpool_batch_put(&rkmp, &batch);
+
+        rd_kafka_msgpool_stats(&rkmp, &cnt, &size);
+        RD_UT_ASSERT(cnt == 4, "expected 4 cached allocations, not %d", cnt);
+        RD_UT_ASSERT(size == 4 * RD_KAFKA_MSGPOOL_CLASS_SIZE(0),
+                     "expected %"PRIusz" cached bytes, not %"PRIusz,
+                     4 * RD_KAFKA_MSGPOOL_CLASS_SIZE(0), size);
+
+        /* Reuse */
+        for (i = 0 ; i < 6 ; i++)
+                rkms[i] = rd_kafka_msgpool_alloc(&rkmp, sizeof(*rkms[i]),
+                                                 &flags);
+
+        RD_UT_ASSERT(rd_atomic64_get(&rkmp.rkmp_hits) == 4,
+                     "expected 4 hits, not %"PRId64,
+                     rd_atomic64_get(&rkmp.rkmp_hits));
+
+        for (i = 0 ; i < 6 ; i++)
+                rd_kafka_msgpool_put(&rkmp, rkms[i]);
+
+        rd_kafka_msgpool_stats(&rkmp, &cnt, &size);
+        RD_UT_ASSERT(cnt == 4, "expected 4 cached allocations, not %d", cnt);
+
+        /* Chunks are cached regardless of the message size limit,
+         * up to RD_KAFKA_MSGPOOL_CHUNK_CNT_MAX per shard. */
+        rkmcs = rd_malloc(sizeof(*rkmcs) * (RD_KAFKA_MSGPOOL_CHUNK_CNT_MAX+1));
+        for (i = 0 ; i < RD_KAFKA_MSGPOOL_CHUNK_CNT_MAX + 1 ; i++) {
+                rkmcs[i] = rd_kafka_msgpool_chunk_alloc(&rkmp);
+                RD_UT_ASSERT(rkmcs[i]->rkmc_shard == rkmcs[0]->rkmc_shard &&
+                             rkmcs[i]->rkmc_shard != -1,
+                             "expected pooled chunk from the same shard");
+                rkmcs[i]->rkmc_cnt = 1;
+        }
+        for (i = 0 ; i < RD_KAFKA_MSGPOOL_CHUNK_CNT_MAX + 1 ; i++)
+                rd_kafka_msgpool_chunk_put(&rkmp, rkmcs[i]);
+
+        shard = &rkmp.rkmp_shards[rkmcs[0]->rkmc_shard];
+        RD_UT_ASSERT(shard->rkmps_chunk_cnt == RD_KAFKA_MSGPOOL_CHUNK_CNT_MAX,
+                     "expected %d cached chunks, not %d",
+                     RD_KAFKA_MSGPOOL_CHUNK_CNT_MAX, shard->rkmps_chunk_cnt);
+
+        /* Reuse, zeroed */
+        rkmcs[0] = rd_kafka_msgpool_chunk_alloc(&rkmp);
+        RD_UT_ASSERT(shard->rkmps_chunk_cnt ==
+                     RD_KAFKA_MSGPOOL_CHUNK_CNT_MAX - 1,
+                     "expected cached chunk to be reused");
+        RD_UT_ASSERT(rkmcs[0]->rkmc_cnt == 0 && !rkmcs[0]->rkmc_first,
+                     "expected reused chunk to be cleared");
+        rd_kafka_msgpool_chunk_put(&rkmp, rkmcs[0]);
+
+        /* Without a pool */
+        rkmcs[0] = rd_kafka_msgpool_chunk_alloc(NULL);
+        RD_UT_ASSERT(rkmcs[0]->rkmc_shard == -1, "expected unpooled chunk");
+        rd_kafka_msgpool_chunk_put(&rkmp, rkmcs[0]);
+        RD_UT_ASSERT(shard->rkmps_chunk_cnt == RD_KAFKA_MSGPOOL_CHUNK_CNT_MAX,
+                     "expected unpooled chunk to be freed");
+        rd_free(rkmcs);
+
+        rd_kafka_msgpool_destroy(&rkmp);
+
+        RD_UT_PASS();
+}
+
+
 int unittest_msg (void) {
         int fails = 0;
         double insert_baseline = 0.0;
 
+        fails += unittest_msgpool();
         fails += unittest_msgq_order("FIFO", 1, rd_kafka_msg_cmp_msgid);
         fails += unittest_msg_seq_wrap();
+        fails += unittest_msgq_age_scan();
+        fails += unittest_msgq_large();
 
         fails += unittest_msgq_insert_sort(
                 "get baseline insert time", 100000.0, &insert_baseline,
@@ -78,6 +78,9 @@ typedef struct rd_kafka_msg_s {
 #define rkm_err               rkm_rkmessage.err
 
 	TAILQ_ENTRY(rd_kafka_msg_s)  rkm_link;
+        struct rd_kafka_msgq_chunk_s *rkm_chunk; /**< Chunk of the msgq
+                                                  *   this message is
+                                                  *   enqueued on. */
 
 	int        rkm_flags;
 	/* @remark These additional flags must not collide with
@@ -85,6 +88,8 @@ typedef struct rd_kafka_msg_s {
 #define RD_KAFKA_MSG_F_FREE_RKM     0x10000 /* msg_t is allocated */
 #define RD_KAFKA_MSG_F_ACCOUNT      0x20000 /* accounted for in curr_msgs */
 #define RD_KAFKA_MSG_F_PRODUCER     0x40000 /* Producer message */
+#define RD_KAFKA_MSG_F_POOLED       0x80000 /* msg_t is allocated from
+                                             * the rk_msgpool */
 
 	rd_kafka_timestamp_type_t rkm_tstype; /* rkm_timestamp type */
 	int64_t    rkm_timestamp;  /* Message format V1.
@@ -135,6 +140,58 @@ typedef struct rd_kafka_msg_s {
 TAILQ_HEAD(rd_kafka_msg_head_s, rd_kafka_msg_s);
 
 
+/**
+ * @name Producer message pool
+ *
+ * Size-classed free lists of rd_kafka_msg_t allocations
+ * (including the inline copied payload and key), enabled with
+ * `message.pool.enable`.
+ *
+ * The pool is sharded and each producing thread is assigned a shard
+ * on first use, which makes the shard lock effectively thread-local
+ * on the produce side. Messages are returned to the shard they were
+ * allocated from, in bulk when a delivery report op is destroyed.
+ *
+ * The shards also cache a limited number of msgq chunks, which are
+ * otherwise allocated and freed whenever a queue goes from empty to
+ * non-empty and back. Chunk caching is always enabled for producers.
+ */
+#define RD_KAFKA_MSGPOOL_CLASS_MIN_SHIFT 8  /**< Smallest class: 256 bytes */
+#define RD_KAFKA_MSGPOOL_CLASS_CNT       9  /**< 256 bytes .. 64 KiB */
+#define RD_KAFKA_MSGPOOL_SHARD_CNT       8
+#define RD_KAFKA_MSGPOOL_CHUNK_CNT_MAX   64 /**< Cached msgq chunks
+                                             *   per shard */
+
+typedef struct rd_kafka_msgpool_shard_s {
+        mtx_t   rkmps_lock;
+        void   *rkmps_free[RD_KAFKA_MSGPOOL_CLASS_CNT]; /**< Free lists */
+        int     rkmps_cnt[RD_KAFKA_MSGPOOL_CLASS_CNT];  /**< Free list
+                                                         *   lengths */
+        size_t  rkmps_size;                             /**< Cached bytes */
+        void   *rkmps_chunks;     /**< Free list of msgq chunks */
+        int     rkmps_chunk_cnt;  /**< Chunk free list length */
+} rd_kafka_msgpool_shard_t;
+
+typedef struct rd_kafka_msgpool_s {
+        rd_bool_t     rkmp_enabled;
+        rd_bool_t     rkmp_chunks_enabled; /**< Cache msgq chunks, this
+                                            *   is independent of
+                                            *   rkmp_enabled. */
+        size_t        rkmp_max_size;    /**< Max cached bytes per shard */
+        rd_atomic32_t rkmp_shard_next;  /**< Shard assignment counter */
+        rd_atomic64_t rkmp_hits;        /**< Allocations served from
+                                         *   a free list. */
+        rd_atomic64_t rkmp_misses;      /**< Allocations that fell back
+                                         *   on rd_malloc(). */
+        rd_kafka_msgpool_shard_t rkmp_shards[RD_KAFKA_MSGPOOL_SHARD_CNT];
+} rd_kafka_msgpool_t;
+
+void rd_kafka_msgpool_init (rd_kafka_msgpool_t *rkmp, size_t max_size);
+void rd_kafka_msgpool_destroy (rd_kafka_msgpool_t *rkmp);
+void rd_kafka_msgpool_stats (rd_kafka_msgpool_t *rkmp,
+                             int *cntp, size_t *sizep);
+
+
 /** @returns the absolute time a message was enqueued (producer) */
 #define rd_kafka_msg_enq_time(rkm) ((rkm)->rkm_ts_enq)
 
@@ -187,18 +244,55 @@ rd_kafka_msg_t *rd_kafka_message2msg (rd_kafka_message_t *rkmessage) {
 
 
 
+/**
+ * @brief Maximum number of messages per msgq chunk.
+ */
+#define RD_KAFKA_MSGQ_CHUNK_SIZE 256
+
+/**
+ * @brief A run of consecutive messages in a message queue.
+ *
+ * The messages of a queue are partitioned into chunks of at most
+ * RD_KAFKA_MSGQ_CHUNK_SIZE messages (chunks may be smaller, e.g., after
+ * splits or dequeues from the middle), each keeping the first and last
+ * message (and thus the msgid range), the message and byte counts,
+ * and an upper bound of the message timeouts.
+ * This allows finding sorted insert positions, splitting and timeout
+ * scanning to skip whole chunks rather than visiting each message.
+ */
+typedef struct rd_kafka_msgq_chunk_s {
+        TAILQ_ENTRY(rd_kafka_msgq_chunk_s) rkmc_link;
+        struct rd_kafka_msg_s *rkmc_first;  /**< First message in chunk */
+        struct rd_kafka_msg_s *rkmc_last;   /**< Last message in chunk */
+        int32_t rkmc_cnt;                   /**< Number of messages */
+        int64_t rkmc_bytes;                 /**< Message bytes */
+        rd_ts_t rkmc_ts_timeout_max;        /**< Upper bound of the
+                                             *   messages' ts_timeout */
+        int     rkmc_shard;                 /**< Owning msgpool shard,
+                                             *   or -1 if not pooled. */
+} rd_kafka_msgq_chunk_t;
+
+
 /**
  * @brief Message queue with message and byte counters.
+ *
+ * Messages are linked through rkm_link, and indexed by chunks
+ * (rkm_chunk, see rd_kafka_msgq_chunk_t).
+ * The queue MUST only be modified through the rd_kafka_msgq_..()
+ * functions to keep the chunks consistent.
  */
 TAILQ_HEAD(rd_kafka_msgs_head_s, rd_kafka_msg_s);
+TAILQ_HEAD(rd_kafka_msgq_chunks_head_s, rd_kafka_msgq_chunk_s);
 typedef struct rd_kafka_msgq_s {
         struct rd_kafka_msgs_head_s rkmq_msgs;  /* TAILQ_HEAD */
+        struct rd_kafka_msgq_chunks_head_s rkmq_chunks; /* TAILQ_HEAD */
         int32_t rkmq_msg_cnt;
         int64_t rkmq_msg_bytes;
 } rd_kafka_msgq_t;
 
 #define RD_KAFKA_MSGQ_INITIALIZER(rkmq) \
-	{ .rkmq_msgs = TAILQ_HEAD_INITIALIZER((rkmq).rkmq_msgs) }
+	{ .rkmq_msgs = TAILQ_HEAD_INITIALIZER((rkmq).rkmq_msgs),        \
+          .rkmq_chunks = TAILQ_HEAD_INITIALIZER((rkmq).rkmq_chunks) }
 
 #define RD_KAFKA_MSGQ_FOREACH(elm,head) \
 	TAILQ_FOREACH(elm, &(head)->rkmq_msgs, rkm_link)
@@ -233,10 +327,33 @@ int rd_kafka_msg_new (rd_kafka_itopic_t *rkt, int32_t force_partition,
 
 static RD_INLINE RD_UNUSED void rd_kafka_msgq_init (rd_kafka_msgq_t *rkmq) {
         TAILQ_INIT(&rkmq->rkmq_msgs);
+        TAILQ_INIT(&rkmq->rkmq_chunks);
         rkmq->rkmq_msg_cnt   = 0;
         rkmq->rkmq_msg_bytes = 0;
 }
 
+
+rd_kafka_msgq_chunk_t *rd_kafka_msgq_chunk_new (rd_kafka_msgq_t *rkmq,
+                                                rd_kafka_msgq_chunk_t *before,
+                                                rd_kafka_msg_t *rkm);
+void rd_kafka_msgq_chunk_destroy (rd_kafka_msgq_chunk_t *rkmc,
+                                  const rd_kafka_msg_t *rkm);
+void rd_kafka_msgq_chunks_concat (rd_kafka_msgq_t *dst, rd_kafka_msgq_t *src);
+void rd_kafka_msgq_chunks_destroy (rd_kafka_t *rk, rd_kafka_msgq_t *rkmq);
+
+/**
+ * @brief Account \p rkm to chunk \p rkmc, the caller sets
+ *        the chunk's first/last message as needed.
+ */
+static RD_INLINE RD_UNUSED void
+rd_kafka_msgq_chunk_add (rd_kafka_msgq_chunk_t *rkmc, rd_kafka_msg_t *rkm) {
+        rkm->rkm_chunk = rkmc;
+        rkmc->rkmc_cnt++;
+        rkmc->rkmc_bytes += rkm->rkm_len+rkm->rkm_key_len;
+        if (rkm->rkm_ts_timeout > rkmc->rkmc_ts_timeout_max)
+                rkmc->rkmc_ts_timeout_max = rkm->rkm_ts_timeout;
+}
+
 #if ENABLE_DEVEL
 #define rd_kafka_msgq_verify_order(rktp,rkmq,exp_first_msgid,gapless) \
         rd_kafka_msgq_verify_order0(__FUNCTION__, __LINE__, \
@@ -260,6 +377,7 @@ void rd_kafka_msgq_verify_order0 (const char *function, int line,
  */
 static RD_INLINE RD_UNUSED void rd_kafka_msgq_concat (rd_kafka_msgq_t *dst,
 						   rd_kafka_msgq_t *src) {
+        rd_kafka_msgq_chunks_concat(dst, src);
 	TAILQ_CONCAT(&dst->rkmq_msgs, &src->rkmq_msgs, rkm_link);
         dst->rkmq_msg_cnt   += src->rkmq_msg_cnt;
         dst->rkmq_msg_bytes += src->rkmq_msg_bytes;
@@ -274,6 +392,7 @@ static RD_INLINE RD_UNUSED void rd_kafka_msgq_concat (rd_kafka_msgq_t *dst,
 static RD_INLINE RD_UNUSED void rd_kafka_msgq_move (rd_kafka_msgq_t *dst,
 						 rd_kafka_msgq_t *src) {
 	TAILQ_MOVE(&dst->rkmq_msgs, &src->rkmq_msgs, rkm_link);
+	TAILQ_MOVE(&dst->rkmq_chunks, &src->rkmq_chunks, rkmc_link);
         dst->rkmq_msg_cnt   = src->rkmq_msg_cnt;
         dst->rkmq_msg_bytes = src->rkmq_msg_bytes;
 	rd_kafka_msgq_init(src);
@@ -298,20 +417,7 @@ static RD_INLINE RD_UNUSED void rd_kafka_msgq_prepend (rd_kafka_msgq_t *dst,
 /**
  * rd_free all msgs in msgq and reinitialize the msgq.
  */
-static RD_INLINE RD_UNUSED void rd_kafka_msgq_purge (rd_kafka_t *rk,
-                                                    rd_kafka_msgq_t *rkmq) {
-	rd_kafka_msg_t *rkm, *next;
-
-	next = TAILQ_FIRST(&rkmq->rkmq_msgs);
-	while (next) {
-		rkm = next;
-		next = TAILQ_NEXT(next, rkm_link);
-
-		rd_kafka_msg_destroy(rk, rkm);
-	}
-
-	rd_kafka_msgq_init(rkmq);
-}
+void rd_kafka_msgq_purge (rd_kafka_t *rk, rd_kafka_msgq_t *rkmq);
 
 
 /**
@@ -321,6 +427,23 @@ static RD_INLINE RD_UNUSED
 rd_kafka_msg_t *rd_kafka_msgq_deq (rd_kafka_msgq_t *rkmq,
 				   rd_kafka_msg_t *rkm,
 				   int do_count) {
+        rd_kafka_msgq_chunk_t *rkmc = rkm->rkm_chunk;
+
+        if (rkmc->rkmc_cnt == 1) {
+                TAILQ_REMOVE(&rkmq->rkmq_chunks, rkmc, rkmc_link);
+                rd_kafka_msgq_chunk_destroy(rkmc, rkm);
+        } else {
+                if (rkmc->rkmc_first == rkm)
+                        rkmc->rkmc_first = TAILQ_NEXT(rkm, rkm_link);
+                if (rkmc->rkmc_last == rkm)
+                        rkmc->rkmc_last = TAILQ_PREV(rkm,
+                                                     rd_kafka_msgs_head_s,
+                                                     rkm_link);
+                rkmc->rkmc_cnt--;
+                rkmc->rkmc_bytes -= rkm->rkm_len+rkm->rkm_key_len;
+        }
+        rkm->rkm_chunk = NULL;
+
 	if (likely(do_count)) {
 		rd_kafka_assert(NULL, rkmq->rkmq_msg_cnt > 0);
                 rd_kafka_assert(NULL, rkmq->rkmq_msg_bytes >=
@@ -410,7 +533,7 @@ int rd_kafka_msg_cmp_msgid_lifo (const void *_a, const void *_b) {
 
 /**
  * @brief Insert message at its sorted position using the msgid.
- * @remark This is an O(n) operation.
+ * @remark This is an O(n/RD_KAFKA_MSGQ_CHUNK_SIZE) operation.
  * @warning The message must have a msgid set.
  * @returns the message count of the queue after enqueuing the message.
  */
@@ -421,7 +544,7 @@ rd_kafka_msgq_enq_sorted0 (rd_kafka_msgq_t *rkmq,
 
 /**
  * @brief Insert message at its sorted position using the msgid.
- * @remark This is an O(n) operation.
+ * @remark This is an O(n/RD_KAFKA_MSGQ_CHUNK_SIZE) operation.
  * @warning The message must have a msgid set.
  * @returns the message count of the queue after enqueuing the message.
  */
@@ -434,7 +557,14 @@ int rd_kafka_msgq_enq_sorted (const rd_kafka_itopic_t *rkt,
  */
 static RD_INLINE RD_UNUSED void rd_kafka_msgq_insert (rd_kafka_msgq_t *rkmq,
 						   rd_kafka_msg_t *rkm) {
+        rd_kafka_msgq_chunk_t *rkmc = TAILQ_FIRST(&rkmq->rkmq_chunks);
+
 	TAILQ_INSERT_HEAD(&rkmq->rkmq_msgs, rkm, rkm_link);
+        if (unlikely(!rkmc || rkmc->rkmc_cnt >= RD_KAFKA_MSGQ_CHUNK_SIZE))
+                rkmc = rd_kafka_msgq_chunk_new(rkmq, rkmc, rkm);
+        rkmc->rkmc_first = rkm;
+        rd_kafka_msgq_chunk_add(rkmc, rkm);
+
         rkmq->rkmq_msg_cnt++;
         rkmq->rkmq_msg_bytes += rkm->rkm_len+rkm->rkm_key_len;
 }
@@ -444,7 +574,14 @@ static RD_INLINE RD_UNUSED void rd_kafka_msgq_insert (rd_kafka_msgq_t *rkmq,
  */
 static RD_INLINE RD_UNUSED int rd_kafka_msgq_enq (rd_kafka_msgq_t *rkmq,
                                                 rd_kafka_msg_t *rkm) {
+        rd_kafka_msgq_chunk_t *rkmc = TAILQ_LAST(&rkmq->rkmq_chunks,
+                                                 rd_kafka_msgq_chunks_head_s);
+
         TAILQ_INSERT_TAIL(&rkmq->rkmq_msgs, rkm, rkm_link);
+        if (unlikely(!rkmc || rkmc->rkmc_cnt >= RD_KAFKA_MSGQ_CHUNK_SIZE))
+                rkmc = rd_kafka_msgq_chunk_new(rkmq, NULL, rkm);
+        rkmc->rkmc_last = rkm;
+        rd_kafka_msgq_chunk_add(rkmc, rkm);
         rkmq->rkmq_msg_bytes += rkm->rkm_len+rkm->rkm_key_len;
         return (int)++rkmq->rkmq_msg_cnt;
 }
@@ -494,6 +631,10 @@ rd_kafka_msg_t *rd_kafka_msgq_find_pos (const rd_kafka_msgq_t *rkmq,
                                                     const void *),
                                         int *cntp, int64_t *bytesp);
 
+void rd_kafka_msgq_insert_list_before (rd_kafka_msgq_t *destq,
+                                       rd_kafka_msg_t *insert_before,
+                                       rd_kafka_msgq_t *srcq);
+
 void rd_kafka_msgq_set_metadata (rd_kafka_msgq_t *rkmq,
                                  int64_t base_offset, int64_t timestamp,
                                  rd_kafka_msg_status_t status);
@@ -521,6 +662,7 @@ static RD_INLINE RD_UNUSED int32_t rd_kafka_seq_wrap (int64_t seq) {
 }
 
 void rd_kafka_msgq_dump (FILE *fp, const char *what, rd_kafka_msgq_t *rkmq);
+int rd_kafka_msgq_verify_chunks (const rd_kafka_msgq_t *rkmq);
 
 rd_kafka_msg_t *ut_rd_kafka_msg_new (size_t msgsize);
 void ut_rd_kafka_msgq_purge (rd_kafka_msgq_t *rkmq);
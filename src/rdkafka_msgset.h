@@ -70,6 +70,8 @@ rd_kafka_msgset_create_ProduceRequest (rd_kafka_broker_t *rkb,
                                        const rd_kafka_pid_t pid,
                                        size_t *MessageSetSizep);
 
+void rd_kafka_msgset_compress_done (rd_kafka_buf_t *rkbuf);
+
 /**
  * @name MessageSet readers
  */
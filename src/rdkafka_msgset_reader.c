@@ -104,6 +104,11 @@ struct msgset_v2_hdr {
 };
 
 
+/**< Minimum number of FETCH ops per slab,
+ *   see rd_kafka_msgset_reader_slab(). */
+#define RD_KAFKA_MSGSET_READER_SLAB_MIN 16
+
+
 /**
  * @struct rd_kafka_aborted_txn_start_offsets_t
  *
@@ -134,6 +139,13 @@ typedef struct rd_kafka_msgset_reader_s {
         } msetr_outer;
 
         struct msgset_v2_hdr   *msetr_v2_hdr;    /**< MessageSet v2 header */
+        rd_kafka_op_fetch_slab_t *msetr_slab;    /**< FETCH op slab for the
+                                                  *   current v2 MessageSet */
+        int32_t msetr_slab_remain;   /**< Records of the current v2
+                                      *   MessageSet not yet covered
+                                      *   by a slab. */
+        int32_t msetr_slab_total;    /**< Op slots allocated for the
+                                      *   current v2 MessageSet. */
 
         /*
          * Aborted Transaction Start Offsets. These are arranged in a map
@@ -668,7 +680,7 @@ rd_kafka_msgset_reader_msg_v0_1 (rd_kafka_msgset_reader_t *msetr) {
 
         /* Create op/message container for message. */
         rko = rd_kafka_op_new_fetch_msg(&rkm, rktp, msetr->msetr_tver->version,
-                                        rkbuf,
+                                        rkbuf, NULL,
                                         hdr.Offset,
                                         (size_t)RD_KAFKAP_BYTES_LEN(&Key),
                                         RD_KAFKAP_BYTES_IS_NULL(&Key) ?
@@ -709,6 +721,134 @@ rd_kafka_msgset_reader_msg_v0_1 (rd_kafka_msgset_reader_t *msetr) {
 
 
 
+/**
+ * @brief MsgVersion v2 record fields.
+ */
+typedef struct rd_kafka_msgset_reader_v2_rec_s {
+        int64_t Length;
+        int8_t  MsgAttributes;
+        int64_t TimestampDelta;
+        int64_t OffsetDelta;
+        int64_t Offset;  /* Absolute offset */
+        rd_kafkap_bytes_t Key;
+        rd_kafkap_bytes_t Value;
+        rd_kafkap_bytes_t Headers;
+} rd_kafka_msgset_reader_v2_rec_t;
+
+
+/**
+ * @brief Decode a v2 record (excluding the absolute Offset) from the
+ *        contiguous memory at \p p of \p size bytes.
+ *
+ * This is the fast path for the common case where the entire record
+ * resides in a single buffer segment: the varints are decoded with
+ * rd_varint_dec_i64_fast() directly from memory without per-field
+ * slice bookkeeping.
+ *
+ * @returns the total size of the record, including the Length field,
+ *          or 0 if the record does not fit in \p size or is otherwise
+ *          not decodable here, in which case the caller must fall back
+ *          on the slice reader (which also provides proper error
+ *          reporting for malformed records).
+ */
+static RD_INLINE size_t
+rd_kafka_msgset_reader_msg_v2_contig (const char *p, size_t size,
+                                      rd_kafka_msgset_reader_v2_rec_t *hdr) {
+        const char *start = p, *end = p + size, *rec_end;
+        int64_t len;
+        size_t r;
+
+        r = rd_varint_dec_i64_fast(p, size, &hdr->Length);
+        if (unlikely(RD_UVARINT_UNDERFLOW(r) || hdr->Length < 1 ||
+                     (uint64_t)hdr->Length > (uint64_t)(size - r)))
+                return 0;
+        p += r;
+        rec_end = p + hdr->Length;
+
+        hdr->MsgAttributes = (int8_t)*p++;
+
+        /* Varints may be loaded from past the record end (but never past
+         * the segment end), so check each field against the record end
+         * after decoding it. */
+#define _DEC_VARINT(DST) do {                                           \
+                r = rd_varint_dec_i64_fast(p, (size_t)(end - p), DST);  \
+                if (unlikely(RD_UVARINT_UNDERFLOW(r) ||                 \
+                             r > (size_t)(rec_end - p)))                \
+                        return 0;                                       \
+                p += r;                                                 \
+        } while (0)
+
+#define _DEC_BYTES(KBYTES) do {                                         \
+                _DEC_VARINT(&len);                                      \
+                if (len == RD_KAFKAP_BYTES_LEN_NULL) {                  \
+                        (KBYTES)->data = NULL;                          \
+                        (KBYTES)->len  = 0;                             \
+                } else if (unlikely(len < 0 ||                          \
+                                    len > (int64_t)(rec_end - p))) {    \
+                        return 0;                                       \
+                } else {                                                \
+                        (KBYTES)->data = len ? p : "";                  \
+                        (KBYTES)->len  = (int32_t)len;                  \
+                        p += len;                                       \
+                }                                                       \
+        } while (0)
+
+        _DEC_VARINT(&hdr->TimestampDelta);
+        _DEC_VARINT(&hdr->OffsetDelta);
+        _DEC_BYTES(&hdr->Key);
+        _DEC_BYTES(&hdr->Value);
+
+#undef _DEC_BYTES
+#undef _DEC_VARINT
+
+        /* Headers are parsed on first access */
+        hdr->Headers.data = p;
+        hdr->Headers.len  = (int32_t)(rec_end - p);
+
+        return (size_t)(rec_end - start);
+}
+
+
+/**
+ * @returns the slab to allocate the next FETCH op from, or NULL to
+ *          allocate a standalone op.
+ *
+ * The broker-provided RecordCount is not trusted for sizing the slabs:
+ * each new slab is as large as all previous slabs for the MessageSet
+ * combined (but at least RD_KAFKA_MSGSET_READER_SLAB_MIN ops), capped
+ * by the records remaining according to RecordCount.
+ * A bogus RecordCount thus allocates at most twice the slots needed
+ * for the records actually parsed.
+ */
+static rd_kafka_op_fetch_slab_t *
+rd_kafka_msgset_reader_slab (rd_kafka_msgset_reader_t *msetr) {
+        int32_t size;
+
+        if (msetr->msetr_slab) {
+                if (likely(msetr->msetr_slab->cnt < msetr->msetr_slab->size))
+                        return msetr->msetr_slab;
+
+                /* Slab exhausted: release the reader's reference,
+                 * the slab is freed when its last op is destroyed. */
+                rd_kafka_op_fetch_slab_destroy(msetr->msetr_slab);
+                msetr->msetr_slab = NULL;
+        }
+
+        size = RD_MIN(msetr->msetr_slab_remain,
+                      RD_MAX(msetr->msetr_slab_total,
+                             RD_KAFKA_MSGSET_READER_SLAB_MIN));
+        if (size <= 1)
+                return NULL;
+
+        msetr->msetr_slab_remain -= size;
+        msetr->msetr_slab_total  += size;
+        msetr->msetr_slab = rd_kafka_op_fetch_slab_new(msetr->msetr_rkbuf,
+                                                       (int)size);
+
+        return msetr->msetr_slab;
+}
+
+
 /**
  * @brief Message parser for MsgVersion v2
  */
@@ -716,29 +856,39 @@ static rd_kafka_resp_err_t
 rd_kafka_msgset_reader_msg_v2 (rd_kafka_msgset_reader_t *msetr) {
         rd_kafka_buf_t *rkbuf = msetr->msetr_rkbuf;
         rd_kafka_toppar_t *rktp = msetr->msetr_rktp;
-        struct {
-                int64_t Length;
-                int8_t  MsgAttributes;
-                int64_t TimestampDelta;
-                int64_t OffsetDelta;
-                int64_t Offset;  /* Absolute offset */
-                rd_kafkap_bytes_t Key;
-                rd_kafkap_bytes_t Value;
-                rd_kafkap_bytes_t Headers;
-        } hdr;
+        rd_kafka_msgset_reader_v2_rec_t hdr;
         rd_kafka_op_t *rko;
         rd_kafka_msg_t *rkm;
         /* Only log decoding errors if protocol debugging enabled. */
         int log_decode_errors = (rkbuf->rkbuf_rkb->rkb_rk->rk_conf.debug &
                                  RD_KAFKA_DBG_PROTOCOL) ? LOG_DEBUG : 0;
         size_t message_end;
+        const void *p;
+        size_t contig_size = 0;
+
+        /* Fast path: decode the record straight from memory if it is
+         * fully contained in the current buffer segment.
+         * Control records are rare and are left to the slice reader. */
+        if (likely(!(msetr->msetr_v2_hdr->Attributes &
+                     RD_KAFKA_MSGSET_V2_ATTR_CONTROL)) &&
+            (contig_size = rd_slice_peeker(&rkbuf->rkbuf_reader, &p)))
+                contig_size = rd_kafka_msgset_reader_msg_v2_contig(
+                        (const char *)p, contig_size, &hdr);
+
+        if (likely(contig_size > 0)) {
+                rd_kafka_buf_skip(rkbuf, contig_size);
+                message_end = rd_slice_offset(&rkbuf->rkbuf_reader);
 
-        rd_kafka_buf_read_varint(rkbuf, &hdr.Length);
-        message_end = rd_slice_offset(&rkbuf->rkbuf_reader)+(size_t)hdr.Length;
-        rd_kafka_buf_read_i8(rkbuf, &hdr.MsgAttributes);
+        } else {
+                rd_kafka_buf_read_varint(rkbuf, &hdr.Length);
+                message_end = rd_slice_offset(&rkbuf->rkbuf_reader) +
+                        (size_t)hdr.Length;
+                rd_kafka_buf_read_i8(rkbuf, &hdr.MsgAttributes);
+
+                rd_kafka_buf_read_varint(rkbuf, &hdr.TimestampDelta);
+                rd_kafka_buf_read_varint(rkbuf, &hdr.OffsetDelta);
+        }
 
-        rd_kafka_buf_read_varint(rkbuf, &hdr.TimestampDelta);
-        rd_kafka_buf_read_varint(rkbuf, &hdr.OffsetDelta);
         hdr.Offset = msetr->msetr_v2_hdr->BaseOffset + hdr.OffsetDelta;
 
         /* Skip message if outdated */
@@ -868,18 +1018,23 @@ unexpected_abort_txn:
 
         /* Note: messages in aborted transactions are skipped at the MessageSet level */
 
-        rd_kafka_buf_read_bytes_varint(rkbuf, &hdr.Key);
-        rd_kafka_buf_read_bytes_varint(rkbuf, &hdr.Value);
-
-        /* We parse the Headers later, just store the size (possibly truncated)
-         * and pointer to the headers. */
-        hdr.Headers.len = (int32_t)(message_end -
-                                    rd_slice_offset(&rkbuf->rkbuf_reader));
-        rd_kafka_buf_read_ptr(rkbuf, &hdr.Headers.data, hdr.Headers.len);
+        if (!contig_size) {
+                rd_kafka_buf_read_bytes_varint(rkbuf, &hdr.Key);
+                rd_kafka_buf_read_bytes_varint(rkbuf, &hdr.Value);
+
+                /* We parse the Headers later, just store the size
+                 * (possibly truncated) and pointer to the headers. */
+                hdr.Headers.len = (int32_t)(message_end -
+                                            rd_slice_offset(&rkbuf->
+                                                            rkbuf_reader));
+                rd_kafka_buf_read_ptr(rkbuf, &hdr.Headers.data,
+                                      hdr.Headers.len);
+        }
 
         /* Create op/message container for message. */
         rko = rd_kafka_op_new_fetch_msg(&rkm,
                                         rktp, msetr->msetr_tver->version, rkbuf,
+                                        rd_kafka_msgset_reader_slab(msetr),
                                         hdr.Offset,
                                         (size_t)RD_KAFKAP_BYTES_LEN(&hdr.Key),
                                         RD_KAFKAP_BYTES_IS_NULL(&hdr.Key) ?
@@ -913,8 +1068,9 @@ unexpected_abort_txn:
         }
 
 
-        /* Enqueue message on temporary queue */
-        rd_kafka_q_enq(&msetr->msetr_rkq, rko);
+        /* Enqueue message on temporary queue, which is locked
+         * by rd_kafka_msgset_reader_msgs_v2() for the entire MessageSet. */
+        rd_kafka_q_enq0(&msetr->msetr_rkq, rko, 0);
         msetr->msetr_msgcnt++;
         msetr->msetr_msg_bytes += rkm->rkm_key_len + rkm->rkm_len;
 
@@ -932,14 +1088,32 @@ unexpected_abort_txn:
  */
 static rd_kafka_resp_err_t
 rd_kafka_msgset_reader_msgs_v2 (rd_kafka_msgset_reader_t *msetr) {
+        rd_kafka_resp_err_t err = RD_KAFKA_RESP_ERR_NO_ERROR;
+
+        /* The FETCH ops are allocated from slabs as the records
+         * are parsed, see rd_kafka_msgset_reader_slab(). */
+        msetr->msetr_slab_remain = RD_MAX(msetr->msetr_v2_hdr->RecordCount,
+                                          0);
+        msetr->msetr_slab_total = 0;
+
+        /* The temporary queue is private to this reader: lock it
+         * once for the MessageSet rather than once per message. */
+        mtx_lock(&msetr->msetr_rkq.rkq_lock);
+
         while (rd_kafka_buf_read_remain(msetr->msetr_rkbuf)) {
-                rd_kafka_resp_err_t err;
                 err = rd_kafka_msgset_reader_msg_v2(msetr);
                 if (unlikely(err))
-                        return err;
+                        break;
         }
 
-        return RD_KAFKA_RESP_ERR_NO_ERROR;
+        mtx_unlock(&msetr->msetr_rkq.rkq_lock);
+
+        if (msetr->msetr_slab) {
+                rd_kafka_op_fetch_slab_destroy(msetr->msetr_slab);
+                msetr->msetr_slab = NULL;
+        }
+
+        return err;
 }
 
 
@@ -1052,8 +1226,9 @@ rd_kafka_msgset_reader_v2 (rd_kafka_msgset_reader_t *msetr) {
         if (hdr.Attributes & RD_KAFKA_MSG_ATTR_COMPRESSION_MASK) {
                 const void *compressed;
 
-                compressed = rd_slice_ensure_contig(&rkbuf->rkbuf_reader,
-                                                    payload_size);
+                /* The compressed payload is only copied if it spans
+                 * multiple receive buffer segments. */
+                compressed = rd_kafka_buf_read_contig(rkbuf, payload_size);
                 rd_assert(compressed);
 
                 err = rd_kafka_msgset_reader_decompress(
@@ -64,6 +64,10 @@ typedef struct rd_kafka_msgset_writer_s {
         size_t  msetw_of_start;          /* offset of MessageSet */
 
         int     msetw_relative_offsets;  /* Bool: use relative offsets */
+        rd_bool_t msetw_zerocopy;        /**< Pass payloads of messages not
+                                          *   produced with .._F_COPY by
+                                          *   reference regardless of size,
+                                          *   see produce.zerocopy. */
 
         /* For MessageSet v2 */
         int     msetw_Attributes;        /* MessageSet Attributes */
@@ -89,6 +93,24 @@ typedef struct rd_kafka_msgset_writer_s {
 } rd_kafka_msgset_writer_t;
 
 
+/**
+ * Minimum uncompressed MessageSet size to offload compression to the
+ * worker pool for, smaller MessageSets are compressed in place since
+ * the job hand-over would cost more than the compression itself.
+ */
+#define RD_KAFKA_MSGSET_COMPRESS_JOB_MIN_SIZE  4096
+
+/**
+ * @brief Compression job on the worker pool, see compression.threads.
+ */
+typedef struct rd_kafka_msgset_compress_job_s {
+        rd_kafka_workpool_job_t job;      /**< Must be first */
+        rd_kafka_msgset_writer_t msetw;   /**< Writer state copy */
+        size_t len;                       /**< Total messages size,
+                                           *   compressed size on return. */
+} rd_kafka_msgset_compress_job_t;
+
+
 
 /**
  * @brief Select ApiVersion and MsgVersion to use based on broker's
@@ -191,6 +213,16 @@ rd_kafka_msgset_writer_select_MsgVersion (rd_kafka_msgset_writer_t *msetw) {
                 break;
         }
 
+        /* Zero-copy is only applicable to uncompressed MessageSets since
+         * the compressor creates its own copy of the MessageSet,
+         * and to non-SSL connections since each buffer segment
+         * would otherwise be written as a separate SSL record. */
+        msetw->msetw_zerocopy =
+                rkb->rkb_rk->rk_conf.produce_zerocopy &&
+                msetw->msetw_compression == RD_KAFKA_COMPRESSION_NONE &&
+                (rkb->rkb_proto == RD_KAFKA_PROTO_PLAINTEXT ||
+                 rkb->rkb_proto == RD_KAFKA_PROTO_SASL_PLAINTEXT);
+
         /* Set the highest ApiVersion supported by us and broker */
         msetw->msetw_ApiVersion = rd_kafka_broker_ApiVersion_supported(
                 rkb,
@@ -315,8 +347,9 @@ rd_kafka_msgset_writer_alloc_buf (rd_kafka_msgset_writer_t *msetw) {
 
         /* If copying for small payloads is enabled, allocate enough
          * space for each message to be copied based on this limit.
-         */
-        if (rk->rk_conf.msg_copy_max_size > 0) {
+         * In zero-copy mode only the message framing goes in the
+         * buffer, payloads that still need copying will grow it. */
+        if (rk->rk_conf.msg_copy_max_size > 0 && !msetw->msetw_zerocopy) {
                 size_t queued_bytes = rd_kafka_msgq_size(msetw->msetw_msgq);
                 bufsize += RD_MIN(queued_bytes,
                                   (size_t)rk->rk_conf.msg_copy_max_size *
@@ -336,6 +369,11 @@ rd_kafka_msgset_writer_alloc_buf (rd_kafka_msgset_writer_t *msetw) {
          */
         msetw->msetw_rkbuf =
                 rd_kafka_buf_new_request(msetw->msetw_rkb, RD_KAFKAP_Produce,
+                                         /* In zero-copy mode each payload
+                                          * is one segment, and the framing
+                                          * following it another. */
+                                         msetw->msetw_zerocopy ?
+                                         msetw->msetw_msgcntmax*2 + 10 :
                                          msetw->msetw_msgcntmax/2 + 10,
                                          bufsize);
 
@@ -527,8 +565,15 @@ rd_kafka_msgset_writer_write_msg_payload (rd_kafka_msgset_writer_t *msetw,
 
         /* If payload is below the copy limit and there is still
          * room in the buffer we'll copy the payload to the buffer,
-         * otherwise we push a reference to the memory. */
-        if (rkm->rkm_len <= (size_t)rk->rk_conf.msg_copy_max_size &&
+         * otherwise we push a reference to the memory.
+         * In zero-copy mode payloads that were not copied on produce()
+         * are always pushed by reference: the memory is owned by the
+         * message which outlives the request buffer, since the message
+         * is held by the buffer's batch until the delivery report
+         * (or retry). */
+        if (!(msetw->msetw_zerocopy &&
+              !(rkm->rkm_flags & RD_KAFKA_MSG_F_COPY)) &&
+            rkm->rkm_len <= (size_t)rk->rk_conf.msg_copy_max_size &&
             rd_buf_write_remains(&rkbuf->rkbuf_buf) > rkm->rkm_len) {
                 rd_kafka_buf_write(rkbuf,
                                    rkm->rkm_payload, rkm->rkm_len);
@@ -1318,6 +1363,86 @@ rd_kafka_msgset_writer_finalize_MessageSet (rd_kafka_msgset_writer_t *msetw) {
 }
 
 
+/**
+ * @brief Final part of rd_kafka_msgset_writer_finalize(), called on the
+ *        broker thread after the MessageSet is complete.
+ */
+static void
+rd_kafka_msgset_writer_finalize_done (rd_kafka_msgset_writer_t *msetw) {
+        rd_kafka_toppar_t *rktp = msetw->msetw_rktp;
+        int cnt = rd_kafka_msgq_len(&msetw->msetw_rkbuf->rkbuf_batch.msgq);
+
+        msetw->msetw_rkbuf->rkbuf_u.Produce.MessageSetSize =
+                msetw->msetw_MessageSetSize;
+        msetw->msetw_rkbuf->rkbuf_u.Produce.MessageSetOffset =
+                msetw->msetw_of_MessageSetSize + 4;
+
+        rd_rkb_dbg(msetw->msetw_rkb, MSG, "PRODUCE",
+                   "%s [%"PRId32"]: "
+                   "Produce MessageSet with %i message(s) (%"PRIusz" bytes, "
+                   "ApiVersion %d, MsgVersion %d, MsgId %"PRIu64", "
+                   "BaseSeq %"PRId32", %s, %s)",
+                   rktp->rktp_rkt->rkt_topic->str, rktp->rktp_partition,
+                   cnt, msetw->msetw_MessageSetSize,
+                   msetw->msetw_ApiVersion, msetw->msetw_MsgVersion,
+                   msetw->msetw_batch->first_msgid,
+                   msetw->msetw_batch->first_seq,
+                   rd_kafka_pid2str(msetw->msetw_pid),
+                   msetw->msetw_compression ?
+                   rd_kafka_compression2str(msetw->msetw_compression) :
+                   "uncompressed");
+
+        rd_kafka_msgq_verify_order(rktp, &msetw->msetw_batch->msgq,
+                                   msetw->msetw_batch->first_msgid, rd_false);
+
+        rd_kafka_msgbatch_ready_produce(msetw->msetw_batch);
+}
+
+
+/**
+ * @brief Worker pool job: compress and finalize the MessageSet.
+ *
+ * @locality any thread
+ */
+static void rd_kafka_msgset_compress_job_run (rd_kafka_workpool_job_t *job) {
+        rd_kafka_msgset_compress_job_t *cjob =
+                (rd_kafka_msgset_compress_job_t *)job;
+        rd_kafka_msgset_writer_t *msetw = &cjob->msetw;
+
+        if (rd_kafka_msgset_writer_compress(msetw, &cjob->len) == -1)
+                msetw->msetw_compression = 0;
+
+        msetw->msetw_messages_len = cjob->len;
+
+        rd_kafka_msgset_writer_finalize_MessageSet(msetw);
+}
+
+
+/**
+ * @brief Submit compression and finalization of the MessageSet to the
+ *        worker pool as part of the broker's current produce pass.
+ *
+ *        The buffer must not be transmitted until
+ *        rd_kafka_msgset_compress_done() has been called on it.
+ */
+static void
+rd_kafka_msgset_writer_compress_submit (rd_kafka_msgset_writer_t *msetw,
+                                        size_t len) {
+        rd_kafka_broker_t *rkb = msetw->msetw_rkb;
+        rd_kafka_msgset_compress_job_t *cjob;
+
+        cjob = rd_malloc(sizeof(*cjob));
+        cjob->msetw = *msetw;
+        cjob->len = len;
+
+        msetw->msetw_rkbuf->rkbuf_u.Produce.compress_job = cjob;
+
+        rd_kafka_workpool_submit(rkb->rkb_rk->rk_workpool,
+                                 rkb->rkb_produce_wpg, &cjob->job,
+                                 rd_kafka_msgset_compress_job_run);
+}
+
+
 /**
  * @brief Finalize the messageset - call when no more messages are to be
  *        added to the messageset.
@@ -1327,7 +1452,10 @@ rd_kafka_msgset_writer_finalize_MessageSet (rd_kafka_msgset_writer_t *msetw) {
  *        The messageset writer is destroyed and the buffer is returned
  *        and ready to be transmitted.
  *
- * @param MessagetSetSizep will be set to the finalized MessageSetSize
+ * @param MessagetSetSizep will be set to the finalized MessageSetSize,
+ *        or 0 if compression was offloaded to the worker pool in which
+ *        case the buffer must be passed to rd_kafka_msgset_compress_done()
+ *        before transmission.
  *
  * @returns the buffer to transmit or NULL if there were no messages
  *          in messageset.
@@ -1364,6 +1492,15 @@ rd_kafka_msgset_writer_finalize (rd_kafka_msgset_writer_t *msetw,
 
         /* Compress the message set */
         if (msetw->msetw_compression) {
+                if (msetw->msetw_rkb->rkb_produce_wpg &&
+                    len >= RD_KAFKA_MSGSET_COMPRESS_JOB_MIN_SIZE) {
+                        /* Offload compression and the remaining
+                         * finalization to the worker pool. */
+                        rd_kafka_msgset_writer_compress_submit(msetw, len);
+                        *MessageSetSizep = 0;
+                        return rkbuf;
+                }
+
                 if (rd_kafka_msgset_writer_compress(msetw, &len) == -1)
                         msetw->msetw_compression = 0;
         }
@@ -1376,27 +1513,30 @@ rd_kafka_msgset_writer_finalize (rd_kafka_msgset_writer_t *msetw,
         /* Return final MessageSetSize */
         *MessageSetSizep = msetw->msetw_MessageSetSize;
 
-        rd_rkb_dbg(msetw->msetw_rkb, MSG, "PRODUCE",
-                   "%s [%"PRId32"]: "
-                   "Produce MessageSet with %i message(s) (%"PRIusz" bytes, "
-                   "ApiVersion %d, MsgVersion %d, MsgId %"PRIu64", "
-                   "BaseSeq %"PRId32", %s, %s)",
-                   rktp->rktp_rkt->rkt_topic->str, rktp->rktp_partition,
-                   cnt, msetw->msetw_MessageSetSize,
-                   msetw->msetw_ApiVersion, msetw->msetw_MsgVersion,
-                   msetw->msetw_batch->first_msgid,
-                   msetw->msetw_batch->first_seq,
-                   rd_kafka_pid2str(msetw->msetw_pid),
-                   msetw->msetw_compression ?
-                   rd_kafka_compression2str(msetw->msetw_compression) :
-                   "uncompressed");
+        rd_kafka_msgset_writer_finalize_done(msetw);
 
-        rd_kafka_msgq_verify_order(rktp, &msetw->msetw_batch->msgq,
-                                   msetw->msetw_batch->first_msgid, rd_false);
+        return rkbuf;
+}
 
-        rd_kafka_msgbatch_ready_produce(msetw->msetw_batch);
 
-        return rkbuf;
+/**
+ * @brief Finish a ProduceRequest whose compression was offloaded to the
+ *        worker pool, if any, once its job group has been waited for.
+ *
+ * @locality broker thread
+ */
+void rd_kafka_msgset_compress_done (rd_kafka_buf_t *rkbuf) {
+        rd_kafka_msgset_compress_job_t *cjob =
+                rkbuf->rkbuf_u.Produce.compress_job;
+
+        if (!cjob)
+                return;
+
+        rkbuf->rkbuf_u.Produce.compress_job = NULL;
+
+        rd_kafka_msgset_writer_finalize_done(&cjob->msetw);
+
+        rd_free(cjob);
 }
 
 
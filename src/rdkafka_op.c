@@ -220,14 +220,21 @@ rd_kafka_op_t *rd_kafka_op_new0 (const char *source, rd_kafka_op_type_t type) {
 
 
 void rd_kafka_op_destroy (rd_kafka_op_t *rko) {
+        rd_kafka_op_fetch_slab_t *slab = NULL;
 
 	switch (rko->rko_type & ~RD_KAFKA_OP_FLAGMASK)
 	{
 	case RD_KAFKA_OP_FETCH:
 		rd_kafka_msg_destroy(NULL, &rko->rko_u.fetch.rkm);
+                if (rko->rko_rktp)
+                        rd_kafka_fetch_budget_add(
+                                rd_kafka_toppar_s2i(rko->rko_rktp),
+                                -(int64_t)rko->rko_len);
 		/* Decrease refcount on rkbuf to eventually rd_free shared buf*/
 		if (rko->rko_u.fetch.rkbuf)
 			rd_kafka_buf_handle_op(rko, RD_KAFKA_RESP_ERR__DESTROY);
+                /* The op memory is owned by the slab, if any. */
+                slab = rko->rko_u.fetch.slab;
 
 		break;
 
@@ -351,7 +358,10 @@ void rd_kafka_op_destroy (rd_kafka_op_t *rko) {
                 rd_kafka_assert(NULL, !*"rd_kafka_op_cnt < 0");
 #endif
 
-	rd_free(rko);
+        if (slab)
+                rd_kafka_op_fetch_slab_destroy(slab);
+        else
+                rd_free(rko);
 }
 
 
@@ -537,11 +547,84 @@ rd_kafka_op_res_t rd_kafka_op_call (rd_kafka_t *rk, rd_kafka_q_t *rkq,
 }
 
 
+/**
+ * @brief Create a FETCH op slab with room for \p size ops,
+ *        all sharing a single reference to \p rkbuf.
+ *
+ * The caller holds one reference which must be released with
+ * rd_kafka_op_fetch_slab_destroy() when done carving ops from the slab.
+ */
+rd_kafka_op_fetch_slab_t *rd_kafka_op_fetch_slab_new (rd_kafka_buf_t *rkbuf,
+                                                      int size) {
+        rd_kafka_op_fetch_slab_t *slab;
+        rd_kafka_op_t *rko;
+        size_t hdrsize = RD_ROUNDUP(sizeof(*slab), 8);
+        size_t slotsize = RD_ROUNDUP(sizeof(*rko) - sizeof(rko->rko_u) +
+                                     sizeof(rko->rko_u.fetch), 8);
+
+        rd_assert(size > 0);
+
+        /* Slots are zeroed once here, each slot is only used once. */
+        slab = rd_calloc(1, hdrsize + ((size_t)size * slotsize));
+        rd_refcnt_init(&slab->refcnt, 1);
+        slab->rkbuf    = rkbuf;
+        rd_kafka_buf_keep(rkbuf);
+        slab->size     = size;
+        slab->slotsize = slotsize;
+        slab->slots    = (char *)slab + hdrsize;
+
+        return slab;
+}
+
+
+/**
+ * @brief Release one reference to the slab, freeing it and its rkbuf
+ *        reference when the last carved op (and the creator) is done.
+ */
+void rd_kafka_op_fetch_slab_destroy (rd_kafka_op_fetch_slab_t *slab) {
+        if (rd_refcnt_sub(&slab->refcnt) > 0)
+                return;
+
+        rd_kafka_buf_destroy(slab->rkbuf);
+        rd_refcnt_destroy(&slab->refcnt);
+        rd_free(slab);
+}
+
+
+/**
+ * @brief Carve a FETCH op out of \p slab.
+ *
+ * @returns the op, or NULL if the slab is exhausted.
+ */
+static rd_kafka_op_t *
+rd_kafka_op_fetch_slab_alloc (rd_kafka_op_fetch_slab_t *slab) {
+        rd_kafka_op_t *rko;
+
+        if (unlikely(slab->cnt == slab->size))
+                return NULL;
+
+        rko = (rd_kafka_op_t *)(slab->slots +
+                                ((size_t)slab->cnt++ * slab->slotsize));
+        rko->rko_type = RD_KAFKA_OP_FETCH;
+        rko->rko_u.fetch.slab = slab;
+        rd_refcnt_add(&slab->refcnt);
+
+#if ENABLE_DEVEL
+        rko->rko_source = __FILE__ ":" _STRINGIFY(__LINE__);
+        rd_atomic32_add(&rd_kafka_op_cnt, 1);
+#endif
+        return rko;
+}
+
+
 /**
  * @brief Creates a new RD_KAFKA_OP_FETCH op and sets up the
  *        embedded message according to the parameters.
  *
  * @param rkmp will be set to the embedded rkm in the rko (for convenience)
+ * @param slab optional op slab to allocate the op from, in which case
+ *             the slab's rkbuf reference is used. If the slab is
+ *             exhausted a standalone op is allocated.
  * @param offset may be updated later if relative offset.
  */
 rd_kafka_op_t *
@@ -549,26 +632,35 @@ rd_kafka_op_new_fetch_msg (rd_kafka_msg_t **rkmp,
                            rd_kafka_toppar_t *rktp,
                            int32_t version,
                            rd_kafka_buf_t *rkbuf,
+                           rd_kafka_op_fetch_slab_t *slab,
                            int64_t offset,
                            size_t key_len, const void *key,
                            size_t val_len, const void *val) {
         rd_kafka_msg_t *rkm;
-        rd_kafka_op_t *rko;
+        rd_kafka_op_t *rko = NULL;
+
+        if (slab) {
+                rd_dassert(slab->rkbuf == rkbuf);
+                rko = rd_kafka_op_fetch_slab_alloc(slab);
+        }
+
+        if (!rko) {
+                rko = rd_kafka_op_new(RD_KAFKA_OP_FETCH);
+
+                /* Since all the ops share the same payload buffer
+                 * a refcnt is used on the rkbuf that makes sure all
+                 * consume_cb() will have been
+                 * called for each of these ops before the rkbuf
+                 * and its memory backing buffers are freed. */
+                rko->rko_u.fetch.rkbuf = rkbuf;
+                rd_kafka_buf_keep(rkbuf);
+        }
 
-        rko = rd_kafka_op_new(RD_KAFKA_OP_FETCH);
         rko->rko_rktp    = rd_kafka_toppar_keep(rktp);
         rko->rko_version = version;
         rkm   = &rko->rko_u.fetch.rkm;
         *rkmp = rkm;
 
-        /* Since all the ops share the same payload buffer
-         * a refcnt is used on the rkbuf that makes sure all
-         * consume_cb() will have been
-         * called for each of these ops before the rkbuf
-         * and its memory backing buffers are freed. */
-        rko->rko_u.fetch.rkbuf = rkbuf;
-        rd_kafka_buf_keep(rkbuf);
-
         rkm->rkm_offset    = offset;
 
         rkm->rkm_key       = (void *)key;
@@ -578,6 +670,8 @@ rd_kafka_op_new_fetch_msg (rd_kafka_msg_t **rkmp,
         rkm->rkm_len       = val_len;
         rko->rko_len       = (int32_t)rkm->rkm_len;
 
+        rd_kafka_fetch_budget_add(rktp, rko->rko_len);
+
         rkm->rkm_partition = rktp->rktp_partition;
 
         /* Persistence status is always PERSISTED for consumed messages
@@ -246,6 +246,9 @@ struct rd_kafka_op_s {
 			rd_kafka_buf_t *rkbuf;
 			rd_kafka_msg_t  rkm;
 			int evidx;
+                        /**< Slab this op was carved from, if any.
+                         *   The slab holds the rkbuf reference. */
+                        struct rd_kafka_op_fetch_slab_s *slab;
 		} fetch;
 
 		struct {
@@ -430,7 +433,8 @@ struct rd_kafka_op_s {
                                 RD_KAFKA_MOCK_CMD_PART_SET_LEADER,
                                 RD_KAFKA_MOCK_CMD_PART_SET_FOLLOWER,
                                 RD_KAFKA_MOCK_CMD_PART_SET_FOLLOWER_WMARKS,
-                                RD_KAFKA_MOCK_CMD_BROKER_SET_RACK
+                                RD_KAFKA_MOCK_CMD_BROKER_SET_RACK,
+                                RD_KAFKA_MOCK_CMD_BROKER_DISCONNECT
                         } cmd;
 
                         rd_kafka_resp_err_t err; /**< Error for:
@@ -447,7 +451,8 @@ struct rd_kafka_op_s {
                         int32_t broker_id;       /**< For:
                                                   *    PART_SET_FOLLOWER
                                                   *    PART_SET_LEADER
-                                                  *    BROKER_SET_RACK */
+                                                  *    BROKER_SET_RACK
+                                                  *    BROKER_DISCONNECT */
                         int64_t lo;              /**< Low offset, for:
                                                   *    PART_SET_FOLLOWER_WMARKS
                                                   */
@@ -507,11 +512,35 @@ rd_kafka_op_res_t rd_kafka_op_call (rd_kafka_t *rk,
                                     rd_kafka_q_t *rkq, rd_kafka_op_t *rko)
         RD_WARN_UNUSED_RESULT;
 
+
+/**
+ * @brief Contiguous block of FETCH ops for all messages in a MessageSet.
+ *
+ * Instead of allocating one op per fetched message, and keeping one
+ * reference to the shared rkbuf per op, the MessageSet reader allocates
+ * a slab sized by the MessageSet's record count and carves the ops
+ * out of it. The slab holds a single rkbuf reference and is freed
+ * when the last op has been destroyed.
+ */
+typedef struct rd_kafka_op_fetch_slab_s {
+        rd_refcnt_t     refcnt;    /**< One per carved op + creator's */
+        rd_kafka_buf_t *rkbuf;     /**< Shared payload buffer */
+        int             cnt;       /**< Number of carved ops */
+        int             size;      /**< Number of op slots */
+        size_t          slotsize;  /**< Size of each op slot */
+        char           *slots;     /**< Op slots, follows this struct */
+} rd_kafka_op_fetch_slab_t;
+
+rd_kafka_op_fetch_slab_t *rd_kafka_op_fetch_slab_new (rd_kafka_buf_t *rkbuf,
+                                                      int size);
+void rd_kafka_op_fetch_slab_destroy (rd_kafka_op_fetch_slab_t *slab);
+
 rd_kafka_op_t *
 rd_kafka_op_new_fetch_msg (rd_kafka_msg_t **rkmp,
                            rd_kafka_toppar_t *rktp,
                            int32_t version,
                            rd_kafka_buf_t *rkbuf,
+                           rd_kafka_op_fetch_slab_t *slab,
                            int64_t offset,
                            size_t key_len, const void *key,
                            size_t val_len, const void *val);
@@ -54,6 +54,118 @@ static void rd_kafka_toppar_offset_retry (rd_kafka_toppar_t *rktp,
                                           const char *reason);
 
 
+
+/**
+ * @name Consumer fetch memory budget (queued.max.total.kbytes)
+ * @{
+ */
+
+/**
+ * @brief Budget usage shared by all consumer instances in the process
+ *        configured with queued.max.total.kbytes.scope=process.
+ */
+rd_kafka_fetch_budget_t rd_kafka_fetch_budget_process;
+
+
+/**
+ * @brief Set up the fetch memory budget of consumer \p rk from its
+ *        configuration.
+ *
+ * @locality application thread (rd_kafka_new())
+ */
+void rd_kafka_fetch_budget_init (rd_kafka_t *rk) {
+        rd_atomic64_init(&rk->rk_fetch_budget.local.used, 0);
+        rd_atomic32_init(&rk->rk_fetch_budget.local.member_cnt, 0);
+        rd_atomic64_init(&rk->rk_fetch_budget.c_held, 0);
+
+        rk->rk_fetch_budget.max = rk->rk_conf.queued_max_total_bytes;
+        if (!rk->rk_fetch_budget.max)
+                rk->rk_fetch_budget.fb = NULL;
+        else if (rk->rk_conf.queued_max_total_scope ==
+                 RD_KAFKA_FETCH_BUDGET_SCOPE_PROCESS)
+                rk->rk_fetch_budget.fb = &rd_kafka_fetch_budget_process;
+        else
+                rk->rk_fetch_budget.fb = &rk->rk_fetch_budget.local;
+}
+
+
+/**
+ * @returns the number of bytes left in the fetch memory budget,
+ *          or INT64_MAX if the budget is disabled.
+ *
+ * @locality any
+ * @locks none
+ */
+int64_t rd_kafka_fetch_budget_remains (rd_kafka_t *rk) {
+        int64_t remains;
+
+        if (!rk->rk_fetch_budget.fb)
+                return INT64_MAX;
+
+        remains = rk->rk_fetch_budget.max -
+                rd_atomic64_get(&rk->rk_fetch_budget.fb->used);
+
+        return RD_MAX(remains, 0);
+}
+
+
+/**
+ * @brief Add or remove \p rktp from the set of partitions being consumed
+ *        that the fetch memory budget is evenly shared between.
+ *
+ * @locks toppar_lock() MUST be held.
+ */
+static void rd_kafka_fetch_budget_member_set (rd_kafka_toppar_t *rktp,
+                                              rd_bool_t member) {
+        rd_kafka_t *rk = rktp->rktp_rkt->rkt_rk;
+        int32_t delta = member ? 1 : -1;
+
+        if (!rk->rk_fetch_budget.fb || rktp->rktp_fetch_budget_member == member)
+                return;
+
+        rktp->rktp_fetch_budget_member = member;
+        rd_atomic32_add(&rk->rk_fetch_budget.local.member_cnt, delta);
+        if (rk->rk_fetch_budget.fb != &rk->rk_fetch_budget.local)
+                rd_atomic32_add(&rk->rk_fetch_budget.fb->member_cnt, delta);
+}
+
+
+/**
+ * @brief Check if \p rktp may fetch within the fetch memory budget.
+ *
+ * Nothing is fetched once the budget is exhausted. When there is not
+ * enough left of it for another full partition fetch, only partitions
+ * holding less than their even share of the budget may fetch, so that
+ * partitions that are consumed slowly can't starve the others.
+ *
+ * @returns NULL if the partition may fetch, else the reason it may not.
+ *
+ * @locks toppar_lock() MUST be held.
+ */
+static const char *
+rd_kafka_fetch_budget_check (rd_kafka_toppar_t *rktp) {
+        rd_kafka_t *rk = rktp->rktp_rkt->rkt_rk;
+        rd_kafka_fetch_budget_t *fb = rk->rk_fetch_budget.fb;
+        int64_t max = rk->rk_fetch_budget.max;
+        int64_t used = rd_atomic64_get(&fb->used);
+        int64_t share;
+
+        if (used >= max)
+                return "queued.max.total.kbytes exceeded";
+
+        if (used + rktp->rktp_fetch_msg_max_bytes <= max)
+                return NULL;
+
+        share = max / RD_MAX(rd_atomic32_get(&fb->member_cnt), 1);
+        if (rd_atomic64_get(&rktp->rktp_fetch_budget_used) >= share)
+                return "queued.max.total.kbytes share exceeded";
+
+        return NULL;
+}
+
+/**@}*/
+
+
 static RD_INLINE int32_t
 rd_kafka_toppar_version_new_barrier0 (rd_kafka_toppar_t *rktp,
 				     const char *func, int line) {
@@ -240,6 +352,8 @@ shptr_rd_kafka_toppar_t *rd_kafka_toppar_new0 (rd_kafka_itopic_t *rkt,
 	rktp->rktp_op_version = rd_atomic32_get(&rktp->rktp_version);
 
         rd_atomic32_init(&rktp->rktp_msgs_inflight, 0);
+        rd_atomic64_init(&rktp->rktp_fetch_budget_used, 0);
+        rd_atomic64_init(&rktp->rktp_linger.us, 0);
         rd_kafka_pid_reset(&rktp->rktp_eos.pid);
 
         /* Consumer: If statistics is available we query the log start offset
@@ -308,9 +422,17 @@ void rd_kafka_toppar_destroy_final (rd_kafka_toppar_t *rktp) {
 		     rktp->rktp_rkt->rkt_topic->str,
                      rktp->rktp_partition, rktp);
 
+        rd_kafka_toppar_lock(rktp);
+        rd_kafka_fetch_budget_member_set(rktp, rd_false);
+        rd_kafka_toppar_unlock(rktp);
+
 	/* Clear queues */
 	rd_kafka_assert(rktp->rktp_rkt->rkt_rk,
 			rd_kafka_msgq_len(&rktp->rktp_xmit_msgq) == 0);
+        /* The lock-free enqueue stack is emptied by the producer that
+         * pushed onto the empty stack, which holds a reference to
+         * rktp until it has moved all staged messages to rktp_msgq. */
+        rd_kafka_assert(rktp->rktp_rkt->rkt_rk, !rktp->rktp_msgq_stage);
 	rd_kafka_dr_msgq(rktp->rktp_rkt, &rktp->rktp_msgq,
 			 RD_KAFKA_RESP_ERR__DESTROY);
 	rd_kafka_q_destroy_owner(rktp->rktp_fetchq);
@@ -671,26 +793,108 @@ void rd_kafka_toppar_desired_del (rd_kafka_toppar_t *rktp) {
 /**
  * Append message at tail of 'rktp' message queue.
  */
-void rd_kafka_toppar_enq_msg (rd_kafka_toppar_t *rktp, rd_kafka_msg_t *rkm) {
-        int queue_len;
-        rd_kafka_q_t *wakeup_q = NULL;
+/**
+ * @brief Acquire the toppar lock for enqueuing messages, accounting
+ *        for the time spent waiting when the lock is contended.
+ */
+static RD_INLINE void rd_kafka_toppar_enq_lock (rd_kafka_toppar_t *rktp) {
+        rd_ts_t ts_start;
 
+        if (likely(rd_kafka_toppar_trylock(rktp) == thrd_success))
+                return;
+
+        ts_start = rd_clock();
         rd_kafka_toppar_lock(rktp);
+        rd_atomic64_add(&rktp->rktp_c.enq_lock_waits, 1);
+        rd_atomic64_add(&rktp->rktp_c.enq_lock_wait_us, rd_clock() - ts_start);
+}
+
+
+#if RD_ATOMICPTR_LOCKFREE
+/**
+ * @brief Move all messages on the lock-free enqueue stack to rktp_msgq,
+ *        in enqueue order, assigning their msgids.
+ *
+ * @returns the number of messages moved.
+ *
+ * @locks toppar_lock() MUST be held
+ */
+static int rd_kafka_toppar_msgq_stage_move (rd_kafka_toppar_t *rktp) {
+        rd_kafka_msg_t *rkm, *next, *first = NULL;
+        int cnt = 0;
 
-        if (!rkm->rkm_u.producer.msgid &&
-            rktp->rktp_partition != RD_KAFKA_PARTITION_UA)
+        /* Reverse the stack to enqueue order */
+        rkm = rd_atomicptr_xchg(&rktp->rktp_msgq_stage, NULL);
+        while (rkm) {
+                next = TAILQ_NEXT(rkm, rkm_link);
+                TAILQ_NEXT(rkm, rkm_link) = first;
+                first = rkm;
+                rkm = next;
+        }
+
+        for (rkm = first ; rkm ; rkm = next) {
+                next = TAILQ_NEXT(rkm, rkm_link);
                 rkm->rkm_u.producer.msgid = ++rktp->rktp_msgid;
+                rd_kafka_msgq_enq(&rktp->rktp_msgq, rkm);
+                cnt++;
+        }
+
+        return cnt;
+}
+#endif
+
+
+void rd_kafka_toppar_enq_msg (rd_kafka_toppar_t *rktp, rd_kafka_msg_t *rkm) {
+        int queue_len, enq_cnt = 1;
+        rd_kafka_q_t *wakeup_q = NULL;
 
-        if (rktp->rktp_partition == RD_KAFKA_PARTITION_UA ||
+#if RD_ATOMICPTR_LOCKFREE
+        if (rktp->rktp_rkt->rkt_rk->rk_conf.lockfree_enqueue &&
+            !rkm->rkm_u.producer.msgid &&
+            rktp->rktp_partition != RD_KAFKA_PARTITION_UA &&
             rktp->rktp_rkt->rkt_conf.queuing_strategy == RD_KAFKA_QUEUE_FIFO) {
-                /* No need for enq_sorted(), this is the oldest message. */
-                queue_len = rd_kafka_msgq_enq(&rktp->rktp_msgq, rkm);
-        } else {
-                queue_len = rd_kafka_msgq_enq_sorted(rktp->rktp_rkt,
-                                                     &rktp->rktp_msgq, rkm);
+                void *head;
+
+                do {
+                        head = rd_atomicptr_get(&rktp->rktp_msgq_stage);
+                        TAILQ_NEXT(rkm, rkm_link) = head;
+                } while (!rd_atomicptr_cas(&rktp->rktp_msgq_stage,
+                                           head, rkm));
+
+                /* Only the producer pushing on an empty stack takes the
+                 * lock and moves the staged messages to the queue,
+                 * concurrent producers return immediately. */
+                if (head)
+                        return;
+
+                rd_kafka_toppar_enq_lock(rktp);
+                enq_cnt = rd_kafka_toppar_msgq_stage_move(rktp);
+                queue_len = rd_kafka_msgq_len(&rktp->rktp_msgq);
+
+        } else
+#endif
+        {
+                rd_kafka_toppar_enq_lock(rktp);
+
+                if (!rkm->rkm_u.producer.msgid &&
+                    rktp->rktp_partition != RD_KAFKA_PARTITION_UA)
+                        rkm->rkm_u.producer.msgid = ++rktp->rktp_msgid;
+
+                if (rktp->rktp_partition == RD_KAFKA_PARTITION_UA ||
+                    rktp->rktp_rkt->rkt_conf.queuing_strategy ==
+                    RD_KAFKA_QUEUE_FIFO) {
+                        /* No need for enq_sorted(), this is the oldest
+                         * message. */
+                        queue_len = rd_kafka_msgq_enq(&rktp->rktp_msgq, rkm);
+                } else {
+                        queue_len = rd_kafka_msgq_enq_sorted(rktp->rktp_rkt,
+                                                             &rktp->rktp_msgq,
+                                                             rkm);
+                }
         }
 
-        if (unlikely(queue_len == 1 &&
+        /* Wake up the broker thread if the queue was empty */
+        if (unlikely(queue_len == enq_cnt &&
                      (wakeup_q = rktp->rktp_msgq_wakeup_q)))
                 rd_kafka_q_keep(wakeup_q);
 
@@ -757,18 +961,7 @@ rd_kafka_msgq_insert_msgq_before (rd_kafka_msgq_t *destq,
 
         /* srcq now contains messages up to the first message in destq,
          * insert srcq at insert_before in destq. */
-        rd_dassert(!TAILQ_EMPTY(&destq->rkmq_msgs));
-        rd_dassert(!TAILQ_EMPTY(&srcq->rkmq_msgs));
-        TAILQ_INSERT_LIST_BEFORE(&destq->rkmq_msgs,
-                                 insert_before,
-                                 &srcq->rkmq_msgs,
-                                 rd_kafka_msgs_head_s,
-                                 rd_kafka_msg_t *,
-                                 rkm_link);
-        destq->rkmq_msg_cnt   += srcq->rkmq_msg_cnt;
-        destq->rkmq_msg_bytes += srcq->rkmq_msg_bytes;
-        srcq->rkmq_msg_cnt     = 0;
-        srcq->rkmq_msg_bytes   = 0;
+        rd_kafka_msgq_insert_list_before(destq, insert_before, srcq);
 
         rd_kafka_msgq_verify_order(NULL, destq, 0, rd_false);
         rd_kafka_msgq_verify_order(NULL, srcq, 0, rd_false);
@@ -1913,6 +2106,8 @@ rd_ts_t rd_kafka_toppar_fetch_decide (rd_kafka_toppar_t *rktp,
         int32_t version;
         rd_ts_t ts_backoff = 0;
         rd_bool_t lease_expired = rd_false;
+        rd_bool_t budget_member = rd_false;
+        const char *budget_reason;
 
         rd_kafka_toppar_lock(rktp);
 
@@ -1987,6 +2182,10 @@ rd_ts_t rd_kafka_toppar_fetch_decide (rd_kafka_toppar_t *rktp,
         }
 
 
+        /* Partitions being consumed share the fetch memory budget. */
+        budget_member = !RD_KAFKA_TOPPAR_IS_PAUSED(rktp) &&
+                !RD_KAFKA_OFFSET_IS_LOGICAL(rktp->rktp_next_offset);
+
 	if (RD_KAFKA_TOPPAR_IS_PAUSED(rktp)) {
 		should_fetch = 0;
 		reason = "paused";
@@ -2007,6 +2206,18 @@ rd_ts_t rd_kafka_toppar_fetch_decide (rd_kafka_toppar_t *rktp,
                 reason = "queued.max.messages.kbytes exceeded";
                 should_fetch = 0;
 
+        } else if (rkb->rkb_rk->rk_fetch_budget.fb &&
+                   (budget_reason = rd_kafka_fetch_budget_check(rktp))) {
+                reason = budget_reason;
+                should_fetch = 0;
+                /* The budget is freed up by the application, not by
+                 * anything the broker thread is woken up by:
+                 * check again shortly. */
+                ts_backoff = rd_clock() + RD_KAFKA_FETCH_BUDGET_RECHECK_US;
+                if (rktp->rktp_fetch)
+                        rd_atomic64_add(&rkb->rkb_rk->rk_fetch_budget.c_held,
+                                        1);
+
         } else if (rktp->rktp_ts_fetch_backoff > rd_clock()) {
                 reason = "fetch backed off";
                 ts_backoff = rktp->rktp_ts_fetch_backoff;
@@ -2014,6 +2225,8 @@ rd_ts_t rd_kafka_toppar_fetch_decide (rd_kafka_toppar_t *rktp,
         }
 
  done:
+        rd_kafka_fetch_budget_member_set(rktp, budget_member);
+
         /* Copy offset stats to finalized place holder. */
         rktp->rktp_offsets_fin = rktp->rktp_offsets;
 
@@ -2891,8 +3104,9 @@ int rd_kafka_topic_partition_match (rd_kafka_t *rk,
 	if (*rktpar->topic == '^') {
 		char errstr[128];
 
-		ret = rd_regex_match(rktpar->topic, topic,
-				     errstr, sizeof(errstr));
+		ret = rd_kafka_regex_cache_match(&rk->rk_regex_cache,
+                                                 rktpar->topic, topic,
+                                                 errstr, sizeof(errstr));
 		if (ret == -1) {
 			rd_kafka_dbg(rk, CGRP,
 				     "SUBMATCH",
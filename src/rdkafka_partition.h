@@ -104,6 +104,13 @@ struct rd_kafka_toppar_s { /* rd_kafka_toppar_t */
         rd_kafka_q_t      *rktp_msgq_wakeup_q;  /**< Wake-up queue */
 	rd_kafka_msgq_t    rktp_msgq;      /* application->rdkafka queue.
 					    * protected by rktp_lock */
+        void              *rktp_msgq_stage; /**< Lock-free enqueue stack
+                                             *   (LIFO) of messages, linked
+                                             *   through rkm_link.tqe_next,
+                                             *   that are moved to rktp_msgq
+                                             *   by rd_kafka_toppar_enq_msg().
+                                             *   Only used with
+                                             *   enable.lockfree.enqueue. */
         rd_kafka_msgq_t    rktp_xmit_msgq; /* internal broker xmit queue.
                                             * local to broker thread. */
 
@@ -114,6 +121,15 @@ struct rd_kafka_toppar_s { /* rd_kafka_toppar_t */
 						  * from broker.
                                                   * Broker thread -> App */
         rd_kafka_q_t      *rktp_ops;             /* * -> Main thread */
+        rd_atomic64_t      rktp_fetch_budget_used; /**< Bytes of fetched
+                                                    *   messages held, counted
+                                                    *   towards the fetch
+                                                    *   memory budget. */
+        rd_bool_t          rktp_fetch_budget_member; /**< Counted as being
+                                                      *   consumed by the
+                                                      *   fetch memory budget.
+                                                      *   Locality: broker
+                                                      *   thread */
 
         rd_atomic32_t      rktp_msgs_inflight;  /**< Current number of
                                                  *   messages in-flight to/from
@@ -359,8 +375,24 @@ struct rd_kafka_toppar_s { /* rd_kafka_toppar_t */
                 rd_atomic64_t producer_enq_msgs; /**< Producer: enqueued msgs */
                 rd_atomic64_t rx_ver_drops;  /**< Consumer: outdated message
                                               *             drops. */
+                rd_atomic64_t enq_lock_waits; /**< Producer: contended
+                                               *   toppar lock acquisitions
+                                               *   on message enqueue. */
+                rd_atomic64_t enq_lock_wait_us; /**< .. total wait time */
         } rktp_c;
 
+        /**
+         * Adaptive linger state, see rd_kafka_toppar_linger_us().
+         * @locality broker thread
+         */
+        struct {
+                rd_ts_t ts_sample;    /**< Start of current rate sample */
+                int64_t enq_msgs;     /**< producer_enq_msgs at ts_sample */
+                double  rate;         /**< Smoothed arrival rate (msgs/s) */
+                rd_atomic64_t us;     /**< Current linger time (us),
+                                       *   also read by stats. */
+        } rktp_linger;
+
 };
 
 
@@ -403,6 +435,7 @@ struct rd_kafka_toppar_s { /* rd_kafka_toppar_t */
 
 
 #define rd_kafka_toppar_lock(rktp)     mtx_lock(&(rktp)->rktp_lock)
+#define rd_kafka_toppar_trylock(rktp)  mtx_trylock(&(rktp)->rktp_lock)
 #define rd_kafka_toppar_unlock(rktp)   mtx_unlock(&(rktp)->rktp_lock)
 
 static const char *rd_kafka_toppar_name (const rd_kafka_toppar_t *rktp)
@@ -501,6 +534,39 @@ rd_ts_t rd_kafka_toppar_fetch_decide (rd_kafka_toppar_t *rktp,
                                       int force_remove);
 
 
+/**
+ * @brief Partitions held back by the fetch memory budget are reconsidered
+ *        at this interval (microseconds).
+ */
+#define RD_KAFKA_FETCH_BUDGET_RECHECK_US  (50*1000)
+
+extern rd_kafka_fetch_budget_t rd_kafka_fetch_budget_process;
+
+void rd_kafka_fetch_budget_init (rd_kafka_t *rk);
+int64_t rd_kafka_fetch_budget_remains (rd_kafka_t *rk);
+
+/**
+ * @brief Account \p size bytes of fetched messages for \p rktp in the
+ *        consumer fetch memory budget, or release them if \p size is
+ *        negative. No-op unless queued.max.total.kbytes is set.
+ *
+ * @locality any
+ * @locks none
+ */
+static RD_INLINE RD_UNUSED void
+rd_kafka_fetch_budget_add (rd_kafka_toppar_t *rktp, int64_t size) {
+        rd_kafka_t *rk = rktp->rktp_rkt->rkt_rk;
+
+        if (likely(!rk->rk_fetch_budget.fb))
+                return;
+
+        rd_atomic64_add(&rktp->rktp_fetch_budget_used, size);
+        rd_atomic64_add(&rk->rk_fetch_budget.local.used, size);
+        if (rk->rk_fetch_budget.fb != &rk->rk_fetch_budget.local)
+                rd_atomic64_add(&rk->rk_fetch_budget.fb->used, size);
+}
+
+
 
 rd_ts_t rd_kafka_broker_consumer_toppar_serve (rd_kafka_broker_t *rkb,
                                                rd_kafka_toppar_t *rktp);
@@ -644,6 +710,9 @@ int rd_kafka_topic_partition_list_regex_cnt (
 struct rd_kafka_toppar_ver {
 	shptr_rd_kafka_toppar_t *s_rktp;
 	int32_t version;
+        rd_bool_t seen;  /**< Partition was included in the Fetch
+                          *   response. Incremental fetch sessions
+                          *   omit unchanged partitions. */
 };
 
 
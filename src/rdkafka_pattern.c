@@ -28,6 +28,7 @@
 
 #include "rdkafka_int.h"
 #include "rdkafka_pattern.h"
+#include "rdunittest.h"
 
 void rd_kafka_pattern_destroy (rd_kafka_pattern_list_t *plist,
                                rd_kafka_pattern_t *rkpat) {
@@ -222,3 +223,315 @@ rd_kafka_pattern_list_copy (rd_kafka_pattern_list_t *src) {
 	return rd_kafka_pattern_list_new(src->rkpl_orig,
 					 errstr, sizeof(errstr));
 }
+
+
+
+/**
+ * @brief Compare cache entries by pattern.
+ */
+static int rd_kafka_regex_cache_entry_cmp (const void *_a, const void *_b) {
+        const rd_kafka_regex_cache_entry_t *a = _a, *b = _b;
+        return strcmp(a->rkrce_pattern, b->rkrce_pattern);
+}
+
+
+/**
+ * @brief Initialize an empty regex cache.
+ */
+void rd_kafka_regex_cache_init (rd_kafka_regex_cache_t *rkrc) {
+        rd_avl_init(&rkrc->rkrc_avl, rd_kafka_regex_cache_entry_cmp,
+                    RD_AVL_F_LOCKS);
+        mtx_init(&rkrc->rkrc_lock, mtx_plain);
+        TAILQ_INIT(&rkrc->rkrc_entries);
+        rkrc->rkrc_cnt = 0;
+}
+
+
+/**
+ * @brief Destroy the cache and all its compiled regexes.
+ *
+ * @locks No other thread may use the cache.
+ */
+void rd_kafka_regex_cache_destroy (rd_kafka_regex_cache_t *rkrc) {
+        rd_kafka_regex_cache_entry_t *rkrce;
+
+        while ((rkrce = TAILQ_FIRST(&rkrc->rkrc_entries))) {
+                TAILQ_REMOVE(&rkrc->rkrc_entries, rkrce, rkrce_link);
+                if (rkrce->rkrce_re)
+                        rd_regex_destroy(rkrce->rkrce_re);
+                if (rkrce->rkrce_errstr)
+                        rd_free(rkrce->rkrce_errstr);
+                rd_free(rkrce->rkrce_pattern);
+                rd_free(rkrce);
+        }
+
+        rd_avl_destroy(&rkrc->rkrc_avl);
+        mtx_destroy(&rkrc->rkrc_lock);
+}
+
+
+/**
+ * @brief Get the compiled regex for \p pattern, compiling and caching it
+ *        on first use.
+ *
+ * Invalid patterns are cached too so that they are not recompiled,
+ * their compilation error is written to \p errstr on each call.
+ *
+ * @param ownedp is set to true if the returned regex is not cached
+ *               (the cache is full).
+ *
+ * @returns the compiled regex, which must be released with
+ *          rd_kafka_regex_cache_release(), or NULL if the pattern is invalid.
+ *
+ * @locality any
+ * @locks none
+ */
+rd_regex_t *rd_kafka_regex_cache_get (rd_kafka_regex_cache_t *rkrc,
+                                      const char *pattern,
+                                      rd_bool_t *ownedp,
+                                      char *errstr, size_t errstr_size) {
+        rd_kafka_regex_cache_entry_t skel, *rkrce;
+        char errstr2[256];
+        rd_regex_t *re;
+
+        *ownedp = rd_false;
+
+        skel.rkrce_pattern = (char *)pattern;
+        rkrce = rd_avl_find(&rkrc->rkrc_avl, &skel, 1);
+
+        if (unlikely(!rkrce)) {
+                /* Compile outside the lock */
+                re = rd_regex_comp(pattern, errstr2, sizeof(errstr2));
+
+                mtx_lock(&rkrc->rkrc_lock);
+
+                /* Another thread may have cached it in the meantime */
+                rkrce = rd_avl_find(&rkrc->rkrc_avl, &skel, 1);
+                if (rkrce) {
+                        if (re)
+                                rd_regex_destroy(re);
+
+                } else if (rkrc->rkrc_cnt >= RD_KAFKA_REGEX_CACHE_MAX) {
+                        mtx_unlock(&rkrc->rkrc_lock);
+                        if (!re && errstr)
+                                rd_strlcpy(errstr, errstr2, errstr_size);
+                        *ownedp = !!re;
+                        return re;
+
+                } else {
+                        rkrce = rd_calloc(1, sizeof(*rkrce));
+                        rkrce->rkrce_pattern = rd_strdup(pattern);
+                        rkrce->rkrce_re = re;
+                        if (!re)
+                                rkrce->rkrce_errstr = rd_strdup(errstr2);
+                        TAILQ_INSERT_TAIL(&rkrc->rkrc_entries, rkrce,
+                                          rkrce_link);
+                        RD_AVL_INSERT(&rkrc->rkrc_avl, rkrce, rkrce_avlnode);
+                        rkrc->rkrc_cnt++;
+                }
+
+                mtx_unlock(&rkrc->rkrc_lock);
+        }
+
+        if (!rkrce->rkrce_re && errstr)
+                rd_strlcpy(errstr, rkrce->rkrce_errstr, errstr_size);
+
+        return rkrce->rkrce_re;
+}
+
+
+/**
+ * @brief Release a regex returned by rd_kafka_regex_cache_get().
+ */
+void rd_kafka_regex_cache_release (rd_regex_t *re, rd_bool_t owned) {
+        if (owned)
+                rd_regex_destroy(re);
+}
+
+
+/**
+ * @brief Cached equivalent of rd_regex_match().
+ *
+ * @returns 1 on match, 0 on non-match or -1 if \p pattern is invalid
+ *          in which case a human readable error string is written to
+ *          \p errstr (if not NULL).
+ */
+int rd_kafka_regex_cache_match (rd_kafka_regex_cache_t *rkrc,
+                                const char *pattern, const char *str,
+                                char *errstr, size_t errstr_size) {
+        rd_regex_t *re;
+        rd_bool_t owned;
+        int r;
+
+        if (!(re = rd_kafka_regex_cache_get(rkrc, pattern, &owned,
+                                            errstr, errstr_size)))
+                return -1;
+
+        r = rd_regex_exec(re, str);
+
+        rd_kafka_regex_cache_release(re, owned);
+
+        return r;
+}
+
+
+
+/**
+ * @brief Create a matcher for the topics and regexes in \p match.
+ *
+ * Regexes are compiled (or looked up) once here rather than for each
+ * matched topic, invalid regexes are logged and never match.
+ */
+rd_kafka_topic_matcher_t *
+rd_kafka_topic_matcher_new (rd_kafka_t *rk, rd_kafka_regex_cache_t *rkrc,
+                            const rd_kafka_topic_partition_list_t *match) {
+        rd_kafka_topic_matcher_t *rktm;
+        int i;
+
+        rktm = rd_calloc(1, sizeof(*rktm));
+        rktm->cnt = match->cnt;
+        rktm->elems = rd_calloc(RD_MAX(match->cnt, 1),
+                                sizeof(*rktm->elems));
+
+        for (i = 0 ; i < match->cnt ; i++) {
+                const char *topic = match->elems[i].topic;
+                unsigned char c;
+
+                if (*topic == '^') {
+                        char errstr[128];
+                        const char *prefix;
+                        size_t prefix_len;
+
+                        rktm->elems[i].re = rd_kafka_regex_cache_get(
+                                rkrc, topic, &rktm->elems[i].owned,
+                                errstr, sizeof(errstr));
+                        if (!rktm->elems[i].re) {
+                                if (rk)
+                                        rd_kafka_dbg(rk, TOPIC, "TOPICREGEX",
+                                                     "Topic regex \"%s\" "
+                                                     "is invalid: %s",
+                                                     topic, errstr);
+                                continue;
+                        }
+
+                        prefix = rd_regex_prefix(rktm->elems[i].re,
+                                                 &prefix_len);
+                        if (!prefix) {
+                                /* Any first character may match */
+                                memset(rktm->first, 0xff,
+                                       sizeof(rktm->first));
+                                continue;
+                        }
+                        c = (unsigned char)*prefix;
+
+                } else {
+                        rktm->elems[i].topic = topic;
+                        c = (unsigned char)*topic;
+                }
+
+                rktm->first[c / 32] |= 1u << (c % 32);
+        }
+
+        return rktm;
+}
+
+
+void rd_kafka_topic_matcher_destroy (rd_kafka_topic_matcher_t *rktm) {
+        int i;
+
+        for (i = 0 ; i < rktm->cnt ; i++)
+                if (rktm->elems[i].re)
+                        rd_kafka_regex_cache_release(rktm->elems[i].re,
+                                                     rktm->elems[i].owned);
+        rd_free(rktm->elems);
+        rd_free(rktm);
+}
+
+
+
+/**
+ * @brief Regex cache and topic matcher unittests
+ */
+int unittest_pattern (void) {
+        rd_kafka_regex_cache_t rkrc;
+        rd_kafka_topic_partition_list_t *match;
+        rd_kafka_topic_matcher_t *rktm;
+        rd_regex_t *re, *re2;
+        rd_bool_t owned;
+        char errstr[128];
+        static const struct {
+                const char *topic;
+                int exp[4];  /**< Expected match per match list entry */
+        } topics[] = {
+                { "orders",       { 1, 0, 0, 0 } },
+                { "orders.eu",    { 0, 1, 0, 0 } },
+                { "payments.v2",  { 0, 0, 1, 0 } },
+                { "payments.v2x", { 0, 0, 0, 0 } },
+                { "customers",    { 0, 0, 0, 0 } },
+                { "Xorders.eu",   { 0, 0, 0, 0 } },
+                { NULL }
+        };
+        int i, j;
+
+        rd_kafka_regex_cache_init(&rkrc);
+
+        /* Same pattern yields the same cached regex */
+        re = rd_kafka_regex_cache_get(&rkrc, "^orders\\..*", &owned,
+                                      errstr, sizeof(errstr));
+        RD_UT_ASSERT(re && !owned, "expected cached regex: %s", errstr);
+        re2 = rd_kafka_regex_cache_get(&rkrc, "^orders\\..*", &owned,
+                                       errstr, sizeof(errstr));
+        RD_UT_ASSERT(re == re2, "expected same cached regex");
+        RD_UT_ASSERT(rkrc.rkrc_cnt == 1, "expected 1 entry, not %d",
+                     rkrc.rkrc_cnt);
+        rd_kafka_regex_cache_release(re, owned);
+        rd_kafka_regex_cache_release(re2, owned);
+
+        /* Invalid patterns are cached and keep failing */
+        for (i = 0 ; i < 2 ; i++) {
+                *errstr = '\0';
+                RD_UT_ASSERT(rd_kafka_regex_cache_match(&rkrc, "^bad(",
+                                                        "bad", errstr,
+                                                        sizeof(errstr)) == -1,
+                             "expected invalid regex");
+                RD_UT_ASSERT(*errstr, "expected error string");
+        }
+        RD_UT_ASSERT(rkrc.rkrc_cnt == 2, "expected 2 entries, not %d",
+                     rkrc.rkrc_cnt);
+
+        /* Matcher */
+        match = rd_kafka_topic_partition_list_new(4);
+        rd_kafka_topic_partition_list_add(match, "orders",
+                                          RD_KAFKA_PARTITION_UA);
+        rd_kafka_topic_partition_list_add(match, "^orders\\..*",
+                                          RD_KAFKA_PARTITION_UA);
+        rd_kafka_topic_partition_list_add(match, "^payments\\.v[0-9]$",
+                                          RD_KAFKA_PARTITION_UA);
+        rd_kafka_topic_partition_list_add(match, "^bad(",
+                                          RD_KAFKA_PARTITION_UA);
+
+        rktm = rd_kafka_topic_matcher_new(NULL, &rkrc, match);
+
+        RD_UT_ASSERT(!rd_kafka_topic_matcher_candidate(rktm, "customers"),
+                     "expected customers to be prefiltered");
+
+        for (i = 0 ; topics[i].topic ; i++) {
+                for (j = 0 ; j < match->cnt ; j++) {
+                        int r = rd_kafka_topic_matcher_candidate(
+                                rktm, topics[i].topic) &&
+                                rd_kafka_topic_matcher_match(
+                                        rktm, j, topics[i].topic);
+                        RD_UT_ASSERT(r == topics[i].exp[j],
+                                     "%s vs %s: expected %d, not %d",
+                                     topics[i].topic, match->elems[j].topic,
+                                     topics[i].exp[j], r);
+                }
+        }
+
+        rd_kafka_topic_matcher_destroy(rktm);
+        rd_kafka_topic_partition_list_destroy(match);
+
+        rd_kafka_regex_cache_destroy(&rkrc);
+
+        RD_UT_PASS();
+}
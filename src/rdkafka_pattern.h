@@ -29,6 +29,7 @@
 #define _RDKAFKA_PATTERN_H_
 
 #include "rdregex.h"
+#include "rdavl.h"
 
 typedef struct rd_kafka_pattern_s {
         TAILQ_ENTRY(rd_kafka_pattern_s)  rkpat_link;
@@ -65,4 +66,104 @@ rd_kafka_pattern_list_t *rd_kafka_pattern_list_new (const char *patternlist,
 rd_kafka_pattern_list_t *
 rd_kafka_pattern_list_copy (rd_kafka_pattern_list_t *src);
 
+
+/**
+ * @name Compiled regex cache
+ *
+ * Maps regex pattern strings (e.g., wildcard subscriptions) to their
+ * compiled form so that repeated matching of the same pattern, such as on
+ * each metadata refresh, does not recompile it.
+ * Entries live until the cache is destroyed, so returned regexes
+ * remain valid for the lifetime of the cache.
+ * @{
+ */
+
+/** Maximum number of cached patterns, beyond which patterns are compiled
+ *  on each use. */
+#define RD_KAFKA_REGEX_CACHE_MAX 1000
+
+typedef struct rd_kafka_regex_cache_entry_s {
+        rd_avl_node_t rkrce_avlnode;
+        TAILQ_ENTRY(rd_kafka_regex_cache_entry_s) rkrce_link;
+        char       *rkrce_pattern;
+        rd_regex_t *rkrce_re;      /**< Compiled regex, or NULL if invalid */
+        char       *rkrce_errstr;  /**< Compilation error if invalid */
+} rd_kafka_regex_cache_entry_t;
+
+typedef struct rd_kafka_regex_cache_s {
+        rd_avl_t     rkrc_avl;     /**< Lookup by pattern */
+        mtx_t        rkrc_lock;    /**< Serializes inserts */
+        TAILQ_HEAD(, rd_kafka_regex_cache_entry_s) rkrc_entries;
+        int          rkrc_cnt;
+} rd_kafka_regex_cache_t;
+
+void rd_kafka_regex_cache_init (rd_kafka_regex_cache_t *rkrc);
+void rd_kafka_regex_cache_destroy (rd_kafka_regex_cache_t *rkrc);
+rd_regex_t *rd_kafka_regex_cache_get (rd_kafka_regex_cache_t *rkrc,
+                                      const char *pattern,
+                                      rd_bool_t *ownedp,
+                                      char *errstr, size_t errstr_size);
+void rd_kafka_regex_cache_release (rd_regex_t *re, rd_bool_t owned);
+int rd_kafka_regex_cache_match (rd_kafka_regex_cache_t *rkrc,
+                                const char *pattern, const char *str,
+                                char *errstr, size_t errstr_size);
+
+/**@}*/
+
+
+/**
+ * @name Multi-pattern topic matcher
+ *
+ * Matches topic names against all entries of a subscription list
+ * (literal topic names and "^" regexes) at once, rejecting topics
+ * whose first character can't start any match before looking at the
+ * individual entries.
+ * @{
+ */
+
+typedef struct rd_kafka_topic_matcher_s {
+        int cnt;
+        struct {
+                const char *topic;  /**< Literal topic name, or NULL */
+                rd_regex_t *re;     /**< Compiled regex, or NULL */
+                rd_bool_t   owned;  /**< re is not from the cache */
+        } *elems;
+        uint32_t first[256/32];     /**< Bitmap of possible first characters
+                                     *   of matching topics */
+} rd_kafka_topic_matcher_t;
+
+rd_kafka_topic_matcher_t *
+rd_kafka_topic_matcher_new (rd_kafka_t *rk, rd_kafka_regex_cache_t *rkrc,
+                            const rd_kafka_topic_partition_list_t *match);
+void rd_kafka_topic_matcher_destroy (rd_kafka_topic_matcher_t *rktm);
+
+/**
+ * @returns true if \p topic may match any of the matcher's entries,
+ *          false if it definitely does not.
+ */
+static RD_INLINE RD_UNUSED rd_bool_t
+rd_kafka_topic_matcher_candidate (const rd_kafka_topic_matcher_t *rktm,
+                                  const char *topic) {
+        unsigned char c = (unsigned char)*topic;
+        return !!(rktm->first[c / 32] & (1u << (c % 32)));
+}
+
+/**
+ * @returns true if \p topic matches the \p idx'th entry of the list
+ *          the matcher was created from.
+ */
+static RD_INLINE RD_UNUSED rd_bool_t
+rd_kafka_topic_matcher_match (const rd_kafka_topic_matcher_t *rktm,
+                              int idx, const char *topic) {
+        if (rktm->elems[idx].topic)
+                return !strcmp(rktm->elems[idx].topic, topic);
+        else if (rktm->elems[idx].re)
+                return rd_regex_exec(rktm->elems[idx].re, topic);
+        return rd_false; /* Invalid regex */
+}
+
+/**@}*/
+
+int unittest_pattern (void);
+
 #endif /* _RDKAFKA_PATTERN_H_ */
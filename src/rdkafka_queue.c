@@ -30,6 +30,7 @@
 #include "rdkafka_offset.h"
 #include "rdkafka_topic.h"
 #include "rdkafka_interceptor.h"
+#include "rdunittest.h"
 
 int RD_TLS rd_kafka_yield_thread = 0;
 
@@ -68,6 +69,10 @@ void rd_kafka_q_destroy_final (rd_kafka_q_t *rkq) {
         rd_kafka_q_fwd_set0(rkq, NULL, 0/*no-lock*/, 0 /*no-fwd-app*/);
         rd_kafka_q_purge0(rkq, 0/*no-lock*/);
 	assert(!rkq->rkq_fwdq);
+        /* The lock-free enqueue stack was drained and closed
+         * by rd_kafka_q_disable0(). */
+        rd_assert(!rkq->rkq_mpsc_head ||
+                  rkq->rkq_mpsc_head == RD_KAFKA_Q_MPSC_CLOSED);
         mtx_unlock(&rkq->rkq_lock);
 	mtx_destroy(&rkq->rkq_lock);
 	cnd_destroy(&rkq->rkq_cond);
@@ -78,6 +83,154 @@ void rd_kafka_q_destroy_final (rd_kafka_q_t *rkq) {
 
 
 
+#if RD_ATOMICPTR_LOCKFREE
+/**
+ * @brief Move the lock-free enqueue stack \p rko (LIFO) to the queue,
+ *        in enqueue order, and wake up the consumer once.
+ *
+ * @locks rkq_lock MUST be held
+ */
+void rd_kafka_q_mpsc_move0 (rd_kafka_q_t *rkq, rd_kafka_op_t *rko) {
+        rd_kafka_op_t *next, *first = NULL;
+        int cnt = 0;
+
+        /* The queue is neither disabled nor forwarded while the
+         * stack is open, see rd_kafka_q_mpsc_close0(). */
+        rd_dassert((rkq->rkq_flags & RD_KAFKA_Q_F_READY) && !rkq->rkq_fwdq);
+
+        /* Reverse the stack to enqueue order */
+        while (rko) {
+                next = rko->rko_link.tqe_next;
+                rko->rko_link.tqe_next = first;
+                first = rko;
+                rko = next;
+        }
+
+        for (rko = first ; rko ; rko = next) {
+                next = rko->rko_link.tqe_next;
+                if (!rko->rko_serve && rkq->rkq_serve) {
+                        rko->rko_serve = rkq->rkq_serve;
+                        rko->rko_serve_opaque = rkq->rkq_opaque;
+                }
+                rd_kafka_q_enq0(rkq, rko, 0/*at tail*/);
+                cnt++;
+        }
+
+        if (cnt > 0) {
+                if (cnt > 1)
+                        cnd_broadcast(&rkq->rkq_cond);
+                else
+                        cnd_signal(&rkq->rkq_cond);
+                if (rkq->rkq_qlen == cnt)
+                        rd_kafka_q_io_event(rkq, rd_false/*no rate-limiting*/);
+        }
+}
+
+
+/**
+ * @brief Move all ops on the lock-free enqueue stack to the queue,
+ *        in enqueue order, waking up the consumer.
+ *
+ * If the ops were already moved by another thread that locked the queue
+ * that thread woke up the consumer.
+ *
+ * @locality any thread
+ * @locks rkq MUST NOT be locked
+ */
+void rd_kafka_q_mpsc_drain (rd_kafka_q_t *rkq) {
+        mtx_lock(&rkq->rkq_lock);
+        rd_kafka_q_mpsc_drain0(rkq);
+        mtx_unlock(&rkq->rkq_lock);
+}
+
+
+/**
+ * @brief Wait for \p rkq 's cond to be signalled, as cnd_timedwait_abs().
+ *
+ * The waiter is announced to lock-free enqueuers before taking a last
+ * look at the stack: ops pushed after that look wake us up,
+ * see rd_kafka_q_mpsc_enq().
+ *
+ * @locks rkq_lock MUST be held
+ */
+static int rd_kafka_q_mpsc_cond_wait0 (rd_kafka_q_t *rkq,
+                                       const struct timespec *tspec) {
+        rd_kafka_op_t *rko;
+        int r = thrd_success;
+
+        rd_atomic32_add(&rkq->rkq_mpsc_waiters, 1);
+
+        /* Full barrier after announcing the waiter */
+        rko = rd_atomicptr_xchg(&rkq->rkq_mpsc_head, NULL);
+        if (rko)
+                rd_kafka_q_mpsc_move0(rkq, rko);
+        else
+                r = cnd_timedwait_abs(&rkq->rkq_cond, &rkq->rkq_lock, tspec);
+
+        rd_atomic32_sub(&rkq->rkq_mpsc_waiters, 1);
+
+        /* Ops pushed while we were being woken up, or while the queue
+         * was disabled or forwarded (closed stack). */
+        rd_kafka_q_mpsc_drain0(rkq);
+        if (rkq->rkq_qlen > 0)
+                r = thrd_success;
+
+        return r;
+}
+
+
+/**
+ * @brief Close the lock-free enqueue stack prior to the queue being
+ *        disabled or forwarded.
+ *
+ * Ops already pushed were accepted by rd_kafka_q_enq() and are moved to
+ * the queue, subsequent rd_kafka_q_enq() calls use the locked path which
+ * honours the disabled and forwarded states.
+ *
+ * @locks rkq_lock MUST be held
+ */
+void rd_kafka_q_mpsc_close0 (rd_kafka_q_t *rkq) {
+        rd_kafka_op_t *rko;
+
+        if (!(rkq->rkq_flags & RD_KAFKA_Q_F_MPSC))
+                return;
+
+        rko = rd_atomicptr_xchg(&rkq->rkq_mpsc_head, RD_KAFKA_Q_MPSC_CLOSED);
+        if (rko != RD_KAFKA_Q_MPSC_CLOSED)
+                rd_kafka_q_mpsc_move0(rkq, rko);
+}
+
+
+/**
+ * @brief Reopen the lock-free enqueue stack if the queue is usable again.
+ *
+ * @locks rkq_lock MUST be held
+ */
+static void rd_kafka_q_mpsc_reopen0 (rd_kafka_q_t *rkq) {
+        if ((rkq->rkq_flags & RD_KAFKA_Q_F_MPSC) &&
+            (rkq->rkq_flags & RD_KAFKA_Q_F_READY) && !rkq->rkq_fwdq)
+                rd_atomicptr_cas(&rkq->rkq_mpsc_head,
+                                 RD_KAFKA_Q_MPSC_CLOSED, NULL);
+}
+#endif
+
+
+/**
+ * @brief Wait for \p rkq 's cond to be signalled, as cnd_timedwait_abs().
+ *
+ * @locks rkq_lock MUST be held
+ */
+static RD_INLINE int rd_kafka_q_cond_wait0 (rd_kafka_q_t *rkq,
+                                            const struct timespec *tspec) {
+#if RD_ATOMICPTR_LOCKFREE
+        if ((rkq->rkq_flags & RD_KAFKA_Q_F_MPSC) &&
+            rd_atomicptr_get(&rkq->rkq_mpsc_head) != RD_KAFKA_Q_MPSC_CLOSED)
+                return rd_kafka_q_mpsc_cond_wait0(rkq, tspec);
+#endif
+        return cnd_timedwait_abs(&rkq->rkq_cond, &rkq->rkq_lock, tspec);
+}
+
+
 /**
  * Initialize a queue.
  */
@@ -91,6 +244,8 @@ void rd_kafka_q_init0 (rd_kafka_q_t *rkq, rd_kafka_t *rk,
 	rkq->rkq_qio    = NULL;
         rkq->rkq_serve  = NULL;
         rkq->rkq_opaque = NULL;
+        rkq->rkq_mpsc_head = NULL;
+        rd_atomic32_init(&rkq->rkq_mpsc_waiters, 0);
 	mtx_init(&rkq->rkq_lock, mtx_plain);
 	cnd_init(&rkq->rkq_cond);
 #if ENABLE_DEVEL
@@ -131,6 +286,10 @@ void rd_kafka_q_fwd_set0 (rd_kafka_q_t *srcq, rd_kafka_q_t *destq,
                 mtx_lock(&srcq->rkq_lock);
         if (fwd_app)
                 srcq->rkq_flags |= RD_KAFKA_Q_F_FWD_APP;
+#if RD_ATOMICPTR_LOCKFREE
+        if (destq)
+                rd_kafka_q_mpsc_close0(srcq);
+#endif
 	if (srcq->rkq_fwdq) {
 		rd_kafka_q_destroy(srcq->rkq_fwdq);
 		srcq->rkq_fwdq = NULL;
@@ -147,6 +306,10 @@ void rd_kafka_q_fwd_set0 (rd_kafka_q_t *srcq, rd_kafka_q_t *destq,
 
 		srcq->rkq_fwdq = destq;
 	}
+#if RD_ATOMICPTR_LOCKFREE
+        else
+                rd_kafka_q_mpsc_reopen0(srcq);
+#endif
         if (do_lock)
                 mtx_unlock(&srcq->rkq_lock);
 }
@@ -171,6 +334,8 @@ int rd_kafka_q_purge0 (rd_kafka_q_t *rkq, int do_lock) {
                 return cnt;
         }
 
+        rd_kafka_q_mpsc_drain0(rkq);
+
 	/* Move ops queue to tmpq to avoid lock-order issue
 	 * by locks taken from rd_kafka_op_destroy(). */
 	TAILQ_MOVE(&tmpq, &rkq->rkq_q, rko_link);
@@ -215,6 +380,8 @@ void rd_kafka_q_purge_toppar_version (rd_kafka_q_t *rkq,
                 return;
         }
 
+        rd_kafka_q_mpsc_drain0(rkq);
+
         /* Move ops to temporary queue and then destroy them from there
          * without locks to avoid lock-ordering problems in op_destroy() */
         while ((rko = TAILQ_FIRST(&rkq->rkq_q)) && rko->rko_rktp &&
@@ -255,6 +422,9 @@ int rd_kafka_q_move_cnt (rd_kafka_q_t *dstq, rd_kafka_q_t *srcq,
 	}
 
 	if (!dstq->rkq_fwdq && !srcq->rkq_fwdq) {
+                rd_kafka_q_mpsc_drain0(srcq);
+                rd_kafka_q_mpsc_drain0(dstq);
+
 		if (cnt > 0 && dstq->rkq_qlen == 0)
 			rd_kafka_q_io_event(dstq, rd_false/*no rate-limiting*/);
 
@@ -351,6 +521,8 @@ rd_kafka_op_t *rd_kafka_q_pop_serve (rd_kafka_q_t *rkq, rd_ts_t timeout_us,
 
                 rd_timeout_init_timespec_us(&timeout_tspec, timeout_us);
 
+                rd_kafka_q_mpsc_drain0(rkq);
+
                 while (1) {
                         rd_kafka_op_res_t res;
 
@@ -387,9 +559,7 @@ rd_kafka_op_t *rd_kafka_q_pop_serve (rd_kafka_q_t *rkq, rd_ts_t timeout_us,
                                 return NULL;
                         }
 
-                        if (cnd_timedwait_abs(&rkq->rkq_cond,
-                                              &rkq->rkq_lock,
-                                              &timeout_tspec) !=
+                        if (rd_kafka_q_cond_wait0(rkq, &timeout_tspec) !=
                             thrd_success) {
 				mtx_unlock(&rkq->rkq_lock);
 				return NULL;
@@ -456,11 +626,12 @@ int rd_kafka_q_serve (rd_kafka_q_t *rkq, int timeout_ms,
 
         rd_timeout_init_timespec(&timeout_tspec, timeout_ms);
 
+        rd_kafka_q_mpsc_drain0(rkq);
+
         /* Wait for op */
         while (!(rko = TAILQ_FIRST(&rkq->rkq_q)) &&
                !rd_kafka_q_check_yield(rkq) &&
-               cnd_timedwait_abs(&rkq->rkq_cond, &rkq->rkq_lock,
-                                 &timeout_tspec) == thrd_success)
+               rd_kafka_q_cond_wait0(rkq, &timeout_tspec) == thrd_success)
                 ;
 
 	if (!rko) {
@@ -549,10 +720,12 @@ int rd_kafka_q_serve_rkmessages (rd_kafka_q_t *rkq, int timeout_ms,
 
                 mtx_lock(&rkq->rkq_lock);
 
+                rd_kafka_q_mpsc_drain0(rkq);
+
                 while (!(rko = TAILQ_FIRST(&rkq->rkq_q)) &&
                        !rd_kafka_q_check_yield(rkq) &&
-                       cnd_timedwait_abs(&rkq->rkq_cond, &rkq->rkq_lock,
-                                         &timeout_tspec) == thrd_success)
+                       rd_kafka_q_cond_wait0(rkq, &timeout_tspec) ==
+                       thrd_success)
                         ;
 
 		if (!rko) {
@@ -747,6 +920,8 @@ void rd_kafka_q_io_event_enable (rd_kafka_q_t *rkq, rd_socket_t fd,
                 rkq->rkq_qio = qio;
         }
 
+        rd_kafka_q_mpsc_drain0(rkq);
+
         mtx_unlock(&rkq->rkq_lock);
 
 }
@@ -785,6 +960,8 @@ void rd_kafka_q_cb_event_enable (rd_kafka_q_t *rkq,
                 rkq->rkq_qio = qio;
         }
 
+        rd_kafka_q_mpsc_drain0(rkq);
+
         mtx_unlock(&rkq->rkq_lock);
 
 }
@@ -843,6 +1020,8 @@ int rd_kafka_q_apply (rd_kafka_q_t *rkq,
 		return cnt;
 	}
 
+        rd_kafka_q_mpsc_drain0(rkq);
+
 	next = TAILQ_FIRST(&rkq->rkq_q);
 	while ((rko = next)) {
 		next = TAILQ_NEXT(next, rko_link);
@@ -900,6 +1079,7 @@ void rd_kafka_q_fix_offsets (rd_kafka_q_t *rkq, int64_t min_offset,
  */
 void rd_kafka_q_dump (FILE *fp, rd_kafka_q_t *rkq) {
         mtx_lock(&rkq->rkq_lock);
+        rd_kafka_q_mpsc_drain0(rkq);
         fprintf(fp, "Queue %p \"%s\" (refcnt %d, flags 0x%x, %d ops, "
                 "%"PRId64" bytes)\n",
                 rkq, rkq->rkq_name, rkq->rkq_refcnt, rkq->rkq_flags,
@@ -946,3 +1126,217 @@ void rd_kafka_enq_once_trigger_destroy (void *ptr) {
 
         rd_kafka_enq_once_trigger(eonce, RD_KAFKA_RESP_ERR__DESTROY, "destroy");
 }
+
+
+
+/**
+ * @name Unit tests
+ * @{
+ *
+ */
+
+struct ut_q_producer {
+        rd_kafka_q_t *rkq;
+        rd_kafka_q_t *fwdsrcq;  /**< If set, every other op is enqueued on
+                                 *   this queue that is forwarded to rkq */
+        int id;
+        int cnt;        /**< Number of ops to enqueue */
+        int enqcnt;     /**< Number of ops rd_kafka_q_enq() accepted */
+};
+
+static int ut_q_producer_main (void *arg) {
+        struct ut_q_producer *prod = arg;
+        int i;
+
+        for (i = 0 ; i < prod->cnt ; i++) {
+                rd_kafka_op_t *rko = rd_kafka_op_new(RD_KAFKA_OP_NONE);
+                /* Producer id in rko_len, sequence number in rko_version */
+                rko->rko_len     = prod->id;
+                rko->rko_version = i + 1;
+                prod->enqcnt += rd_kafka_q_enq(prod->fwdsrcq && (i & 1) ?
+                                               prod->fwdsrcq : prod->rkq,
+                                               rko);
+        }
+
+        return 0;
+}
+
+
+/**
+ * @brief Enqueue \p msgcnt ops from \p producer_cnt threads and
+ *        dequeue them from the calling thread, verifying per-producer
+ *        ordering.
+ *
+ * If \p locked_enq is true every other op is enqueued through a
+ * forwarded queue, which enqueues with the queue lock held.
+ */
+static int ut_q_order (rd_bool_t mpsc, rd_bool_t locked_enq,
+                       int producer_cnt, int msgcnt) {
+        rd_kafka_q_t *rkq = rd_kafka_q_new(NULL);
+        rd_kafka_q_t *fwdsrcq = NULL;
+        struct ut_q_producer *prods;
+        thrd_t *thrds;
+        int32_t *next_seq;
+        int i, rcvcnt = 0;
+
+        if (mpsc)
+                rd_kafka_q_mpsc_enable(rkq);
+
+        if (locked_enq) {
+                fwdsrcq = rd_kafka_q_new(NULL);
+                rd_kafka_q_fwd_set(fwdsrcq, rkq);
+        }
+
+        prods    = rd_calloc(producer_cnt, sizeof(*prods));
+        thrds    = rd_calloc(producer_cnt, sizeof(*thrds));
+        next_seq = rd_calloc(producer_cnt, sizeof(*next_seq));
+
+        for (i = 0 ; i < producer_cnt ; i++) {
+                prods[i].rkq     = rkq;
+                prods[i].fwdsrcq = fwdsrcq;
+                prods[i].id      = i;
+                prods[i].cnt     = msgcnt / producer_cnt;
+                next_seq[i]      = 1;
+                if (thrd_create(&thrds[i], ut_q_producer_main, &prods[i]) !=
+                    thrd_success)
+                        RD_UT_FAIL("Failed to create producer thread");
+        }
+
+        while (rcvcnt < msgcnt) {
+                rd_kafka_op_t *rko = rd_kafka_q_pop(rkq, 5*1000*1000, 0);
+                int id;
+
+                RD_UT_ASSERT(rko != NULL,
+                             "timed out after %d/%d ops", rcvcnt, msgcnt);
+
+                id = (int)rko->rko_len;
+                RD_UT_ASSERT(id >= 0 && id < producer_cnt,
+                             "invalid producer id %d", id);
+                RD_UT_ASSERT(rko->rko_version == next_seq[id],
+                             "producer %d: expected seq %"PRId32", "
+                             "not %"PRId32,
+                             id, next_seq[id], rko->rko_version);
+                next_seq[id]++;
+
+                rd_kafka_op_destroy(rko);
+                rcvcnt++;
+        }
+
+        for (i = 0 ; i < producer_cnt ; i++)
+                thrd_join(thrds[i], NULL);
+
+        RD_UT_ASSERT(rd_kafka_q_len(rkq) == 0,
+                     "expected empty queue, not %d", rd_kafka_q_len(rkq));
+
+        rd_free(prods);
+        rd_free(thrds);
+        rd_free(next_seq);
+        if (fwdsrcq)
+                rd_kafka_q_destroy_owner(fwdsrcq);
+        rd_kafka_q_destroy_owner(rkq);
+
+        RD_UT_PASS();
+}
+
+
+#if RD_ATOMICPTR_LOCKFREE
+/**
+ * @brief Verify that lock-free enqueues honour forwarding and report
+ *        disabled queues, also when the queue is disabled while
+ *        producers are enqueuing.
+ */
+static int ut_q_mpsc_states (void) {
+        const int producer_cnt = 8, msgcnt = 8 * 25000;
+        rd_kafka_q_t *rkq = rd_kafka_q_new(NULL);
+        rd_kafka_q_t *fwdq = rd_kafka_q_new(NULL);
+        struct ut_q_producer prods[8];
+        thrd_t thrds[8];
+        int i, enqcnt = 0;
+
+        rd_kafka_q_mpsc_enable(rkq);
+
+        RD_UT_ASSERT(rd_kafka_q_enq(rkq, rd_kafka_op_new(RD_KAFKA_OP_NONE)),
+                     "enqueue failed");
+        RD_UT_ASSERT(rd_kafka_q_len(rkq) == 1,
+                     "expected 1 op, not %d", rd_kafka_q_len(rkq));
+
+        /* Forwarded: ops go to the forward queue */
+        rd_kafka_q_fwd_set(rkq, fwdq);
+        RD_UT_ASSERT(rd_kafka_q_enq(rkq, rd_kafka_op_new(RD_KAFKA_OP_NONE)),
+                     "enqueue failed");
+        RD_UT_ASSERT(rd_kafka_q_len(fwdq) == 2,
+                     "expected 2 ops on forward queue, not %d",
+                     rd_kafka_q_len(fwdq));
+
+        /* Unforwarded: lock-free enqueues are used again */
+        rd_kafka_q_fwd_set(rkq, NULL);
+        RD_UT_ASSERT(rd_kafka_q_enq(rkq, rd_kafka_op_new(RD_KAFKA_OP_NONE)),
+                     "enqueue failed");
+        RD_UT_ASSERT(rd_kafka_q_len(rkq) == 1 && rd_kafka_q_len(fwdq) == 2,
+                     "expected 1 op on queue, not %d, "
+                     "and 2 ops on forward queue, not %d",
+                     rd_kafka_q_len(rkq), rd_kafka_q_len(fwdq));
+        rd_kafka_q_purge(rkq);
+
+        /* Disable the queue while producers are enqueuing: every op
+         * rd_kafka_q_enq() accepted must be on the queue. */
+        memset(prods, 0, sizeof(prods));
+        for (i = 0 ; i < producer_cnt ; i++) {
+                prods[i].rkq = rkq;
+                prods[i].id  = i;
+                prods[i].cnt = msgcnt / producer_cnt;
+                if (thrd_create(&thrds[i], ut_q_producer_main, &prods[i]) !=
+                    thrd_success)
+                        RD_UT_FAIL("Failed to create producer thread");
+        }
+
+        while (rd_kafka_q_len(rkq) == 0)
+                rd_usleep(10, NULL);
+        rd_kafka_q_disable(rkq);
+
+        for (i = 0 ; i < producer_cnt ; i++) {
+                thrd_join(thrds[i], NULL);
+                enqcnt += prods[i].enqcnt;
+        }
+
+        RD_UT_SAY("%d/%d enqueues succeeded before the queue was disabled",
+                  enqcnt, msgcnt);
+        RD_UT_ASSERT(rd_kafka_q_len(rkq) == enqcnt,
+                     "%d enqueues succeeded but %d ops are on the queue",
+                     enqcnt, rd_kafka_q_len(rkq));
+        RD_UT_ASSERT(!rd_kafka_q_enq(rkq, rd_kafka_op_new(RD_KAFKA_OP_NONE)),
+                     "enqueue on disabled queue succeeded");
+
+        rd_kafka_q_destroy_owner(rkq);
+        rd_kafka_q_destroy_owner(fwdq);
+
+        RD_UT_PASS();
+}
+#endif
+
+
+int unittest_queue (void) {
+        static const int producer_cnts[] = { 1, 4, 16 };
+        const int msgcnt = 16 * 2000;
+        int fails = 0;
+        size_t i;
+
+        for (i = 0 ; i < RD_ARRAYSIZE(producer_cnts) ; i++) {
+                fails += ut_q_order(rd_false, rd_false,
+                                    producer_cnts[i], msgcnt);
+#if RD_ATOMICPTR_LOCKFREE
+                fails += ut_q_order(rd_true, rd_false,
+                                    producer_cnts[i], msgcnt);
+                fails += ut_q_order(rd_true, rd_true,
+                                    producer_cnts[i], msgcnt);
+#endif
+        }
+
+#if RD_ATOMICPTR_LOCKFREE
+        fails += ut_q_mpsc_states();
+#endif
+
+        return fails;
+}
+
+/**@}*/
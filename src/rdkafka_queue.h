@@ -65,6 +65,21 @@ struct rd_kafka_q_s {
                                       * by triggering the cond-var
                                       * but without having to enqueue
                                       * an op. */
+#define RD_KAFKA_Q_F_MPSC      0x10  /* Lock-free multi-producer enqueue,
+                                      * see rd_kafka_q_mpsc_enq(). */
+
+        /* Lock-free enqueue stack (LIFO), linked through
+         * rko_link.tqe_next, that is moved to rkq_q by
+         * rd_kafka_q_mpsc_drain0() whenever the queue is locked.
+         * Only used with RD_KAFKA_Q_F_MPSC.
+         * Set to RD_KAFKA_Q_MPSC_CLOSED while the queue is disabled
+         * or forwarded. */
+        void         *rkq_mpsc_head;
+#define RD_KAFKA_Q_MPSC_CLOSED ((void *)1)
+        /* Number of threads waiting, or about to wait, on rkq_cond
+         * for ops: lock-free enqueuers only take rkq_lock to wake
+         * them up. Only used with RD_KAFKA_Q_F_MPSC. */
+        rd_atomic32_t rkq_mpsc_waiters;
 
         rd_kafka_t   *rkq_rk;
 	struct rd_kafka_q_io *rkq_qio;   /* FD-based application signalling */
@@ -160,6 +175,37 @@ const char *rd_kafka_q_dest_name (rd_kafka_q_t *rkq) {
 	return ret;
 }
 
+#if RD_ATOMICPTR_LOCKFREE
+void rd_kafka_q_mpsc_move0 (rd_kafka_q_t *rkq, rd_kafka_op_t *rko);
+void rd_kafka_q_mpsc_drain (rd_kafka_q_t *rkq);
+void rd_kafka_q_mpsc_close0 (rd_kafka_q_t *rkq);
+#endif
+
+/**
+ * @brief Move the ops on the lock-free enqueue stack, if any, to the queue.
+ *
+ * Must be called after locking the queue and prior to accessing its ops
+ * or counters, or enqueuing ops with the lock held: this keeps the ops
+ * pushed on the stack ahead of ops enqueued later.
+ *
+ * @locks rkq_lock MUST be held
+ */
+static RD_INLINE RD_UNUSED
+void rd_kafka_q_mpsc_drain0 (rd_kafka_q_t *rkq) {
+#if RD_ATOMICPTR_LOCKFREE
+        void *head;
+
+        if (likely(!(rkq->rkq_flags & RD_KAFKA_Q_F_MPSC)))
+                return;
+
+        /* The stack is only closed with the lock held. */
+        head = rd_atomicptr_get(&rkq->rkq_mpsc_head);
+        if (head && head != RD_KAFKA_Q_MPSC_CLOSED)
+                rd_kafka_q_mpsc_move0(
+                        rkq, rd_atomicptr_xchg(&rkq->rkq_mpsc_head, NULL));
+#endif
+}
+
 /**
  * @brief Disable a queue.
  *        Attempting to enqueue ops to the queue will destroy the ops.
@@ -168,6 +214,9 @@ static RD_INLINE RD_UNUSED
 void rd_kafka_q_disable0 (rd_kafka_q_t *rkq, int do_lock) {
         if (do_lock)
                 mtx_lock(&rkq->rkq_lock);
+#if RD_ATOMICPTR_LOCKFREE
+        rd_kafka_q_mpsc_close0(rkq);
+#endif
         rkq->rkq_flags &= ~RD_KAFKA_Q_F_READY;
         if (do_lock)
                 mtx_unlock(&rkq->rkq_lock);
@@ -407,6 +456,9 @@ int rd_kafka_q_enq1 (rd_kafka_q_t *rkq, rd_kafka_op_t *rko,
 
         rd_dassert(rkq->rkq_refcnt > 0);
 
+        /* Ops pushed lock-free before this one go first. */
+        rd_kafka_q_mpsc_drain0(rkq);
+
         if (unlikely(!(rkq->rkq_flags & RD_KAFKA_Q_F_READY))) {
                 /* Queue has been disabled, reply to and fail the rko. */
                 if (do_lock)
@@ -440,6 +492,66 @@ int rd_kafka_q_enq1 (rd_kafka_q_t *rkq, rd_kafka_op_t *rko,
         return 1;
 }
 
+#if RD_ATOMICPTR_LOCKFREE
+/**
+ * @brief Lock-free enqueue of \p rko on \p rkq.
+ *
+ * The op is pushed on the queue's lock-free stack, which is moved,
+ * in order, to the queue by the next thread to lock the queue:
+ * the consumer, a locked enqueue, or rd_kafka_q_mpsc_close0() if the
+ * queue is disabled or forwarded in the meantime.
+ *
+ * The queue lock is only taken to wake up the consumer, by the producer
+ * that pushes on an empty stack while a consumer is waiting on the
+ * queue's cond (rkq_mpsc_waiters), or if the queue has IO or callback
+ * based wakeups (rkq_qio), which are triggered once per batch of pushes.
+ *
+ * If the stack is closed the op is enqueued through the regular
+ * locked path.
+ *
+ * @returns 1 if op was enqueued or 0 if queue is disabled and
+ * there was no replyq to enqueue on in which case the rko is destroyed.
+ *
+ * @locality any thread.
+ * @locks rkq MUST NOT be locked
+ */
+static RD_INLINE RD_UNUSED
+int rd_kafka_q_mpsc_enq (rd_kafka_q_t *rkq, rd_kafka_op_t *rko) {
+        void *head;
+
+        do {
+                head = rd_atomicptr_get(&rkq->rkq_mpsc_head);
+                if (unlikely(head == RD_KAFKA_Q_MPSC_CLOSED))
+                        return rd_kafka_q_enq1(rkq, rko, rkq, 0/*at tail*/,
+                                               1/*do lock*/);
+                rko->rko_link.tqe_next = head;
+        } while (!rd_atomicptr_cas(&rkq->rkq_mpsc_head, head, rko));
+
+        /* A waiter announces itself before its last look at the stack,
+         * see rd_kafka_q_mpsc_cond_wait0(), and the compare-and-swap
+         * above orders the push before this read: either the waiter
+         * sees the op or we see the waiter. */
+        if (!head && (rd_atomic32_get(&rkq->rkq_mpsc_waiters) > 0 ||
+                      rkq->rkq_qio))
+                rd_kafka_q_mpsc_drain(rkq);
+
+        return 1;
+}
+#endif
+
+/**
+ * @brief Enable lock-free enqueues on \p rkq, if supported by the platform.
+ *
+ * @locality queue creator, prior to the queue being used.
+ */
+static RD_INLINE RD_UNUSED
+void rd_kafka_q_mpsc_enable (rd_kafka_q_t *rkq) {
+#if RD_ATOMICPTR_LOCKFREE
+        rkq->rkq_flags |= RD_KAFKA_Q_F_MPSC;
+#endif
+}
+
+
 /**
  * @brief Enqueue the 'rko' op at the tail of the queue 'rkq'.
  *
@@ -453,6 +565,10 @@ int rd_kafka_q_enq1 (rd_kafka_q_t *rkq, rd_kafka_op_t *rko,
  */
 static RD_INLINE RD_UNUSED
 int rd_kafka_q_enq (rd_kafka_q_t *rkq, rd_kafka_op_t *rko) {
+#if RD_ATOMICPTR_LOCKFREE
+        if (rkq->rkq_flags & RD_KAFKA_Q_F_MPSC)
+                return rd_kafka_q_mpsc_enq(rkq, rko);
+#endif
         return rd_kafka_q_enq1(rkq, rko, rkq, 0/*at tail*/, 1/*do lock*/);
 }
 
@@ -513,6 +629,8 @@ int rd_kafka_q_concat0 (rd_kafka_q_t *rkq, rd_kafka_q_t *srcq, int do_lock) {
 	if (!rkq->rkq_fwdq) {
                 rd_kafka_op_t *rko;
 
+                rd_kafka_q_mpsc_drain0(rkq);
+
                 rd_dassert(TAILQ_EMPTY(&srcq->rkq_q) ||
                            srcq->rkq_qlen > 0);
 		if (unlikely(!(rkq->rkq_flags & RD_KAFKA_Q_F_READY))) {
@@ -566,6 +684,7 @@ void rd_kafka_q_prepend0 (rd_kafka_q_t *rkq, rd_kafka_q_t *srcq,
 	if (do_lock)
 		mtx_lock(&rkq->rkq_lock);
 	if (!rkq->rkq_fwdq && !srcq->rkq_fwdq) {
+                rd_kafka_q_mpsc_drain0(rkq);
                 /* FIXME: prio-aware */
                 /* Concat rkq on srcq */
                 TAILQ_CONCAT(&srcq->rkq_q, &rkq->rkq_q, rko_link);
@@ -595,6 +714,7 @@ int rd_kafka_q_len (rd_kafka_q_t *rkq) {
         rd_kafka_q_t *fwdq;
         mtx_lock(&rkq->rkq_lock);
         if (!(fwdq = rd_kafka_q_fwd_get(rkq, 0))) {
+                rd_kafka_q_mpsc_drain0(rkq);
                 qlen = rkq->rkq_qlen;
                 mtx_unlock(&rkq->rkq_lock);
         } else {
@@ -612,6 +732,7 @@ uint64_t rd_kafka_q_size (rd_kafka_q_t *rkq) {
         rd_kafka_q_t *fwdq;
         mtx_lock(&rkq->rkq_lock);
         if (!(fwdq = rd_kafka_q_fwd_get(rkq, 0))) {
+                rd_kafka_q_mpsc_drain0(rkq);
                 sz = rkq->rkq_qsize;
                 mtx_unlock(&rkq->rkq_lock);
         } else {
@@ -1072,4 +1193,6 @@ rd_kafka_op_t *rd_kafka_enq_once_disable (rd_kafka_enq_once_t *eonce) {
 /**@}*/
 
 
+int unittest_queue (void);
+
 #endif /* _RDKAFKA_QUEUE_H_ */
@@ -2870,6 +2870,157 @@ rd_kafka_msgbatch_handle_Produce_result (
 }
 
 
+/**
+ * @brief Parses a multi-partition Produce reply into \p results and
+ *        \p errs, which are indexed as the request's parts.
+ *
+ * Partitions missing from the reply are left untouched.
+ *
+ * @returns 0 on success or an error code on failure.
+ * @locality broker thread
+ */
+static rd_kafka_resp_err_t
+rd_kafka_handle_Produce_parse_multi (rd_kafka_broker_t *rkb,
+                                     rd_kafka_buf_t *rkbuf,
+                                     rd_kafka_buf_t *request,
+                                     struct rd_kafka_Produce_result *results,
+                                     rd_kafka_resp_err_t *errs) {
+        rd_list_t *parts = request->rkbuf_u.Produce.parts;
+        int32_t TopicArrayCnt;
+        const int log_decode_errors = LOG_ERR;
+
+        rd_kafka_buf_read_i32(rkbuf, &TopicArrayCnt);
+
+        while (TopicArrayCnt-- > 0) {
+                rd_kafkap_str_t Topic;
+                int32_t PartitionArrayCnt;
+
+                rd_kafka_buf_read_str(rkbuf, &Topic);
+                rd_kafka_buf_read_i32(rkbuf, &PartitionArrayCnt);
+
+                while (PartitionArrayCnt-- > 0) {
+                        struct {
+                                int32_t Partition;
+                                int16_t ErrorCode;
+                                int64_t Offset;
+                                int64_t Timestamp;
+                                int64_t LogStartOffset;
+                        } hdr = { .Timestamp = -1 };
+                        rd_kafka_buf_t *part;
+                        int i;
+
+                        rd_kafka_buf_read_i32(rkbuf, &hdr.Partition);
+                        rd_kafka_buf_read_i16(rkbuf, &hdr.ErrorCode);
+                        rd_kafka_buf_read_i64(rkbuf, &hdr.Offset);
+
+                        if (request->rkbuf_reqhdr.ApiVersion >= 2)
+                                rd_kafka_buf_read_i64(rkbuf, &hdr.Timestamp);
+
+                        if (request->rkbuf_reqhdr.ApiVersion >= 5)
+                                rd_kafka_buf_read_i64(rkbuf,
+                                                      &hdr.LogStartOffset);
+
+                        RD_LIST_FOREACH(part, parts, i) {
+                                rd_kafka_toppar_t *rktp = rd_kafka_toppar_s2i(
+                                        part->rkbuf_batch.s_rktp);
+
+                                if (rktp->rktp_partition != hdr.Partition ||
+                                    rd_kafkap_str_cmp(rktp->rktp_rkt->
+                                                      rkt_topic, &Topic))
+                                        continue;
+
+                                results[i].offset = hdr.Offset;
+                                results[i].timestamp = hdr.Timestamp;
+                                errs[i] = hdr.ErrorCode;
+                                break;
+                        }
+                }
+        }
+
+        if (request->rkbuf_reqhdr.ApiVersion >= 1) {
+                int32_t Throttle_Time;
+                rd_kafka_buf_read_i32(rkbuf, &Throttle_Time);
+
+                rd_kafka_op_throttle_time(rkb, rkb->rkb_rk->rk_rep,
+                                          Throttle_Time);
+        }
+
+        return RD_KAFKA_RESP_ERR_NO_ERROR;
+
+ err_parse:
+        return rkbuf->rkbuf_err;
+}
+
+
+/**
+ * @brief Handle multi-partition ProduceResponse by handling the result
+ *        of each partition's message batch as for a single-partition
+ *        ProduceResponse.
+ *
+ * @warning May be called on the old leader thread. Lock rktp appropriately!
+ *
+ * @locality broker thread (but not necessarily the leader broker thread)
+ */
+static void rd_kafka_handle_Produce_multi (rd_kafka_t *rk,
+                                           rd_kafka_broker_t *rkb,
+                                           rd_kafka_resp_err_t err,
+                                           rd_kafka_buf_t *reply,
+                                           rd_kafka_buf_t *request) {
+        rd_list_t *parts = request->rkbuf_u.Produce.parts;
+        int partcnt = rd_list_cnt(parts);
+        struct rd_kafka_Produce_result *results;
+        rd_kafka_resp_err_t *errs;
+        rd_kafka_buf_t *part;
+        int i;
+
+        results = rd_malloc(sizeof(*results) * partcnt);
+        errs = rd_malloc(sizeof(*errs) * partcnt);
+
+        for (i = 0 ; i < partcnt ; i++) {
+                results[i].offset = RD_KAFKA_OFFSET_INVALID;
+                results[i].timestamp = -1;
+                /* A partition missing from the reply is handled
+                 * as a bad reply to a single-partition request. */
+                errs[i] = RD_KAFKA_RESP_ERR__BAD_MSG;
+        }
+
+        /* Parse Produce reply (unless the request errored) */
+        if (!err && reply) {
+                rd_kafka_resp_err_t parse_err =
+                        rd_kafka_handle_Produce_parse_multi(rkb, reply,
+                                                            request,
+                                                            results, errs);
+                if (parse_err)
+                        for (i = 0 ; i < partcnt ; i++)
+                                errs[i] = parse_err;
+        }
+
+        RD_LIST_FOREACH(part, parts, i) {
+                rd_kafka_resp_err_t part_err = err;
+
+                /* Unit test interface: inject errors */
+                if (unlikely(rk->rk_conf.ut.handle_ProduceResponse != NULL))
+                        part_err = rk->rk_conf.ut.handle_ProduceResponse(
+                                rkb->rkb_rk,
+                                rkb->rkb_nodeid,
+                                part->rkbuf_batch.first_msgid,
+                                err);
+
+                if (!part_err && reply)
+                        part_err = errs[i];
+
+                rd_kafka_msgbatch_handle_Produce_result(rkb,
+                                                        &part->rkbuf_batch,
+                                                        part_err,
+                                                        &results[i],
+                                                        request);
+        }
+
+        rd_free(results);
+        rd_free(errs);
+}
+
+
 /**
  * @brief Handle ProduceResponse
  *
@@ -2891,12 +3042,19 @@ static void rd_kafka_handle_Produce (rd_kafka_t *rk,
                                      rd_kafka_buf_t *request,
                                      void *opaque) {
         rd_kafka_msgbatch_t *batch = &request->rkbuf_batch;
-        rd_kafka_toppar_t *rktp = rd_kafka_toppar_s2i(batch->s_rktp);
+        rd_kafka_toppar_t *rktp;
         struct rd_kafka_Produce_result result = {
                 .offset = RD_KAFKA_OFFSET_INVALID,
                 .timestamp = -1
         };
 
+        if (request->rkbuf_u.Produce.parts) {
+                rd_kafka_handle_Produce_multi(rk, rkb, err, reply, request);
+                return;
+        }
+
+        rktp = rd_kafka_toppar_s2i(batch->s_rktp);
+
         /* Unit test interface: inject errors */
         if (unlikely(rk->rk_conf.ut.handle_ProduceResponse != NULL)) {
                 err = rk->rk_conf.ut.handle_ProduceResponse(
@@ -2918,45 +3076,67 @@ static void rd_kafka_handle_Produce (rd_kafka_t *rk,
 
 
 /**
- * @brief Send ProduceRequest for messages in toppar queue.
+ * @brief Update the topic's batch statistics with the MessageSet of a
+ *        single-partition ProduceRequest.
  *
- * @returns the number of messages included, or 0 on error / no messages.
+ * @returns the absolute timeout of the MessageSet's first message.
+ */
+static rd_ts_t
+rd_kafka_ProduceRequest_batch_stats (const rd_kafka_buf_t *rkbuf) {
+        rd_kafka_itopic_t *rkt =
+                rd_kafka_toppar_s2i(rkbuf->rkbuf_batch.s_rktp)->rktp_rkt;
+        int cnt = rd_kafka_msgq_len(&rkbuf->rkbuf_batch.msgq);
+
+        rd_dassert(cnt > 0);
+
+        rd_avg_add(&rkt->rkt_avg_batchcnt, (int64_t)cnt);
+        rd_avg_add(&rkt->rkt_avg_batchsize,
+                   (int64_t)rkbuf->rkbuf_u.Produce.MessageSetSize);
+
+        return rd_kafka_msgq_first(&rkbuf->rkbuf_batch.msgq)->rkm_ts_timeout;
+}
+
+
+/**
+ * @brief Enqueue a finalized ProduceRequest for transmission.
  *
  * @locality broker thread
  */
-int rd_kafka_ProduceRequest (rd_kafka_broker_t *rkb, rd_kafka_toppar_t *rktp,
-                             const rd_kafka_pid_t pid) {
-        rd_kafka_buf_t *rkbuf;
-        rd_kafka_itopic_t *rkt = rktp->rktp_rkt;
-        size_t MessageSetSize = 0;
-        int cnt;
+static void rd_kafka_ProduceRequest_enq (rd_kafka_broker_t *rkb,
+                                         rd_kafka_buf_t *rkbuf) {
+        const rd_kafka_buf_t *first = rkbuf;
         rd_ts_t now;
+        rd_ts_t ts_timeout;
         int64_t first_msg_timeout;
         int tmout;
 
-        /**
-         * Create ProduceRequest with as many messages from the toppar
-         * transmit queue as possible.
-         */
-        rkbuf = rd_kafka_msgset_create_ProduceRequest(rkb, rktp,
-                                                      &rktp->rktp_xmit_msgq,
-                                                      pid, &MessageSetSize);
-        if (unlikely(!rkbuf))
-                return 0;
+        rd_dassert(!rkbuf->rkbuf_u.Produce.compress_job);
 
-        cnt = rd_kafka_msgq_len(&rkbuf->rkbuf_batch.msgq);
-        rd_dassert(cnt > 0);
+        if (rkbuf->rkbuf_u.Produce.parts) {
+                const rd_kafka_buf_t *part;
+                int i;
 
-        rd_avg_add(&rktp->rktp_rkt->rkt_avg_batchcnt, (int64_t)cnt);
-        rd_avg_add(&rktp->rktp_rkt->rkt_avg_batchsize, (int64_t)MessageSetSize);
+                ts_timeout = INT64_MAX;
+                RD_LIST_FOREACH(part, rkbuf->rkbuf_u.Produce.parts, i) {
+                        rd_ts_t part_ts_timeout =
+                                rd_kafka_ProduceRequest_batch_stats(part);
+                        if (part_ts_timeout < ts_timeout)
+                                ts_timeout = part_ts_timeout;
+                }
+
+                first = rd_list_elem(rkbuf->rkbuf_u.Produce.parts, 0);
+        } else {
+                ts_timeout = rd_kafka_ProduceRequest_batch_stats(rkbuf);
+        }
 
-        if (!rkt->rkt_conf.required_acks)
+        /* All partitions of a multi-partition request have the same acks */
+        if (!rd_kafka_toppar_s2i(first->rkbuf_batch.s_rktp)->rktp_rkt->
+            rkt_conf.required_acks)
                 rkbuf->rkbuf_flags |= RD_KAFKA_OP_F_NO_RESPONSE;
 
         /* Use timeout from first message in batch */
         now = rd_clock();
-        first_msg_timeout = (rd_kafka_msgq_first(&rkbuf->rkbuf_batch.msgq)->
-                             rkm_ts_timeout - now) / 1000;
+        first_msg_timeout = (ts_timeout - now) / 1000;
 
         if (unlikely(first_msg_timeout <= 0)) {
                 /* Message has already timed out, allow 100 ms
@@ -2974,6 +3154,349 @@ int rd_kafka_ProduceRequest (rd_kafka_broker_t *rkb, rd_kafka_toppar_t *rktp,
         rd_kafka_broker_buf_enq_replyq(rkb, rkbuf,
                                        RD_KAFKA_NO_REPLYQ,
                                        rd_kafka_handle_Produce, NULL);
+}
+
+
+/**
+ * @brief Sort single-partition ProduceRequests by topic.
+ */
+static int rd_kafka_ProduceRequest_topic_cmp (const void *_a,
+                                              const void *_b) {
+        const rd_kafka_buf_t *a = _a, *b = _b;
+
+        return RD_CMP(rd_kafka_toppar_s2i(a->rkbuf_batch.s_rktp)->rktp_rkt,
+                      rd_kafka_toppar_s2i(b->rkbuf_batch.s_rktp)->rktp_rkt);
+}
+
+
+/**
+ * @brief Create a multi-partition ProduceRequest carrying the MessageSets
+ *        of the finalized single-partition ProduceRequests in \p parts.
+ *
+ * The MessageSets are not copied but referenced from the parts,
+ * which are owned by the returned request from here on.
+ *
+ * @locality broker thread
+ */
+static rd_kafka_buf_t *
+rd_kafka_ProduceRequest_new_multi (rd_kafka_broker_t *rkb, rd_list_t *parts) {
+        rd_kafka_t *rk = rkb->rkb_rk;
+        const rd_kafka_buf_t *first = rd_list_elem(parts, 0);
+        const rd_kafka_itopic_t *rkt =
+                rd_kafka_toppar_s2i(first->rkbuf_batch.s_rktp)->rktp_rkt;
+        const rd_kafka_itopic_t *prev_rkt = NULL;
+        int partcnt = rd_list_cnt(parts);
+        rd_kafka_buf_t *rkbuf;
+        const rd_kafka_buf_t *part;
+        size_t of_TopicArrayCnt, of_PartitionArrayCnt = 0;
+        int32_t TopicArrayCnt = 0, PartitionArrayCnt = 0;
+        size_t MessageSetSize = 0;
+        int msgcnt = 0;
+        int i;
+        int r RD_UNUSED;
+
+        /* Group the partitions by topic */
+        rd_list_sort(parts, rd_kafka_ProduceRequest_topic_cmp);
+
+        rkbuf = rd_kafka_buf_new_request(rkb, RD_KAFKAP_Produce,
+                                         1 + partcnt * 2,
+                                         64 + partcnt * (4+4+4) +
+                                         partcnt * (2 + 64/*topic*/));
+
+        rd_kafka_buf_ApiVersion_set(rkbuf, first->rkbuf_reqhdr.ApiVersion,
+                                    first->rkbuf_features);
+
+        /* V3: TransactionalId */
+        if (first->rkbuf_reqhdr.ApiVersion >= 3)
+                rd_kafka_buf_write_kstr(rkbuf, rk->rk_eos.transactional_id);
+
+        /* RequiredAcks */
+        rd_kafka_buf_write_i16(rkbuf, rkt->rkt_conf.required_acks);
+
+        /* Timeout */
+        rd_kafka_buf_write_i32(rkbuf, rkt->rkt_conf.request_timeout_ms);
+
+        /* TopicArrayCnt: updated later */
+        of_TopicArrayCnt = rd_kafka_buf_write_i32(rkbuf, 0);
+
+        RD_LIST_FOREACH(part, parts, i) {
+                const rd_kafka_toppar_t *rktp =
+                        rd_kafka_toppar_s2i(part->rkbuf_batch.s_rktp);
+                rd_slice_t slice;
+                const void *p;
+                size_t rlen;
+
+                if (rktp->rktp_rkt != prev_rkt) {
+                        if (prev_rkt)
+                                rd_kafka_buf_update_i32(rkbuf,
+                                                        of_PartitionArrayCnt,
+                                                        PartitionArrayCnt);
+
+                        /* Insert topic */
+                        rd_kafka_buf_write_kstr(rkbuf,
+                                                rktp->rktp_rkt->rkt_topic);
+
+                        /* PartitionArrayCnt: updated later */
+                        of_PartitionArrayCnt = rd_kafka_buf_write_i32(rkbuf,
+                                                                      0);
+                        PartitionArrayCnt = 0;
+                        TopicArrayCnt++;
+                        prev_rkt = rktp->rktp_rkt;
+                }
+
+                /* Partition */
+                rd_kafka_buf_write_i32(rkbuf, rktp->rktp_partition);
+
+                /* MessageSetSize */
+                rd_kafka_buf_write_i32(rkbuf,
+                                       (int32_t)part->rkbuf_u.Produce.
+                                       MessageSetSize);
+
+                /* MessageSet: referenced from the part's buffer */
+                r = rd_slice_init(&slice, &part->rkbuf_buf,
+                                  part->rkbuf_u.Produce.MessageSetOffset,
+                                  part->rkbuf_u.Produce.MessageSetSize);
+                rd_assert(r != -1);
+
+                while ((rlen = rd_slice_reader(&slice, &p)))
+                        rd_kafka_buf_push(rkbuf, p, rlen, NULL);
+
+                PartitionArrayCnt++;
+                MessageSetSize += part->rkbuf_u.Produce.MessageSetSize;
+                msgcnt += rd_kafka_msgq_len(&part->rkbuf_batch.msgq);
+        }
+
+        rd_kafka_buf_update_i32(rkbuf, of_PartitionArrayCnt,
+                                PartitionArrayCnt);
+        rd_kafka_buf_update_i32(rkbuf, of_TopicArrayCnt, TopicArrayCnt);
+
+        rd_kafka_msgq_init(&rkbuf->rkbuf_batch.msgq);
+        rkbuf->rkbuf_u.Produce.parts = parts;
+        rkbuf->rkbuf_u.Produce.msgcnt = msgcnt;
+        rkbuf->rkbuf_u.Produce.MessageSetSize = MessageSetSize;
+
+        rd_rkb_dbg(rkb, MSG, "PRODUCE",
+                   "Packed %d partition MessageSet(s) of %"PRId32" topic(s) "
+                   "with %d message(s) (%"PRIusz" bytes) into one "
+                   "ProduceRequest",
+                   partcnt, TopicArrayCnt, msgcnt, MessageSetSize);
+
+        return rkbuf;
+}
+
+
+/**
+ * @brief Remove partition \p rktp's MessageSet from the unsent
+ *        multi-partition ProduceRequest \p rkbuf in \p rkbq, failing
+ *        the partition's batch with \p err.
+ *
+ * The request is rebuilt from its remaining parts and takes the original
+ * request's place in \p rkbq, so that the other partitions' requests
+ * remain in order. If no parts remain the request is removed.
+ *
+ * @returns rd_true if \p rkbuf carried a MessageSet for \p rktp,
+ *          in which case \p rkbuf has been destroyed.
+ *
+ * @locality broker thread
+ */
+rd_bool_t rd_kafka_ProduceRequest_purge_part (rd_kafka_broker_t *rkb,
+                                              rd_kafka_bufq_t *rkbq,
+                                              rd_kafka_buf_t *rkbuf,
+                                              rd_kafka_toppar_t *rktp,
+                                              rd_kafka_resp_err_t err) {
+        rd_list_t *parts = rkbuf->rkbuf_u.Produce.parts;
+        struct rd_kafka_Produce_result result = {
+                .offset = RD_KAFKA_OFFSET_INVALID,
+                .timestamp = -1
+        };
+        rd_kafka_buf_t *part, *next;
+        int i;
+
+        rd_dassert(parts && !rkbuf->rkbuf_replyq.q);
+
+        RD_LIST_FOREACH(part, parts, i)
+                if (rd_kafka_toppar_s2i(part->rkbuf_batch.s_rktp) == rktp)
+                        break;
+
+        if (!part)
+                return rd_false;
+
+        rd_rkb_dbg(rkb, MSG, "PRODUCE",
+                   "%s [%"PRId32"]: removing MessageSet with %d message(s) "
+                   "from %d-partition ProduceRequest: %s",
+                   rktp->rktp_rkt->rkt_topic->str, rktp->rktp_partition,
+                   rd_kafka_msgq_len(&part->rkbuf_batch.msgq),
+                   rd_list_cnt(parts), rd_kafka_err2str(err));
+
+        next = TAILQ_NEXT(rkbuf, rkbuf_link);
+        rd_kafka_bufq_deq(rkbq, rkbuf);
+
+        rd_list_remove_elem(parts, i);
+
+        /* Fail the partition's batch as for a single-partition request */
+        rd_kafka_msgbatch_handle_Produce_result(rkb, &part->rkbuf_batch, err,
+                                                &result, rkbuf);
+        rd_kafka_buf_destroy(part);
+
+        if (rd_list_cnt(parts) > 0) {
+                /* The new request takes over the parts and the original
+                 * request's enqueue and timeout state. */
+                rd_kafka_buf_t *new_rkbuf =
+                        rd_kafka_ProduceRequest_new_multi(rkb, parts);
+                rkbuf->rkbuf_u.Produce.parts = NULL;
+
+                new_rkbuf->rkbuf_flags         = rkbuf->rkbuf_flags;
+                new_rkbuf->rkbuf_prio          = rkbuf->rkbuf_prio;
+                new_rkbuf->rkbuf_cb            = rkbuf->rkbuf_cb;
+                new_rkbuf->rkbuf_opaque        = rkbuf->rkbuf_opaque;
+                new_rkbuf->rkbuf_retries       = rkbuf->rkbuf_retries;
+                new_rkbuf->rkbuf_ts_enq        = rkbuf->rkbuf_ts_enq;
+                new_rkbuf->rkbuf_ts_timeout    = rkbuf->rkbuf_ts_timeout;
+                new_rkbuf->rkbuf_abs_timeout   = rkbuf->rkbuf_abs_timeout;
+                new_rkbuf->rkbuf_rel_timeout   = rkbuf->rkbuf_rel_timeout;
+                new_rkbuf->rkbuf_force_timeout = rkbuf->rkbuf_force_timeout;
+                rd_kafka_buf_finalize(rkb->rkb_rk, new_rkbuf);
+
+                if (next)
+                        rd_kafka_bufq_insert_before(rkbq, next, new_rkbuf);
+                else
+                        rd_kafka_bufq_enq(rkbq, new_rkbuf);
+        }
+
+        rd_kafka_buf_destroy(rkbuf);
+
+        return rd_true;
+}
+
+
+/**
+ * @returns true if the single-partition ProduceRequest \p next may be
+ *          packed into the same multi-partition ProduceRequest as the
+ *          \p cnt consecutive requests starting at \p first, of which the
+ *          MessageSets total \p size bytes.
+ *
+ * @locality broker thread
+ */
+static rd_bool_t
+rd_kafka_ProduceRequest_packable (rd_kafka_broker_t *rkb,
+                                  const rd_kafka_buf_t *first, int cnt,
+                                  size_t size, const rd_kafka_buf_t *next) {
+        const rd_kafka_toppar_t *rktp =
+                rd_kafka_toppar_s2i(first->rkbuf_batch.s_rktp);
+        const rd_kafka_toppar_t *next_rktp =
+                rd_kafka_toppar_s2i(next->rkbuf_batch.s_rktp);
+        const rd_kafka_buf_t *rkbuf;
+        int i;
+
+        if (size + next->rkbuf_u.Produce.MessageSetSize >
+            (size_t)rkb->rkb_rk->rk_conf.max_msg_size)
+                return rd_false;
+
+        /* The request-level fields must be the same */
+        if (next->rkbuf_reqhdr.ApiVersion != first->rkbuf_reqhdr.ApiVersion ||
+            next_rktp->rktp_rkt->rkt_conf.required_acks !=
+            rktp->rktp_rkt->rkt_conf.required_acks ||
+            next_rktp->rktp_rkt->rkt_conf.request_timeout_ms !=
+            rktp->rktp_rkt->rkt_conf.request_timeout_ms)
+                return rd_false;
+
+        /* A partition may only appear once in a request */
+        for (rkbuf = first, i = 0 ; i < cnt ;
+             rkbuf = TAILQ_NEXT(rkbuf, rkbuf_link), i++)
+                if (rd_kafka_toppar_s2i(rkbuf->rkbuf_batch.s_rktp) ==
+                    next_rktp)
+                        return rd_false;
+
+        return rd_true;
+}
+
+
+/**
+ * @brief Enqueue the finalized single-partition ProduceRequests in \p rkbq
+ *        for transmission, in order.
+ *
+ * Consecutive requests are packed into multi-partition ProduceRequests
+ * of up to produce.request.max.partitions partitions.
+ *
+ * @locality broker thread
+ */
+void rd_kafka_ProduceRequests_enq (rd_kafka_broker_t *rkb,
+                                   rd_kafka_bufq_t *rkbq) {
+        const int max_parts = rkb->rkb_rk->rk_conf.
+                produce_request_max_partitions;
+        rd_kafka_buf_t *rkbuf;
+
+        while ((rkbuf = TAILQ_FIRST(&rkbq->rkbq_bufs))) {
+                const rd_kafka_buf_t *next = rkbuf;
+                size_t size = rkbuf->rkbuf_u.Produce.MessageSetSize;
+                rd_list_t *parts;
+                int cnt = 1;
+
+                while (cnt < max_parts &&
+                       (next = TAILQ_NEXT(next, rkbuf_link)) &&
+                       rd_kafka_ProduceRequest_packable(rkb, rkbuf, cnt,
+                                                        size, next)) {
+                        size += next->rkbuf_u.Produce.MessageSetSize;
+                        cnt++;
+                }
+
+                if (cnt == 1) {
+                        rd_kafka_bufq_deq(rkbq, rkbuf);
+                        rd_kafka_ProduceRequest_enq(rkb, rkbuf);
+                        continue;
+                }
+
+                parts = rd_list_new(cnt, rd_kafka_buf_destroy_free);
+                while (cnt-- > 0) {
+                        rkbuf = TAILQ_FIRST(&rkbq->rkbq_bufs);
+                        rd_kafka_bufq_deq(rkbq, rkbuf);
+                        rd_list_add(parts, rkbuf);
+                }
+
+                rd_kafka_ProduceRequest_enq(
+                        rkb, rd_kafka_ProduceRequest_new_multi(rkb, parts));
+        }
+}
+
+
+/**
+ * @brief Send ProduceRequest for messages in toppar queue.
+ *
+ * The request is held back on rkb_produce_deferred, to be enqueued in order
+ * by the broker at the end of the current produce pass, if:
+ *  - the MessageSet's compression was offloaded to the worker pool
+ *    (compression.threads), or such a request is already held back,
+ *  - or it may be packed with other partitions' requests into a
+ *    multi-partition ProduceRequest (produce.request.max.partitions).
+ *
+ * @returns the number of messages included, or 0 on error / no messages.
+ *
+ * @locality broker thread
+ */
+int rd_kafka_ProduceRequest (rd_kafka_broker_t *rkb, rd_kafka_toppar_t *rktp,
+                             const rd_kafka_pid_t pid) {
+        rd_kafka_buf_t *rkbuf;
+        size_t MessageSetSize = 0;
+        int cnt;
+
+        /**
+         * Create ProduceRequest with as many messages from the toppar
+         * transmit queue as possible.
+         */
+        rkbuf = rd_kafka_msgset_create_ProduceRequest(rkb, rktp,
+                                                      &rktp->rktp_xmit_msgq,
+                                                      pid, &MessageSetSize);
+        if (unlikely(!rkbuf))
+                return 0;
+
+        cnt = rd_kafka_msgq_len(&rkbuf->rkbuf_batch.msgq);
+
+        if (rkbuf->rkbuf_u.Produce.compress_job ||
+            rkb->rkb_rk->rk_conf.produce_request_max_partitions > 1 ||
+            rd_kafka_bufq_cnt(&rkb->rkb_produce_deferred) > 0)
+                rd_kafka_bufq_enq(&rkb->rkb_produce_deferred, rkbuf);
+        else
+                rd_kafka_ProduceRequest_enq(rkb, rkbuf);
 
         return cnt;
 }
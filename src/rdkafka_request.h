@@ -219,8 +219,15 @@ void rd_kafka_SaslAuthenticateRequest (rd_kafka_broker_t *rkb,
                                        rd_kafka_resp_cb_t *resp_cb,
                                        void *opaque);
 
+void rd_kafka_ProduceRequests_enq (rd_kafka_broker_t *rkb,
+                                   rd_kafka_bufq_t *rkbq);
 int rd_kafka_ProduceRequest (rd_kafka_broker_t *rkb, rd_kafka_toppar_t *rktp,
                              const rd_kafka_pid_t pid);
+rd_bool_t rd_kafka_ProduceRequest_purge_part (rd_kafka_broker_t *rkb,
+                                              rd_kafka_bufq_t *rkbq,
+                                              rd_kafka_buf_t *rkbuf,
+                                              rd_kafka_toppar_t *rktp,
+                                              rd_kafka_resp_err_t err);
 
 rd_kafka_resp_err_t
 rd_kafka_CreateTopicsRequest (rd_kafka_broker_t *rkb,
@@ -54,4 +54,11 @@ int rd_kafka_sasl_global_init (void);
 int rd_kafka_sasl_select_provider (rd_kafka_t *rk,
                                    char *errstr, size_t errstr_size);
 
+#if WITH_SASL_SCRAM
+rd_bool_t rd_kafka_sasl_scram_stats (rd_kafka_t *rk,
+                                     int64_t *derived_cntp,
+                                     int64_t *cached_cntp,
+                                     int64_t *keys_cntp);
+#endif
+
 #endif /* _RDKAFKA_SASL_H_ */
@@ -36,11 +36,13 @@
 #include "rdkafka_sasl.h"
 #include "rdkafka_sasl_int.h"
 #include "rdrand.h"
+#include "rdbase64.h"
 
 #if WITH_SSL
 #include <openssl/hmac.h>
 #include <openssl/evp.h>
 #include <openssl/sha.h>
+#include <openssl/crypto.h>
 #else
 #error "WITH_SSL (OpenSSL) is required for SASL SCRAM"
 #endif
@@ -62,6 +64,50 @@ struct rd_kafka_sasl_scram_state {
 };
 
 
+/**
+ * @brief Maximum number of cached SCRAM keys per client instance.
+ */
+#define RD_KAFKA_SASL_SCRAM_KEYS_MAX 16
+
+/**
+ * @brief Keys derived from the password for a (username, salt, iterations)
+ *        tuple.
+ *
+ * Deriving the SaltedPassword runs the full PBKDF2 iteration count, which
+ * is by far the most expensive part of the authentication, while the
+ * salt and iteration count are the same for every broker in a cluster
+ * (they are stored with the user's credentials), so the result is cached
+ * per client instance and reused for all connections.
+ * Only the ClientKey and ServerKey are kept since the SaltedPassword is
+ * not needed once these have been derived.
+ */
+typedef struct rd_kafka_sasl_scram_keys_s {
+        TAILQ_ENTRY(rd_kafka_sasl_scram_keys_s) link;
+        char *username;
+        rd_chariov_t salt;
+        int itcnt;
+        unsigned int size;                       /**< Key size */
+        unsigned char ClientKey[EVP_MAX_MD_SIZE];
+        unsigned char ServerKey[EVP_MAX_MD_SIZE];
+} rd_kafka_sasl_scram_keys_t;
+
+
+/**
+ * @brief Per client instance (rk_sasl.handle) state
+ */
+typedef struct rd_kafka_sasl_scram_handle_s {
+        mtx_t lock;
+        TAILQ_HEAD(rd_kafka_sasl_scram_keys_head_s,
+                   rd_kafka_sasl_scram_keys_s) keys; /**< Most recently
+                                                        *   used first */
+        /* Counters are atomic to be read for statistics without
+         * waiting for an ongoing key derivation to finish. */
+        rd_atomic64_t keys_cnt;    /**< Number of cached keys */
+        rd_atomic64_t derived_cnt; /**< Number of key derivations */
+        rd_atomic64_t cached_cnt;  /**< Number of cached keys used */
+} rd_kafka_sasl_scram_handle_t;
+
+
 /**
  * @brief Close and free authentication state
  */
@@ -138,76 +184,6 @@ static char *rd_kafka_sasl_scram_get_attr (const rd_chariov_t *inbuf, char attr,
 }
 
 
-/**
- * @brief Base64 encode binary input \p in
- * @returns a newly allocated, base64-encoded string or NULL on error.
- */
-static char *rd_base64_encode (const rd_chariov_t *in) {
-        char *ret;
-        size_t ret_len, max_len;
-
-        /* OpenSSL takes an |int| argument so the input cannot exceed that. */
-        if (in->size > INT_MAX) {
-                return NULL;
-        }
-
-        /* This does not overflow given the |INT_MAX| bound, above. */
-        max_len = (((in->size + 2) / 3) * 4) + 1;
-        ret = rd_malloc(max_len);
-        if (ret == NULL) {
-                return NULL;
-        }
-
-        ret_len = EVP_EncodeBlock((uint8_t*)ret, (uint8_t*)in->ptr, (int)in->size);
-        assert(ret_len < max_len);
-        ret[ret_len] = 0;
-
-        return ret;
-}
-
-
-/**
- * @brief Base64 decode input string \p in. Ignores leading and trailing
- *         whitespace.
- * @returns -1 on invalid Base64, or 0 on successes in which case a
- *         newly allocated binary string is set in out (and size).
- */
-static int rd_base64_decode (const rd_chariov_t *in, rd_chariov_t *out) {
-        size_t ret_len;
-
-        /* OpenSSL takes an |int| argument, so |in->size| must not exceed
-         * that. */
-        if (in->size % 4 != 0 || in->size > INT_MAX) {
-                return -1;
-        }
-
-        ret_len = ((in->size / 4) * 3);
-        out->ptr = rd_malloc(ret_len+1);
-
-        if (EVP_DecodeBlock((uint8_t*)out->ptr, (uint8_t*)in->ptr,
-                            (int)in->size) == -1) {
-                free(out->ptr);
-                out->ptr = NULL;
-                return -1;
-        }
-
-        /* EVP_DecodeBlock will pad the output with trailing NULs and count
-         * them in the return value. */
-        if (in->size > 1 && in->ptr[in->size-1] == '=') {
-          if (in->size > 2 && in->ptr[in->size-2] == '=') {
-                  ret_len -= 2;
-          } else {
-                  ret_len -= 1;
-          }
-        }
-
-        out->ptr[ret_len] = 0;
-        out->size = ret_len;
-
-        return 0;
-}
-
-
 /**
  * @brief Perform H(str) hash function and stores the result in \p out
  *        which must be at least EVP_MAX_MD_SIZE.
@@ -325,6 +301,141 @@ rd_kafka_sasl_scram_Hi (rd_kafka_transport_t *rktrans,
 }
 
 
+/**
+ * @brief Securely clear and free cached keys.
+ */
+static void rd_kafka_sasl_scram_keys_destroy (rd_kafka_sasl_scram_keys_t *keys) {
+        OPENSSL_cleanse(keys->ClientKey, sizeof(keys->ClientKey));
+        OPENSSL_cleanse(keys->ServerKey, sizeof(keys->ServerKey));
+        rd_free(keys->username);
+        rd_free(keys->salt.ptr);
+        rd_free(keys);
+}
+
+
+/**
+ * @brief Get the ClientKey and ServerKey for \p salt and \p itcnt,
+ *        from the client instance's cache if available, else derive them
+ *        and add them to the cache.
+ *
+ * ClientKey and ServerKey must be at least EVP_MAX_MD_SIZE.
+ *
+ * The cache lock is held while deriving the keys so that concurrent
+ * (re)connects to multiple brokers only derive them once.
+ *
+ * @returns 0 on success, else -1
+ *
+ * @locality broker thread
+ */
+static int
+rd_kafka_sasl_scram_keys_get (rd_kafka_transport_t *rktrans,
+                              const rd_chariov_t *salt,
+                              int itcnt,
+                              rd_chariov_t *ClientKey,
+                              rd_chariov_t *ServerKey) {
+        rd_kafka_t *rk = rktrans->rktrans_rkb->rkb_rk;
+        rd_kafka_sasl_scram_handle_t *handle = rk->rk_sasl.handle;
+        const rd_kafka_conf_t *conf = &rk->rk_conf;
+        rd_kafka_sasl_scram_keys_t *keys;
+        rd_chariov_t SaslPassword =
+                { .ptr = conf->sasl.password,
+                  .size = strlen(conf->sasl.password) };
+        unsigned char SaltedPasswordBuf[EVP_MAX_MD_SIZE];
+        rd_chariov_t SaltedPassword = { .ptr = (char *)SaltedPasswordBuf };
+        const rd_chariov_t ClientKeyVerbatim =
+                { .ptr = "Client Key", .size = 10 };
+        const rd_chariov_t ServerKeyVerbatim =
+                { .ptr = "Server Key", .size = 10 };
+        rd_ts_t ts_start;
+        int r = -1;
+
+        mtx_lock(&handle->lock);
+
+        TAILQ_FOREACH(keys, &handle->keys, link) {
+                if (keys->itcnt == itcnt &&
+                    keys->salt.size == salt->size &&
+                    !memcmp(keys->salt.ptr, salt->ptr, salt->size) &&
+                    !strcmp(keys->username, conf->sasl.username))
+                        break;
+        }
+
+        if (keys) {
+                /* Move to head (most recently used) */
+                if (keys != TAILQ_FIRST(&handle->keys)) {
+                        TAILQ_REMOVE(&handle->keys, keys, link);
+                        TAILQ_INSERT_HEAD(&handle->keys, keys, link);
+                }
+
+                memcpy(ClientKey->ptr, keys->ClientKey, keys->size);
+                ClientKey->size = keys->size;
+                memcpy(ServerKey->ptr, keys->ServerKey, keys->size);
+                ServerKey->size = keys->size;
+                rd_atomic64_add(&handle->cached_cnt, 1);
+                mtx_unlock(&handle->lock);
+
+                rd_rkb_dbg(rktrans->rktrans_rkb, SECURITY, "SCRAM",
+                           "Using cached SCRAM keys for %s "
+                           "(%d iterations)", conf->sasl.username, itcnt);
+                return 0;
+        }
+
+        ts_start = rd_clock();
+
+        /* SaltedPassword  := Hi(Normalize(password), salt, i) */
+        if (rd_kafka_sasl_scram_Hi(
+                    rktrans, &SaslPassword, salt,
+                    itcnt, &SaltedPassword) == -1)
+                goto done;
+
+        /* ClientKey       := HMAC(SaltedPassword, "Client Key") */
+        if (rd_kafka_sasl_scram_HMAC(
+                    rktrans, &SaltedPassword, &ClientKeyVerbatim,
+                    ClientKey) == -1)
+                goto done;
+
+        /* ServerKey       := HMAC(SaltedPassword, "Server Key") */
+        if (rd_kafka_sasl_scram_HMAC(
+                    rktrans, &SaltedPassword, &ServerKeyVerbatim,
+                    ServerKey) == -1)
+                goto done;
+
+        rd_assert(ClientKey->size == ServerKey->size);
+
+        keys = rd_calloc(1, sizeof(*keys));
+        keys->username = rd_strdup(conf->sasl.username);
+        keys->salt.ptr = rd_memdup(salt->ptr, salt->size);
+        keys->salt.size = salt->size;
+        keys->itcnt = itcnt;
+        keys->size = (unsigned int)ClientKey->size;
+        memcpy(keys->ClientKey, ClientKey->ptr, ClientKey->size);
+        memcpy(keys->ServerKey, ServerKey->ptr, ServerKey->size);
+
+        TAILQ_INSERT_HEAD(&handle->keys, keys, link);
+        rd_atomic64_add(&handle->derived_cnt, 1);
+        if (rd_atomic64_add(&handle->keys_cnt, 1) >
+            RD_KAFKA_SASL_SCRAM_KEYS_MAX) {
+                keys = TAILQ_LAST(&handle->keys,
+                                  rd_kafka_sasl_scram_keys_head_s);
+                TAILQ_REMOVE(&handle->keys, keys, link);
+                rd_kafka_sasl_scram_keys_destroy(keys);
+                rd_atomic64_sub(&handle->keys_cnt, 1);
+        }
+
+        r = 0;
+
+        rd_rkb_dbg(rktrans->rktrans_rkb, SECURITY, "SCRAM",
+                   "Derived SCRAM keys for %s (%d iterations) in %.3fms",
+                   conf->sasl.username, itcnt,
+                   (double)(rd_clock() - ts_start) / 1000.0);
+
+ done:
+        mtx_unlock(&handle->lock);
+        OPENSSL_cleanse(SaltedPasswordBuf, sizeof(SaltedPasswordBuf));
+
+        return r;
+}
+
+
 /**
  * @returns a SASL value-safe-char encoded string, replacing "," and "="
  *          with their escaped counterparts in a newly allocated string.
@@ -403,12 +514,6 @@ rd_kafka_sasl_scram_build_client_final_message (
         const rd_chariov_t *server_first_msg,
         int itcnt, rd_chariov_t *out) {
         struct rd_kafka_sasl_scram_state *state = rktrans->rktrans_sasl.state;
-        const rd_kafka_conf_t *conf = &rktrans->rktrans_rkb->rkb_rk->rk_conf;
-        rd_chariov_t SaslPassword =
-                { .ptr = conf->sasl.password,
-                  .size = strlen(conf->sasl.password) };
-        rd_chariov_t SaltedPassword =
-                { .ptr = rd_alloca(EVP_MAX_MD_SIZE) };
         rd_chariov_t ClientKey =
                 { .ptr = rd_alloca(EVP_MAX_MD_SIZE) };
         rd_chariov_t ServerKey =
@@ -420,10 +525,6 @@ rd_kafka_sasl_scram_build_client_final_message (
                 { .ptr = rd_alloca(EVP_MAX_MD_SIZE) };
         rd_chariov_t ServerSignature =
                 { .ptr = rd_alloca(EVP_MAX_MD_SIZE) };
-        const rd_chariov_t ClientKeyVerbatim =
-                { .ptr = "Client Key", .size = 10 };
-        const rd_chariov_t ServerKeyVerbatim =
-                { .ptr = "Server Key", .size = 10 };
         rd_chariov_t ClientProof =
                 { .ptr = rd_alloca(EVP_MAX_MD_SIZE) };
         rd_chariov_t client_final_msg_wo_proof;
@@ -445,16 +546,12 @@ rd_kafka_sasl_scram_build_client_final_message (
          * ServerSignature := HMAC(ServerKey, AuthMessage)
          */
 
-        /* SaltedPassword  := Hi(Normalize(password), salt, i) */
-        if (rd_kafka_sasl_scram_Hi(
-                    rktrans, &SaslPassword, salt,
-                    itcnt, &SaltedPassword) == -1)
-                return -1;
-
-        /* ClientKey       := HMAC(SaltedPassword, "Client Key") */
-        if (rd_kafka_sasl_scram_HMAC(
-                    rktrans, &SaltedPassword, &ClientKeyVerbatim,
-                    &ClientKey) == -1)
+        /* SaltedPassword  := Hi(Normalize(password), salt, i)
+         * ClientKey       := HMAC(SaltedPassword, "Client Key")
+         * ServerKey       := HMAC(SaltedPassword, "Server Key")
+         * (cached per client instance) */
+        if (rd_kafka_sasl_scram_keys_get(rktrans, salt, itcnt,
+                                         &ClientKey, &ServerKey) == -1)
                 return -1;
 
         /* StoredKey       := H(ClientKey) */
@@ -485,14 +582,6 @@ rd_kafka_sasl_scram_build_client_final_message (
          * server-final-message is received.
          */
 
-        /* ServerKey       := HMAC(SaltedPassword, "Server Key") */
-        if (rd_kafka_sasl_scram_HMAC(
-                    rktrans, &SaltedPassword, &ServerKeyVerbatim,
-                    &ServerKey) == -1) {
-                rd_free(client_final_msg_wo_proof.ptr);
-                return -1;
-        }
-
         /* ServerSignature := HMAC(ServerKey, AuthMessage) */
         if (rd_kafka_sasl_scram_HMAC(rktrans, &ServerKey,
                                      &AuthMessage, &ServerSignature) == -1) {
@@ -863,6 +952,72 @@ static int rd_kafka_sasl_scram_client_new (rd_kafka_transport_t *rktrans,
 
 
 
+/**
+ * @brief Per client instance initializer
+ */
+static int rd_kafka_sasl_scram_init (rd_kafka_t *rk,
+                                     char *errstr, size_t errstr_size) {
+        rd_kafka_sasl_scram_handle_t *handle;
+
+        handle = rd_calloc(1, sizeof(*handle));
+        mtx_init(&handle->lock, mtx_plain);
+        TAILQ_INIT(&handle->keys);
+        rd_atomic64_init(&handle->keys_cnt, 0);
+        rd_atomic64_init(&handle->derived_cnt, 0);
+        rd_atomic64_init(&handle->cached_cnt, 0);
+        rk->rk_sasl.handle = handle;
+
+        return 0;
+}
+
+
+/**
+ * @brief Get the key cache statistics of client instance \p rk.
+ *
+ * @returns rd_false if \p rk does not use SASL SCRAM.
+ *
+ * @locality any
+ * @locks none: does not wait for ongoing key derivations.
+ */
+rd_bool_t rd_kafka_sasl_scram_stats (rd_kafka_t *rk,
+                                     int64_t *derived_cntp,
+                                     int64_t *cached_cntp,
+                                     int64_t *keys_cntp) {
+        rd_kafka_sasl_scram_handle_t *handle = rk->rk_sasl.handle;
+
+        if (rk->rk_conf.sasl.provider != &rd_kafka_sasl_scram_provider ||
+            !handle)
+                return rd_false;
+
+        *derived_cntp = rd_atomic64_get(&handle->derived_cnt);
+        *cached_cntp = rd_atomic64_get(&handle->cached_cnt);
+        *keys_cntp = rd_atomic64_get(&handle->keys_cnt);
+
+        return rd_true;
+}
+
+
+/**
+ * @brief Per client instance destructor, securely clears the cached keys.
+ */
+static void rd_kafka_sasl_scram_term (rd_kafka_t *rk) {
+        rd_kafka_sasl_scram_handle_t *handle = rk->rk_sasl.handle;
+        rd_kafka_sasl_scram_keys_t *keys;
+
+        if (!handle)
+                return;
+
+        while ((keys = TAILQ_FIRST(&handle->keys))) {
+                TAILQ_REMOVE(&handle->keys, keys, link);
+                rd_kafka_sasl_scram_keys_destroy(keys);
+        }
+
+        mtx_destroy(&handle->lock);
+        rd_free(handle);
+        rk->rk_sasl.handle = NULL;
+}
+
+
 /**
  * @brief Validate SCRAM config and look up the hash function
  */
@@ -905,6 +1060,8 @@ static int rd_kafka_sasl_scram_conf_validate (rd_kafka_t *rk,
 
 const struct rd_kafka_sasl_provider rd_kafka_sasl_scram_provider = {
         .name          = "SCRAM (builtin)",
+        .init          = rd_kafka_sasl_scram_init,
+        .term          = rd_kafka_sasl_scram_term,
         .client_new    = rd_kafka_sasl_scram_client_new,
         .recv          = rd_kafka_sasl_scram_recv,
         .close         = rd_kafka_sasl_scram_close,
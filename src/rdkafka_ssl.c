@@ -35,6 +35,8 @@
 #include "rdkafka_int.h"
 #include "rdkafka_transport_int.h"
 #include "rdkafka_cert.h"
+#include "rdkafka_ssl.h"
+#include "rdunittest.h"
 
 #ifdef _MSC_VER
 #pragma comment (lib, "crypt32.lib")
@@ -42,6 +44,11 @@
 
 #include <openssl/x509.h>
 
+#ifndef _MSC_VER
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#endif
+
 
 
 #if WITH_VALGRIND
@@ -462,6 +469,72 @@ rd_kafka_transport_ssl_set_endpoint_id (rd_kafka_transport_t *rktrans,
 }
 
 
+/**
+ * @brief Check if OpenSSL handed the connection's record encryption
+ *        over to the kernel (kTLS) when the handshake completed.
+ *
+ * With kTLS send offload application data is written to the socket
+ * directly, see rd_kafka_transport_send(), while received records are
+ * still read through SSL_read() so that OpenSSL gets to handle any
+ * post-handshake (non-application data) records.
+ */
+static void rd_kafka_transport_ssl_ktls_check (rd_kafka_transport_t *rktrans) {
+#ifdef SSL_OP_ENABLE_KTLS
+        rd_kafka_broker_t *rkb = rktrans->rktrans_rkb;
+        rd_bool_t ktls_send, ktls_recv;
+
+        if (!rkb->rkb_rk->rk_conf.ssl.ktls_enable)
+                return;
+
+        ktls_send = !!BIO_get_ktls_send(SSL_get_wbio(rktrans->rktrans_ssl));
+        ktls_recv = !!BIO_get_ktls_recv(SSL_get_rbio(rktrans->rktrans_ssl));
+
+        rktrans->rktrans_ktls_send = ktls_send;
+
+        rd_rkb_dbg(rkb, SECURITY, "KTLS",
+                   "Kernel TLS offload with %s (%s): send %s, receive %s",
+                   SSL_get_version(rktrans->rktrans_ssl),
+                   SSL_get_cipher_name(rktrans->rktrans_ssl),
+                   ktls_send ? "enabled" : "not available",
+                   ktls_recv ? "enabled" : "not available");
+#endif
+}
+
+
+/**
+ * @returns true if application data may be written directly to the
+ *          socket, i.e., kTLS send offload is active and OpenSSL has no
+ *          pending TLS 1.3 KeyUpdate to send.
+ *
+ * A KeyUpdate requested by the peer is only answered from SSL_write(),
+ * so writes go through SSL_write() until it has been sent, after which
+ * the offload state is re-read since OpenSSL may have dropped it when
+ * rekeying.
+ */
+rd_bool_t rd_kafka_transport_ssl_ktls_send (rd_kafka_transport_t *rktrans) {
+#ifdef SSL_OP_ENABLE_KTLS
+        if (!rktrans->rktrans_ktls_send)
+                return rd_false;
+
+        if (SSL_get_key_update_type(rktrans->rktrans_ssl) !=
+            SSL_KEY_UPDATE_NONE) {
+                rktrans->rktrans_ktls_key_update = rd_true;
+                return rd_false;
+        }
+
+        if (unlikely(rktrans->rktrans_ktls_key_update)) {
+                rktrans->rktrans_ktls_key_update = rd_false;
+                rktrans->rktrans_ktls_send = !!BIO_get_ktls_send(
+                        SSL_get_wbio(rktrans->rktrans_ssl));
+        }
+
+        return rktrans->rktrans_ktls_send;
+#else
+        return rd_false;
+#endif
+}
+
+
 /**
  * @brief Set up SSL for a newly connected connection
  *
@@ -489,6 +562,7 @@ int rd_kafka_transport_ssl_connect (rd_kafka_broker_t *rkb,
         if (r == 1) {
                 /* Connected, highly unlikely since this is a
                  * non-blocking operation. */
+                rd_kafka_transport_ssl_ktls_check(rktrans);
                 rd_kafka_transport_connect_done(rktrans, NULL);
                 return 0;
         }
@@ -581,6 +655,8 @@ int rd_kafka_transport_ssl_handshake (rd_kafka_transport_t *rktrans) {
                 if (rd_kafka_transport_ssl_verify(rktrans) == -1)
                         return -1;
 
+                rd_kafka_transport_ssl_ktls_check(rktrans);
+
                 rd_kafka_transport_connect_done(rktrans, NULL);
                 return 1;
 
@@ -1121,6 +1197,20 @@ int rd_kafka_ssl_ctx_init (rd_kafka_t *rk, char *errstr, size_t errstr_size) {
 
         SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE);
 
+        if (rk->rk_conf.ssl.ktls_enable) {
+#ifdef SSL_OP_ENABLE_KTLS
+                rd_kafka_dbg(rk, SECURITY, "SSL",
+                             "Enabling kernel TLS offload");
+                SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#else
+                rd_kafka_log(rk, LOG_WARNING, "KTLS",
+                             "ssl.ktls.enable ignored: kernel TLS offload "
+                             "is not supported by this build "
+                             "(OpenSSL version 0x%lx)",
+                             OPENSSL_VERSION_NUMBER);
+#endif
+        }
+
         rk->rk_conf.ssl.ctx = ctx;
 
         return 0;
@@ -1226,3 +1316,328 @@ void rd_kafka_ssl_init (void) {
         OpenSSL_add_all_algorithms();
 #endif
 }
+
+
+
+/**
+ * @name Unit tests
+ * @{
+ */
+
+#if !defined(_MSC_VER) && defined(SSL_OP_ENABLE_KTLS)
+
+#define UT_SSL_PATTERN_PERIOD 251
+
+/**
+ * @brief Loopback TLS server: receives \c expect bytes and verifies
+ *        that they follow the repeating pattern.
+ */
+struct ut_ssl_server {
+        SSL *ssl;
+        size_t expect;
+        size_t recvd;
+        rd_bool_t corrupt;
+        const char *pattern;
+};
+
+static int ut_ssl_server_main (void *arg) {
+        struct ut_ssl_server *srv = arg;
+        char buf[65536];
+
+        if (SSL_accept(srv->ssl) != 1)
+                return 0;
+
+        while (srv->recvd < srv->expect) {
+                int r = SSL_read(srv->ssl, buf, sizeof(buf));
+                if (r <= 0)
+                        break;
+
+                if (memcmp(buf,
+                           srv->pattern +
+                           (srv->recvd % UT_SSL_PATTERN_PERIOD),
+                           (size_t)r))
+                        srv->corrupt = rd_true;
+
+                srv->recvd += (size_t)r;
+        }
+
+        return 0;
+}
+
+
+/**
+ * @brief Creates a self-signed server certificate and key on \p ctx.
+ */
+static int ut_ssl_server_cert (SSL_CTX *ctx) {
+        EVP_PKEY *pkey;
+        X509 *x509;
+        X509_NAME *name;
+        int r = -1;
+
+        if (!(pkey = EVP_EC_gen("P-256")))
+                return -1;
+
+        x509 = X509_new();
+        ASN1_INTEGER_set(X509_get_serialNumber(x509), 1);
+        X509_gmtime_adj(X509_getm_notBefore(x509), 0);
+        X509_gmtime_adj(X509_getm_notAfter(x509), 3600);
+        X509_set_pubkey(x509, pkey);
+        name = X509_get_subject_name(x509);
+        X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                                   (const unsigned char *)"localhost",
+                                   -1, -1, 0);
+        X509_set_issuer_name(x509, name);
+
+        if (X509_sign(x509, pkey, EVP_sha256()) &&
+            SSL_CTX_use_certificate(ctx, x509) == 1 &&
+            SSL_CTX_use_PrivateKey(ctx, pkey) == 1)
+                r = 0;
+
+        X509_free(x509);
+        EVP_PKEY_free(pkey);
+        return r;
+}
+
+
+/**
+ * @brief Like RD_UT_ASSERT() but jumps to the function's \c done label
+ *        so that sockets, SSL objects and the server thread are cleaned up.
+ */
+#define UT_SSL_ASSERT(expr,...) do {                                    \
+                if (!(expr)) {                                          \
+                        fprintf(stderr,                                 \
+                                "\033[31mRDUT: FAIL: %s:%d: %s: "       \
+                                "assert failed: " # expr ": ",          \
+                                __FILE__, __LINE__, __FUNCTION__);      \
+                        fprintf(stderr, __VA_ARGS__);                   \
+                        fprintf(stderr, "\033[0m\n");                   \
+                        if (rd_unittest_assert_on_failure)              \
+                                rd_assert(expr);                        \
+                        fails++;                                        \
+                        goto done;                                      \
+                }                                                       \
+        } while (0)
+
+
+/**
+ * @brief Pushes \p size bytes through a TLS connection over loopback TCP
+ *        with rd_kafka_transport_send(), with or without kTLS send
+ *        offload, and reports the throughput.
+ */
+static int ut_ssl_loopback_throughput (SSL_CTX *sctx, rd_bool_t ktls,
+                                       const char *pattern, size_t size) {
+        struct ut_ssl_server srv = { .expect = size, .pattern = pattern };
+        rd_kafka_transport_t *rktrans = NULL;
+        struct sockaddr_in sin = { .sin_family = AF_INET };
+        socklen_t sinlen = sizeof(sin);
+        SSL_CTX *cctx = NULL;
+        int ls = -1, ss = -1, cs = -1;
+        int sndbuf = 0;
+        socklen_t sndbuflen = sizeof(sndbuf);
+        thrd_t thrd;
+        rd_bool_t thrd_running = rd_false;
+        rd_buf_t b;
+        rd_slice_t slice;
+        size_t of;
+        rd_ts_t ts;
+        char errstr[256];
+        rd_bool_t ktls_send;
+        int fails = 0;
+
+        rd_buf_init(&b, 0, 0);
+
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        ls = socket(AF_INET, SOCK_STREAM, 0);
+        UT_SSL_ASSERT(ls != -1, "socket() failed: %s", rd_strerror(errno));
+        UT_SSL_ASSERT(!bind(ls, (struct sockaddr *)&sin, sizeof(sin)) &&
+                      !listen(ls, 1) &&
+                      !getsockname(ls, (struct sockaddr *)&sin, &sinlen),
+                      "listener failed: %s", rd_strerror(errno));
+
+        cs = socket(AF_INET, SOCK_STREAM, 0);
+        UT_SSL_ASSERT(cs != -1, "socket() failed: %s", rd_strerror(errno));
+        UT_SSL_ASSERT(!connect(cs, (struct sockaddr *)&sin, sizeof(sin)),
+                      "connect() failed: %s", rd_strerror(errno));
+        ss = accept(ls, NULL, NULL);
+        UT_SSL_ASSERT(ss != -1, "accept() failed: %s", rd_strerror(errno));
+
+        srv.ssl = SSL_new(sctx);
+        SSL_set_fd(srv.ssl, ss);
+        UT_SSL_ASSERT(thrd_create(&thrd, ut_ssl_server_main, &srv) ==
+                      thrd_success, "thrd_create() failed");
+        thrd_running = rd_true;
+
+        cctx = SSL_CTX_new(TLS_client_method());
+        SSL_CTX_set_verify(cctx, SSL_VERIFY_NONE, NULL);
+        SSL_CTX_set_mode(cctx, SSL_MODE_ENABLE_PARTIAL_WRITE);
+        if (ktls)
+                SSL_CTX_set_options(cctx, SSL_OP_ENABLE_KTLS);
+
+        getsockopt(cs, SOL_SOCKET, SO_SNDBUF, (void *)&sndbuf, &sndbuflen);
+
+        rktrans = rd_calloc(1, sizeof(*rktrans));
+        rktrans->rktrans_s = cs;
+        rktrans->rktrans_sndbuf_size = (size_t)sndbuf;
+        rktrans->rktrans_ssl = SSL_new(cctx);
+        SSL_set_fd(rktrans->rktrans_ssl, cs);
+        UT_SSL_ASSERT(SSL_connect(rktrans->rktrans_ssl) == 1,
+                      "SSL_connect() failed: %s",
+                      rd_kafka_ssl_last_error_str());
+
+        ktls_send = !!BIO_get_ktls_send(SSL_get_wbio(rktrans->rktrans_ssl));
+        rktrans->rktrans_ktls_send = ktls_send;
+        if (ktls && !ktls_send)
+                RD_UT_SAY("kTLS send offload not available for %s (%s): "
+                          "using user-space TLS",
+                          SSL_get_version(rktrans->rktrans_ssl),
+                          SSL_get_cipher_name(rktrans->rktrans_ssl));
+
+        /* Write the payload in Produce-sized chunks so that the
+         * buffer has many segments to gather. */
+        for (of = 0 ; of < size ; of += 65536)
+                rd_buf_write(&b, pattern + (of % UT_SSL_PATTERN_PERIOD),
+                             RD_MIN(65536, size - of));
+        rd_slice_init_full(&slice, &b);
+
+        ts = rd_clock();
+        while (rd_slice_remains(&slice) > 0) {
+                ssize_t r = rd_kafka_transport_send(rktrans, &slice,
+                                                    errstr, sizeof(errstr));
+                UT_SSL_ASSERT(r != -1, "send failed: %s", errstr);
+                if (r == 0) {
+                        struct pollfd pfd = { .fd = cs, .events = POLLOUT };
+                        poll(&pfd, 1, 100);
+                }
+        }
+        thrd_join(thrd, NULL);
+        thrd_running = rd_false;
+        ts = rd_clock() - ts;
+
+        UT_SSL_ASSERT(srv.recvd == size && !srv.corrupt,
+                      "server received %"PRIusz"/%"PRIusz" bytes%s",
+                      srv.recvd, size, srv.corrupt ? " (corrupt)" : "");
+
+        RD_UT_SAY("%s TLS: %"PRIusz" bytes in %.3fms: %.1f MB/s",
+                  ktls_send ? "kernel" : "user-space", size,
+                  (double)ts / 1000.0,
+                  (double)size / (double)RD_MAX(ts, 1));
+
+        /* Have the server request a TLS 1.3 KeyUpdate: the client must
+         * answer it through SSL_write() before writing more data,
+         * whether or not kTLS send offload is active. */
+        if (SSL_version(srv.ssl) == TLS1_3_VERSION) {
+                char buf[2];
+                int i;
+
+                UT_SSL_ASSERT(SSL_key_update(srv.ssl,
+                                             SSL_KEY_UPDATE_REQUESTED) == 1 &&
+                              SSL_write(srv.ssl, "k", 1) == 1,
+                              "server KeyUpdate failed: %s",
+                              rd_kafka_ssl_last_error_str());
+                UT_SSL_ASSERT(SSL_read(rktrans->rktrans_ssl, buf, 1) == 1,
+                              "client SSL_read() failed: %s",
+                              rd_kafka_ssl_last_error_str());
+                UT_SSL_ASSERT(SSL_get_key_update_type(rktrans->rktrans_ssl) !=
+                              SSL_KEY_UPDATE_NONE,
+                              "expected a pending KeyUpdate");
+
+                for (i = 0 ; i < 2 ; i++) {
+                        rd_buf_destroy(&b);
+                        rd_buf_init(&b, 0, 0);
+                        rd_buf_write(&b, i == 0 ? "ku" : "ok", 2);
+                        rd_slice_init_full(&slice, &b);
+                        while (rd_slice_remains(&slice) > 0)
+                                UT_SSL_ASSERT(rd_kafka_transport_send(
+                                                      rktrans, &slice,
+                                                      errstr,
+                                                      sizeof(errstr)) != -1,
+                                              "send failed: %s", errstr);
+
+                        UT_SSL_ASSERT(SSL_get_key_update_type(
+                                              rktrans->rktrans_ssl) ==
+                                      SSL_KEY_UPDATE_NONE,
+                                      "KeyUpdate was not sent");
+                        UT_SSL_ASSERT(SSL_read(srv.ssl, buf, 2) == 2 &&
+                                      !memcmp(buf, i == 0 ? "ku" : "ok", 2),
+                                      "server SSL_read() failed after "
+                                      "KeyUpdate: %s",
+                                      rd_kafka_ssl_last_error_str());
+                }
+
+                RD_UT_SAY("KeyUpdate answered with kTLS send offload %s",
+                          rktrans->rktrans_ktls_send ?
+                          "enabled" : "not active");
+        }
+
+ done:
+        if (thrd_running) {
+                /* Unblock the server thread's SSL_accept() or SSL_read() */
+                shutdown(cs, SHUT_RDWR);
+                thrd_join(thrd, NULL);
+        }
+
+        rd_buf_destroy(&b);
+        if (rktrans) {
+                if (!fails)
+                        SSL_shutdown(rktrans->rktrans_ssl);
+                SSL_free(rktrans->rktrans_ssl);
+                rd_free(rktrans);
+        }
+        SSL_CTX_free(cctx);
+        SSL_free(srv.ssl);
+        if (cs != -1)
+                close(cs);
+        if (ss != -1)
+                close(ss);
+        if (ls != -1)
+                close(ls);
+
+        return fails;
+}
+#endif
+
+
+/**
+ * @brief Loopback TLS throughput with and without kTLS send offload.
+ */
+static int ut_ssl_ktls (void) {
+#if !defined(_MSC_VER) && defined(SSL_OP_ENABLE_KTLS)
+        SSL_CTX *sctx;
+        char *pattern;
+        size_t size = 32 * 1024 * 1024;
+        int i, fails = 0;
+
+        pattern = rd_malloc(65536 + UT_SSL_PATTERN_PERIOD);
+        for (i = 0 ; i < 65536 + UT_SSL_PATTERN_PERIOD ; i++)
+                pattern[i] = (char)(i % UT_SSL_PATTERN_PERIOD);
+
+        sctx = SSL_CTX_new(TLS_server_method());
+        UT_SSL_ASSERT(!ut_ssl_server_cert(sctx),
+                      "Failed to create server certificate: %s",
+                      rd_kafka_ssl_last_error_str());
+
+        fails += ut_ssl_loopback_throughput(sctx, rd_false, pattern, size);
+        fails += ut_ssl_loopback_throughput(sctx, rd_true, pattern, size);
+
+ done:
+        SSL_CTX_free(sctx);
+        rd_free(pattern);
+
+        RD_UT_ASSERT(!fails, "%d loopback run(s) failed", fails);
+        RD_UT_PASS();
+#else
+        RD_UT_SAY("kTLS is not supported by this build: skipping");
+        return 0;
+#endif
+}
+
+
+int unittest_ssl (void) {
+        int fails = 0;
+
+        fails += ut_ssl_ktls();
+
+        return fails;
+}
+
+/**@}*/
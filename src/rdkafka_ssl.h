@@ -35,6 +35,7 @@ int rd_kafka_transport_ssl_connect (rd_kafka_broker_t *rkb,
                                     rd_kafka_transport_t *rktrans,
                                     char *errstr, size_t errstr_size);
 int rd_kafka_transport_ssl_handshake (rd_kafka_transport_t *rktrans);
+rd_bool_t rd_kafka_transport_ssl_ktls_send (rd_kafka_transport_t *rktrans);
 ssize_t rd_kafka_transport_ssl_send (rd_kafka_transport_t *rktrans,
                                      rd_slice_t *slice,
                                      char *errstr, size_t errstr_size);
@@ -52,4 +53,6 @@ void rd_kafka_ssl_init(void);
 
 const char *rd_kafka_ssl_last_error_str (void);
 
+int unittest_ssl (void);
+
 #endif /* _RDKAFKA_SSL_H_ */
@@ -47,10 +47,17 @@ rd_kafka_resp_err_t rd_kafka_unsubscribe (rd_kafka_t *rk) {
 }
 
 
-/** @returns 1 if the topic is invalid (bad regex, empty), else 0 if valid. */
+/**
+ * @returns 1 if the topic is invalid (bad regex, empty), else 0 if valid.
+ *
+ * Regexes are compiled through the handle's regex cache (\p opaque)
+ * so they are ready for matching on the following metadata refreshes.
+ */
 static size_t _invalid_topic_cb (const rd_kafka_topic_partition_t *rktpar,
                                  void *opaque) {
+        rd_kafka_t *rk = opaque;
         rd_regex_t *re;
+        rd_bool_t owned;
         char errstr[1];
 
         if (!*rktpar->topic)
@@ -59,10 +66,12 @@ static size_t _invalid_topic_cb (const rd_kafka_topic_partition_t *rktpar,
         if (*rktpar->topic != '^')
                 return 0;
 
-        if (!(re = rd_regex_comp(rktpar->topic, errstr, sizeof(errstr))))
+        if (!(re = rd_kafka_regex_cache_get(&rk->rk_regex_cache,
+                                            rktpar->topic, &owned,
+                                            errstr, sizeof(errstr))))
                 return 1;
 
-        rd_regex_destroy(re);
+        rd_kafka_regex_cache_release(re, owned);
 
         return 0;
 }
@@ -81,7 +90,7 @@ rd_kafka_subscribe (rd_kafka_t *rk,
         /* Validate topics */
         if (topics->cnt == 0 ||
             rd_kafka_topic_partition_list_sum(topics,
-                                              _invalid_topic_cb, NULL) > 0)
+                                              _invalid_topic_cb, rk) > 0)
                 return RD_KAFKA_RESP_ERR__INVALID_ARG;
 
         rko = rd_kafka_op_new(RD_KAFKA_OP_SUBSCRIBE);
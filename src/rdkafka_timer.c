@@ -30,6 +30,16 @@
 #include "rd.h"
 #include "rdtime.h"
 #include "rdsysqueue.h"
+#include "rdrand.h"
+#include "rdunittest.h"
+
+
+/**
+ * Number of children per node in the timer heap.
+ * A 4-ary heap is shallower than a binary heap and keeps the children
+ * of a node on the same cache line.
+ */
+#define RD_KAFKA_TIMERS_HEAP_D  4
 
 
 static RD_INLINE void rd_kafka_timers_lock (rd_kafka_timers_t *rkts) {
@@ -51,20 +61,107 @@ static RD_INLINE int rd_kafka_timer_scheduled (const rd_kafka_timer_t *rtmr) {
 }
 
 
-static int rd_kafka_timer_cmp (const void *_a, const void *_b) {
-	const rd_kafka_timer_t *a = _a, *b = _b;
-        return RD_CMP(a->rtmr_next, b->rtmr_next);
+/**
+ * @returns true if timer \p a fires before timer \p b.
+ */
+static RD_INLINE rd_bool_t rd_kafka_timer_before (const rd_kafka_timer_t *a,
+                                                  const rd_kafka_timer_t *b) {
+        return a->rtmr_next < b->rtmr_next ||
+                (a->rtmr_next == b->rtmr_next && a->rtmr_seq < b->rtmr_seq);
+}
+
+/**
+ * @returns the next timer to fire, or NULL if no timers are scheduled.
+ */
+static RD_INLINE rd_kafka_timer_t *
+rd_kafka_timers_first (const rd_kafka_timers_t *rkts) {
+        return rkts->rkts_cnt > 0 ? rkts->rkts_heap[0] : NULL;
+}
+
+static RD_INLINE void rd_kafka_timers_heap_set (rd_kafka_timers_t *rkts,
+                                                int idx,
+                                                rd_kafka_timer_t *rtmr) {
+        rkts->rkts_heap[idx] = rtmr;
+        rtmr->rtmr_idx = idx;
+}
+
+/**
+ * @brief Move the timer at \p idx up the heap until its parent
+ *        fires before it.
+ */
+static void rd_kafka_timers_heap_up (rd_kafka_timers_t *rkts, int idx) {
+        rd_kafka_timer_t *rtmr = rkts->rkts_heap[idx];
+
+        while (idx > 0) {
+                int parent = (idx - 1) / RD_KAFKA_TIMERS_HEAP_D;
+
+                if (!rd_kafka_timer_before(rtmr, rkts->rkts_heap[parent]))
+                        break;
+
+                rd_kafka_timers_heap_set(rkts, idx, rkts->rkts_heap[parent]);
+                idx = parent;
+        }
+
+        rd_kafka_timers_heap_set(rkts, idx, rtmr);
+}
+
+/**
+ * @brief Move the timer at \p idx down the heap until it fires before
+ *        all of its children.
+ */
+static void rd_kafka_timers_heap_down (rd_kafka_timers_t *rkts, int idx) {
+        rd_kafka_timer_t *rtmr = rkts->rkts_heap[idx];
+
+        while (1) {
+                int first = idx * RD_KAFKA_TIMERS_HEAP_D + 1;
+                int last, min, i;
+
+                if (first >= rkts->rkts_cnt)
+                        break;
+
+                last = RD_MIN(first + RD_KAFKA_TIMERS_HEAP_D, rkts->rkts_cnt);
+                min = first;
+                for (i = first + 1 ; i < last ; i++)
+                        if (rd_kafka_timer_before(rkts->rkts_heap[i],
+                                                  rkts->rkts_heap[min]))
+                                min = i;
+
+                if (!rd_kafka_timer_before(rkts->rkts_heap[min], rtmr))
+                        break;
+
+                rd_kafka_timers_heap_set(rkts, idx, rkts->rkts_heap[min]);
+                idx = min;
+        }
+
+        rd_kafka_timers_heap_set(rkts, idx, rtmr);
 }
 
 static void rd_kafka_timer_unschedule (rd_kafka_timers_t *rkts,
                                        rd_kafka_timer_t *rtmr) {
-	TAILQ_REMOVE(&rkts->rkts_timers, rtmr, rtmr_link);
+        int idx = rtmr->rtmr_idx;
+        rd_kafka_timer_t *last;
+
+        rd_dassert(idx < rkts->rkts_cnt && rkts->rkts_heap[idx] == rtmr);
+
+        /* Fill the hole with the last timer and restore the heap order */
+        last = rkts->rkts_heap[--rkts->rkts_cnt];
+        if (last != rtmr) {
+                rd_kafka_timers_heap_set(rkts, idx, last);
+                if (idx > 0 &&
+                    rd_kafka_timer_before(
+                            last,
+                            rkts->rkts_heap[(idx - 1) /
+                                            RD_KAFKA_TIMERS_HEAP_D]))
+                        rd_kafka_timers_heap_up(rkts, idx);
+                else
+                        rd_kafka_timers_heap_down(rkts, idx);
+        }
+
 	rtmr->rtmr_next = 0;
 }
 
 static void rd_kafka_timer_schedule (rd_kafka_timers_t *rkts,
 				     rd_kafka_timer_t *rtmr, int extra_us) {
-	rd_kafka_timer_t *first;
 
 	/* Timer has been stopped */
 	if (!rtmr->rtmr_interval)
@@ -75,15 +172,21 @@ static void rd_kafka_timer_schedule (rd_kafka_timers_t *rkts,
                 return;
 
 	rtmr->rtmr_next = rd_clock() + rtmr->rtmr_interval + extra_us;
+        rtmr->rtmr_seq  = rkts->rkts_seq++;
 
-	if (!(first = TAILQ_FIRST(&rkts->rkts_timers)) ||
-	    first->rtmr_next > rtmr->rtmr_next) {
-		TAILQ_INSERT_HEAD(&rkts->rkts_timers, rtmr, rtmr_link);
+        if (unlikely(rkts->rkts_cnt == rkts->rkts_size)) {
+                rkts->rkts_size = rkts->rkts_size ? rkts->rkts_size * 2 : 32;
+                rkts->rkts_heap = rd_realloc(rkts->rkts_heap,
+                                             sizeof(*rkts->rkts_heap) *
+                                             rkts->rkts_size);
+        }
+
+        rd_kafka_timers_heap_set(rkts, rkts->rkts_cnt++, rtmr);
+        rd_kafka_timers_heap_up(rkts, rtmr->rtmr_idx);
+
+        /* Wake up the timer thread if this is the new first timer */
+        if (rtmr->rtmr_idx == 0)
                 cnd_signal(&rkts->rkts_cond);
-	} else
-		TAILQ_INSERT_SORTED(&rkts->rkts_timers, rtmr,
-                                    rd_kafka_timer_t *, rtmr_link,
-				    rd_kafka_timer_cmp);
 }
 
 /**
@@ -203,7 +306,7 @@ rd_ts_t rd_kafka_timers_next (rd_kafka_timers_t *rkts, int timeout_us,
 	if (do_lock)
 		rd_kafka_timers_lock(rkts);
 
-	if (likely((rtmr = TAILQ_FIRST(&rkts->rkts_timers)) != NULL)) {
+	if (likely((rtmr = rd_kafka_timers_first(rkts)) != NULL)) {
 		sleeptime = rtmr->rtmr_next - now;
 		if (sleeptime < 0)
 			sleeptime = 0;
@@ -248,7 +351,7 @@ void rd_kafka_timers_run (rd_kafka_timers_t *rkts, int timeout_us) {
 
 		now = rd_clock();
 
-		while ((rtmr = TAILQ_FIRST(&rkts->rkts_timers)) &&
+		while ((rtmr = rd_kafka_timers_first(rkts)) &&
 		       rtmr->rtmr_next <= now) {
 
 			rd_kafka_timer_unschedule(rkts, rtmr);
@@ -286,11 +389,14 @@ void rd_kafka_timers_destroy (rd_kafka_timers_t *rkts) {
 
         rd_kafka_timers_lock(rkts);
         rkts->rkts_enabled = 0;
-        while ((rtmr = TAILQ_FIRST(&rkts->rkts_timers)))
+        while ((rtmr = rd_kafka_timers_first(rkts)))
                 rd_kafka_timer_stop(rkts, rtmr, 0);
-        rd_kafka_assert(rkts->rkts_rk, TAILQ_EMPTY(&rkts->rkts_timers));
+        rd_kafka_assert(rkts->rkts_rk, rkts->rkts_cnt == 0);
         rd_kafka_timers_unlock(rkts);
 
+        if (rkts->rkts_heap)
+                rd_free(rkts->rkts_heap);
+
         cnd_destroy(&rkts->rkts_cond);
         mtx_destroy(&rkts->rkts_lock);
 }
@@ -298,8 +404,170 @@ void rd_kafka_timers_destroy (rd_kafka_timers_t *rkts) {
 void rd_kafka_timers_init (rd_kafka_timers_t *rkts, rd_kafka_t *rk) {
         memset(rkts, 0, sizeof(*rkts));
         rkts->rkts_rk = rk;
-        TAILQ_INIT(&rkts->rkts_timers);
         mtx_init(&rkts->rkts_lock, mtx_plain);
         cnd_init(&rkts->rkts_cond);
         rkts->rkts_enabled = 1;
 }
+
+
+/**
+ * @name Unit tests
+ * @{
+ *
+ */
+
+#define UT_TIMER_CNT 100000
+
+struct ut_timer {
+        rd_kafka_timer_t rtmr;
+        rd_ts_t next;           /**< Expected rtmr_next */
+        uint64_t seq;           /**< Expected rtmr_seq */
+        rd_bool_t stopped;
+};
+
+static struct {
+        rd_ts_t  last_next;
+        uint64_t last_seq;
+        int      fired;
+        int      misordered;
+        int      unexpected;
+} ut_timer_state;
+
+
+static void ut_timer_cb (rd_kafka_timers_t *rkts, void *arg) {
+        struct ut_timer *ut = arg;
+
+        if (ut->stopped)
+                ut_timer_state.unexpected++;
+
+        if (ut->next < ut_timer_state.last_next ||
+            (ut->next == ut_timer_state.last_next &&
+             ut->seq < ut_timer_state.last_seq))
+                ut_timer_state.misordered++;
+
+        ut_timer_state.last_next = ut->next;
+        ut_timer_state.last_seq  = ut->seq;
+        ut_timer_state.fired++;
+}
+
+
+/**
+ * @brief Verify the heap property and index back-references.
+ */
+static int ut_timers_verify (rd_kafka_timers_t *rkts) {
+        int i;
+
+        for (i = 0 ; i < rkts->rkts_cnt ; i++) {
+                const rd_kafka_timer_t *rtmr = rkts->rkts_heap[i];
+
+                RD_UT_ASSERT(rtmr->rtmr_idx == i,
+                             "timer at heap index %d has rtmr_idx %d",
+                             i, rtmr->rtmr_idx);
+                RD_UT_ASSERT(i == 0 ||
+                             !rd_kafka_timer_before(
+                                     rtmr,
+                                     rkts->rkts_heap[(i - 1) /
+                                                     RD_KAFKA_TIMERS_HEAP_D]),
+                             "timer at heap index %d fires before its parent",
+                             i);
+        }
+
+        return 0;
+}
+
+
+static void ut_timer_start (rd_kafka_timers_t *rkts, struct ut_timer *ut) {
+        rd_kafka_timer_start_oneshot(rkts, &ut->rtmr,
+                                     rd_jitter(1, 200) * 1000,
+                                     ut_timer_cb, ut);
+        ut->next = ut->rtmr.rtmr_next;
+        ut->seq  = ut->rtmr.rtmr_seq;
+}
+
+
+/**
+ * @brief Schedule, reschedule, stop and fire 100k timers and verify
+ *        that they fire in order.
+ */
+static int ut_timers_many (void) {
+        rd_kafka_t *rk;
+        rd_kafka_timers_t rkts;
+        struct ut_timer *timers;
+        int exp_fired = UT_TIMER_CNT;
+        rd_ts_t ts, ts_end;
+        int i;
+
+        RD_UT_SAY("Verifying %d timers", UT_TIMER_CNT);
+
+        rk = rd_kafka_new(RD_KAFKA_PRODUCER, NULL, NULL, 0);
+        RD_UT_ASSERT(rk, "failed to create producer");
+
+        rd_kafka_timers_init(&rkts, rk);
+        timers = rd_calloc(UT_TIMER_CNT, sizeof(*timers));
+        memset(&ut_timer_state, 0, sizeof(ut_timer_state));
+
+        ts = rd_clock();
+        for (i = 0 ; i < UT_TIMER_CNT ; i++)
+                ut_timer_start(&rkts, &timers[i]);
+        RD_UT_SAY("Started %d timers in %.3fms",
+                  UT_TIMER_CNT, (float)(rd_clock() - ts) / 1000.0f);
+
+        if (ut_timers_verify(&rkts))
+                return 1;
+
+        /* Restart every third timer and stop every fifth timer */
+        ts = rd_clock();
+        for (i = 0 ; i < UT_TIMER_CNT ; i += 3)
+                ut_timer_start(&rkts, &timers[i]);
+        for (i = 0 ; i < UT_TIMER_CNT ; i += 5) {
+                RD_UT_ASSERT(rd_kafka_timer_stop(&rkts, &timers[i].rtmr, 1),
+                             "timer %d should have been started", i);
+                timers[i].stopped = rd_true;
+                exp_fired--;
+        }
+        RD_UT_SAY("Restarted and stopped %d timers in %.3fms",
+                  UT_TIMER_CNT / 3 + UT_TIMER_CNT / 5,
+                  (float)(rd_clock() - ts) / 1000.0f);
+
+        RD_UT_ASSERT(rkts.rkts_cnt == exp_fired,
+                     "expected %d scheduled timers, not %d",
+                     exp_fired, rkts.rkts_cnt);
+        if (ut_timers_verify(&rkts))
+                return 1;
+
+        /* Fire all timers */
+        ts = rd_clock();
+        ts_end = ts + 10 * 1000 * 1000;
+        while (ut_timer_state.fired < exp_fired && rd_clock() < ts_end)
+                rd_kafka_timers_run(&rkts, 10 * 1000);
+        RD_UT_SAY("Fired %d timers in %.3fms",
+                  ut_timer_state.fired, (float)(rd_clock() - ts) / 1000.0f);
+
+        RD_UT_ASSERT(ut_timer_state.fired == exp_fired,
+                     "expected %d timers to fire, not %d",
+                     exp_fired, ut_timer_state.fired);
+        RD_UT_ASSERT(ut_timer_state.misordered == 0,
+                     "%d timers fired out of order",
+                     ut_timer_state.misordered);
+        RD_UT_ASSERT(ut_timer_state.unexpected == 0,
+                     "%d stopped timers fired", ut_timer_state.unexpected);
+        RD_UT_ASSERT(rkts.rkts_cnt == 0,
+                     "%d timers still scheduled", rkts.rkts_cnt);
+
+        rd_kafka_timers_destroy(&rkts);
+        rd_free(timers);
+        rd_kafka_destroy(rk);
+
+        RD_UT_PASS();
+}
+
+
+int unittest_timer (void) {
+        int fails = 0;
+
+        fails += ut_timers_many();
+
+        return fails;
+}
+
+/**@}*/
@@ -34,7 +34,13 @@
 /* A timer engine. */
 typedef struct rd_kafka_timers_s {
 
-        TAILQ_HEAD(, rd_kafka_timer_s) rkts_timers;
+        /** Scheduled timers as a 4-ary min-heap ordered by
+         *  rtmr_next (and rtmr_seq for equal rtmr_next),
+         *  the next timer to fire is at index 0. */
+        struct rd_kafka_timer_s **rkts_heap;
+        int         rkts_cnt;    /**< Number of scheduled timers */
+        int         rkts_size;   /**< Allocated size of rkts_heap */
+        uint64_t    rkts_seq;    /**< Scheduling sequence counter */
 
         struct rd_kafka_s *rkts_rk;
 
@@ -46,7 +52,10 @@ typedef struct rd_kafka_timers_s {
 
 
 typedef struct rd_kafka_timer_s {
-	TAILQ_ENTRY(rd_kafka_timer_s)  rtmr_link;
+        int      rtmr_idx;       /**< Index in rkts_heap, if scheduled. */
+        uint64_t rtmr_seq;       /**< Scheduling order, keeps timers with
+                                  *   the same rtmr_next firing in the
+                                  *   order they were scheduled. */
 
 	rd_ts_t rtmr_next;
 	rd_ts_t rtmr_interval;   /* interval in microseconds */
@@ -83,4 +92,6 @@ void rd_kafka_timers_run (rd_kafka_timers_t *rkts, int timeout_us);
 void rd_kafka_timers_destroy (rd_kafka_timers_t *rkts);
 void rd_kafka_timers_init (rd_kafka_timers_t *rkte, rd_kafka_t *rk);
 
+int unittest_timer (void);
+
 #endif /* _RDKAFKA_TIMER_H_ */
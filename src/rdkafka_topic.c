@@ -36,6 +36,7 @@
 #include "rdkafka_metadata.h"
 #include "rdlog.h"
 #include "rdsysqueue.h"
+#include "rdmurmur2.h"
 #include "rdtime.h"
 #include "rdregex.h"
 
@@ -107,6 +108,141 @@ static void rd_kafka_topic_destroy_app (rd_kafka_topic_t *app_rkt) {
 }
 
 
+/**
+ * @brief Process-wide source of rk_topic_gen values, see
+ *        rd_kafka_topic_get_cached().
+ */
+rd_atomic64_t rd_kafka_topic_gen;
+
+
+/**
+ * @returns the rk_topic_hash hash value for a topic name.
+ */
+static RD_INLINE uint32_t rd_kafka_topic_hash (const char *topic, size_t len) {
+        return rd_murmur2(topic, len);
+}
+
+/**
+ * @returns the bucket for hash value \p hash.
+ * @remark rk_topic_hash.size must be > 0.
+ */
+#define rd_kafka_topic_hash_bucket(rk,hash)                             \
+        (&(rk)->rk_topic_hash.buckets[(hash) &                          \
+                                      ((rk)->rk_topic_hash.size - 1)])
+
+
+/**
+ * @brief Grow the topic hash index to \p size buckets (power of two)
+ *        and rehash all topics.
+ *
+ * @locks rd_kafka_wrlock() MUST be held.
+ */
+static void rd_kafka_topic_hash_resize (rd_kafka_t *rk, int size) {
+        rd_kafka_itopic_t **old = rk->rk_topic_hash.buckets;
+        int old_size = rk->rk_topic_hash.size;
+        int i;
+
+        rk->rk_topic_hash.buckets = rd_calloc(size,
+                                              sizeof(*rk->rk_topic_hash.
+                                                     buckets));
+        rk->rk_topic_hash.size = size;
+
+        for (i = 0 ; i < old_size ; i++) {
+                rd_kafka_itopic_t *rkt, *next;
+
+                for (rkt = old[i] ; rkt ; rkt = next) {
+                        rd_kafka_itopic_t **bucket =
+                                rd_kafka_topic_hash_bucket(rk, rkt->rkt_hash);
+                        next = rkt->rkt_hash_next;
+                        rkt->rkt_hash_next = *bucket;
+                        *bucket = rkt;
+                }
+        }
+
+        if (old)
+                rd_free(old);
+}
+
+/**
+ * @brief Add topic to the topic hash index.
+ *
+ * @locks rd_kafka_wrlock() MUST be held.
+ */
+static void rd_kafka_topic_hash_insert (rd_kafka_t *rk,
+                                        rd_kafka_itopic_t *rkt) {
+        rd_kafka_itopic_t **bucket;
+
+        /* Keep the load factor at or below 1 */
+        if (rk->rk_topic_cnt >= rk->rk_topic_hash.size)
+                rd_kafka_topic_hash_resize(rk,
+                                           RD_MAX(64,
+                                                  rk->rk_topic_hash.size * 2));
+
+        bucket = rd_kafka_topic_hash_bucket(rk, rkt->rkt_hash);
+        rkt->rkt_hash_next = *bucket;
+        *bucket = rkt;
+}
+
+/**
+ * @brief Remove topic from the topic hash index.
+ *
+ * @locks rd_kafka_wrlock() MUST be held.
+ */
+static void rd_kafka_topic_hash_remove (rd_kafka_t *rk,
+                                        rd_kafka_itopic_t *rkt) {
+        rd_kafka_itopic_t **rktp;
+
+        for (rktp = rd_kafka_topic_hash_bucket(rk, rkt->rkt_hash) ;
+             *rktp ; rktp = &(*rktp)->rkt_hash_next) {
+                if (*rktp == rkt) {
+                        *rktp = rkt->rkt_hash_next;
+                        rkt->rkt_hash_next = NULL;
+                        return;
+                }
+        }
+
+        rd_kafka_assert(rk, !*"topic not found in hash index");
+}
+
+/**
+ * @returns the topic matching \p topic of length \p len, or NULL.
+ *          No reference is acquired.
+ *
+ * @locks rd_kafka_*lock() MUST be held.
+ */
+static rd_kafka_itopic_t *rd_kafka_topic_hash_find (rd_kafka_t *rk,
+                                                    const char *topic,
+                                                    int len) {
+        uint32_t hash;
+        rd_kafka_itopic_t *rkt;
+
+        if (unlikely(!rk->rk_topic_hash.size))
+                return NULL;
+
+        hash = rd_kafka_topic_hash(topic, (size_t)len);
+
+        for (rkt = *rd_kafka_topic_hash_bucket(rk, hash) ; rkt ;
+             rkt = rkt->rkt_hash_next) {
+                if (rkt->rkt_hash == hash &&
+                    rkt->rkt_topic->len == len &&
+                    !memcmp(rkt->rkt_topic->str, topic, (size_t)len))
+                        return rkt;
+        }
+
+        return NULL;
+}
+
+/**
+ * @brief Free the topic hash index, all topics must have been removed.
+ */
+void rd_kafka_topic_hash_destroy (rd_kafka_t *rk) {
+        if (rk->rk_topic_hash.buckets)
+                rd_free(rk->rk_topic_hash.buckets);
+        rk->rk_topic_hash.buckets = NULL;
+        rk->rk_topic_hash.size = 0;
+}
+
+
 /**
  * Final destructor for topic. Refcnt must be 0.
  */
@@ -116,7 +252,10 @@ void rd_kafka_topic_destroy_final (rd_kafka_itopic_t *rkt) {
 
         rd_kafka_wrlock(rkt->rkt_rk);
         TAILQ_REMOVE(&rkt->rkt_rk->rk_topics, rkt, rkt_link);
+        rd_kafka_topic_hash_remove(rkt->rkt_rk, rkt);
         rkt->rkt_rk->rk_topic_cnt--;
+        /* Invalidate per-thread topic caches referencing this topic */
+        rkt->rkt_rk->rk_topic_gen = rd_atomic64_add(&rd_kafka_topic_gen, 1);
         rd_kafka_wrunlock(rkt->rkt_rk);
 
         rd_kafka_assert(rkt->rkt_rk, rd_list_empty(&rkt->rkt_desp));
@@ -125,6 +264,8 @@ void rd_kafka_topic_destroy_final (rd_kafka_itopic_t *rkt) {
         rd_avg_destroy(&rkt->rkt_avg_batchsize);
         rd_avg_destroy(&rkt->rkt_avg_batchcnt);
 
+        mtx_destroy(&rkt->rkt_sticky.lock);
+
 	if (rkt->rkt_topic)
 		rd_kafkap_str_destroy(rkt->rkt_topic);
 
@@ -161,12 +302,8 @@ shptr_rd_kafka_itopic_t *rd_kafka_topic_find_fl (const char *func, int line,
 
         if (do_lock)
                 rd_kafka_rdlock(rk);
-	TAILQ_FOREACH(rkt, &rk->rk_topics, rkt_link) {
-		if (!rd_kafkap_str_cmp_str(rkt->rkt_topic, topic)) {
-                        s_rkt = rd_kafka_topic_keep(rkt);
-			break;
-		}
-	}
+        if ((rkt = rd_kafka_topic_hash_find(rk, topic, (int)strlen(topic))))
+                s_rkt = rd_kafka_topic_keep(rkt);
         if (do_lock)
                 rd_kafka_rdunlock(rk);
 
@@ -183,12 +320,9 @@ shptr_rd_kafka_itopic_t *rd_kafka_topic_find0_fl (const char *func, int line,
         shptr_rd_kafka_itopic_t *s_rkt = NULL;
 
 	rd_kafka_rdlock(rk);
-	TAILQ_FOREACH(rkt, &rk->rk_topics, rkt_link) {
-		if (!rd_kafkap_str_cmp(rkt->rkt_topic, topic)) {
-                        s_rkt = rd_kafka_topic_keep(rkt);
-			break;
-		}
-	}
+        if ((rkt = rd_kafka_topic_hash_find(rk, topic->str,
+                                            RD_KAFKAP_STR_LEN(topic))))
+                s_rkt = rd_kafka_topic_keep(rkt);
 	rd_kafka_rdunlock(rk);
 
 	return s_rkt;
@@ -237,6 +371,15 @@ shptr_rd_kafka_itopic_t *rd_kafka_topic_new0 (rd_kafka_t *rk,
 		return NULL;
 	}
 
+        /* Fast path: existing topics only need the read lock. */
+        if (do_lock && (s_rkt = rd_kafka_topic_find(rk, topic, 1/*lock*/))) {
+                if (conf)
+                        rd_kafka_topic_conf_destroy(conf);
+                if (existing)
+                        *existing = 1;
+                return s_rkt;
+        }
+
 	if (do_lock)
                 rd_kafka_wrlock(rk);
 	if ((s_rkt = rd_kafka_topic_find(rk, topic, 0/*no lock*/))) {
@@ -277,6 +420,8 @@ shptr_rd_kafka_itopic_t *rd_kafka_topic_new0 (rd_kafka_t *rk,
 	rkt = rd_calloc(1, sizeof(*rkt));
 
 	rkt->rkt_topic     = rd_kafkap_str_new(topic, -1);
+        rkt->rkt_hash      = rd_kafka_topic_hash(topic,
+                                                 (size_t)rkt->rkt_topic->len);
 	rkt->rkt_rk        = rk;
 
 	rkt->rkt_conf = *conf;
@@ -290,6 +435,8 @@ shptr_rd_kafka_itopic_t *rd_kafka_topic_new0 (rd_kafka_t *rk,
                 const struct {
                         const char *str;
                         void *part;
+                        rd_bool_t sticky;
+                        rd_bool_t empty_key;
                 } part_map[] = {
                         { "random",
                           (void *)rd_kafka_msg_partitioner_random },
@@ -301,6 +448,14 @@ shptr_rd_kafka_itopic_t *rd_kafka_topic_new0 (rd_kafka_t *rk,
                           (void *)rd_kafka_msg_partitioner_murmur2 },
                         { "murmur2_random",
                           (void *)rd_kafka_msg_partitioner_murmur2_random },
+                        /* Keyless messages are handled by the sticky
+                         * partitioner in rd_kafka_msg_partitioner() */
+                        { "consistent_sticky",
+                          (void *)rd_kafka_msg_partitioner_consistent,
+                          rd_true, rd_true },
+                        { "murmur2_sticky",
+                          (void *)rd_kafka_msg_partitioner_murmur2,
+                          rd_true, rd_false },
                         { NULL }
                 };
                 int i;
@@ -311,6 +466,10 @@ shptr_rd_kafka_itopic_t *rd_kafka_topic_new0 (rd_kafka_t *rk,
                         if (!strcmp(rkt->rkt_conf.partitioner_str,
                                     part_map[i].str)) {
                                 rkt->rkt_conf.partitioner = part_map[i].part;
+                                rkt->rkt_sticky.enabled =
+                                        part_map[i].sticky;
+                                rkt->rkt_sticky.empty_key =
+                                        part_map[i].empty_key;
                                 break;
                         }
                 }
@@ -378,6 +537,9 @@ shptr_rd_kafka_itopic_t *rd_kafka_topic_new0 (rd_kafka_t *rk,
                     rk->rk_conf.batch_num_messages, 2,
                     rk->rk_conf.stats_interval_ms ? 1 : 0);
 
+        mtx_init(&rkt->rkt_sticky.lock, mtx_plain);
+        rkt->rkt_sticky.partition = -1;
+
 	rd_kafka_dbg(rk, TOPIC, "TOPIC", "New local topic: %.*s",
 		     RD_KAFKAP_STR_PR(rkt->rkt_topic));
 
@@ -393,6 +555,7 @@ shptr_rd_kafka_itopic_t *rd_kafka_topic_new0 (rd_kafka_t *rk,
 	rkt->rkt_ua = rd_kafka_toppar_new(rkt, RD_KAFKA_PARTITION_UA);
 
 	TAILQ_INSERT_TAIL(&rk->rk_topics, rkt, rkt_link);
+        rd_kafka_topic_hash_insert(rk, rkt);
 	rk->rk_topic_cnt++;
 
         /* Populate from metadata cache. */
@@ -411,6 +574,66 @@ shptr_rd_kafka_itopic_t *rd_kafka_topic_new0 (rd_kafka_t *rk,
 }
 
 
+/**
+ * @brief Per-thread cache of the last topic looked up by
+ *        rd_kafka_topic_get_cached().
+ *
+ * No reference is held on the cached topic: the entry is only valid
+ * as long as \c gen matches the rk_topic_gen of \c rk, which changes
+ * whenever a topic is removed from the instance.
+ */
+static RD_TLS struct {
+        rd_kafka_t        *rk;
+        int64_t            gen;
+        rd_kafka_itopic_t *rkt;
+} rd_kafka_topic_tls_cache;
+
+
+/**
+ * @brief Find or create a topic by name, optimized for producev() which
+ *        typically produces to the same topic repeatedly: the calling
+ *        thread's last topic is tried first, then the topic hash index,
+ *        both under the read lock, and only then is the topic created.
+ *
+ * @returns a new reference to the topic, or NULL on error
+ *          (see rd_kafka_topic_new0()).
+ *
+ * @locality any thread
+ * @locks none
+ */
+shptr_rd_kafka_itopic_t *rd_kafka_topic_get_cached (rd_kafka_t *rk,
+                                                    const char *topic) {
+        shptr_rd_kafka_itopic_t *s_rkt = NULL;
+        rd_kafka_itopic_t *rkt;
+
+        if (unlikely(!topic))
+                return rd_kafka_topic_new0(rk, topic, NULL, NULL, 1);
+
+        rd_kafka_rdlock(rk);
+
+        rkt = rd_kafka_topic_tls_cache.rkt;
+        if (!rkt ||
+            rd_kafka_topic_tls_cache.rk != rk ||
+            rd_kafka_topic_tls_cache.gen != rk->rk_topic_gen ||
+            rd_kafkap_str_cmp_str(rkt->rkt_topic, topic))
+                rkt = rd_kafka_topic_hash_find(rk, topic, (int)strlen(topic));
+
+        if (rkt) {
+                s_rkt = rd_kafka_topic_keep(rkt);
+                rd_kafka_topic_tls_cache.rk  = rk;
+                rd_kafka_topic_tls_cache.gen = rk->rk_topic_gen;
+                rd_kafka_topic_tls_cache.rkt = rkt;
+        }
+
+        rd_kafka_rdunlock(rk);
+
+        if (likely(s_rkt != NULL))
+                return s_rkt;
+
+        return rd_kafka_topic_new0(rk, topic, NULL, NULL, 1);
+}
+
+
 
 /**
  * Create new app topic handle.
@@ -820,7 +1043,7 @@ static void rd_kafka_topic_assign_uas (rd_kafka_itopic_t *rkt,
 	rd_kafka_t *rk = rkt->rkt_rk;
 	shptr_rd_kafka_toppar_t *s_rktp_ua;
         rd_kafka_toppar_t *rktp_ua;
-	rd_kafka_msg_t *rkm, *tmp;
+	rd_kafka_msg_t *rkm;
 	rd_kafka_msgq_t uas = RD_KAFKA_MSGQ_INITIALIZER(uas);
 	rd_kafka_msgq_t failed = RD_KAFKA_MSGQ_INITIALIZER(failed);
 	int cnt;
@@ -852,7 +1075,7 @@ static void rd_kafka_topic_assign_uas (rd_kafka_itopic_t *rkt,
 	cnt = uas.rkmq_msg_cnt;
 	rd_kafka_toppar_unlock(rktp_ua);
 
-	TAILQ_FOREACH_SAFE(rkm, &uas.rkmq_msgs, rkm_link, tmp) {
+	while ((rkm = rd_kafka_msgq_pop(&uas))) {
 		/* Fast-path for failing messages with forced partition */
 		if (rkm->rkm_partition != RD_KAFKA_PARTITION_UA &&
 		    rkm->rkm_partition >= rkt->rkt_partition_cnt &&
@@ -1463,7 +1686,9 @@ int rd_kafka_topic_match (rd_kafka_t *rk, const char *pattern,
 	char errstr[128];
 
 	if (*pattern == '^') {
-		int r = rd_regex_match(pattern, topic, errstr, sizeof(errstr));
+		int r = rd_kafka_regex_cache_match(&rk->rk_regex_cache,
+                                                   pattern, topic,
+                                                   errstr, sizeof(errstr));
 		if (unlikely(r == -1))
 			rd_kafka_dbg(rk, TOPIC, "TOPICREGEX",
 				     "Topic \"%s\" regex \"%s\" "
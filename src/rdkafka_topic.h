@@ -42,6 +42,9 @@ struct rd_kafka_itopic_s {
 
 	rwlock_t           rkt_lock;
 	rd_kafkap_str_t   *rkt_topic;
+        uint32_t           rkt_hash;       /**< Hash of rkt_topic */
+        struct rd_kafka_itopic_s *rkt_hash_next; /**< rk_topic_hash chain,
+                                                  *   protected by rk_lock */
 
 	shptr_rd_kafka_toppar_t  *rkt_ua;  /* unassigned partition */
 	shptr_rd_kafka_toppar_t **rkt_p;
@@ -77,6 +80,24 @@ struct rd_kafka_itopic_s {
         rd_avg_t          rkt_avg_batchsize; /**< Average batch size */
         rd_avg_t          rkt_avg_batchcnt;  /**< Average batch message count */
 
+        /**
+         * Sticky partitioner state for keyless messages
+         * (partitioner=consistent_sticky or murmur2_sticky).
+         * Keyless messages stay on one partition until its batch is
+         * full (batch.num.messages or message.max.bytes) or linger.ms
+         * has elapsed, after which a new partition is picked.
+         */
+        struct {
+                mtx_t     lock;       /**< Protects all fields but enabled
+                                       *   and empty_key */
+                rd_bool_t enabled;    /**< Sticky partitioning enabled */
+                rd_bool_t empty_key;  /**< Empty keys are also sticky */
+                int32_t   partition;  /**< Current partition, or -1 */
+                int       msgcnt;     /**< Messages since switch */
+                size_t    bytes;      /**< Payload bytes since switch */
+                rd_ts_t   ts_start;   /**< Time of last switch */
+        } rkt_sticky;
+
         shptr_rd_kafka_itopic_t *rkt_shptr_app; /* Application's topic_new() */
 
 	rd_kafka_topic_conf_t rkt_conf;
@@ -148,6 +169,12 @@ shptr_rd_kafka_itopic_t *rd_kafka_topic_find0_fl (const char *func, int line,
         rd_kafka_topic_find0_fl(__FUNCTION__,__LINE__,rk,topic)
 int rd_kafka_topic_cmp_s_rkt (const void *_a, const void *_b);
 
+shptr_rd_kafka_itopic_t *rd_kafka_topic_get_cached (rd_kafka_t *rk,
+                                                    const char *topic);
+void rd_kafka_topic_hash_destroy (rd_kafka_t *rk);
+
+extern rd_atomic64_t rd_kafka_topic_gen;
+
 void rd_kafka_topic_partitions_remove (rd_kafka_itopic_t *rkt);
 
 void rd_kafka_topic_metadata_none (rd_kafka_itopic_t *rkt);
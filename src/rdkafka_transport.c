@@ -103,21 +103,36 @@ void rd_kafka_transport_close (rd_kafka_transport_t *rktrans) {
 #ifndef _MSC_VER
 /**
  * @brief sendmsg() abstraction, converting a list of segments to iovecs.
+ *
+ * The segments of all \p slice_cnt \p slices are gathered, in order,
+ * into a single sendmsg() call and the slices' read positions are
+ * updated according to the number of bytes written.
+ *
  * @remark should only be called if the number of segments is > 1.
  */
 static ssize_t
 rd_kafka_transport_socket_sendmsg (rd_kafka_transport_t *rktrans,
-                                   rd_slice_t *slice,
+                                   rd_slice_t **slices, int slice_cnt,
                                    char *errstr, size_t errstr_size) {
         struct iovec iov[IOV_MAX];
         struct msghdr msg = { .msg_iov = iov };
-        size_t iovlen;
+        size_t iovlen = 0;
+        size_t sum = 0;
+        size_t remains;
         ssize_t r;
-        size_t r2;
-
-        rd_slice_get_iov(slice, msg.msg_iov, &iovlen, IOV_MAX,
-                         /* FIXME: Measure the effects of this */
-                         rktrans->rktrans_sndbuf_size);
+        int i;
+
+        for (i = 0 ; i < slice_cnt && iovlen < IOV_MAX &&
+                     sum < (size_t)rktrans->rktrans_sndbuf_size ; i++) {
+                size_t cnt;
+
+                sum += rd_slice_get_iov(slices[i], &iov[iovlen], &cnt,
+                                        IOV_MAX - iovlen,
+                                        /* FIXME: Measure the effects
+                                         *        of this */
+                                        rktrans->rktrans_sndbuf_size - sum);
+                iovlen += cnt;
+        }
         msg.msg_iovlen = (int)iovlen;
 
 #ifdef __sun
@@ -138,10 +153,20 @@ rd_kafka_transport_socket_sendmsg (rd_kafka_transport_t *rktrans,
                 return -1;
         }
 
-        /* Update buffer read position */
-        r2 = rd_slice_read(slice, NULL, (size_t)r);
-        rd_assert((size_t)r == r2 &&
-                  *"BUG: wrote more bytes than available in slice");
+        /* Update buffer read positions */
+        remains = (size_t)r;
+        for (i = 0 ; remains > 0 ; i++) {
+                size_t rlen = RD_MIN(remains, rd_slice_remains(slices[i]));
+                size_t r2;
+
+                rd_assert(i < slice_cnt &&
+                          *"BUG: wrote more bytes than available in slices");
+
+                r2 = rd_slice_read(slices[i], NULL, rlen);
+                rd_assert(rlen == r2 &&
+                          *"BUG: wrote more bytes than available in slice");
+                remains -= rlen;
+        }
 
         return r;
 }
@@ -217,7 +242,7 @@ rd_kafka_transport_socket_send (rd_kafka_transport_t *rktrans,
         /* FIXME: Use sendmsg() with iovecs if there's more than one segment
          * remaining, otherwise (or if platform does not have sendmsg)
          * use plain send(). */
-        return rd_kafka_transport_socket_sendmsg(rktrans, slice,
+        return rd_kafka_transport_socket_sendmsg(rktrans, &slice, 1,
                                                  errstr, errstr_size);
 #endif
         return rd_kafka_transport_socket_send0(rktrans, slice,
@@ -380,7 +405,11 @@ rd_kafka_transport_send (rd_kafka_transport_t *rktrans,
                          rd_slice_t *slice, char *errstr, size_t errstr_size) {
         ssize_t r;
 #if WITH_SSL
-        if (rktrans->rktrans_ssl) {
+        /* With kTLS send offload the kernel encrypts what is
+         * written to the socket, unless OpenSSL needs SSL_write()
+         * to send a KeyUpdate. */
+        if (rktrans->rktrans_ssl &&
+            !rd_kafka_transport_ssl_ktls_send(rktrans)) {
                 rd_kafka_curr_transport = rktrans;
                 r = rd_kafka_transport_ssl_send(rktrans, slice,
                                                 errstr, errstr_size);
@@ -393,6 +422,36 @@ rd_kafka_transport_send (rd_kafka_transport_t *rktrans,
 }
 
 
+/**
+ * @brief Send the remaining contents of \p slice_cnt \p slices, in order,
+ *        with a single gathering write.
+ *
+ * Falls back to sending only the first slice with
+ * rd_kafka_transport_send() for SSL connections without kTLS send
+ * offload and on platforms without sendmsg().
+ *
+ * @returns the number of bytes sent, or -1 on error.
+ */
+ssize_t
+rd_kafka_transport_sendv (rd_kafka_transport_t *rktrans,
+                          rd_slice_t **slices, int slice_cnt,
+                          char *errstr, size_t errstr_size) {
+#ifndef _MSC_VER
+        if (slice_cnt > 1
+#if WITH_SSL
+            && (!rktrans->rktrans_ssl ||
+                rd_kafka_transport_ssl_ktls_send(rktrans))
+#endif
+                )
+                return rd_kafka_transport_socket_sendmsg(rktrans,
+                                                         slices, slice_cnt,
+                                                         errstr, errstr_size);
+#endif
+        return rd_kafka_transport_send(rktrans, slices[0],
+                                       errstr, errstr_size);
+}
+
+
 ssize_t
 rd_kafka_transport_recv (rd_kafka_transport_t *rktrans, rd_buf_t *rbuf,
                          char *errstr, size_t errstr_size) {
@@ -44,6 +44,9 @@ int rd_kafka_transport_io_serve (rd_kafka_transport_t *rktrans,
 ssize_t rd_kafka_transport_send (rd_kafka_transport_t *rktrans,
                                  rd_slice_t *slice,
                                  char *errstr, size_t errstr_size);
+ssize_t rd_kafka_transport_sendv (rd_kafka_transport_t *rktrans,
+                                  rd_slice_t **slices, int slice_cnt,
+                                  char *errstr, size_t errstr_size);
 ssize_t rd_kafka_transport_recv (rd_kafka_transport_t *rktrans,
                                  rd_buf_t *rbuf,
                                  char *errstr, size_t errstr_size);
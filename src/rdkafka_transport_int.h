@@ -50,6 +50,14 @@ struct rd_kafka_transport_s {
 
 #if WITH_SSL
 	SSL *rktrans_ssl;
+        rd_bool_t rktrans_ktls_send;       /**< Kernel TLS send offload is
+                                            *   active: application data is
+                                            *   written to the socket
+                                            *   directly. */
+        rd_bool_t rktrans_ktls_key_update; /**< A TLS 1.3 KeyUpdate was
+                                            *   pending: re-check the
+                                            *   offload state once it has
+                                            *   been sent. */
 #endif
 
 	struct {
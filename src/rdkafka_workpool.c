@@ -0,0 +1,351 @@
+/*
+ * librdkafka - Apache Kafka C library
+ *
+ * Copyright (c) 2020 Magnus Edenhill
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/**
+ * Worker thread pool for offloading CPU-heavy work from broker threads.
+ */
+
+#include "rdkafka_int.h"
+#include "rdkafka_workpool.h"
+#include "rdunittest.h"
+
+
+/**
+ * @brief Run \p job and mark it done in its group.
+ *
+ * @locks wp_lock MUST NOT be held.
+ */
+static void rd_kafka_workpool_job_run (rd_kafka_workpool_t *wp,
+                                       rd_kafka_workpool_job_t *job) {
+        rd_kafka_workpool_group_t *wpg = job->wpj_group;
+
+        /* The job may be freed by its run function, or by the group
+         * owner as soon as the group is done: don't touch it after this. */
+        job->wpj_run(job);
+
+        mtx_lock(&wp->wp_lock);
+        rd_assert(wpg->wpg_pending > 0);
+        if (--wpg->wpg_pending == 0)
+                cnd_broadcast(&wp->wp_done_cnd);
+        mtx_unlock(&wp->wp_lock);
+}
+
+
+/**
+ * @brief Dequeue the next job, if any.
+ *
+ * @locks wp_lock MUST be held.
+ */
+static RD_INLINE rd_kafka_workpool_job_t *
+rd_kafka_workpool_job_next (rd_kafka_workpool_t *wp) {
+        rd_kafka_workpool_job_t *job;
+
+        if ((job = TAILQ_FIRST(&wp->wp_jobs)))
+                TAILQ_REMOVE(&wp->wp_jobs, job, wpj_link);
+
+        return job;
+}
+
+
+static int rd_kafka_workpool_thread_main (void *arg) {
+        rd_kafka_workpool_t *wp = arg;
+
+        rd_kafka_set_thread_name("worker");
+        rd_kafka_set_thread_sysname("rdk:worker");
+
+        (void)rd_atomic32_add(&rd_kafka_thread_cnt_curr, 1);
+
+        mtx_lock(&wp->wp_lock);
+        while (1) {
+                rd_kafka_workpool_job_t *job;
+
+                if (!(job = rd_kafka_workpool_job_next(wp))) {
+                        if (wp->wp_terminate)
+                                break;
+                        cnd_wait(&wp->wp_cnd, &wp->wp_lock);
+                        continue;
+                }
+
+                mtx_unlock(&wp->wp_lock);
+                rd_kafka_workpool_job_run(wp, job);
+                mtx_lock(&wp->wp_lock);
+        }
+        mtx_unlock(&wp->wp_lock);
+
+        rd_atomic32_sub(&rd_kafka_thread_cnt_curr, 1);
+
+        return 0;
+}
+
+
+/**
+ * @brief Create a new worker pool with \p thread_cnt threads.
+ *
+ * @returns the new pool, or NULL on failure in which case \p errstr
+ *          is set.
+ */
+rd_kafka_workpool_t *rd_kafka_workpool_new (int thread_cnt,
+                                            char *errstr,
+                                            size_t errstr_size) {
+        rd_kafka_workpool_t *wp;
+
+        wp = rd_calloc(1, sizeof(*wp));
+        mtx_init(&wp->wp_lock, mtx_plain);
+        cnd_init(&wp->wp_cnd);
+        cnd_init(&wp->wp_done_cnd);
+        TAILQ_INIT(&wp->wp_jobs);
+
+        if (thread_cnt > 0)
+                wp->wp_threads = rd_malloc(sizeof(*wp->wp_threads) *
+                                           thread_cnt);
+
+        for (wp->wp_thread_cnt = 0 ; wp->wp_thread_cnt < thread_cnt ;
+             wp->wp_thread_cnt++) {
+                if (thrd_create(&wp->wp_threads[wp->wp_thread_cnt],
+                                rd_kafka_workpool_thread_main, wp) !=
+                    thrd_success) {
+                        rd_snprintf(errstr, errstr_size,
+                                    "Failed to create worker thread: "
+                                    "%s (%i)", rd_strerror(errno), errno);
+                        rd_kafka_workpool_destroy(wp);
+                        return NULL;
+                }
+        }
+
+        return wp;
+}
+
+
+/**
+ * @brief Terminate and join the worker threads and destroy the pool.
+ *
+ * @remark There must be no outstanding job groups.
+ */
+void rd_kafka_workpool_destroy (rd_kafka_workpool_t *wp) {
+        int i;
+
+        mtx_lock(&wp->wp_lock);
+        rd_assert(TAILQ_EMPTY(&wp->wp_jobs));
+        wp->wp_terminate = rd_true;
+        cnd_broadcast(&wp->wp_cnd);
+        mtx_unlock(&wp->wp_lock);
+
+        for (i = 0 ; i < wp->wp_thread_cnt ; i++) {
+                int res;
+                thrd_join(wp->wp_threads[i], &res);
+        }
+
+        RD_IF_FREE(wp->wp_threads, rd_free);
+        cnd_destroy(&wp->wp_done_cnd);
+        cnd_destroy(&wp->wp_cnd);
+        mtx_destroy(&wp->wp_lock);
+        rd_free(wp);
+}
+
+
+/**
+ * @brief Submit \p job to be run by \p run on any of the pool's threads,
+ *        or by the thread waiting for \p wpg.
+ */
+void rd_kafka_workpool_submit (rd_kafka_workpool_t *wp,
+                               rd_kafka_workpool_group_t *wpg,
+                               rd_kafka_workpool_job_t *job,
+                               void (*run) (rd_kafka_workpool_job_t *job)) {
+        job->wpj_run   = run;
+        job->wpj_group = wpg;
+
+        mtx_lock(&wp->wp_lock);
+        wpg->wpg_pending++;
+        TAILQ_INSERT_TAIL(&wp->wp_jobs, job, wpj_link);
+        cnd_signal(&wp->wp_cnd);
+        mtx_unlock(&wp->wp_lock);
+}
+
+
+/**
+ * @brief Dequeue the first queued job of group \p wpg, if any.
+ *
+ * @locks wp_lock MUST be held.
+ */
+static rd_kafka_workpool_job_t *
+rd_kafka_workpool_job_next_group (rd_kafka_workpool_t *wp,
+                                  rd_kafka_workpool_group_t *wpg) {
+        rd_kafka_workpool_job_t *job;
+
+        TAILQ_FOREACH(job, &wp->wp_jobs, wpj_link) {
+                if (job->wpj_group == wpg) {
+                        TAILQ_REMOVE(&wp->wp_jobs, job, wpj_link);
+                        return job;
+                }
+        }
+
+        return NULL;
+}
+
+
+/**
+ * @brief Wait for all jobs in \p wpg to finish, running the group's
+ *        queued jobs on the calling thread while waiting.
+ *
+ * Jobs of other groups are left to the workers and their own waiters,
+ * so that a broker thread is not held up by another broker's work.
+ */
+void rd_kafka_workpool_group_wait (rd_kafka_workpool_t *wp,
+                                   rd_kafka_workpool_group_t *wpg) {
+        mtx_lock(&wp->wp_lock);
+        while (wpg->wpg_pending > 0) {
+                rd_kafka_workpool_job_t *job;
+
+                if (!(job = rd_kafka_workpool_job_next_group(wp, wpg))) {
+                        /* All remaining jobs of the group are
+                         * being run by other threads. */
+                        cnd_wait(&wp->wp_done_cnd, &wp->wp_lock);
+                        continue;
+                }
+
+                mtx_unlock(&wp->wp_lock);
+                rd_kafka_workpool_job_run(wp, job);
+                mtx_lock(&wp->wp_lock);
+        }
+        mtx_unlock(&wp->wp_lock);
+}
+
+
+
+/**
+ * @name Unit tests
+ * @{
+ */
+
+struct ut_wp_job {
+        rd_kafka_workpool_job_t job;
+        rd_atomic32_t *runcntp;
+        int done;
+};
+
+static void ut_wp_job_run (rd_kafka_workpool_job_t *job) {
+        struct ut_wp_job *utj = (struct ut_wp_job *)job;
+
+        rd_atomic32_add(utj->runcntp, 1);
+        utj->done++;
+}
+
+
+/**
+ * @brief Submit groups of jobs with \p thread_cnt workers and verify
+ *        that each job runs exactly once before its group wait returns.
+ */
+static int ut_workpool (int thread_cnt) {
+        rd_kafka_workpool_t *wp;
+        char errstr[256];
+        const int groupcnt = 50;
+        const int jobcnt = 100;
+        struct ut_wp_job *jobs;
+        rd_atomic32_t runcnt;
+        int g, i;
+
+        wp = rd_kafka_workpool_new(thread_cnt, errstr, sizeof(errstr));
+        RD_UT_ASSERT(wp, "workpool_new(%d) failed: %s", thread_cnt, errstr);
+
+        rd_atomic32_init(&runcnt, 0);
+        jobs = rd_calloc(jobcnt, sizeof(*jobs));
+
+        for (g = 0 ; g < groupcnt ; g++) {
+                rd_kafka_workpool_group_t wpg;
+
+                rd_kafka_workpool_group_init(&wpg);
+
+                for (i = 0 ; i < jobcnt ; i++) {
+                        jobs[i].runcntp = &runcnt;
+                        jobs[i].done = 0;
+                        rd_kafka_workpool_submit(wp, &wpg, &jobs[i].job,
+                                                 ut_wp_job_run);
+                }
+
+                rd_kafka_workpool_group_wait(wp, &wpg);
+
+                RD_UT_ASSERT(wpg.wpg_pending == 0,
+                             "group %d: %d jobs still pending",
+                             g, wpg.wpg_pending);
+                for (i = 0 ; i < jobcnt ; i++)
+                        RD_UT_ASSERT(jobs[i].done == 1,
+                                     "group %d job %d ran %d times",
+                                     g, i, jobs[i].done);
+        }
+
+        RD_UT_ASSERT(rd_atomic32_get(&runcnt) == groupcnt * jobcnt,
+                     "expected %d job runs, not %d",
+                     groupcnt * jobcnt, rd_atomic32_get(&runcnt));
+
+        if (thread_cnt == 0) {
+                /* Without workers, waiting for a group must only run
+                 * that group's jobs. */
+                rd_kafka_workpool_group_t wpg_a, wpg_b;
+
+                rd_kafka_workpool_group_init(&wpg_a);
+                rd_kafka_workpool_group_init(&wpg_b);
+                for (i = 0 ; i < jobcnt ; i++) {
+                        jobs[i].done = 0;
+                        rd_kafka_workpool_submit(wp,
+                                                 (i & 1) ? &wpg_b : &wpg_a,
+                                                 &jobs[i].job, ut_wp_job_run);
+                }
+
+                rd_kafka_workpool_group_wait(wp, &wpg_b);
+                for (i = 0 ; i < jobcnt ; i++)
+                        RD_UT_ASSERT(jobs[i].done == (i & 1),
+                                     "job %d of group %c ran %d times",
+                                     i, (i & 1) ? 'b' : 'a', jobs[i].done);
+
+                rd_kafka_workpool_group_wait(wp, &wpg_a);
+                for (i = 0 ; i < jobcnt ; i++)
+                        RD_UT_ASSERT(jobs[i].done == 1,
+                                     "job %d ran %d times", i, jobs[i].done);
+        }
+
+        rd_free(jobs);
+        rd_kafka_workpool_destroy(wp);
+
+        RD_UT_SAY("%d thread(s): %d jobs in %d groups OK",
+                  thread_cnt, groupcnt * jobcnt, groupcnt);
+
+        RD_UT_PASS();
+}
+
+
+int unittest_workpool (void) {
+        int fails = 0;
+
+        fails += ut_workpool(0);
+        fails += ut_workpool(1);
+        fails += ut_workpool(4);
+
+        return fails;
+}
+
+/**@}*/
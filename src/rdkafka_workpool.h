@@ -0,0 +1,109 @@
+/*
+ * librdkafka - Apache Kafka C library
+ *
+ * Copyright (c) 2020 Magnus Edenhill
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _RDKAFKA_WORKPOOL_H_
+#define _RDKAFKA_WORKPOOL_H_
+
+#include "rd.h"
+#include "rdsysqueue.h"
+
+/**
+ * @name Worker thread pool
+ *
+ * A fixed set of worker threads serving a shared FIFO of jobs, used to
+ * offload CPU-heavy work (such as compression) from the broker threads.
+ *
+ * Jobs are submitted as part of a job group which the submitter later
+ * waits for with rd_kafka_workpool_group_wait(); the waiting thread
+ * runs the group's queued jobs itself rather than sleeping, so progress
+ * is guaranteed even if all workers are busy.
+ *
+ * @{
+ */
+
+typedef struct rd_kafka_workpool_job_s rd_kafka_workpool_job_t;
+
+/**
+ * @brief A group of jobs to be waited for together.
+ *
+ * Owned and initialized (rd_kafka_workpool_group_init()) by the submitter.
+ */
+typedef struct rd_kafka_workpool_group_s {
+        int wpg_pending;    /**< Number of submitted jobs not yet done,
+                             *   protected by the pool lock. */
+} rd_kafka_workpool_group_t;
+
+/**
+ * @brief A unit of work. Typically embedded in a larger struct
+ *        carrying the job's state.
+ */
+struct rd_kafka_workpool_job_s {
+        TAILQ_ENTRY(rd_kafka_workpool_job_s) wpj_link;
+        void (*wpj_run) (rd_kafka_workpool_job_t *job); /**< Job function,
+                                                          *   called on any
+                                                          *   thread. */
+        rd_kafka_workpool_group_t *wpj_group;   /**< Group the job
+                                                 *   belongs to. */
+};
+
+typedef struct rd_kafka_workpool_s {
+        mtx_t  wp_lock;
+        cnd_t  wp_cnd;        /**< Signalled when jobs are added */
+        cnd_t  wp_done_cnd;   /**< Broadcasted when a group completes */
+        TAILQ_HEAD(, rd_kafka_workpool_job_s) wp_jobs; /**< Queued jobs */
+        rd_bool_t wp_terminate; /**< Workers should exit */
+        int       wp_thread_cnt;
+        thrd_t   *wp_threads;
+} rd_kafka_workpool_t;
+
+
+rd_kafka_workpool_t *rd_kafka_workpool_new (int thread_cnt,
+                                            char *errstr,
+                                            size_t errstr_size);
+void rd_kafka_workpool_destroy (rd_kafka_workpool_t *wp);
+
+/**
+ * @brief Initialize job group \p wpg.
+ */
+static RD_INLINE RD_UNUSED void
+rd_kafka_workpool_group_init (rd_kafka_workpool_group_t *wpg) {
+        wpg->wpg_pending = 0;
+}
+
+void rd_kafka_workpool_submit (rd_kafka_workpool_t *wp,
+                               rd_kafka_workpool_group_t *wpg,
+                               rd_kafka_workpool_job_t *job,
+                               void (*run) (rd_kafka_workpool_job_t *job));
+void rd_kafka_workpool_group_wait (rd_kafka_workpool_t *wp,
+                                   rd_kafka_workpool_group_t *wpg);
+
+int unittest_workpool (void);
+
+/**@}*/
+
+#endif /* _RDKAFKA_WORKPOOL_H_ */
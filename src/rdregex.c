@@ -30,20 +30,95 @@
 #include "rd.h"
 #include "rdstring.h"
 #include "rdregex.h"
+#include "rdtime.h"
+#include "rdunittest.h"
+
+#include <ctype.h>
 
 #if HAVE_REGEX
 #include <regex.h>
-struct rd_regex_s {
-	regex_t re;
-};
-
 #else
-
 #include "regexp.h"
+#endif
+
 struct rd_regex_s {
+#if HAVE_REGEX
+	regex_t re;
+#else
 	Reprog *re;
-};
 #endif
+        /**< How the pattern can be matched without the regex engine,
+         *   see rd_regex_analyze(). */
+        enum {
+                RD_REGEX_FULL,     /**< Run the regex, after checking
+                                    *   the prefix (if any). */
+                RD_REGEX_PREFIX,   /**< Matches iff str begins with
+                                    *   prefix: "^literal" or
+                                    *   "^literal.*" */
+                RD_REGEX_LITERAL,  /**< Matches iff str equals prefix:
+                                    *   "^literal$" */
+        } kind;
+        char   *prefix;      /**< Literal prefix every match begins with */
+        size_t  prefix_len;  /**< Length of prefix, or 0 if none */
+};
+
+
+/**
+ * @brief Extract the literal prefix of an anchored ("^...") pattern
+ *        and check if the pattern is nothing but that prefix,
+ *        in which case rd_regex_exec() can skip the regex engine.
+ *
+ * This is conservative: any construct that is not a plain character
+ * or an escaped ERE metacharacter ends the prefix, as does a character
+ * followed by a quantifier, and alternations are never prefiltered.
+ */
+static void rd_regex_analyze (rd_regex_t *re, const char *pattern) {
+        const char *s, *rest;
+        size_t len = 0;
+
+        re->kind = RD_REGEX_FULL;
+
+        if (*pattern != '^' || strchr(pattern, '|'))
+                return;
+
+        re->prefix = rd_malloc(strlen(pattern));
+
+        s = pattern + 1;
+        while (*s) {
+                const char *start = s;
+                char c = *s;
+
+                if (c == '\\') {
+                        /* Escaped metacharacters are literal, anything
+                         * else (\d, \w, back-references, the \< \> \`
+                         * \' anchors, ..) is not. */
+                        if (!s[1] || !strchr(".[]()*+?{}^$|\\", s[1]))
+                                break;
+                        c = s[1];
+                        s += 2;
+                } else if (strchr(".[]()*+?{}^$", c))
+                        break;
+                else
+                        s++;
+
+                /* A quantified character is not part of the prefix */
+                if (*s && strchr("*+?{", *s)) {
+                        s = start;
+                        break;
+                }
+
+                re->prefix[len++] = c;
+        }
+
+        re->prefix[len] = '\0';
+        re->prefix_len = len;
+        rest = s;
+
+        if (!*rest || !strcmp(rest, ".*") || !strcmp(rest, ".*$"))
+                re->kind = RD_REGEX_PREFIX;
+        else if (!strcmp(rest, "$"))
+                re->kind = RD_REGEX_LITERAL;
+}
 
 
 /**
@@ -55,6 +130,8 @@ void rd_regex_destroy (rd_regex_t *re) {
 #else
 	re_regfree(re->re);
 #endif
+        if (re->prefix)
+                rd_free(re->prefix);
 	rd_free(re);
 }
 
@@ -88,67 +165,214 @@ rd_regex_comp (const char *pattern, char *errstr, size_t errstr_size) {
 	}
 #endif
 
+        rd_regex_analyze(re, pattern);
+
 	return re;
 }
 
 
 /**
- * @brief Match \p str to pre-compiled regex \p re
- * @returns 1 on match, else 0
+ * @brief Match \p str to pre-compiled regex \p re, skipping the regex
+ *        engine if \p use_prefix is true and the literal prefix decides
+ *        the outcome.
  */
-int rd_regex_exec (rd_regex_t *re, const char *str) {
+static int rd_regex_exec0 (rd_regex_t *re, const char *str,
+                           rd_bool_t use_prefix) {
+        if (use_prefix && re->prefix_len > 0 &&
+            strncmp(str, re->prefix, re->prefix_len))
+                return 0;
+
+        if (use_prefix && re->kind == RD_REGEX_PREFIX)
+                return 1;
+        else if (use_prefix && re->kind == RD_REGEX_LITERAL)
+                return !str[re->prefix_len];
+
 #if HAVE_REGEX
 	return regexec(&re->re, str, 0, NULL, 0) != REG_NOMATCH;
 #else
-	return !re_regexec(re->re, str, NULL, 0);	
+	return !re_regexec(re->re, str, NULL, 0);
 #endif
 }
 
 
+/**
+ * @brief Match \p str to pre-compiled regex \p re
+ * @returns 1 on match, else 0
+ */
+int rd_regex_exec (rd_regex_t *re, const char *str) {
+        return rd_regex_exec0(re, str, rd_true);
+}
+
+
+/**
+ * @returns the literal prefix that all strings matched by \p re begin with,
+ *          and its length in \p lenp, or NULL if there is no such prefix.
+ */
+const char *rd_regex_prefix (const rd_regex_t *re, size_t *lenp) {
+        *lenp = re->prefix_len;
+        return re->prefix_len > 0 ? re->prefix : NULL;
+}
+
+
 /**
  * @brief Perform regex match of \p str using regex \p pattern.
  *
+ * @remark The pattern is compiled for each call, use rd_regex_comp()
+ *         and rd_regex_exec() (or the rd_kafka_regex_cache_..() functions)
+ *         when matching the same pattern repeatedly.
+ *
  * @returns 1 on match, 0 on non-match or -1 on regex compilation error
  *          in which case a human readable error string is written to
  *          \p errstr (if not NULL).
  */
 int rd_regex_match (const char *pattern, const char *str,
 		    char *errstr, size_t errstr_size) {
-#if HAVE_REGEX  /* use libc regex */
-	regex_t re;
-	int r;
+        rd_regex_t *re;
+        int r;
 
-	/* FIXME: cache compiled regex */
-	r = regcomp(&re, pattern, REG_EXTENDED|REG_NOSUB);
-	if (r) {
-		if (errstr)
-			regerror(r, &re, errstr, errstr_size);
-		return 0;
-	}
+        if (!(re = rd_regex_comp(pattern, errstr, errstr_size)))
+                return -1;
+
+        r = rd_regex_exec(re, str);
 
-	r = regexec(&re, str, 0, NULL, 0) != REG_NOMATCH;
+        rd_regex_destroy(re);
 
-	regfree(&re);
+        return r;
+}
 
-	return r;
 
-#else /* Using regexp.h from minilibs (included) */
-	Reprog *re;
-	int r;
-	const char *errstr2;
+/**
+ * @brief Verify that the literal prefix fast path agrees with the
+ *        regex engine, and report the speedup of compiling once over
+ *        rd_regex_match() for a typical wildcard subscription workload.
+ */
+int unittest_rdregex (void) {
+        static const struct {
+                const char *pattern;
+                const char *prefix; /**< Expected prefix, or NULL */
+                int kind;
+        } patterns[] = {
+                { "^mytopic", "mytopic", RD_REGEX_PREFIX },
+                { "^my\\.topic.*", "my.topic", RD_REGEX_PREFIX },
+                { "^mytopic$", "mytopic", RD_REGEX_LITERAL },
+                { "^my.topic", "my", RD_REGEX_FULL },
+                { "^mytopics?", "mytopic", RD_REGEX_FULL },
+                { "^mytopic[0-9]+$", "mytopic", RD_REGEX_FULL },
+                { "^(my|your)topic", NULL, RD_REGEX_FULL },
+                { "^my|topic", NULL, RD_REGEX_FULL },
+                { "^m*ytopic", NULL, RD_REGEX_FULL },
+                { "^mytopic\\>", "mytopic", RD_REGEX_FULL },
+                { "^\\<mytopic", NULL, RD_REGEX_FULL },
+                { "^my\\\\topic$", "my\\topic", RD_REGEX_LITERAL },
+                { "^", NULL, RD_REGEX_PREFIX },
+                { "^.*", NULL, RD_REGEX_PREFIX },
+                { "mytopic", NULL, RD_REGEX_FULL },
+                { NULL }
+        };
+        static const char *strs[] = {
+                "mytopic", "mytopics", "mytopic1", "mytopic123", "my.topic",
+                "myXtopic", "my.topic.a", "yourtopic", "topic", "ytopic",
+                "mmmytopic", "", "xmytopic", "mytopic<", "mytopic>",
+                "mytopic.x", "my\\topic", NULL
+        };
+        const int topic_cnt = 4000;
+        const int pattern_cnt = 12;
+        char **topics;
+        rd_regex_t *res[12];
+        char errstr[128];
+        rd_ts_t ts, t_match, t_exec;
+        int i, j, matches_match = 0, matches_exec = 0;
 
-	/* FIXME: cache compiled regex */
-	re = re_regcomp(pattern, 0, &errstr2);
-	if (!re) {
-                if (errstr)
-                        rd_strlcpy(errstr, errstr2, errstr_size);
-		return -1;
-	}
+        for (i = 0 ; patterns[i].pattern ; i++) {
+                rd_regex_t *re = rd_regex_comp(patterns[i].pattern,
+                                               errstr, sizeof(errstr));
+                const char *prefix;
+                size_t len;
 
-	r = !re_regexec(re, str, NULL, 0);
+                RD_UT_ASSERT(re, "%s: %s", patterns[i].pattern, errstr);
+                prefix = rd_regex_prefix(re, &len);
+                if (patterns[i].prefix)
+                        RD_UT_ASSERT(prefix &&
+                                     len == strlen(patterns[i].prefix) &&
+                                     !strcmp(prefix, patterns[i].prefix),
+                                     "%s: expected prefix \"%s\", not "
+                                     "\"%s\"", patterns[i].pattern,
+                                     patterns[i].prefix,
+                                     prefix ? prefix : "(none)");
+                else
+                        RD_UT_ASSERT(!prefix, "%s: expected no prefix, "
+                                     "not \"%s\"", patterns[i].pattern,
+                                     prefix);
+                RD_UT_ASSERT((int)re->kind == patterns[i].kind,
+                             "%s: expected kind %d, not %d",
+                             patterns[i].pattern, patterns[i].kind,
+                             (int)re->kind);
 
-	re_regfree(re);
+                for (j = 0 ; strs[j] ; j++)
+                        RD_UT_ASSERT(rd_regex_exec0(re, strs[j], rd_true) ==
+                                     rd_regex_exec0(re, strs[j], rd_false),
+                                     "%s vs \"%s\": prefix match %d "
+                                     "!= regex match %d",
+                                     patterns[i].pattern, strs[j],
+                                     rd_regex_exec0(re, strs[j], rd_true),
+                                     rd_regex_exec0(re, strs[j], rd_false));
 
-	return r;
-#endif
+                rd_regex_destroy(re);
+        }
+
+        RD_UT_ASSERT(rd_regex_match("^my(topic", "mytopic",
+                                    errstr, sizeof(errstr)) == -1,
+                     "expected compilation error");
+
+        /* Benchmark: pattern_cnt subscriptions matched against
+         * topic_cnt cluster topics, compiled per match vs once. */
+        topics = rd_malloc(sizeof(*topics) * topic_cnt);
+        for (i = 0 ; i < topic_cnt ; i++) {
+                char name[64];
+                rd_snprintf(name, sizeof(name), "svc%d.events.v%d",
+                            i % 100, i);
+                topics[i] = rd_strdup(name);
+        }
+
+        ts = rd_clock();
+        for (i = 0 ; i < topic_cnt ; i++) {
+                for (j = 0 ; j < pattern_cnt ; j++) {
+                        char pattern[64];
+                        rd_snprintf(pattern, sizeof(pattern),
+                                    "^svc%d\\.events\\..*", j);
+                        matches_match += rd_regex_match(pattern, topics[i],
+                                                        NULL, 0);
+                }
+        }
+        t_match = rd_clock() - ts;
+
+        ts = rd_clock();
+        for (j = 0 ; j < pattern_cnt ; j++) {
+                char pattern[64];
+                rd_snprintf(pattern, sizeof(pattern),
+                            "^svc%d\\.events\\..*", j);
+                res[j] = rd_regex_comp(pattern, NULL, 0);
+        }
+        for (i = 0 ; i < topic_cnt ; i++)
+                for (j = 0 ; j < pattern_cnt ; j++)
+                        matches_exec += rd_regex_exec(res[j], topics[i]);
+        for (j = 0 ; j < pattern_cnt ; j++)
+                rd_regex_destroy(res[j]);
+        t_exec = rd_clock() - ts;
+
+        for (i = 0 ; i < topic_cnt ; i++)
+                rd_free(topics[i]);
+        rd_free(topics);
+
+        RD_UT_ASSERT(matches_match == matches_exec,
+                     "expected same number of matches: %d != %d",
+                     matches_match, matches_exec);
+
+        RD_UT_SAY("%d topics x %d patterns (%d matches): "
+                  "rd_regex_match() %.3fms, compiled %.3fms (%.1fx)",
+                  topic_cnt, pattern_cnt, matches_exec,
+                  (double)t_match / 1000.0, (double)t_exec / 1000.0,
+                  (double)t_match / (double)RD_MAX(t_exec, 1));
+
+        RD_UT_PASS();
 }
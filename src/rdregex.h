@@ -33,8 +33,11 @@ typedef struct rd_regex_s rd_regex_t;
 void rd_regex_destroy (rd_regex_t *re);
 rd_regex_t *rd_regex_comp (const char *pattern, char *errstr, size_t errstr_size);
 int rd_regex_exec (rd_regex_t *re, const char *str);
+const char *rd_regex_prefix (const rd_regex_t *re, size_t *lenp);
 
 int rd_regex_match (const char *pattern, const char *str,
 		    char *errstr, size_t errstr_size);
 
+int unittest_rdregex (void);
+
 #endif /* _RDREGEX_H_ */
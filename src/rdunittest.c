@@ -37,6 +37,7 @@
 #include "rdbuf.h"
 #include "crc32c.h"
 #include "rdmurmur2.h"
+#include "rdregex.h"
 #if WITH_HDRHISTOGRAM
 #include "rdhdrhistogram.h"
 #endif
@@ -47,6 +48,9 @@
 #include "rdsysqueue.h"
 #include "rdkafka_sasl_oauthbearer.h"
 #include "rdkafka_msgset.h"
+#if WITH_SSL
+#include "rdkafka_ssl.h"
+#endif
 
 
 rd_bool_t rd_unittest_assert_on_failure = rd_false;
@@ -399,7 +403,12 @@ int rd_unittest (void) {
                 { "rdvarint", unittest_rdvarint },
                 { "crc32c",   unittest_crc32c },
                 { "msg",      unittest_msg },
+                { "queue",    unittest_queue },
+                { "workpool", unittest_workpool },
+                { "timer",    unittest_timer },
                 { "murmurhash", unittest_murmur2 },
+                { "rdregex",  unittest_rdregex },
+                { "pattern",  unittest_pattern },
 #if WITH_HDRHISTOGRAM
                 { "rdhdrhistogram", unittest_rdhdrhistogram },
 #endif
@@ -413,6 +422,9 @@ int rd_unittest (void) {
                 { "sasl_oauthbearer", unittest_sasl_oauthbearer },
 #endif
                 { "aborted_txns", unittest_aborted_txns },
+#if WITH_SSL
+                { "ssl", unittest_ssl },
+#endif
                 { NULL }
         };
         int i;
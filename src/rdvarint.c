@@ -29,6 +29,7 @@
 
 #include "rdvarint.h"
 #include "rdunittest.h"
+#include "rdtime.h"
 
 
 static int do_test_rd_uvarint_enc_i64 (const char *file, int line,
@@ -104,6 +105,134 @@ static int do_test_rd_uvarint_enc_i64 (const char *file, int line,
 }
 
 
+/**
+ * @brief Verify rd_uvarint_dec_fast() against rd_uvarint_dec() for all
+ *        encoded sizes, with and without 8 readable bytes.
+ */
+static int do_test_rd_uvarint_dec_fast (void) {
+        int bits;
+
+        for (bits = 0 ; bits <= 64 ; bits++) {
+                uint64_t num = bits == 64 ? UINT64_MAX :
+                        (uint64_t)1 << bits;
+                char buf[16];
+                size_t sz, avail;
+
+                memset(buf, 0xff, sizeof(buf)); /* trailing garbage */
+                sz = rd_uvarint_enc_u64(buf, sizeof(buf), num);
+                RD_UT_ASSERT(sz > 0, "encode of %"PRIu64" failed", num);
+
+                for (avail = sz - 1 ; avail <= sizeof(buf) ; avail++) {
+                        uint64_t exp_num = 0, ret_num = 0;
+                        size_t exp_r, r;
+
+                        exp_r = rd_uvarint_dec(buf, avail, &exp_num);
+                        r = rd_uvarint_dec_fast(buf, avail, &ret_num);
+
+                        RD_UT_ASSERT(r == exp_r,
+                                     "%"PRIu64" (%"PRIusz" bytes, "
+                                     "%"PRIusz" available): "
+                                     "expected %"PRIusz" bytes read, "
+                                     "not %"PRIusz,
+                                     num, sz, avail, exp_r, r);
+                        RD_UT_ASSERT(avail < sz || ret_num == num,
+                                     "%"PRIu64" (%"PRIusz" available): "
+                                     "decoded as %"PRIu64,
+                                     num, avail, ret_num);
+                }
+        }
+
+        RD_UT_PASS();
+}
+
+
+/**
+ * @brief Microbenchmark of decoding record-header-like varints with
+ *        rd_slice_read_varint() versus rd_varint_dec_i64_fast().
+ */
+static int do_test_rd_varint_dec_bench (void) {
+        const int cnt = 1000000;
+        const int iterations = 10;
+        char *mem, *p;
+        size_t size;
+        rd_buf_t b;
+        rd_slice_t slice;
+        int64_t sum_slice = 0, sum_fast = 0;
+        rd_ts_t ts, dur_slice = 0, dur_fast = 0;
+        int i, it;
+
+        /* Mix of small values typical of record headers (lengths,
+         * timestamp and offset deltas) and a few larger ones. */
+        mem = rd_malloc((size_t)cnt * RD_UVARINT_ENC_SIZEOF(int64_t));
+        p = mem;
+        for (i = 0 ; i < cnt ; i++) {
+                int64_t v;
+                switch (i % 8)
+                {
+                case 0: v = 100 + (i % 150); break;
+                case 1: v = i % 64; break;
+                case 2: v = -1; break;
+                case 7: v = (int64_t)i * 1000; break;
+                default: v = i % 5000; break;
+                }
+                p += rd_uvarint_enc_i64(p, RD_UVARINT_ENC_SIZEOF(int64_t), v);
+        }
+        size = (size_t)(p - mem);
+
+        rd_buf_init(&b, 1, 0);
+        rd_buf_push(&b, mem, size, NULL);
+
+        for (it = 0 ; it < iterations ; it++) {
+                const char *end = mem + size;
+                int64_t v;
+
+                rd_slice_init_full(&slice, &b);
+                ts = rd_clock();
+                for (i = 0 ; i < cnt ; i++) {
+                        size_t r = rd_slice_read_varint(&slice, &v);
+                        RD_UT_ASSERT(!RD_UVARINT_DEC_FAILED(r),
+                                     "slice varint #%d decode failed", i);
+                        sum_slice += v;
+                }
+                dur_slice += rd_clock() - ts;
+
+                p = mem;
+                ts = rd_clock();
+                for (i = 0 ; i < cnt ; i++) {
+                        size_t r = rd_varint_dec_i64_fast(p,
+                                                          (size_t)(end - p),
+                                                          &v);
+                        RD_UT_ASSERT(!RD_UVARINT_DEC_FAILED(r),
+                                     "fast varint #%d decode failed", i);
+                        p += r;
+                        sum_fast += v;
+                }
+                dur_fast += rd_clock() - ts;
+
+                RD_UT_ASSERT(p == end,
+                             "fast decoder stopped at %"PRIusz"/%"PRIusz,
+                             (size_t)(p - mem), size);
+        }
+
+        RD_UT_ASSERT(sum_slice == sum_fast,
+                     "decoder mismatch: slice sum %"PRId64" != "
+                     "fast sum %"PRId64, sum_slice, sum_fast);
+
+        RD_UT_SAY("%d varints x %d: slice reader: %.3fms (%.1f ns/varint), "
+                  "fast: %.3fms (%.1f ns/varint)",
+                  cnt, iterations,
+                  (double)dur_slice / 1000.0,
+                  (double)dur_slice * 1000.0 / ((double)cnt * iterations),
+                  (double)dur_fast / 1000.0,
+                  (double)dur_fast * 1000.0 / ((double)cnt * iterations));
+
+        rd_buf_destroy(&b);
+        rd_free(mem);
+
+        RD_UT_PASS();
+}
+
+
 int unittest_rdvarint (void) {
         int fails = 0;
 
@@ -140,5 +269,8 @@ int unittest_rdvarint (void) {
                                                             0xb1,
                                                             0x04 }, 8);
 
+        fails += do_test_rd_uvarint_dec_fast();
+        fails += do_test_rd_varint_dec_bench();
+
         return fails;
 }
@@ -32,6 +32,22 @@
 
 #include "rd.h"
 #include "rdbuf.h"
+#include "rdendian.h"
+
+#if defined(__BMI2__)
+#include <immintrin.h>
+#endif
+
+/* rd_uvarint_dec_fast() needs a 64-bit count trailing zeros, which MSVC
+ * only provides (_BitScanForward64) on 64-bit targets. */
+#if !defined(_MSC_VER)
+#define RD_UVARINT_DEC_FAST 1
+#elif defined(_M_X64) || defined(_M_ARM64)
+#include <intrin.h>
+#define RD_UVARINT_DEC_FAST 1
+#else
+#define RD_UVARINT_DEC_FAST 0
+#endif
 
 /**
  * @name signed varint zig-zag encoder/decoder
@@ -141,6 +157,89 @@ size_t rd_varint_dec_i64 (const char *src, size_t srcsize, int64_t *nump) {
 }
 
 
+/**
+ * @brief Branchless variant of rd_uvarint_dec() for contiguous buffers.
+ *
+ * When at least 8 bytes are readable at \p src and the varint is at most
+ * 8 bytes long (i.e., fits 56 bits, which covers all Kafka record header
+ * fields in practice) the varint is decoded from a single 64-bit load:
+ * the terminating byte is located through the inverted continuation
+ * bits and the 7-bit groups are compacted in-register (using PEXT when
+ * compiled with BMI2).
+ * Anything else, and all varints on 32-bit MSVC targets, is handed to
+ * rd_uvarint_dec().
+ *
+ * @remark Up to 8 bytes may be read from \p src, but never more than
+ *         \p srcsize.
+ *
+ * @returns the number of bytes read from \p src, see rd_uvarint_dec().
+ */
+static RD_INLINE RD_UNUSED
+size_t rd_uvarint_dec_fast (const char *src, size_t srcsize, uint64_t *nump) {
+#if !RD_UVARINT_DEC_FAST
+        return rd_uvarint_dec(src, srcsize, nump);
+#else
+        uint64_t w, stop, x;
+        unsigned int bit;
+
+        if (unlikely(srcsize < 8))
+                return rd_uvarint_dec(src, srcsize, nump);
+
+        memcpy(&w, src, sizeof(w));
+        w = le64toh(w);
+
+        /* High bit clear on the terminating byte */
+        stop = ~w & 0x8080808080808080ULL;
+        if (unlikely(!stop))
+                return rd_uvarint_dec(src, srcsize, nump);
+
+        /* Keep the bytes up to and including the terminating byte */
+        w &= stop ^ (stop - 1);
+
+#if defined(__BMI2__)
+        x = _pext_u64(w, 0x7f7f7f7f7f7f7f7fULL);
+#else
+        x = w & 0x7f7f7f7f7f7f7f7fULL;
+        x = ((x & 0x7f007f007f007f00ULL) >> 1) |
+                (x & 0x007f007f007f007fULL);
+        x = ((x & 0x3fff00003fff0000ULL) >> 2) |
+                (x & 0x00003fff00003fffULL);
+        x = ((x & 0x0fffffff00000000ULL) >> 4) |
+                (x & 0x000000000fffffffULL);
+#endif
+
+#ifdef _MSC_VER
+        {
+                unsigned long idx;
+                _BitScanForward64(&idx, stop);
+                bit = (unsigned int)idx;
+        }
+#else
+        bit = (unsigned int)__builtin_ctzll(stop);
+#endif
+
+        *nump = x;
+        return (size_t)(bit >> 3) + 1;
+#endif
+}
+
+/**
+ * @brief Zig-zag decoding variant of rd_uvarint_dec_fast().
+ */
+static RD_INLINE RD_UNUSED
+size_t rd_varint_dec_i64_fast (const char *src, size_t srcsize,
+                               int64_t *nump) {
+        uint64_t n;
+        size_t r;
+
+        r = rd_uvarint_dec_fast(src, srcsize, &n);
+        if (likely(!RD_UVARINT_DEC_FAILED(r)))
+                *nump = (int64_t)(n >> 1) ^ -(int64_t)(n & 1);
+
+        return r;
+}
+
+
 /**
  * @returns the maximum encoded size for a type
  */
@@ -0,0 +1,172 @@
+/*
+ * librdkafka - Apache Kafka C library
+ *
+ * Copyright (c) 2020, Magnus Edenhill
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "test.h"
+
+
+/**
+ * @name Verify that messages produced with produce.zerocopy=true, where
+ *       the payloads are passed by reference all the way to the socket,
+ *       are correctly received for a wide range of payload sizes,
+ *       including interleaved RD_KAFKA_MSG_F_COPY messages.
+ */
+
+
+/**
+ * @returns the payload byte at position \p i for message \p msgid
+ */
+static RD_INLINE char payload_byte (int msgid, size_t i) {
+        return (char)('a' + ((msgid * 7 + i) % 26));
+}
+
+
+static int is_fatal_cb (rd_kafka_t *rk, rd_kafka_resp_err_t err,
+                        const char *reason) {
+        /* Closing the consumer takes down the group coordinator's
+         * logical broker connection, which raises ALL_BROKERS_DOWN
+         * with a single broker cluster. */
+        if (err == RD_KAFKA_RESP_ERR__ALL_BROKERS_DOWN)
+                return 0;
+        return 1;
+}
+
+
+int main_0105_produce_zerocopy (int argc, char **argv) {
+        const char *topic = test_mk_topic_name("0105_produce_zerocopy", 1);
+        static const size_t sizes[] = {
+                0, 1, 17, 100, 1000, 65535, 65536, 100*1000, 500*1000
+        };
+        const int msgcnt = (int)RD_ARRAYSIZE(sizes) * 2;
+        rd_kafka_mock_cluster_t *mcluster;
+        rd_kafka_t *p, *c;
+        rd_kafka_conf_t *conf;
+        const char *bootstraps;
+        char **payloads;
+        int i, rcvcnt = 0;
+        int remains = 0;
+        test_timing_t t_consume;
+
+        mcluster = test_mock_cluster_new(1, &bootstraps);
+
+        test_conf_init(&conf, NULL, 30);
+        test_conf_set(conf, "bootstrap.servers", bootstraps);
+
+        /* Producer */
+        test_conf_set(conf, "produce.zerocopy", "true");
+        test_conf_set(conf, "linger.ms", "100");
+        rd_kafka_conf_set_dr_msg_cb(conf, test_dr_msg_cb);
+        p = test_create_handle(RD_KAFKA_PRODUCER, rd_kafka_conf_dup(conf));
+
+        /* Application owned payloads, must remain valid until the
+         * delivery report (flush). */
+        payloads = malloc(sizeof(*payloads) * msgcnt);
+
+        for (i = 0 ; i < msgcnt ; i++) {
+                size_t size = sizes[i % RD_ARRAYSIZE(sizes)];
+                size_t j;
+                rd_kafka_resp_err_t err;
+
+                payloads[i] = malloc(size + 1);
+                for (j = 0 ; j < size ; j++)
+                        payloads[i][j] = payload_byte(i, j);
+
+                /* Every other message is copied */
+                err = rd_kafka_producev(p,
+                                        RD_KAFKA_V_TOPIC(topic),
+                                        RD_KAFKA_V_PARTITION(0),
+                                        RD_KAFKA_V_VALUE(payloads[i], size),
+                                        RD_KAFKA_V_KEY(&i, sizeof(i)),
+                                        RD_KAFKA_V_OPAQUE(&remains),
+                                        RD_KAFKA_V_MSGFLAGS(
+                                                (i & 1) ?
+                                                RD_KAFKA_MSG_F_COPY : 0),
+                                        RD_KAFKA_V_END);
+                TEST_ASSERT(!err, "producev() #%d failed: %s",
+                            i, rd_kafka_err2str(err));
+                remains++;
+        }
+
+        test_flush(p, tmout_multip(10*1000));
+        TEST_ASSERT(remains == 0, "%d message(s) not delivered", remains);
+
+        for (i = 0 ; i < msgcnt ; i++)
+                free(payloads[i]);
+        free(payloads);
+
+        rd_kafka_destroy(p);
+
+        /* Consume and verify */
+        test_conf_set(conf, "auto.offset.reset", "earliest");
+        c = test_create_consumer(topic, NULL, conf, NULL);
+        test_consumer_assign_partition("CONSUME", c, topic, 0,
+                                       RD_KAFKA_OFFSET_BEGINNING);
+
+        TIMING_START(&t_consume, "CONSUME");
+        while (rcvcnt < msgcnt) {
+                rd_kafka_message_t *rkm;
+                size_t exp_size, j;
+                int msgid;
+
+                rkm = rd_kafka_consumer_poll(c, 1000);
+                if (!rkm)
+                        continue;
+
+                TEST_ASSERT(!rkm->err, "Consumer error: %s",
+                            rd_kafka_message_errstr(rkm));
+
+                TEST_ASSERT(rkm->key_len == sizeof(msgid),
+                            "Unexpected key length %"PRIusz, rkm->key_len);
+                memcpy(&msgid, rkm->key, sizeof(msgid));
+                TEST_ASSERT(msgid == rcvcnt,
+                            "Expected msgid %d, not %d", rcvcnt, msgid);
+
+                exp_size = sizes[msgid % RD_ARRAYSIZE(sizes)];
+                TEST_ASSERT(rkm->len == exp_size,
+                            "msgid %d: expected size %"PRIusz", not %"PRIusz,
+                            msgid, exp_size, rkm->len);
+
+                for (j = 0 ; j < exp_size ; j++)
+                        TEST_ASSERT(((const char *)rkm->payload)[j] ==
+                                    payload_byte(msgid, j),
+                                    "msgid %d: payload mismatch at "
+                                    "offset %"PRIusz, msgid, j);
+
+                rd_kafka_message_destroy(rkm);
+                rcvcnt++;
+        }
+        TIMING_STOP(&t_consume);
+
+        test_curr->is_fatal_cb = is_fatal_cb;
+        test_consumer_close(c);
+        rd_kafka_destroy(c);
+        test_curr->is_fatal_cb = NULL;
+
+        test_mock_cluster_destroy(mcluster);
+
+        return 0;
+}
@@ -0,0 +1,160 @@
+/*
+ * librdkafka - Apache Kafka C library
+ *
+ * Copyright (c) 2020, Magnus Edenhill
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "test.h"
+
+
+/**
+ * @name Verify that messages produced concurrently from multiple threads
+ *       to the same partition with enable.lockfree.enqueue=true are all
+ *       delivered, and in per-thread order, with the idempotent producer.
+ */
+
+
+#define _THREAD_CNT  8
+#define _MSG_CNT     2000  /* per thread */
+
+struct producer_thread {
+        rd_kafka_t *rk;
+        const char *topic;
+        int id;
+        int *remainsp;
+};
+
+static int producer_thread_main (void *arg) {
+        struct producer_thread *pt = arg;
+        /* The mock broker expects at least
+         * RD_KAFKAP_MESSAGE_V2_OVERHEAD bytes per record. */
+        char payload[64];
+        int i;
+
+        memset(payload, 'l', sizeof(payload));
+
+        for (i = 0 ; i < _MSG_CNT ; i++) {
+                int key[2] = { pt->id, i };
+                rd_kafka_resp_err_t err;
+
+                err = rd_kafka_producev(pt->rk,
+                                        RD_KAFKA_V_TOPIC(pt->topic),
+                                        RD_KAFKA_V_PARTITION(0),
+                                        RD_KAFKA_V_KEY(key, sizeof(key)),
+                                        RD_KAFKA_V_VALUE(payload,
+                                                         sizeof(payload)),
+                                        RD_KAFKA_V_OPAQUE(pt->remainsp),
+                                        RD_KAFKA_V_MSGFLAGS(
+                                                RD_KAFKA_MSG_F_COPY),
+                                        RD_KAFKA_V_END);
+                TEST_ASSERT(!err, "thread %d: producev() #%d failed: %s",
+                            pt->id, i, rd_kafka_err2str(err));
+        }
+
+        return 0;
+}
+
+
+int main_0106_lockfree_enqueue (int argc, char **argv) {
+        const char *topic = test_mk_topic_name("0106_lockfree_enqueue", 1);
+        const int msgcnt = _THREAD_CNT * _MSG_CNT;
+        struct producer_thread pts[_THREAD_CNT];
+        thrd_t thrds[_THREAD_CNT];
+        int next_seq[_THREAD_CNT] = { 0 };
+        rd_kafka_mock_cluster_t *mcluster;
+        rd_kafka_t *p, *c;
+        rd_kafka_conf_t *conf;
+        const char *bootstraps;
+        int i, rcvcnt = 0;
+        int remains = msgcnt;
+
+        mcluster = test_mock_cluster_new(1, &bootstraps);
+
+        test_conf_init(&conf, NULL, 60);
+        test_conf_set(conf, "bootstrap.servers", bootstraps);
+        test_conf_set(conf, "enable.lockfree.enqueue", "true");
+
+        /* Producer */
+        test_conf_set(conf, "enable.idempotence", "true");
+        test_conf_set(conf, "linger.ms", "5");
+        rd_kafka_conf_set_dr_msg_cb(conf, test_dr_msg_cb);
+        p = test_create_handle(RD_KAFKA_PRODUCER, rd_kafka_conf_dup(conf));
+
+        for (i = 0 ; i < _THREAD_CNT ; i++) {
+                pts[i].rk    = p;
+                pts[i].topic = topic;
+                pts[i].id    = i;
+                pts[i].remainsp = &remains;
+                if (thrd_create(&thrds[i], producer_thread_main, &pts[i]) !=
+                    thrd_success)
+                        TEST_FAIL("Failed to create producer thread %d", i);
+        }
+
+        for (i = 0 ; i < _THREAD_CNT ; i++)
+                thrd_join(thrds[i], NULL);
+
+        test_flush(p, tmout_multip(30*1000));
+        TEST_ASSERT(remains == 0, "%d message(s) not delivered", remains);
+        rd_kafka_destroy(p);
+
+        /* Consume and verify per-thread ordering */
+        test_conf_set(conf, "auto.offset.reset", "earliest");
+        c = test_create_consumer(topic, NULL, conf, NULL);
+        test_consumer_assign_partition("CONSUME", c, topic, 0,
+                                       RD_KAFKA_OFFSET_BEGINNING);
+
+        while (rcvcnt < msgcnt) {
+                rd_kafka_message_t *rkm;
+                int key[2];
+
+                rkm = rd_kafka_consumer_poll(c, 1000);
+                if (!rkm)
+                        continue;
+
+                TEST_ASSERT(!rkm->err, "Consumer error: %s",
+                            rd_kafka_message_errstr(rkm));
+                TEST_ASSERT(rkm->key_len == sizeof(key),
+                            "Unexpected key length %"PRIusz, rkm->key_len);
+                memcpy(key, rkm->key, sizeof(key));
+                TEST_ASSERT(key[0] >= 0 && key[0] < _THREAD_CNT,
+                            "Invalid thread id %d", key[0]);
+                TEST_ASSERT(key[1] == next_seq[key[0]],
+                            "Thread %d: expected seq %d, not %d",
+                            key[0], next_seq[key[0]], key[1]);
+                next_seq[key[0]]++;
+
+                rd_kafka_message_destroy(rkm);
+                rcvcnt++;
+        }
+
+        TEST_SAY("Consumed %d messages in per-thread order\n", rcvcnt);
+
+        test_consumer_close(c);
+        rd_kafka_destroy(c);
+
+        test_mock_cluster_destroy(mcluster);
+
+        return 0;
+}
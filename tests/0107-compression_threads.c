@@ -0,0 +1,160 @@
+/*
+ * librdkafka - Apache Kafka C library
+ *
+ * Copyright (c) 2020, Magnus Edenhill
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "test.h"
+
+
+/**
+ * @name Verify that MessageSets compressed in parallel on the
+ *       compression.threads worker pool are delivered, consumed
+ *       and in order, with the idempotent producer, and that
+ *       the consumer's parallel decompression of FetchResponse
+ *       partitions preserves per-partition order.
+ */
+
+
+#define _PART_CNT 4
+
+
+static void do_test_compression_threads (const char *bootstraps,
+                                         const char *codec) {
+        const char *topic = test_mk_topic_name("0107_compression_threads",
+                                               1);
+        rd_kafka_t *p, *c;
+        rd_kafka_conf_t *conf;
+        rd_kafka_topic_partition_list_t *parts;
+        test_msgver_t mv;
+        uint64_t testid;
+        const int msgcnt = 5000;
+        int remains = 0;
+        int i;
+
+        TEST_SAY(_C_MAG "[ Test %s compression on 4 threads ]\n", codec);
+
+        testid = test_id_generate();
+
+        test_conf_init(&conf, NULL, 60);
+        test_conf_set(conf, "bootstrap.servers", bootstraps);
+
+        /* Producer */
+        rd_kafka_conf_set_dr_msg_cb(conf, test_dr_msg_cb);
+        test_conf_set(conf, "enable.idempotence", "true");
+        test_conf_set(conf, "compression.codec", codec);
+        test_conf_set(conf, "compression.threads", "4");
+        /* Accumulate batches large enough to be offloaded */
+        test_conf_set(conf, "linger.ms", "100");
+        p = test_create_handle(RD_KAFKA_PRODUCER, rd_kafka_conf_dup(conf));
+
+        /* Payloads compress to about half their size: enough to
+         * exercise compression while keeping the compressed records
+         * above the mock broker's minimum record size. */
+        for (i = 0 ; i < msgcnt ; i++) {
+                int32_t partition = i / (msgcnt / _PART_CNT);
+                char key[64];
+                char value[512];
+                size_t j;
+                rd_kafka_resp_err_t err;
+
+                test_msg_fmt(key, sizeof(key), testid, partition, i);
+                /* The value starts with the msgver token. */
+                memcpy(value, key, strlen(key));
+                for (j = strlen(key) ; j < sizeof(value) ; j++)
+                        value[j] = "0123456789abcdef"[rand() % 16];
+
+                err = rd_kafka_producev(p,
+                                        RD_KAFKA_V_TOPIC(topic),
+                                        RD_KAFKA_V_PARTITION(partition),
+                                        RD_KAFKA_V_KEY(key, strlen(key)),
+                                        RD_KAFKA_V_VALUE(value, sizeof(value)),
+                                        RD_KAFKA_V_OPAQUE(&remains),
+                                        RD_KAFKA_V_MSGFLAGS(
+                                                RD_KAFKA_MSG_F_COPY),
+                                        RD_KAFKA_V_END);
+                TEST_ASSERT(!err, "producev() #%d failed: %s",
+                            i, rd_kafka_err2str(err));
+                remains++;
+        }
+
+        test_flush(p, 30*1000);
+        TEST_ASSERT(remains == 0,
+                    "%d message(s) not delivered", remains);
+
+        rd_kafka_destroy(p);
+
+        /* Consumer, decompressing on the worker pool
+         * (compression.threads is inherited from conf). */
+        test_conf_set(conf, "auto.offset.reset", "earliest");
+        c = test_create_consumer(topic, NULL, conf, NULL);
+
+        parts = rd_kafka_topic_partition_list_new(_PART_CNT);
+        for (i = 0 ; i < _PART_CNT ; i++)
+                rd_kafka_topic_partition_list_add(parts, topic, i);
+        test_consumer_assign("CONSUME", c, parts);
+        rd_kafka_topic_partition_list_destroy(parts);
+
+        test_msgver_init(&mv, testid);
+        test_consumer_poll("CONSUME", c, testid, -1, 0, msgcnt, &mv);
+        test_msgver_verify("CONSUME", &mv,
+                           TEST_MSGVER_ORDER|TEST_MSGVER_DUP, 0, msgcnt);
+        test_msgver_clear(&mv);
+
+        test_consumer_close(c);
+        rd_kafka_destroy(c);
+
+        TEST_SAY(_C_GRN "[ Test %s compression on 4 threads: PASS ]\n",
+                 codec);
+}
+
+
+int main_0107_compression_threads (int argc, char **argv) {
+        rd_kafka_mock_cluster_t *mcluster;
+        const char *bootstraps;
+        const char *codecs[] = {
+#if WITH_ZLIB
+                "gzip",
+#endif
+#if WITH_SNAPPY
+                "snappy",
+#endif
+#if WITH_ZSTD
+                "zstd",
+#endif
+                "lz4",
+                NULL
+        };
+        int i;
+
+        mcluster = test_mock_cluster_new(3, &bootstraps);
+
+        for (i = 0 ; codecs[i] ; i++)
+                do_test_compression_threads(bootstraps, codecs[i]);
+
+        test_mock_cluster_destroy(mcluster);
+
+        return 0;
+}
@@ -0,0 +1,428 @@
+/*
+ * librdkafka - Apache Kafka C library
+ *
+ * Copyright (c) 2020, Magnus Edenhill
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "test.h"
+
+
+/**
+ * @name Verify that the MessageSets of partitions on the same broker are
+ *       packed into multi-partition ProduceRequests
+ *       (produce.request.max.partitions), and that the messages are
+ *       delivered and consumed in order.
+ */
+
+
+#define _TOPIC_CNT 4
+#define _PART_CNT  4   /* Mock cluster default partition count */
+
+static mtx_t produce_req_lock;
+static int produce_req_cnt = 0;
+
+static rd_kafka_resp_err_t on_request_sent (rd_kafka_t *rk,
+                                            int sockfd,
+                                            const char *brokername,
+                                            int32_t brokerid,
+                                            int16_t ApiKey,
+                                            int16_t ApiVersion,
+                                            int32_t CorrId,
+                                            size_t  size,
+                                            void *ic_opaque) {
+
+        /* Ignore if not a ProduceRequest */
+        if (ApiKey != 0)
+                return RD_KAFKA_RESP_ERR_NO_ERROR;
+
+        mtx_lock(&produce_req_lock);
+        produce_req_cnt++;
+        mtx_unlock(&produce_req_lock);
+
+        return RD_KAFKA_RESP_ERR_NO_ERROR;
+}
+
+static rd_kafka_resp_err_t on_new_producer (rd_kafka_t *rk,
+                                            const rd_kafka_conf_t *conf,
+                                            void *ic_opaque,
+                                            char *errstr, size_t errstr_size) {
+        return rd_kafka_interceptor_add_on_request_sent(
+                rk, "count_produce_requests",
+                on_request_sent, NULL);
+}
+
+
+
+static int is_fatal_cb (rd_kafka_t *rk, rd_kafka_resp_err_t err,
+                        const char *reason) {
+        /* Closing the consumer takes down the group coordinator's
+         * logical broker connection, which raises ALL_BROKERS_DOWN
+         * with a single broker cluster. */
+        if (err == RD_KAFKA_RESP_ERR__ALL_BROKERS_DOWN)
+                return 0;
+        return 1;
+}
+
+
+static void do_test_produce_multi_partition (const char *bootstraps,
+                                             int max_partitions,
+                                             const char *codec) {
+        char *topics[_TOPIC_CNT];
+        rd_kafka_t *p, *c;
+        rd_kafka_conf_t *conf, *pconf;
+        rd_kafka_topic_partition_list_t *parts;
+        test_msgver_t mv;
+        uint64_t testid;
+        const int partcnt = _TOPIC_CNT * _PART_CNT;
+        const int msgcnt = partcnt * 100;
+        int remains = 0;
+        int reqcnt;
+        int i;
+
+        TEST_SAY(_C_MAG "[ Test produce.request.max.partitions=%d, "
+                 "compression %s ]\n", max_partitions, codec);
+
+        testid = test_id_generate();
+
+        for (i = 0 ; i < _TOPIC_CNT ; i++)
+                topics[i] = rd_strdup(test_mk_topic_name("0108_produce_multi",
+                                                         1));
+
+        test_conf_init(&conf, NULL, 60);
+        test_conf_set(conf, "bootstrap.servers", bootstraps);
+
+        /* Producer */
+        rd_kafka_conf_set_dr_msg_cb(conf, test_dr_msg_cb);
+        test_conf_set(conf, "enable.idempotence", "true");
+        test_conf_set(conf, "compression.codec", codec);
+        test_conf_set(conf, "compression.threads", "2");
+        test_conf_set(conf, "produce.request.max.partitions",
+                      tsprintf("%d", max_partitions));
+        /* Have all partitions' batches become ready at about the
+         * same time */
+        test_conf_set(conf, "linger.ms", "500");
+        test_conf_set(conf, "batch.num.messages", "1000");
+
+        mtx_init(&produce_req_lock, mtx_plain);
+        produce_req_cnt = 0;
+
+        pconf = rd_kafka_conf_dup(conf);
+        rd_kafka_conf_interceptor_add_on_new(pconf, "on_new_producer",
+                                             on_new_producer, NULL);
+        p = test_create_handle(RD_KAFKA_PRODUCER, pconf);
+
+        /* Round-robin the messages over the partitions, the values
+         * start with the msgver token and compress to about half
+         * their size. */
+        for (i = 0 ; i < msgcnt ; i++) {
+                int32_t partition = (i / _TOPIC_CNT) % _PART_CNT;
+                const char *topic = topics[i % _TOPIC_CNT];
+                char key[64];
+                char value[256];
+                size_t j;
+                rd_kafka_resp_err_t err;
+
+                test_msg_fmt(key, sizeof(key), testid, partition, i);
+                memcpy(value, key, strlen(key));
+                for (j = strlen(key) ; j < sizeof(value) ; j++)
+                        value[j] = "0123456789abcdef"[rand() % 16];
+
+                err = rd_kafka_producev(p,
+                                        RD_KAFKA_V_TOPIC(topic),
+                                        RD_KAFKA_V_PARTITION(partition),
+                                        RD_KAFKA_V_KEY(key, strlen(key)),
+                                        RD_KAFKA_V_VALUE(value, sizeof(value)),
+                                        RD_KAFKA_V_OPAQUE(&remains),
+                                        RD_KAFKA_V_MSGFLAGS(
+                                                RD_KAFKA_MSG_F_COPY),
+                                        RD_KAFKA_V_END);
+                TEST_ASSERT(!err, "producev() #%d failed: %s",
+                            i, rd_kafka_err2str(err));
+                remains++;
+        }
+
+        test_flush(p, 30*1000);
+        TEST_ASSERT(remains == 0,
+                    "%d message(s) not delivered", remains);
+
+        rd_kafka_destroy(p);
+
+        mtx_lock(&produce_req_lock);
+        reqcnt = produce_req_cnt;
+        mtx_unlock(&produce_req_lock);
+        mtx_destroy(&produce_req_lock);
+
+        TEST_SAY("%d ProduceRequest(s) sent for %d partition(s)\n",
+                 reqcnt, partcnt);
+        if (max_partitions == 1)
+                TEST_ASSERT(reqcnt >= partcnt,
+                            "Expected at least one ProduceRequest per "
+                            "partition, not %d", reqcnt);
+        else
+                TEST_ASSERT(reqcnt >= partcnt / max_partitions &&
+                            reqcnt < partcnt,
+                            "Expected %d..%d ProduceRequests, not %d",
+                            partcnt / max_partitions, partcnt - 1, reqcnt);
+
+        /* Consumer */
+        test_conf_set(conf, "auto.offset.reset", "earliest");
+        c = test_create_consumer(topics[0], NULL, conf, NULL);
+
+        parts = rd_kafka_topic_partition_list_new(partcnt);
+        for (i = 0 ; i < partcnt ; i++)
+                rd_kafka_topic_partition_list_add(parts,
+                                                  topics[i / _PART_CNT],
+                                                  i % _PART_CNT);
+        test_consumer_assign("CONSUME", c, parts);
+        rd_kafka_topic_partition_list_destroy(parts);
+
+        test_msgver_init(&mv, testid);
+        test_consumer_poll("CONSUME", c, testid, -1, 0, msgcnt, &mv);
+        test_msgver_verify("CONSUME", &mv,
+                           TEST_MSGVER_ORDER|TEST_MSGVER_DUP, 0, msgcnt);
+        test_msgver_clear(&mv);
+
+        test_curr->is_fatal_cb = is_fatal_cb;
+        test_consumer_close(c);
+        rd_kafka_destroy(c);
+        test_curr->is_fatal_cb = NULL;
+
+        for (i = 0 ; i < _TOPIC_CNT ; i++)
+                rd_free(topics[i]);
+
+        TEST_SAY(_C_GRN "[ Test produce.request.max.partitions=%d, "
+                 "compression %s: PASS ]\n", max_partitions, codec);
+}
+
+
+#if WITH_SOCKEM
+/**
+ * @brief Stall the connection of the first ProduceRequest so that the
+ *        following requests are held in the output queue.
+ */
+static rd_kafka_resp_err_t on_request_sent_stall (rd_kafka_t *rk,
+                                                  int sockfd,
+                                                  const char *brokername,
+                                                  int32_t brokerid,
+                                                  int16_t ApiKey,
+                                                  int16_t ApiVersion,
+                                                  int32_t CorrId,
+                                                  size_t  size,
+                                                  void *ic_opaque) {
+        int cnt;
+
+        /* Ignore if not a ProduceRequest */
+        if (ApiKey != 0)
+                return RD_KAFKA_RESP_ERR_NO_ERROR;
+
+        mtx_lock(&produce_req_lock);
+        cnt = ++produce_req_cnt;
+        mtx_unlock(&produce_req_lock);
+
+        if (cnt == 1)
+                test_socket_sockem_set(sockfd, "delay", 2000);
+
+        return RD_KAFKA_RESP_ERR_NO_ERROR;
+}
+
+/**
+ * @brief Count the MessageSets taken out of queued multi-partition
+ *        ProduceRequests, see rd_kafka_ProduceRequest_purge_part().
+ */
+static int purged_part_cnt = 0;
+
+static void log_cb_purge (const rd_kafka_t *rk, int level,
+                          const char *fac, const char *buf) {
+        if (strcmp(fac, "PRODUCE") ||
+            !strstr(buf, "-partition ProduceRequest: "))
+                return;
+
+        TEST_SAY("%s\n", buf);
+        mtx_lock(&produce_req_lock);
+        purged_part_cnt++;
+        mtx_unlock(&produce_req_lock);
+}
+
+static rd_kafka_resp_err_t on_new_producer_stall (rd_kafka_t *rk,
+                                                  const rd_kafka_conf_t *conf,
+                                                  void *ic_opaque,
+                                                  char *errstr,
+                                                  size_t errstr_size) {
+        return rd_kafka_interceptor_add_on_request_sent(
+                rk, "stall_produce_requests",
+                on_request_sent_stall, NULL);
+}
+
+
+/**
+ * @brief Move a partition to another leader while a multi-partition
+ *        ProduceRequest with its messages is waiting in the old leader's
+ *        output queue: the partition's MessageSet must be taken out of
+ *        the request and the messages be produced to the new leader,
+ *        in order, while the other partitions' messages are delivered
+ *        by the rebuilt request.
+ */
+static void do_test_leader_change (rd_kafka_mock_cluster_t *mcluster,
+                                   const char *bootstraps) {
+        const char *topic = test_mk_topic_name("0108_leader_change", 1);
+        rd_kafka_t *p, *c;
+        rd_kafka_conf_t *conf, *pconf;
+        rd_kafka_topic_partition_list_t *parts;
+        test_msgver_t mv;
+        uint64_t testid;
+        const int msgs_per_part = 40;
+        const int msgcnt = _PART_CNT * msgs_per_part;
+        int remains = 0;
+        int i;
+
+        TEST_SAY(_C_MAG "[ Test leader change with queued multi-partition "
+                 "ProduceRequest ]\n");
+
+        testid = test_id_generate();
+
+        /* The topic is created with partition+1 partitions by the
+         * first call. */
+        for (i = _PART_CNT - 1 ; i >= 0 ; i--)
+                rd_kafka_mock_partition_set_leader(mcluster, topic, i, 1);
+
+        test_conf_init(&conf, NULL, 60);
+        test_conf_set(conf, "bootstrap.servers", bootstraps);
+
+        rd_kafka_conf_set_dr_msg_cb(conf, test_dr_msg_cb);
+        test_conf_set(conf, "max.in.flight", "1");
+        test_conf_set(conf, "queue.buffering.backpressure.threshold", "100");
+        test_conf_set(conf, "produce.request.max.partitions", "1000");
+        test_conf_set(conf, "linger.ms", "20");
+
+        mtx_init(&produce_req_lock, mtx_plain);
+        produce_req_cnt = 0;
+        purged_part_cnt = 0;
+
+        pconf = rd_kafka_conf_dup(conf);
+        test_socket_enable(pconf);
+        test_conf_set(pconf, "debug", "msg");
+        rd_kafka_conf_set_log_cb(pconf, log_cb_purge);
+        rd_kafka_conf_interceptor_add_on_new(pconf, "on_new_producer",
+                                             on_new_producer_stall, NULL);
+        p = test_create_handle(RD_KAFKA_PRODUCER, pconf);
+
+        TEST_ASSERT(test_get_partition_count(p, topic, 10*1000) == _PART_CNT,
+                    "Expected %d partitions", _PART_CNT);
+
+        /* Once the first ProduceRequest has been sent the connection
+         * is stalled, and with max.in.flight=1 the following
+         * multi-partition requests are held back in the output queue.
+         * Half-way, partition 0 is moved to broker 2. */
+        for (i = 0 ; i < msgcnt ; i++) {
+                int32_t partition = i % _PART_CNT;
+                char key[64];
+                rd_kafka_resp_err_t err;
+
+                if (i == msgcnt / 2) {
+                        rd_kafka_mock_partition_set_leader(mcluster, topic,
+                                                           0, 2);
+                        test_get_partition_count(p, topic, 10*1000);
+                        test_socket_sockem_set_all("delay", 0);
+                }
+
+                test_msg_fmt(key, sizeof(key), testid, partition, i);
+                err = rd_kafka_producev(p,
+                                        RD_KAFKA_V_TOPIC(topic),
+                                        RD_KAFKA_V_PARTITION(partition),
+                                        RD_KAFKA_V_KEY(key, strlen(key)),
+                                        RD_KAFKA_V_VALUE(key, strlen(key)),
+                                        RD_KAFKA_V_OPAQUE(&remains),
+                                        RD_KAFKA_V_MSGFLAGS(
+                                                RD_KAFKA_MSG_F_COPY),
+                                        RD_KAFKA_V_END);
+                TEST_ASSERT(!err, "producev() #%d failed: %s",
+                            i, rd_kafka_err2str(err));
+                remains++;
+
+                if (partition == _PART_CNT - 1)
+                        rd_kafka_poll(p, 50);
+        }
+
+        test_flush(p, 30*1000);
+        TEST_ASSERT(remains == 0,
+                    "%d message(s) not delivered", remains);
+
+        rd_kafka_destroy(p);
+        mtx_destroy(&produce_req_lock);
+
+        TEST_ASSERT(purged_part_cnt > 0,
+                    "Expected partition 0's MessageSet to be taken out of "
+                    "a queued multi-partition ProduceRequest");
+
+        /* Consumer */
+        test_conf_set(conf, "auto.offset.reset", "earliest");
+        c = test_create_consumer(topic, NULL, conf, NULL);
+
+        parts = rd_kafka_topic_partition_list_new(_PART_CNT);
+        for (i = 0 ; i < _PART_CNT ; i++)
+                rd_kafka_topic_partition_list_add(parts, topic, i);
+        test_consumer_assign("CONSUME", c, parts);
+        rd_kafka_topic_partition_list_destroy(parts);
+
+        test_msgver_init(&mv, testid);
+        test_consumer_poll("CONSUME", c, testid, -1, 0, msgcnt, &mv);
+        test_msgver_verify("CONSUME", &mv,
+                           TEST_MSGVER_ORDER|TEST_MSGVER_DUP, 0, msgcnt);
+        test_msgver_clear(&mv);
+
+        test_curr->is_fatal_cb = is_fatal_cb;
+        test_consumer_close(c);
+        rd_kafka_destroy(c);
+        test_curr->is_fatal_cb = NULL;
+
+        TEST_SAY(_C_GRN "[ Test leader change with queued multi-partition "
+                 "ProduceRequest: PASS ]\n");
+}
+#endif
+
+
+int main_0108_produce_multi_partition (int argc, char **argv) {
+        rd_kafka_mock_cluster_t *mcluster;
+        const char *bootstraps;
+
+        /* Single broker: all partitions share the same leader */
+        mcluster = test_mock_cluster_new(1, &bootstraps);
+
+        do_test_produce_multi_partition(bootstraps, 1, "none");
+        do_test_produce_multi_partition(bootstraps, 8, "none");
+        do_test_produce_multi_partition(bootstraps, 1000, "none");
+        do_test_produce_multi_partition(bootstraps, 8, "lz4");
+
+        test_mock_cluster_destroy(mcluster);
+
+#if WITH_SOCKEM
+        /* Two brokers: partitions can move to another leader */
+        mcluster = test_mock_cluster_new(2, &bootstraps);
+        do_test_leader_change(mcluster, bootstraps);
+        test_mock_cluster_destroy(mcluster);
+#endif
+
+        return 0;
+}
@@ -0,0 +1,348 @@
+/*
+ * librdkafka - Apache Kafka C library
+ *
+ * Copyright (c) 2020, Magnus Edenhill
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "test.h"
+
+
+/**
+ * @name Verify incremental fetch sessions (KIP-227) with the mock cluster:
+ *       partitions without changes are omitted from FetchRequests,
+ *       end of partition is still signalled for partitions omitted from
+ *       FetchResponses, and consumption survives session eviction.
+ */
+
+
+#define _TOPIC_CNT 4
+#define _PART_CNT  4   /* Mock cluster default partition count */
+
+
+static mtx_t stats_lock;
+static char *last_stats;
+
+static int stats_cb (rd_kafka_t *rk, char *json, size_t json_len,
+                     void *opaque) {
+        mtx_lock(&stats_lock);
+        if (last_stats)
+                free(last_stats);
+        last_stats = json;
+        mtx_unlock(&stats_lock);
+        return 1; /* Keep json */
+}
+
+struct fetch_session_stats {
+        int64_t full;
+        int64_t incremental;
+        int64_t errors;
+        int64_t omitted;
+        int64_t bytes_saved;
+};
+
+/**
+ * @brief Sum up the fetch_session stats of all brokers in the last
+ *        emitted statistics.
+ */
+static void get_fetch_session_stats (rd_kafka_t *c,
+                                     struct fetch_session_stats *fss) {
+        const char *s;
+        int64_t full, incremental, errors, omitted, bytes_saved;
+
+        /* Wait for the next stats emission */
+        mtx_lock(&stats_lock);
+        if (last_stats) {
+                free(last_stats);
+                last_stats = NULL;
+        }
+        mtx_unlock(&stats_lock);
+
+        while (1) {
+                rd_kafka_message_t *rkm = rd_kafka_consumer_poll(c, 100);
+                TEST_ASSERT(!rkm, "Did not expect message");
+                mtx_lock(&stats_lock);
+                if (last_stats)
+                        break;
+                mtx_unlock(&stats_lock);
+        }
+
+        memset(fss, 0, sizeof(*fss));
+        s = last_stats;
+        while ((s = strstr(s, "\"fetch_session\": {"))) {
+                s += strlen("\"fetch_session\": {");
+                TEST_ASSERT(sscanf(s,
+                                   " \"full\":%"SCNd64", "
+                                   "\"incremental\":%"SCNd64", "
+                                   "\"errors\":%"SCNd64", "
+                                   "\"omitted_partitions\":%"SCNd64", "
+                                   "\"bytes_saved\":%"SCNd64,
+                                   &full, &incremental, &errors,
+                                   &omitted, &bytes_saved) == 5,
+                            "Failed to parse fetch_session stats: %.*s",
+                            100, s);
+                fss->full += full;
+                fss->incremental += incremental;
+                fss->errors += errors;
+                fss->omitted += omitted;
+                fss->bytes_saved += bytes_saved;
+        }
+        mtx_unlock(&stats_lock);
+
+        TEST_SAY("fetch_session stats: full %"PRId64", "
+                 "incremental %"PRId64", errors %"PRId64", "
+                 "omitted %"PRId64", bytes_saved %"PRId64"\n",
+                 fss->full, fss->incremental, fss->errors,
+                 fss->omitted, fss->bytes_saved);
+}
+
+
+/**
+ * @brief Consume until \p exp_cnt messages have been seen and
+ *        \p exp_eof_cnt partitions are at EOF, i.e., their last event was
+ *        a partition EOF, then verify that no more messages or EOFs follow.
+ *
+ * A partition may reach EOF while messages are still being produced to it,
+ * such intermediate EOFs are ignored.
+ */
+static void consume_msgs_and_eofs (const char *what, rd_kafka_t *c,
+                                   int exp_eof_cnt, int exp_cnt,
+                                   test_msgver_t *mv) {
+        struct {
+                const rd_kafka_topic_t *rkt;
+                int32_t partition;
+                rd_bool_t at_eof;
+        } parts[_TOPIC_CNT * _PART_CNT];
+        int part_cnt = 0;
+        int eof_cnt = 0, cnt = 0;
+        rd_kafka_message_t *rkm;
+        test_timing_t t_cons;
+
+        TEST_SAY("%s: consume %d messages and %d EOFs\n",
+                 what, exp_cnt, exp_eof_cnt);
+
+        TIMING_START(&t_cons, "%s", what);
+        while (eof_cnt < exp_eof_cnt || cnt < exp_cnt) {
+                int i;
+
+                rkm = rd_kafka_consumer_poll(c, tmout_multip(10*1000));
+                TEST_ASSERT(rkm, "%s: consumer_poll() timeout "
+                            "(%d/%d EOFs, %d/%d msgs)",
+                            what, eof_cnt, exp_eof_cnt, cnt, exp_cnt);
+
+                if (rkm->err &&
+                    rkm->err != RD_KAFKA_RESP_ERR__PARTITION_EOF)
+                        TEST_FAIL("%s: consume error: %s",
+                                  what, rd_kafka_message_errstr(rkm));
+
+                for (i = 0 ; i < part_cnt ; i++)
+                        if (parts[i].rkt == rkm->rkt &&
+                            parts[i].partition == rkm->partition)
+                                break;
+                if (i == part_cnt) {
+                        TEST_ASSERT(part_cnt < (int)RD_ARRAYSIZE(parts),
+                                    "%s: too many partitions", what);
+                        parts[i].rkt = rkm->rkt;
+                        parts[i].partition = rkm->partition;
+                        parts[i].at_eof = rd_false;
+                        part_cnt++;
+                }
+
+                if (rkm->err == RD_KAFKA_RESP_ERR__PARTITION_EOF) {
+                        if (!parts[i].at_eof)
+                                eof_cnt++;
+                        parts[i].at_eof = rd_true;
+                } else {
+                        if (parts[i].at_eof)
+                                eof_cnt--;
+                        parts[i].at_eof = rd_false;
+                        if (test_msgver_add_msg(mv, rkm))
+                                cnt++;
+                }
+
+                rd_kafka_message_destroy(rkm);
+        }
+        TIMING_STOP(&t_cons);
+
+        /* Nothing more is expected */
+        rkm = rd_kafka_consumer_poll(c, 500);
+        TEST_ASSERT(!rkm, "%s: unexpected %s after %d msgs and %d EOFs",
+                    what, rkm->err ? rd_kafka_err2name(rkm->err) : "message",
+                    cnt, eof_cnt);
+}
+
+
+static int is_fatal_cb (rd_kafka_t *rk, rd_kafka_resp_err_t err,
+                        const char *reason) {
+        /* Closing the consumer takes down the group coordinator's
+         * logical broker connection, which raises ALL_BROKERS_DOWN
+         * with a single broker cluster. */
+        if (err == RD_KAFKA_RESP_ERR__ALL_BROKERS_DOWN)
+                return 0;
+        return 1;
+}
+
+
+static void do_test_fetch_sessions (rd_bool_t enable, rd_bool_t evict) {
+        const char *bootstraps;
+        rd_kafka_mock_cluster_t *mcluster;
+        char *topics[_TOPIC_CNT];
+        rd_kafka_conf_t *conf;
+        rd_kafka_t *c;
+        rd_kafka_topic_partition_list_t *parts;
+        struct fetch_session_stats fss;
+        test_msgver_t mv;
+        uint64_t testid;
+        const int msgcnt = 100;
+        const size_t msgsize = 1000;
+        int i;
+
+        TEST_SAY(_C_MAG "[ Test fetch sessions %s%s ]\n",
+                 enable ? "enabled" : "disabled",
+                 evict ? " with session eviction" : "");
+
+        mcluster = test_mock_cluster_new(1, &bootstraps);
+        testid = test_id_generate();
+
+        /* Seed partition 0 of each topic with messages,
+         * leaving the other partitions empty. */
+        for (i = 0 ; i < _TOPIC_CNT ; i++) {
+                topics[i] = rd_strdup(test_mk_topic_name("0109_fetch_sess",
+                                                         1));
+                test_produce_msgs_easy_v(topics[i], 0, testid,
+                                         i * msgcnt, msgcnt, msgsize,
+                                         "bootstrap.servers", bootstraps,
+                                         "batch.num.messages", "10",
+                                         NULL);
+        }
+
+        test_conf_init(&conf, NULL, 60);
+        test_conf_set(conf, "bootstrap.servers", bootstraps);
+        test_conf_set(conf, "enable.partition.eof", "true");
+        test_conf_set(conf, "enable.fetch.sessions",
+                      enable ? "true" : "false");
+        test_conf_set(conf, "fetch.wait.max.ms", "100");
+        /* Make sure each partition takes several fetches */
+        test_conf_set(conf, "fetch.message.max.bytes", "5000");
+        test_conf_set(conf, "statistics.interval.ms", "100");
+        rd_kafka_conf_set_stats_cb(conf, stats_cb);
+
+        c = test_create_consumer(topics[0], NULL, conf, NULL);
+
+        parts = rd_kafka_topic_partition_list_new(_TOPIC_CNT * _PART_CNT);
+        for (i = 0 ; i < _TOPIC_CNT * _PART_CNT ; i++)
+                rd_kafka_topic_partition_list_add(
+                        parts, topics[i / _PART_CNT], i % _PART_CNT)->offset =
+                        RD_KAFKA_OFFSET_BEGINNING;
+        test_consumer_assign("CONSUME", c, parts);
+        rd_kafka_topic_partition_list_destroy(parts);
+
+        /* All partitions reach EOF: the partitions with messages are
+         * typically omitted from the last FetchResponse. */
+        test_msgver_init(&mv, testid);
+        consume_msgs_and_eofs("CONSUME", c, _TOPIC_CNT * _PART_CNT,
+                              _TOPIC_CNT * msgcnt, &mv);
+
+        if (evict)
+                rd_kafka_mock_push_request_errors(
+                        mcluster, 1/*FetchRequest*/, 2,
+                        RD_KAFKA_RESP_ERR_FETCH_SESSION_ID_NOT_FOUND,
+                        RD_KAFKA_RESP_ERR_INVALID_FETCH_SESSION_EPOCH);
+
+        /* Produce more messages to the last partition of the last topic,
+         * only that partition will reach EOF again. */
+        test_produce_msgs_easy_v(topics[_TOPIC_CNT-1], _PART_CNT-1, testid,
+                                 _TOPIC_CNT * msgcnt, msgcnt, msgsize,
+                                 "bootstrap.servers", bootstraps,
+                                 "batch.num.messages", "10",
+                                 NULL);
+
+        consume_msgs_and_eofs("CONSUME.MORE", c, 1, msgcnt, &mv);
+
+        test_msgver_verify("CONSUME", &mv,
+                           TEST_MSGVER_ORDER|TEST_MSGVER_DUP, 0,
+                           (_TOPIC_CNT+1) * msgcnt);
+        test_msgver_clear(&mv);
+
+        get_fetch_session_stats(c, &fss);
+
+        if (enable) {
+                TEST_ASSERT(fss.full > 0,
+                            "Expected full fetch requests");
+                TEST_ASSERT(fss.incremental > fss.full,
+                            "Expected mostly incremental fetch requests, "
+                            "not %"PRId64" incremental and %"PRId64" full",
+                            fss.incremental, fss.full);
+                TEST_ASSERT(fss.omitted > 0 && fss.bytes_saved > 0,
+                            "Expected partitions to be omitted from "
+                            "fetch requests");
+                if (evict)
+                        TEST_ASSERT(fss.errors >= 2 && fss.full >= 3,
+                                    "Expected session errors and "
+                                    "full fetches to recover");
+                else
+                        TEST_ASSERT(fss.errors == 0,
+                                    "Expected no session errors, not %"PRId64,
+                                    fss.errors);
+        } else {
+                TEST_ASSERT(fss.full == 0 && fss.incremental == 0 &&
+                            fss.omitted == 0,
+                            "Expected no fetch sessions when disabled");
+        }
+
+        test_curr->is_fatal_cb = is_fatal_cb;
+        test_consumer_close(c);
+        rd_kafka_destroy(c);
+        test_curr->is_fatal_cb = NULL;
+
+        mtx_lock(&stats_lock);
+        if (last_stats) {
+                free(last_stats);
+                last_stats = NULL;
+        }
+        mtx_unlock(&stats_lock);
+
+        for (i = 0 ; i < _TOPIC_CNT ; i++)
+                rd_free(topics[i]);
+
+        test_mock_cluster_destroy(mcluster);
+
+        TEST_SAY(_C_GRN "[ Test fetch sessions %s%s: PASS ]\n",
+                 enable ? "enabled" : "disabled",
+                 evict ? " with session eviction" : "");
+}
+
+
+int main_0109_fetch_sessions (int argc, char **argv) {
+
+        mtx_init(&stats_lock, mtx_plain);
+
+        do_test_fetch_sessions(rd_true, rd_false);
+        do_test_fetch_sessions(rd_true, rd_true);
+        do_test_fetch_sessions(rd_false, rd_false);
+
+        mtx_destroy(&stats_lock);
+
+        return 0;
+}
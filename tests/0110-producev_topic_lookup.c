@@ -0,0 +1,144 @@
+/*
+ * librdkafka - Apache Kafka C library
+ *
+ * Copyright (c) 2020, Magnus Edenhill
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "test.h"
+
+
+/**
+ * @name Benchmark rd_kafka_producev(RD_KAFKA_V_TOPIC(..)) throughput
+ *       versus the number of topics known to the producer instance.
+ *
+ * Topic lookups by name go through the topic hash index and the
+ * per-thread last-topic cache, so the per-message cost should stay
+ * roughly constant as the topic count grows.
+ *
+ * No broker is configured: messages are enqueued on the topics'
+ * unassigned partitions and purged before the producer is destroyed.
+ */
+
+
+/**
+ * @returns the producev() rate in messages per second.
+ */
+static double produce_topics (rd_kafka_t *rk, char **topics, int topic_cnt,
+                              int msgcnt, int burst, const char *what) {
+        static const char payload[16] = "producev";
+        test_timing_t t_produce;
+        int64_t dur;
+        int i;
+
+        TIMING_START(&t_produce, "%d topics: %s", topic_cnt, what);
+        for (i = 0 ; i < msgcnt ; i++) {
+                rd_kafka_resp_err_t err;
+
+                err = rd_kafka_producev(
+                        rk,
+                        RD_KAFKA_V_TOPIC(topics[(i / burst) % topic_cnt]),
+                        RD_KAFKA_V_VALUE((void *)payload, sizeof(payload)),
+                        RD_KAFKA_V_END);
+                TEST_ASSERT(!err, "producev() #%d failed: %s",
+                            i, rd_kafka_err2str(err));
+        }
+        TIMING_STOP(&t_produce);
+
+        dur = RD_MAX(TIMING_DURATION(&t_produce), 1);
+
+        return (double)msgcnt * 1000000.0 / (double)dur;
+}
+
+
+static void do_test_producev_topic_lookup (int topic_cnt, int msgcnt) {
+        rd_kafka_conf_t *conf;
+        rd_kafka_t *rk;
+        char **topics;
+        double rr_rate, burst_rate;
+        int i;
+
+        TEST_SAY(_C_MAG "[ Test producev() with %d topics ]\n", topic_cnt);
+
+        test_conf_init(&conf, NULL, 60);
+        test_conf_set(conf, "queue.buffering.max.messages", "10000000");
+        test_conf_set(conf, "queue.buffering.max.kbytes", "2097151");
+        rk = test_create_handle(RD_KAFKA_PRODUCER, conf);
+
+        topics = malloc(sizeof(*topics) * topic_cnt);
+        for (i = 0 ; i < topic_cnt ; i++) {
+                char name[64];
+                rd_snprintf(name, sizeof(name), "0110_topic_lookup_%d", i);
+                topics[i] = rd_strdup(name);
+        }
+
+        /* Create the topics */
+        produce_topics(rk, topics, topic_cnt, topic_cnt, 1, "create");
+
+        /* Verify that every topic is found by name. */
+        for (i = 0 ; i < topic_cnt ; i++) {
+                rd_kafka_topic_t *rkt = rd_kafka_topic_new(rk, topics[i],
+                                                           NULL);
+                TEST_ASSERT(rkt, "topic_new(%s) failed", topics[i]);
+                TEST_ASSERT(!strcmp(rd_kafka_topic_name(rkt), topics[i]),
+                            "Expected topic %s, not %s",
+                            topics[i], rd_kafka_topic_name(rkt));
+                rd_kafka_topic_destroy(rkt);
+        }
+
+        /* Round-robin over all topics: every lookup misses the
+         * per-thread last-topic cache. */
+        rr_rate = produce_topics(rk, topics, topic_cnt, msgcnt, 1,
+                                 "round-robin");
+
+        /* Bursts of messages to the same topic: lookups hit the
+         * per-thread last-topic cache. */
+        burst_rate = produce_topics(rk, topics, topic_cnt, msgcnt, 100,
+                                    "bursts of 100");
+
+        TEST_SAY("%d topics: producev() round-robin %.0f msgs/s, "
+                 "bursts %.0f msgs/s\n", topic_cnt, rr_rate, burst_rate);
+
+        rd_kafka_purge(rk, RD_KAFKA_PURGE_F_QUEUE);
+        rd_kafka_destroy(rk);
+
+        for (i = 0 ; i < topic_cnt ; i++)
+                rd_free(topics[i]);
+        free(topics);
+
+        TEST_SAY(_C_GRN "[ Test producev() with %d topics: PASS ]\n",
+                 topic_cnt);
+}
+
+
+int main_0110_producev_topic_lookup (int argc, char **argv) {
+        const int msgcnt = test_quick ? 20000 : 200000;
+
+        do_test_producev_topic_lookup(1, msgcnt);
+        do_test_producev_topic_lookup(100, msgcnt);
+        do_test_producev_topic_lookup(1000, msgcnt);
+        do_test_producev_topic_lookup(5000, msgcnt);
+
+        return 0;
+}
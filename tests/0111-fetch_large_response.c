@@ -0,0 +1,294 @@
+/*
+ * librdkafka - Apache Kafka C library
+ *
+ * Copyright (c) 2020, Magnus Edenhill
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "test.h"
+
+
+/**
+ * @name Consume FetchResponses larger than the receive buffer pool's
+ *       segment size, which are received into multiple pool segments,
+ *       with MessageSets (and compressed payloads) straddling the
+ *       segment boundaries.
+ */
+
+
+#define _PART_CNT  4   /* Mock cluster default partition count */
+
+
+static void dr_msg_cb (rd_kafka_t *rk, const rd_kafka_message_t *rkmessage,
+                       void *opaque) {
+        TEST_ASSERT(!rkmessage->err, "Message delivery failed: %s",
+                    rd_kafka_err2str(rkmessage->err));
+}
+
+
+static mtx_t stats_lock;
+static char *last_stats;
+
+static int stats_cb (rd_kafka_t *rk, char *json, size_t json_len,
+                     void *opaque) {
+        mtx_lock(&stats_lock);
+        if (last_stats)
+                free(last_stats);
+        last_stats = json;
+        mtx_unlock(&stats_lock);
+        return 1; /* Keep json */
+}
+
+
+/**
+ * @brief Sum up the rxpool segment allocations and reuses of all brokers
+ *        in the next emitted statistics.
+ */
+static int64_t get_rxpool_segments (rd_kafka_t *c) {
+        const char *s;
+        int64_t alloc, reuse, tot = 0;
+
+        mtx_lock(&stats_lock);
+        if (last_stats) {
+                free(last_stats);
+                last_stats = NULL;
+        }
+        mtx_unlock(&stats_lock);
+
+        while (1) {
+                rd_kafka_message_t *rkm = rd_kafka_consumer_poll(c, 100);
+                TEST_ASSERT(!rkm, "Did not expect message");
+                mtx_lock(&stats_lock);
+                if (last_stats)
+                        break;
+                mtx_unlock(&stats_lock);
+        }
+
+        s = last_stats;
+        while ((s = strstr(s, "\"rxpool\": {"))) {
+                s += strlen("\"rxpool\": {");
+                TEST_ASSERT(sscanf(s,
+                                   " \"seg_size\":%*d, "
+                                   "\"alloc\":%"SCNd64", "
+                                   "\"reuse\":%"SCNd64,
+                                   &alloc, &reuse) == 2,
+                            "Failed to parse rxpool stats: %.*s", 100, s);
+                tot += alloc + reuse;
+        }
+        mtx_unlock(&stats_lock);
+
+        return tot;
+}
+
+
+/**
+ * @brief Fill \p buf with incompressible data derived from \p msgid.
+ */
+static void fill_payload (char *buf, size_t size, int msgid) {
+        uint32_t x = (uint32_t)msgid * 2654435761u + 1;
+        size_t i;
+
+        for (i = 0 ; i < size ; i++) {
+                x = x * 1103515245u + 12345u;
+                buf[i] = (char)(x >> 16);
+        }
+}
+
+
+static int is_fatal_cb (rd_kafka_t *rk, rd_kafka_resp_err_t err,
+                        const char *reason) {
+        /* Closing the consumer takes down the group coordinator's
+         * logical broker connection, which raises ALL_BROKERS_DOWN
+         * with a single broker cluster. */
+        if (err == RD_KAFKA_RESP_ERR__ALL_BROKERS_DOWN)
+                return 0;
+        return 1;
+}
+
+
+static void do_test_fetch_large_response (const char *codec,
+                                          const char *threads) {
+        const char *bootstraps;
+        rd_kafka_mock_cluster_t *mcluster;
+        const char *topic = test_mk_topic_name("0111_fetch_large", 1);
+        rd_kafka_conf_t *conf;
+        rd_kafka_t *p, *c;
+        rd_kafka_topic_partition_list_t *parts;
+        test_msgver_t mv;
+        uint64_t testid;
+        const int msgcnt = 1200;
+        const size_t msgsize = 10000;
+        char *payload, *exp_payload;
+        rd_kafka_resp_err_t err;
+        int i, cnt = 0;
+
+        TEST_SAY(_C_MAG "[ Test large FetchResponses with "
+                 "compression.codec=%s, compression.threads=%s ]\n",
+                 codec, threads);
+
+        mcluster = test_mock_cluster_new(1, &bootstraps);
+        testid = test_id_generate();
+
+        payload = malloc(msgsize);
+        exp_payload = malloc(msgsize);
+
+        test_conf_init(&conf, NULL, 60);
+        test_conf_set(conf, "bootstrap.servers", bootstraps);
+        test_conf_set(conf, "compression.codec", codec);
+        test_conf_set(conf, "linger.ms", "100");
+        rd_kafka_conf_set_dr_msg_cb(conf, dr_msg_cb);
+        p = test_create_handle(RD_KAFKA_PRODUCER, conf);
+
+        for (i = 0 ; i < msgcnt ; i++) {
+                int32_t partition = i % _PART_CNT;
+                char msgid_str[128];
+
+                test_msg_fmt(msgid_str, sizeof(msgid_str),
+                             testid, partition, i);
+                fill_payload(payload, msgsize, i);
+                err = rd_kafka_producev(
+                        p,
+                        RD_KAFKA_V_TOPIC(topic),
+                        RD_KAFKA_V_PARTITION(partition),
+                        RD_KAFKA_V_HEADER("rdk_msgid", msgid_str, -1),
+                        RD_KAFKA_V_VALUE(payload, msgsize),
+                        RD_KAFKA_V_MSGFLAGS(RD_KAFKA_MSG_F_COPY),
+                        RD_KAFKA_V_END);
+                TEST_ASSERT(!err, "producev() failed: %s",
+                            rd_kafka_err2str(err));
+        }
+        err = rd_kafka_flush(p, tmout_multip(30*1000));
+        TEST_ASSERT(!err, "flush() failed: %s", rd_kafka_err2str(err));
+        rd_kafka_destroy(p);
+
+        test_conf_init(&conf, NULL, 60);
+        test_conf_set(conf, "bootstrap.servers", bootstraps);
+        test_conf_set(conf, "compression.threads", threads);
+        /* Let each FetchResponse carry a full batch of every partition,
+         * several MiB in total. */
+        test_conf_set(conf, "max.partition.fetch.bytes", "10000000");
+        test_conf_set(conf, "fetch.max.bytes", "50000000");
+        test_conf_set(conf, "statistics.interval.ms", "100");
+        rd_kafka_conf_set_stats_cb(conf, stats_cb);
+
+        c = test_create_consumer(topic, NULL, conf, NULL);
+
+        parts = rd_kafka_topic_partition_list_new(_PART_CNT);
+        for (i = 0 ; i < _PART_CNT ; i++)
+                rd_kafka_topic_partition_list_add(parts, topic, i)->offset =
+                        RD_KAFKA_OFFSET_BEGINNING;
+        test_consumer_assign("CONSUME", c, parts);
+        rd_kafka_topic_partition_list_destroy(parts);
+
+        test_msgver_init(&mv, testid);
+        mv.msgid_hdr = "rdk_msgid";
+        while (cnt < msgcnt) {
+                rd_kafka_message_t *rkm;
+                rd_kafka_headers_t *hdrs;
+                const void *val;
+                size_t valsize;
+                int msgid;
+
+                rkm = rd_kafka_consumer_poll(c, tmout_multip(10*1000));
+                TEST_ASSERT(rkm, "consumer_poll() timeout (%d/%d msgs)",
+                            cnt, msgcnt);
+                if (rkm->err) {
+                        TEST_ASSERT(rkm->err ==
+                                    RD_KAFKA_RESP_ERR__PARTITION_EOF,
+                                    "consume error: %s",
+                                    rd_kafka_message_errstr(rkm));
+                        rd_kafka_message_destroy(rkm);
+                        continue;
+                }
+
+                TEST_ASSERT(!rd_kafka_message_headers(rkm, &hdrs) &&
+                            !rd_kafka_header_get_last(hdrs, "rdk_msgid",
+                                                      &val, &valsize) &&
+                            sscanf(val, "%*[^,], %*[^,], msg=%d",
+                                   &msgid) == 1,
+                            "Failed to get msgid of message at offset "
+                            "%"PRId64, rkm->offset);
+                fill_payload(exp_payload, msgsize, msgid);
+                TEST_ASSERT(rkm->len == msgsize &&
+                            !memcmp(rkm->payload, exp_payload, msgsize),
+                            "Message %d payload mismatch (%"PRIusz" bytes)",
+                            msgid, rkm->len);
+
+                if (test_msgver_add_msg(&mv, rkm))
+                        cnt++;
+                rd_kafka_message_destroy(rkm);
+        }
+
+        test_msgver_verify("CONSUME", &mv,
+                           TEST_MSGVER_ORDER|TEST_MSGVER_DUP, 0, msgcnt);
+        test_msgver_clear(&mv);
+
+        TEST_ASSERT(get_rxpool_segments(c) > 0,
+                    "Expected responses to be received into "
+                    "pool segments");
+
+        test_curr->is_fatal_cb = is_fatal_cb;
+        test_consumer_close(c);
+        rd_kafka_destroy(c);
+        test_curr->is_fatal_cb = NULL;
+
+        mtx_lock(&stats_lock);
+        if (last_stats) {
+                free(last_stats);
+                last_stats = NULL;
+        }
+        mtx_unlock(&stats_lock);
+
+        free(payload);
+        free(exp_payload);
+
+        test_mock_cluster_destroy(mcluster);
+
+        TEST_SAY(_C_GRN "[ Test large FetchResponses with "
+                 "compression.codec=%s, compression.threads=%s: PASS ]\n",
+                 codec, threads);
+}
+
+
+int main_0111_fetch_large_response (int argc, char **argv) {
+
+        if (test_needs_auth()) {
+                TEST_SKIP("Mock cluster does not support SSL/SASL\n");
+                return 0;
+        }
+
+        mtx_init(&stats_lock, mtx_plain);
+
+        do_test_fetch_large_response("none", "0");
+        do_test_fetch_large_response("lz4", "0");
+        do_test_fetch_large_response("lz4", "2");
+        if (test_check_builtin("gzip")) {
+                do_test_fetch_large_response("gzip", "0");
+                do_test_fetch_large_response("gzip", "2");
+        }
+
+        mtx_destroy(&stats_lock);
+
+        return 0;
+}
@@ -0,0 +1,364 @@
+/*
+ * librdkafka - Apache Kafka C library
+ *
+ * Copyright (c) 2020, Magnus Edenhill
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "test.h"
+
+
+/**
+ * @name Verify that the consumer's fetch memory budget
+ *       (queued.max.total.kbytes) limits the amount of fetched messages
+ *       held across all partitions, per client instance and shared by
+ *       the instances in the process.
+ */
+
+
+#define _TOPIC_CNT 5
+#define _PART_CNT  4   /* Mock cluster default partition count */
+#define _MSGCNT    200 /* Per partition */
+#define _MSGSIZE   1000
+#define _BUDGET_KB 200
+
+
+struct fetch_budget_stats {
+        int64_t max;
+        int64_t used;
+        int64_t shared_used;
+        int partitions;
+        int64_t held;
+};
+
+static mtx_t stats_lock;
+static struct fetch_budget_stats last_fbs[2];
+static int stats_cnt[2];
+
+static int stats_cb (rd_kafka_t *rk, char *json, size_t json_len,
+                     void *opaque) {
+        int idx = (int)(intptr_t)opaque;
+        struct fetch_budget_stats fbs;
+        const char *s;
+
+        s = strstr(json, "\"fetch_budget\": {");
+        TEST_ASSERT(s, "No fetch_budget in stats");
+        s += strlen("\"fetch_budget\": {");
+        TEST_ASSERT(sscanf(s,
+                           " \"max\": %"SCNd64", "
+                           "\"used\": %"SCNd64", "
+                           "\"shared_used\": %"SCNd64", "
+                           "\"partitions\": %d, "
+                           "\"held\": %"SCNd64,
+                           &fbs.max, &fbs.used, &fbs.shared_used,
+                           &fbs.partitions, &fbs.held) == 5,
+                    "Failed to parse fetch_budget stats: %.*s", 100, s);
+
+        mtx_lock(&stats_lock);
+        last_fbs[idx] = fbs;
+        stats_cnt[idx]++;
+        mtx_unlock(&stats_lock);
+
+        return 0;
+}
+
+
+/**
+ * @brief Serve \p rk's main queue (but not its consumer queue) until the
+ *        next statistics have been emitted.
+ */
+static struct fetch_budget_stats wait_stats (rd_kafka_t *rk, int idx) {
+        struct fetch_budget_stats fbs;
+        int cnt;
+
+        mtx_lock(&stats_lock);
+        cnt = stats_cnt[idx];
+        mtx_unlock(&stats_lock);
+
+        while (1) {
+                rd_kafka_poll(rk, 100);
+                mtx_lock(&stats_lock);
+                if (stats_cnt[idx] > cnt) {
+                        fbs = last_fbs[idx];
+                        mtx_unlock(&stats_lock);
+                        break;
+                }
+                mtx_unlock(&stats_lock);
+        }
+
+        TEST_SAY("%s: fetch_budget: max %"PRId64", used %"PRId64", "
+                 "shared_used %"PRId64", %d partitions, held %"PRId64"\n",
+                 rd_kafka_name(rk), fbs.max, fbs.used, fbs.shared_used,
+                 fbs.partitions, fbs.held);
+
+        return fbs;
+}
+
+
+static void produce_topics (const char *bootstraps, char **topics,
+                            uint64_t testid) {
+        rd_kafka_conf_t *conf;
+        rd_kafka_t *p;
+        int i, partition;
+
+        test_conf_init(&conf, NULL, 60);
+        test_conf_set(conf, "bootstrap.servers", bootstraps);
+        test_conf_set(conf, "batch.num.messages", "10");
+        rd_kafka_conf_set_dr_msg_cb(conf, test_dr_msg_cb);
+        p = test_create_handle(RD_KAFKA_PRODUCER, conf);
+
+        for (i = 0 ; i < _TOPIC_CNT ; i++) {
+                rd_kafka_topic_t *rkt = test_create_producer_topic(
+                        p, topics[i], NULL);
+
+                for (partition = 0 ; partition < _PART_CNT ; partition++)
+                        test_produce_msgs(p, rkt, testid, partition,
+                                          ((i * _PART_CNT) + partition) *
+                                          _MSGCNT,
+                                          _MSGCNT, NULL, _MSGSIZE);
+
+                rd_kafka_topic_destroy(rkt);
+        }
+
+        rd_kafka_destroy(p);
+}
+
+
+static rd_kafka_t *create_consumer (const char *bootstraps,
+                                    char **topics, const char *scope,
+                                    int idx) {
+        rd_kafka_conf_t *conf;
+        rd_kafka_t *c;
+        rd_kafka_topic_partition_list_t *parts;
+        char errstr[512];
+        int i;
+
+        test_conf_init(&conf, NULL, 60);
+        test_conf_set(conf, "bootstrap.servers", bootstraps);
+        test_conf_set(conf, "group.id", topics[0]);
+        test_conf_set(conf, "queued.max.total.kbytes",
+                      tsprintf("%d", _BUDGET_KB));
+        test_conf_set(conf, "queued.max.total.kbytes.scope", scope);
+        test_conf_set(conf, "fetch.wait.max.ms", "100");
+        test_conf_set(conf, "statistics.interval.ms", "100");
+        rd_kafka_conf_set_stats_cb(conf, stats_cb);
+        rd_kafka_conf_set_opaque(conf, (void *)(intptr_t)idx);
+
+        /* The main queue is not forwarded to the consumer queue so that
+         * statistics can be served without consuming any messages. */
+        c = rd_kafka_new(RD_KAFKA_CONSUMER, conf, errstr, sizeof(errstr));
+        TEST_ASSERT(c, "Failed to create consumer: %s", errstr);
+
+        parts = rd_kafka_topic_partition_list_new(_TOPIC_CNT * _PART_CNT);
+        for (i = 0 ; i < _TOPIC_CNT * _PART_CNT ; i++)
+                rd_kafka_topic_partition_list_add(
+                        parts, topics[i / _PART_CNT], i % _PART_CNT)->offset =
+                        RD_KAFKA_OFFSET_BEGINNING;
+        test_consumer_assign("ASSIGN", c, parts);
+        rd_kafka_topic_partition_list_destroy(parts);
+
+        return c;
+}
+
+
+/**
+ * @brief Verify that the budget is reached and held, but not exceeded
+ *        by more than a fetch response.
+ */
+static void verify_budget_held (rd_kafka_t *c, int idx,
+                                rd_bool_t shared) {
+        struct fetch_budget_stats fbs;
+        const int64_t max = _BUDGET_KB * 1000;
+        /* The budget may be overshot by a fetch response of up to one
+         * MessageSet (10 messages) for each partition. */
+        const int64_t overshoot = _TOPIC_CNT * _PART_CNT * 10 *
+                (_MSGSIZE + 100);
+        int64_t prev_used = -1;
+        int i;
+
+        for (i = 0 ; i < 100 ; i++) {
+                fbs = wait_stats(c, idx);
+                TEST_ASSERT(fbs.max == max, "expected max %"PRId64", "
+                            "not %"PRId64, max, fbs.max);
+                TEST_ASSERT(fbs.shared_used <= max + (shared ? 2 : 1) *
+                            overshoot,
+                            "budget exceeded: %"PRId64" > %"PRId64,
+                            fbs.shared_used, max);
+                TEST_ASSERT(shared ? fbs.shared_used >= fbs.used :
+                            fbs.shared_used == fbs.used,
+                            "unexpected shared_used %"PRId64" vs "
+                            "used %"PRId64, fbs.shared_used, fbs.used);
+
+                /* Wait for fetching to settle */
+                if (fbs.partitions == _TOPIC_CNT * _PART_CNT &&
+                    fbs.shared_used >= max && fbs.used == prev_used)
+                        break;
+                prev_used = fbs.used;
+        }
+
+        TEST_ASSERT(fbs.shared_used >= max,
+                    "expected the budget to be used up, not %"PRId64,
+                    fbs.shared_used);
+                TEST_ASSERT(fbs.partitions == _TOPIC_CNT * _PART_CNT,
+                            "expected %d partitions, not %d",
+                            _TOPIC_CNT * _PART_CNT, fbs.partitions);
+        TEST_ASSERT(fbs.used < _TOPIC_CNT * _PART_CNT * _MSGCNT * _MSGSIZE,
+                    "expected fetching to be held back, "
+                    "but all messages were fetched");
+}
+
+
+/**
+ * @brief Consume all messages from the \p cnt consumers, in turns since
+ *        with a shared budget one consumer's fetching may depend on
+ *        the others being consumed. This requires fetching to resume as
+ *        the budget is freed up. Then verify the budget is released.
+ */
+static void consume_all (rd_kafka_t **c, int cnt, uint64_t testid) {
+        test_msgver_t mv[2];
+        const int exp_cnt = _TOPIC_CNT * _PART_CNT * _MSGCNT;
+        int msgcnt[2] = { 0, 0 };
+        test_timing_t t_cons;
+        int j, remains = cnt;
+
+        for (j = 0 ; j < cnt ; j++)
+                test_msgver_init(&mv[j], testid);
+
+        TIMING_START(&t_cons, "CONSUME");
+        while (remains > 0) {
+                TEST_ASSERT(TIMING_DURATION(&t_cons) <
+                            tmout_multip(60*1000) * 1000,
+                            "Timed out consuming: %d+%d/%d messages",
+                            msgcnt[0], msgcnt[1], exp_cnt);
+
+                for (j = 0 ; j < cnt ; j++) {
+                        rd_kafka_message_t *rkm;
+
+                        if (msgcnt[j] == exp_cnt)
+                                continue;
+
+                        rkm = rd_kafka_consumer_poll(c[j], 10);
+                        if (!rkm)
+                                continue;
+
+                        if (rkm->err)
+                                TEST_ASSERT(rkm->err ==
+                                            RD_KAFKA_RESP_ERR__PARTITION_EOF,
+                                            "consume error: %s",
+                                            rd_kafka_message_errstr(rkm));
+                        else if (test_msgver_add_msg(&mv[j], rkm) &&
+                                 ++msgcnt[j] == exp_cnt)
+                                remains--;
+
+                        rd_kafka_message_destroy(rkm);
+                }
+        }
+        TIMING_STOP(&t_cons);
+
+        for (j = 0 ; j < cnt ; j++) {
+                struct fetch_budget_stats fbs;
+                int i;
+
+                test_msgver_verify("CONSUME", &mv[j],
+                                   TEST_MSGVER_ORDER|TEST_MSGVER_DUP, 0,
+                                   exp_cnt);
+                test_msgver_clear(&mv[j]);
+
+                /* Statistics emitted before the last messages were
+                 * destroyed may still be queued. */
+                for (i = 0 ; i < 10 ; i++) {
+                        fbs = wait_stats(c[j], j);
+                        if (fbs.used == 0)
+                                break;
+                }
+                TEST_ASSERT(fbs.used == 0,
+                            "expected budget to be released, "
+                            "%"PRId64" used", fbs.used);
+                TEST_ASSERT(fbs.held > 0,
+                            "expected fetching to have been held");
+        }
+}
+
+
+static void do_test_fetch_budget (rd_bool_t shared) {
+        const char *bootstraps;
+        rd_kafka_mock_cluster_t *mcluster;
+        char *topics[2][_TOPIC_CNT];
+        rd_kafka_t *c[2];
+        uint64_t testid;
+        int cnt = shared ? 2 : 1;
+        int i, j;
+
+        TEST_SAY(_C_MAG "[ Test fetch memory budget with %s scope ]\n",
+                 shared ? "process" : "client");
+
+        mcluster = test_mock_cluster_new(1, &bootstraps);
+        testid = test_id_generate();
+
+        for (j = 0 ; j < cnt ; j++) {
+                for (i = 0 ; i < _TOPIC_CNT ; i++)
+                        topics[j][i] = rd_strdup(
+                                test_mk_topic_name("0112_fetch_budget", 1));
+                produce_topics(bootstraps, topics[j], testid);
+        }
+
+        for (j = 0 ; j < cnt ; j++)
+                c[j] = create_consumer(bootstraps, topics[j],
+                                       shared ? "process" : "client", j);
+
+        for (j = 0 ; j < cnt ; j++)
+                verify_budget_held(c[j], j, shared);
+
+        consume_all(c, cnt, testid);
+
+        for (j = 0 ; j < cnt ; j++) {
+                test_consumer_close(c[j]);
+                rd_kafka_destroy(c[j]);
+                for (i = 0 ; i < _TOPIC_CNT ; i++)
+                        rd_free(topics[j][i]);
+        }
+
+        test_mock_cluster_destroy(mcluster);
+
+        TEST_SAY(_C_GRN "[ Test fetch memory budget with %s scope: PASS ]\n",
+                 shared ? "process" : "client");
+}
+
+
+int main_0112_fetch_memory_budget (int argc, char **argv) {
+
+        if (test_needs_auth()) {
+                TEST_SKIP("Mock cluster does not support SSL/SASL\n");
+                return 0;
+        }
+
+        mtx_init(&stats_lock, mtx_plain);
+
+        do_test_fetch_budget(rd_false);
+        do_test_fetch_budget(rd_true);
+
+        mtx_destroy(&stats_lock);
+
+        return 0;
+}
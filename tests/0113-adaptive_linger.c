@@ -0,0 +1,313 @@
+/*
+ * librdkafka - Apache Kafka C library
+ *
+ * Copyright (c) 2020, Magnus Edenhill
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "test.h"
+
+
+/**
+ * @name Verify adaptive linger (linger.adaptive.target.ms):
+ *       messages produced at a low rate are sent without lingering
+ *       for linger.ms, while a high rate results in a non-zero linger
+ *       time within the latency target, as reported in the statistics.
+ */
+
+
+#define _LINGER_MS 1000
+#define _TARGET_MS 100
+
+
+static int dr_cnt;
+static int dr_fails;
+static rd_ts_t dr_max_latency;
+
+/**
+ * @returns a msg_opaque holding the time the message is produced,
+ *          freed by dr_msg_cb().
+ */
+static rd_ts_t *produce_ts_new (void) {
+        rd_ts_t *ts = malloc(sizeof(*ts));
+
+        *ts = test_clock();
+        return ts;
+}
+
+/**
+ * @brief The msg_opaque points to the time the message was produced.
+ */
+static void dr_msg_cb (rd_kafka_t *rk, const rd_kafka_message_t *rkmessage,
+                       void *opaque) {
+        rd_ts_t *ts = rkmessage->_private;
+        rd_ts_t latency = test_clock() - *ts;
+
+        free(ts);
+
+        if (rkmessage->err && dr_fails++ == 0)
+                TEST_SAY("Delivery failed: %s\n",
+                         rd_kafka_err2str(rkmessage->err));
+        if (latency > dr_max_latency)
+                dr_max_latency = latency;
+        dr_cnt++;
+}
+
+
+static int64_t stats_linger_us;
+static int stats_cnt;
+
+/**
+ * @brief Extract linger_us of partition 0 from the statistics.
+ */
+static int stats_cb (rd_kafka_t *rk, char *json, size_t json_len,
+                     void *opaque) {
+        const char *s;
+        int64_t linger_us;
+
+        s = strstr(json, "\"partition\":0,");
+        if (!s)
+                return 0; /* Partition not yet known */
+
+        s = strstr(s, "\"linger_us\": ");
+        TEST_ASSERT(s, "No linger_us in partition stats");
+        TEST_ASSERT(sscanf(s, "\"linger_us\": %"SCNd64, &linger_us) == 1,
+                    "Failed to parse linger_us: %.*s", 40, s);
+
+        stats_linger_us = linger_us;
+        stats_cnt++;
+
+        return 0;
+}
+
+
+static rd_kafka_t *create_producer (const char *bootstraps,
+                                    rd_bool_t adaptive) {
+        rd_kafka_conf_t *conf;
+
+        test_conf_init(&conf, NULL, 60);
+        test_conf_set(conf, "bootstrap.servers", bootstraps);
+        test_conf_set(conf, "linger.ms", tsprintf("%d", _LINGER_MS));
+        if (adaptive)
+                test_conf_set(conf, "linger.adaptive.target.ms",
+                              tsprintf("%d", _TARGET_MS));
+        test_conf_set(conf, "statistics.interval.ms", "100");
+        rd_kafka_conf_set_dr_msg_cb(conf, dr_msg_cb);
+        rd_kafka_conf_set_stats_cb(conf, stats_cb);
+
+        dr_cnt = 0;
+        dr_fails = 0;
+        dr_max_latency = 0;
+        stats_cnt = 0;
+        stats_linger_us = -1;
+
+        return test_create_handle(RD_KAFKA_PRODUCER, conf);
+}
+
+
+static void produce_one (rd_kafka_t *p, const char *topic) {
+        rd_kafka_resp_err_t err;
+
+        err = rd_kafka_producev(p,
+                                RD_KAFKA_V_TOPIC(topic),
+                                RD_KAFKA_V_PARTITION(0),
+                                RD_KAFKA_V_VALUE("hi", 2),
+                                RD_KAFKA_V_OPAQUE(produce_ts_new()),
+                                RD_KAFKA_V_END);
+        TEST_ASSERT(!err, "producev() failed: %s", rd_kafka_err2str(err));
+}
+
+
+/**
+ * @brief Serve \p p until the next statistics have been emitted.
+ */
+static int64_t wait_stats (rd_kafka_t *p) {
+        int cnt = stats_cnt;
+
+        while (stats_cnt == cnt)
+                rd_kafka_poll(p, 100);
+
+        return stats_linger_us;
+}
+
+
+/**
+ * @brief Without adaptive linger the statistics report linger.ms.
+ */
+static void do_test_static (const char *bootstraps, const char *topic) {
+        rd_kafka_t *p;
+        int64_t linger_us;
+
+        TEST_SAY(_C_MAG "[ Static linger ]\n");
+
+        p = create_producer(bootstraps, rd_false);
+        produce_one(p, topic);
+        test_flush(p, 10*1000);
+
+        linger_us = wait_stats(p);
+        TEST_ASSERT(linger_us == (int64_t)_LINGER_MS * 1000,
+                    "Expected linger_us %d, not %"PRId64,
+                    _LINGER_MS * 1000, linger_us);
+
+        rd_kafka_destroy(p);
+
+        TEST_SAY(_C_GRN "[ Static linger: PASS ]\n");
+}
+
+
+/**
+ * @brief Messages produced at a low rate must not linger for linger.ms.
+ */
+static void do_test_low_load (const char *bootstraps, const char *topic) {
+        rd_kafka_t *p;
+        const int msgcnt = 5;
+        int i;
+
+        TEST_SAY(_C_MAG "[ Adaptive linger: low load ]\n");
+
+        p = create_producer(bootstraps, rd_true);
+
+        /* Look up the topic first so that the first message's latency
+         * does not include the initial metadata refresh. */
+        test_get_partition_count(p, topic, 5000);
+
+        for (i = 0 ; i < msgcnt ; i++) {
+                produce_one(p, topic);
+                while (dr_cnt < i + 1)
+                        rd_kafka_poll(p, 10);
+                rd_usleep(200*1000, 0);
+        }
+
+        TEST_ASSERT(dr_fails == 0, "%d message(s) failed", dr_fails);
+        TEST_SAY("Max delivery latency %.3fms (linger.ms %d)\n",
+                 (double)dr_max_latency / 1000.0, _LINGER_MS);
+        TEST_ASSERT(dr_max_latency < (_LINGER_MS / 2) * 1000,
+                    "Expected delivery latency well below linger.ms %dms, "
+                    "not %.3fms",
+                    _LINGER_MS, (double)dr_max_latency / 1000.0);
+
+        TEST_ASSERT(wait_stats(p) == 0,
+                    "Expected linger_us 0 under low load, not %"PRId64,
+                    stats_linger_us);
+
+        rd_kafka_destroy(p);
+
+        TEST_SAY(_C_GRN "[ Adaptive linger: low load: PASS ]\n");
+}
+
+
+/**
+ * @brief Messages produced at a high rate must linger, but within
+ *        the latency target.
+ */
+static void do_test_high_load (const char *bootstraps, const char *topic) {
+        rd_kafka_t *p;
+        rd_ts_t ts_end;
+        int64_t linger_us, max_linger_us = 0;
+        int msgcnt = 0;
+        /* The mock cluster rejects MessageSets with more records than
+         * fit its maximum per-record overhead, so avoid tiny values. */
+        char value[64];
+
+        memset(value, 'v', sizeof(value));
+
+        TEST_SAY(_C_MAG "[ Adaptive linger: high load ]\n");
+
+        p = create_producer(bootstraps, rd_true);
+
+        ts_end = test_clock() + 1000*1000;
+        while (test_clock() < ts_end) {
+                rd_kafka_resp_err_t err;
+                int i;
+
+                for (i = 0 ; i < 1000 ; i++) {
+                        rd_ts_t *ts = produce_ts_new();
+
+                        err = rd_kafka_producev(
+                                p,
+                                RD_KAFKA_V_TOPIC(topic),
+                                RD_KAFKA_V_PARTITION(0),
+                                RD_KAFKA_V_VALUE(value, sizeof(value)),
+                                RD_KAFKA_V_OPAQUE(ts),
+                                RD_KAFKA_V_END);
+                        if (err == RD_KAFKA_RESP_ERR__QUEUE_FULL) {
+                                free(ts);
+                                break;
+                        }
+                        TEST_ASSERT(!err, "producev() failed: %s",
+                                    rd_kafka_err2str(err));
+                        msgcnt++;
+                }
+
+                rd_kafka_poll(p, err ? 10 : 0);
+
+                if (stats_cnt > 0 && stats_linger_us > max_linger_us)
+                        max_linger_us = stats_linger_us;
+        }
+
+        /* Statistics emitted while still producing */
+        linger_us = wait_stats(p);
+        if (linger_us > max_linger_us)
+                max_linger_us = linger_us;
+
+        test_flush(p, 30*1000);
+
+        TEST_ASSERT(dr_cnt == msgcnt, "Expected %d delivery reports, not %d",
+                    msgcnt, dr_cnt);
+        TEST_ASSERT(dr_fails == 0, "%d message(s) failed", dr_fails);
+
+        TEST_SAY("Produced %d messages: max linger %.3fms\n",
+                 msgcnt, (double)max_linger_us / 1000.0);
+        TEST_ASSERT(max_linger_us > 0,
+                    "Expected non-zero linger time under high load");
+        TEST_ASSERT(max_linger_us <= _TARGET_MS * 1000,
+                    "Expected linger time within target %dms, not %.3fms",
+                    _TARGET_MS, (double)max_linger_us / 1000.0);
+
+        rd_kafka_destroy(p);
+
+        TEST_SAY(_C_GRN "[ Adaptive linger: high load: PASS ]\n");
+}
+
+
+int main_0113_adaptive_linger (int argc, char **argv) {
+        const char *topic = test_mk_topic_name("0113_adaptive_linger", 1);
+        rd_kafka_mock_cluster_t *mcluster;
+        const char *bootstraps;
+
+        if (test_needs_auth()) {
+                TEST_SKIP("Mock cluster does not support SSL/SASL\n");
+                return 0;
+        }
+
+        mcluster = test_mock_cluster_new(1, &bootstraps);
+
+        do_test_static(bootstraps, topic);
+        do_test_low_load(bootstraps, topic);
+        do_test_high_load(bootstraps, topic);
+
+        test_mock_cluster_destroy(mcluster);
+
+        return 0;
+}
@@ -0,0 +1,375 @@
+/*
+ * librdkafka - Apache Kafka C library
+ *
+ * Copyright (c) 2020, Magnus Edenhill
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "test.h"
+
+
+/**
+ * @name Verify the sticky partitioners (consistent_sticky, murmur2_sticky):
+ *       keyless messages are batched on one partition at a time, which
+ *       results in larger produce batches than random partitioning,
+ *       while keyed messages are still hash partitioned.
+ *
+ * The keyless test doubles as a benchmark: the average batch message
+ * count and throughput are printed for both partitioners.
+ */
+
+
+#define _PART_CNT 4 /* Partitions auto-created by the mock cluster */
+
+
+static int dr_cnt;
+static int dr_fails;
+static int dr_partcnt[_PART_CNT];
+static int32_t dr_last_partition;
+static int dr_switches; /**< Partition changes between consecutive DRs */
+
+static void dr_msg_cb (rd_kafka_t *rk, const rd_kafka_message_t *rkmessage,
+                       void *opaque) {
+        if (rkmessage->err) {
+                if (dr_fails++ == 0)
+                        TEST_SAY("Delivery failed: %s\n",
+                                 rd_kafka_err2str(rkmessage->err));
+                return;
+        }
+
+        TEST_ASSERT(rkmessage->partition >= 0 &&
+                    rkmessage->partition < _PART_CNT,
+                    "Unexpected partition %"PRId32, rkmessage->partition);
+
+        dr_partcnt[rkmessage->partition]++;
+        if (dr_cnt > 0 && rkmessage->partition != dr_last_partition)
+                dr_switches++;
+        dr_last_partition = rkmessage->partition;
+        dr_cnt++;
+}
+
+
+static int64_t stats_batchcnt_sum;
+static int64_t stats_batchcnt_cnt;
+static int stats_cnt;
+
+/**
+ * @brief Accumulate the topic's batchcnt sum and count, which are
+ *        rolled over on each statistics interval.
+ */
+static int stats_cb (rd_kafka_t *rk, char *json, size_t json_len,
+                     void *opaque) {
+        const char *s;
+        int64_t sum;
+        int cnt;
+
+        s = strstr(json, "\"batchcnt\": {");
+        if (!s)
+                return 0; /* Topic not yet known */
+
+        s = strstr(s, "\"sum\":");
+        TEST_ASSERT(s && sscanf(s, "\"sum\":%"SCNd64, &sum) == 1,
+                    "Failed to parse batchcnt sum");
+        s = strstr(s, "\"cnt\":");
+        TEST_ASSERT(s && sscanf(s, "\"cnt\":%d", &cnt) == 1,
+                    "Failed to parse batchcnt cnt");
+
+        stats_batchcnt_sum += sum;
+        stats_batchcnt_cnt += cnt;
+        stats_cnt++;
+
+        return 0;
+}
+
+
+static rd_kafka_t *create_producer (const char *bootstraps,
+                                    const char *partitioner,
+                                    int linger_ms) {
+        rd_kafka_conf_t *conf;
+
+        test_conf_init(&conf, NULL, 60);
+        test_conf_set(conf, "bootstrap.servers", bootstraps);
+        test_conf_set(conf, "linger.ms", tsprintf("%d", linger_ms));
+        test_conf_set(conf, "batch.num.messages", "1000");
+        test_conf_set(conf, "partitioner", partitioner);
+        test_conf_set(conf, "statistics.interval.ms", "100");
+        rd_kafka_conf_set_dr_msg_cb(conf, dr_msg_cb);
+        rd_kafka_conf_set_stats_cb(conf, stats_cb);
+
+        dr_cnt = 0;
+        dr_fails = 0;
+        dr_switches = 0;
+        memset(dr_partcnt, 0, sizeof(dr_partcnt));
+        stats_batchcnt_sum = 0;
+        stats_batchcnt_cnt = 0;
+        stats_cnt = 0;
+
+        return test_create_handle(RD_KAFKA_PRODUCER, conf);
+}
+
+
+/**
+ * @brief Produce \p msgcnt keyless messages using \p partitioner.
+ *
+ * If \p round_size is 0 the messages are produced as fast as possible,
+ * otherwise in rounds of \p round_size messages, each produced at once
+ * and then waited for to be delivered before the next round, with
+ * \p linger_ms set well above the time it takes to produce a round.
+ *
+ * @returns the average batch message count.
+ */
+static double produce_keyless (const char *bootstraps, const char *topic,
+                               const char *partitioner, int msgcnt,
+                               int round_size, int linger_ms) {
+        rd_kafka_t *p;
+        rd_ts_t ts_start, duration;
+        double avg_batchcnt;
+        /* The mock cluster rejects MessageSets with more records than
+         * fit its maximum per-record overhead, so avoid tiny values. */
+        char value[64];
+        int i, stats_wait;
+
+        memset(value, 'v', sizeof(value));
+
+        p = create_producer(bootstraps, partitioner, linger_ms);
+
+        /* Make sure the topic and its partitions are known so that
+         * all messages are partitioned at produce time. */
+        TEST_ASSERT(test_get_partition_count(p, topic, 5000) == _PART_CNT,
+                    "Expected %d partitions", _PART_CNT);
+
+        ts_start = test_clock();
+        for (i = 0 ; i < msgcnt ; ) {
+                rd_kafka_resp_err_t err;
+
+                err = rd_kafka_producev(p,
+                                        RD_KAFKA_V_TOPIC(topic),
+                                        RD_KAFKA_V_VALUE(value,
+                                                         sizeof(value)),
+                                        RD_KAFKA_V_END);
+                if (err == RD_KAFKA_RESP_ERR__QUEUE_FULL) {
+                        rd_kafka_poll(p, 10);
+                        continue;
+                }
+                TEST_ASSERT(!err, "producev() failed: %s",
+                            rd_kafka_err2str(err));
+                i++;
+
+                if (round_size && (i % round_size) == 0) {
+                        while (dr_cnt + dr_fails < i)
+                                rd_kafka_poll(p, 10);
+                }
+        }
+
+        test_flush(p, 30*1000);
+        duration = test_clock() - ts_start;
+
+        /* Wait for the statistics to cover all batches */
+        stats_wait = stats_cnt + 2;
+        while (stats_cnt < stats_wait)
+                rd_kafka_poll(p, 100);
+
+        TEST_ASSERT(dr_cnt == msgcnt, "Expected %d delivery reports, not %d",
+                    msgcnt, dr_cnt);
+        TEST_ASSERT(dr_fails == 0, "%d message(s) failed", dr_fails);
+        TEST_ASSERT(stats_batchcnt_cnt > 0, "No batches in statistics");
+
+        avg_batchcnt = (double)stats_batchcnt_sum /
+                (double)stats_batchcnt_cnt;
+
+        TEST_SAY("%-16s %s: %d messages in %"PRId64" batches: "
+                 "avg %.1f msgs/batch, %.0f msgs/s, "
+                 "partitions %d/%d/%d/%d, %d switches\n",
+                 partitioner, round_size ? "rounds" : "max rate",
+                 msgcnt, stats_batchcnt_cnt, avg_batchcnt,
+                 (double)msgcnt / ((double)duration / 1000000.0),
+                 dr_partcnt[0], dr_partcnt[1], dr_partcnt[2], dr_partcnt[3],
+                 dr_switches);
+
+        rd_kafka_destroy(p);
+
+        return avg_batchcnt;
+}
+
+
+/**
+ * @brief Keyless messages with a sticky partitioner must result in larger
+ *        batches than random partitioning, and still be spread
+ *        over more than one partition.
+ *
+ * At the maximum produce rate batches fill up to batch.num.messages
+ * regardless of the partitioner, so the benefit is measured with
+ * messages produced in rounds, each of which is delivered before the
+ * next one starts: with linger.ms well above the time it takes to
+ * produce a round, random partitioning splits each round over all
+ * partitions while the sticky partitioner keeps it on one partition,
+ * and picks another partition for the next round.
+ * This does not depend on how fast the producer or the broker thread run.
+ */
+static void do_test_keyless (const char *bootstraps, const char *topic) {
+        const int msgcnt = test_quick ? 20000 : 100000;
+        const int round_size = 100;
+        const int rounds = 20;
+        double random_avg, sticky_avg;
+        int i, used = 0;
+
+        TEST_SAY(_C_MAG "[ Keyless messages ]\n");
+
+        /* Benchmark only: report batch sizes and throughput */
+        produce_keyless(bootstraps, topic, "murmur2_random", msgcnt, 0, 10);
+        produce_keyless(bootstraps, topic, "murmur2_sticky", msgcnt, 0, 10);
+
+        random_avg = produce_keyless(bootstraps, topic, "murmur2_random",
+                                     round_size * rounds, round_size, 100);
+        sticky_avg = produce_keyless(bootstraps, topic, "murmur2_sticky",
+                                     round_size * rounds, round_size, 100);
+
+        for (i = 0 ; i < _PART_CNT ; i++)
+                if (dr_partcnt[i] > 0)
+                        used++;
+        TEST_ASSERT(used > 1,
+                    "Expected sticky partitioner to switch partitions, "
+                    "only %d partition(s) used", used);
+
+        TEST_SAY("Sticky partitioner average batch is %.2fx that of "
+                 "random partitioning\n", sticky_avg / random_avg);
+
+        TEST_ASSERT(sticky_avg > random_avg,
+                    "Expected sticky average batch (%.1f msgs) to be larger "
+                    "than random (%.1f msgs)", sticky_avg, random_avg);
+
+        TEST_SAY(_C_GRN "[ Keyless messages: PASS ]\n");
+}
+
+
+/**
+ * @brief Keyed messages must be hash partitioned by the sticky
+ *        partitioners, and empty keys only be sticky with
+ *        consistent_sticky.
+ */
+static void do_test_keyed (const char *bootstraps, const char *topic,
+                           const char *partitioner, rd_bool_t empty_sticky) {
+        rd_kafka_t *p;
+        const int msgcnt = 100;
+        int32_t exp_partition;
+        char value[64];
+        int i;
+
+        memset(value, 'v', sizeof(value));
+
+        TEST_SAY(_C_MAG "[ Keyed messages with %s ]\n", partitioner);
+
+        p = create_producer(bootstraps, partitioner, 10);
+        TEST_ASSERT(test_get_partition_count(p, topic, 5000) == _PART_CNT,
+                    "Expected %d partitions", _PART_CNT);
+
+        for (i = 0 ; i < msgcnt ; i++) {
+                rd_kafka_resp_err_t err;
+
+                err = rd_kafka_producev(p,
+                                        RD_KAFKA_V_TOPIC(topic),
+                                        RD_KAFKA_V_KEY("mykey", 5),
+                                        RD_KAFKA_V_VALUE(value,
+                                                         sizeof(value)),
+                                        RD_KAFKA_V_END);
+                TEST_ASSERT(!err, "producev() failed: %s",
+                            rd_kafka_err2str(err));
+        }
+        test_flush(p, 10*1000);
+
+        if (empty_sticky)
+                exp_partition = rd_kafka_msg_partitioner_consistent(
+                        NULL, "mykey", 5, _PART_CNT, NULL, NULL);
+        else
+                exp_partition = rd_kafka_msg_partitioner_murmur2(
+                        NULL, "mykey", 5, _PART_CNT, NULL, NULL);
+
+        TEST_ASSERT(dr_cnt == msgcnt && dr_partcnt[exp_partition] == msgcnt,
+                    "Expected all %d keyed messages in partition %"PRId32
+                    ", got %d of %d",
+                    msgcnt, exp_partition, dr_partcnt[exp_partition], dr_cnt);
+
+        /* Empty keys: sticky for consistent_sticky, else hashed. */
+        dr_cnt = 0;
+        dr_switches = 0;
+        memset(dr_partcnt, 0, sizeof(dr_partcnt));
+
+        for (i = 0 ; i < msgcnt ; i++) {
+                rd_kafka_resp_err_t err;
+
+                err = rd_kafka_producev(p,
+                                        RD_KAFKA_V_TOPIC(topic),
+                                        RD_KAFKA_V_KEY("", 0),
+                                        RD_KAFKA_V_VALUE(value,
+                                                         sizeof(value)),
+                                        RD_KAFKA_V_END);
+                TEST_ASSERT(!err, "producev() failed: %s",
+                            rd_kafka_err2str(err));
+        }
+        test_flush(p, 10*1000);
+
+        if (!empty_sticky) {
+                exp_partition = rd_kafka_msg_partitioner_murmur2(
+                        NULL, "", 0, _PART_CNT, NULL, NULL);
+                TEST_ASSERT(dr_partcnt[exp_partition] == msgcnt,
+                            "Expected all %d empty-key messages in "
+                            "partition %"PRId32", got %d",
+                            msgcnt, exp_partition,
+                            dr_partcnt[exp_partition]);
+        } else {
+                /* Produced within linger.ms in one go: expect them to
+                 * stick to a handful of partitions rather than being
+                 * spread out message by message. */
+                TEST_ASSERT(dr_switches < msgcnt / 4,
+                            "Expected empty-key messages to be sticky, "
+                            "got %d partition switches for %d messages",
+                            dr_switches, msgcnt);
+        }
+
+        rd_kafka_destroy(p);
+
+        TEST_SAY(_C_GRN "[ Keyed messages with %s: PASS ]\n", partitioner);
+}
+
+
+int main_0114_sticky_partitioner (int argc, char **argv) {
+        const char *topic = test_mk_topic_name("0114_sticky_partitioner", 1);
+        rd_kafka_mock_cluster_t *mcluster;
+        const char *bootstraps;
+
+        if (test_needs_auth()) {
+                TEST_SKIP("Mock cluster does not support SSL/SASL\n");
+                return 0;
+        }
+
+        mcluster = test_mock_cluster_new(1, &bootstraps);
+
+        do_test_keyed(bootstraps, topic, "murmur2_sticky", rd_false);
+        do_test_keyed(bootstraps, topic, "consistent_sticky", rd_true);
+        do_test_keyless(bootstraps, topic);
+
+        test_mock_cluster_destroy(mcluster);
+
+        return 0;
+}
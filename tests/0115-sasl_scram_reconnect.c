@@ -0,0 +1,224 @@
+/*
+ * librdkafka - Apache Kafka C library
+ *
+ * Copyright (c) 2020, Magnus Edenhill
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "test.h"
+
+
+/**
+ * @name Reconnect to a SASL SCRAM enabled mock cluster and verify that
+ *       the derived SCRAM keys are reused across reconnects rather than
+ *       re-running the expensive key derivation on each connection,
+ *       as reported in the statistics.
+ *
+ * Doubles as a benchmark: the time to re-authenticate to all brokers and
+ * produce a message to each partition is printed per round.
+ */
+
+
+#define _PART_CNT   4  /* Partitions auto-created by the mock cluster */
+#define _BROKER_CNT 3
+#define _ROUNDS     10
+
+
+static int is_fatal_cb (rd_kafka_t *rk, rd_kafka_resp_err_t err,
+                        const char *reason) {
+        /* The brokers are disconnected on purpose, ignore the resulting
+         * connectivity errors. */
+        if (err == RD_KAFKA_RESP_ERR__TRANSPORT ||
+            err == RD_KAFKA_RESP_ERR__ALL_BROKERS_DOWN)
+                return 0;
+        return 1;
+}
+
+
+static int64_t stats_derived_cnt;
+static int64_t stats_cached_cnt;
+static int stats_cnt;
+
+/**
+ * @brief Extract the SCRAM key cache counters from the statistics.
+ */
+static int stats_cb (rd_kafka_t *rk, char *json, size_t json_len,
+                     void *opaque) {
+        const char *s;
+
+        s = strstr(json, "\"sasl_scram\": ");
+        TEST_ASSERT(s, "No sasl_scram in statistics");
+        TEST_ASSERT(sscanf(s, "\"sasl_scram\": { "
+                           "\"keys_derived\": %"SCNd64", "
+                           "\"keys_cached\": %"SCNd64,
+                           &stats_derived_cnt, &stats_cached_cnt) == 2,
+                    "Failed to parse sasl_scram: %.*s", 80, s);
+
+        stats_cnt++;
+
+        return 0;
+}
+
+
+/**
+ * @brief Serve \p p until the next statistics have been emitted.
+ */
+static void wait_stats (rd_kafka_t *p) {
+        int cnt = stats_cnt;
+
+        while (stats_cnt == cnt)
+                rd_kafka_poll(p, 100);
+}
+
+
+static int dr_fails;
+
+static void dr_msg_cb (rd_kafka_t *rk, const rd_kafka_message_t *rkmessage,
+                       void *opaque) {
+        if (rkmessage->err && dr_fails++ == 0)
+                TEST_SAY("Delivery failed: %s\n",
+                         rd_kafka_err2str(rkmessage->err));
+}
+
+
+static void conf_set_sasl (rd_kafka_conf_t *conf) {
+        test_conf_set(conf, "security.protocol", "SASL_PLAINTEXT");
+        test_conf_set(conf, "sasl.mechanisms", "SCRAM-SHA-256");
+        test_conf_set(conf, "sasl.username", "myuser");
+        test_conf_set(conf, "sasl.password", "mypassword");
+}
+
+
+int main_0115_sasl_scram_reconnect (int argc, char **argv) {
+        const char *topic = test_mk_topic_name("0115_sasl_scram_reconnect",
+                                               1);
+        rd_kafka_t *mrk, *p;
+        rd_kafka_conf_t *conf;
+        rd_kafka_mock_cluster_t *mcluster;
+        const char *bootstraps;
+        char errstr[256];
+        char value[64];
+        rd_kafka_resp_err_t err;
+        rd_ts_t ts_start, duration, total = 0;
+        int round;
+
+        if (!test_check_builtin("sasl_scram")) {
+                TEST_SKIP("sasl_scram feature not built-in\n");
+                return 0;
+        }
+
+        /* The mock cluster authenticates clients with the SASL
+         * configuration of its rd_kafka_t instance. */
+        test_conf_init(&conf, NULL, 0);
+        test_conf_set(conf, "client.id", "MOCK");
+        conf_set_sasl(conf);
+        mrk = rd_kafka_new(RD_KAFKA_PRODUCER, conf, errstr, sizeof(errstr));
+        TEST_ASSERT(mrk, "Failed to create mock cluster rd_kafka_t: %s",
+                    errstr);
+        mcluster = rd_kafka_mock_cluster_new(mrk, _BROKER_CNT);
+        TEST_ASSERT(mcluster, "Failed to acquire mock cluster");
+        bootstraps = rd_kafka_mock_cluster_bootstraps(mcluster);
+
+        test_conf_init(&conf, NULL, 60);
+        test_conf_set(conf, "bootstrap.servers", bootstraps);
+        conf_set_sasl(conf);
+        test_conf_set(conf, "linger.ms", "0");
+        /* Keep the reconnect backoff from dominating the round time */
+        test_conf_set(conf, "reconnect.backoff.ms", "10");
+        test_conf_set(conf, "reconnect.backoff.max.ms", "100");
+        test_conf_set(conf, "statistics.interval.ms", "100");
+        rd_kafka_conf_set_dr_msg_cb(conf, dr_msg_cb);
+        rd_kafka_conf_set_stats_cb(conf, stats_cb);
+        p = test_create_handle(RD_KAFKA_PRODUCER, conf);
+
+        TEST_ASSERT(test_get_partition_count(p, topic, 10000) == _PART_CNT,
+                    "Expected %d partitions", _PART_CNT);
+
+        wait_stats(p);
+        TEST_SAY("Initial connections: SCRAM keys derived %"PRId64
+                 " time(s), reused %"PRId64" time(s)\n",
+                 stats_derived_cnt, stats_cached_cnt);
+        TEST_ASSERT(stats_derived_cnt == 1,
+                    "Expected SCRAM keys to be derived once, not %"PRId64
+                    " times", stats_derived_cnt);
+
+        memset(value, 'v', sizeof(value));
+
+        test_curr->is_fatal_cb = is_fatal_cb;
+
+        for (round = 0 ; round < _ROUNDS ; round++) {
+                int32_t partition;
+                int32_t broker_id;
+
+                for (broker_id = 1 ; broker_id <= _BROKER_CNT ; broker_id++)
+                        rd_kafka_mock_broker_disconnect(mcluster, broker_id);
+
+                ts_start = test_clock();
+
+                for (partition = 0 ; partition < _PART_CNT ; partition++) {
+                        err = rd_kafka_producev(
+                                p,
+                                RD_KAFKA_V_TOPIC(topic),
+                                RD_KAFKA_V_PARTITION(partition),
+                                RD_KAFKA_V_VALUE(value, sizeof(value)),
+                                RD_KAFKA_V_END);
+                        TEST_ASSERT(!err, "producev() failed: %s",
+                                    rd_kafka_err2str(err));
+                }
+
+                err = rd_kafka_flush(p, 30 * 1000);
+                TEST_ASSERT(!err, "flush() failed: %s",
+                            rd_kafka_err2str(err));
+
+                duration = test_clock() - ts_start;
+                total += duration;
+                TEST_SAY("Round %d: reconnected and produced in %.3fms\n",
+                         round, (double)duration / 1000.0);
+        }
+
+        test_curr->is_fatal_cb = NULL;
+
+        TEST_ASSERT(dr_fails == 0, "%d message(s) failed delivery", dr_fails);
+
+        wait_stats(p);
+        TEST_SAY("SCRAM keys derived %"PRId64" time(s), "
+                 "reused %"PRId64" time(s), average round %.3fms\n",
+                 stats_derived_cnt, stats_cached_cnt,
+                 (double)total / 1000.0 / _ROUNDS);
+        TEST_ASSERT(stats_derived_cnt == 1,
+                    "Expected the reconnects to use the cached SCRAM keys, "
+                    "but the keys were derived %"PRId64" times",
+                    stats_derived_cnt);
+        /* At least the partition leaders are reconnected each round */
+        TEST_ASSERT(stats_cached_cnt >= _ROUNDS,
+                    "Expected cached SCRAM keys to be used at least "
+                    "%d times, not %"PRId64, _ROUNDS, stats_cached_cnt);
+
+        rd_kafka_destroy(p);
+
+        rd_kafka_mock_cluster_destroy(mcluster);
+        rd_kafka_destroy(mrk);
+
+        return 0;
+}
@@ -0,0 +1,259 @@
+/*
+ * librdkafka - Apache Kafka C library
+ *
+ * Copyright (c) 2020, Magnus Edenhill
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "test.h"
+
+
+/**
+ * @name Verify rd_kafka_stats_snapshot() full and incremental snapshots
+ *       against the mock cluster, and benchmark snapshots of a producer
+ *       with many partitions.
+ */
+
+
+#define _PART_CNT 4 /* Partitions auto-created by the mock cluster */
+
+
+static const rd_kafka_stats_topic_t *
+find_topic (const rd_kafka_stats_t *stats, const char *topic) {
+        int i;
+
+        for (i = 0 ; i < stats->topic_cnt ; i++)
+                if (!strcmp(stats->topics[i].topic, topic))
+                        return &stats->topics[i];
+
+        return NULL;
+}
+
+
+static void produce_to (rd_kafka_t *rk, const char *topic,
+                        int32_t partition, int msgcnt) {
+        int i;
+
+        for (i = 0 ; i < msgcnt ; i++) {
+                rd_kafka_resp_err_t err;
+
+                err = rd_kafka_producev(rk,
+                                        RD_KAFKA_V_TOPIC(topic),
+                                        RD_KAFKA_V_PARTITION(partition),
+                                        RD_KAFKA_V_VALUE("hi", 2),
+                                        RD_KAFKA_V_END);
+                TEST_ASSERT(!err, "producev() failed: %s",
+                            rd_kafka_err2str(err));
+        }
+}
+
+
+static void do_test_snapshot (const char *bootstraps) {
+        const char *topic = test_mk_topic_name("0116_stats_snapshot", 1);
+        rd_kafka_conf_t *conf;
+        rd_kafka_t *rk;
+        const rd_kafka_stats_t *full, *incr, *incr2;
+        const rd_kafka_stats_topic_t *st;
+        uint64_t txmsgs = 0;
+        int i;
+
+        TEST_SAY(_C_MAG "[ Full and incremental snapshots ]\n");
+
+        test_conf_init(&conf, NULL, 60);
+        test_conf_set(conf, "bootstrap.servers", bootstraps);
+        test_conf_set(conf, "linger.ms", "0");
+        rk = test_create_handle(RD_KAFKA_PRODUCER, conf);
+
+        TEST_ASSERT(test_get_partition_count(rk, topic, 5000) == _PART_CNT,
+                    "Expected %d partitions", _PART_CNT);
+
+        for (i = 0 ; i < _PART_CNT ; i++)
+                produce_to(rk, topic, i, 10);
+        test_flush(rk, 10000);
+
+        full = rd_kafka_stats_snapshot(rk, NULL);
+        TEST_ASSERT(!full->incremental, "Expected full snapshot");
+        TEST_ASSERT(full->broker_cnt >= 3,
+                    "Expected at least 3 brokers, not %d", full->broker_cnt);
+        TEST_ASSERT(full->msg_cnt == 0,
+                    "Expected no queued messages, not %u", full->msg_cnt);
+
+        st = find_topic(full, topic);
+        TEST_ASSERT(st, "Topic %s not in snapshot", topic);
+        TEST_ASSERT(st->partition_cnt == _PART_CNT,
+                    "Expected %d partitions, not %d",
+                    _PART_CNT, st->partition_cnt);
+        for (i = 0 ; i < st->partition_cnt ; i++) {
+                const rd_kafka_stats_partition_t *sp = &st->partitions[i];
+
+                TEST_ASSERT(sp->partition == i,
+                            "Expected partition %d, not %"PRId32,
+                            i, sp->partition);
+                TEST_ASSERT(sp->txmsgs == 10,
+                            "Expected 10 messages sent to partition %d, "
+                            "not %"PRIu64, i, sp->txmsgs);
+                TEST_ASSERT(sp->broker != -1 && sp->leader == sp->broker,
+                            "Partition %d: broker %"PRId32", leader %"PRId32,
+                            i, sp->broker, sp->leader);
+                txmsgs += sp->txmsgs;
+        }
+        TEST_ASSERT(full->txmsgs == txmsgs,
+                    "Expected total txmsgs %"PRIu64", not %"PRIu64,
+                    txmsgs, full->txmsgs);
+
+        /* Only partition 2 changes */
+        produce_to(rk, topic, 2, 5);
+        test_flush(rk, 10000);
+
+        incr = rd_kafka_stats_snapshot(rk, full);
+        TEST_ASSERT(incr->incremental, "Expected incremental snapshot");
+        TEST_ASSERT(incr->txmsgs == txmsgs + 5,
+                    "Expected total txmsgs %"PRIu64", not %"PRIu64,
+                    txmsgs + 5, incr->txmsgs);
+        TEST_ASSERT(incr->broker_cnt == full->broker_cnt,
+                    "Expected %d brokers, not %d",
+                    full->broker_cnt, incr->broker_cnt);
+        TEST_ASSERT(incr->topic_cnt == 1,
+                    "Expected one changed topic, not %d", incr->topic_cnt);
+        st = find_topic(incr, topic);
+        TEST_ASSERT(st && st->partition_cnt == 1 &&
+                    st->partitions[0].partition == 2 &&
+                    st->partitions[0].txmsgs == 15,
+                    "Expected only partition 2 with 15 messages sent");
+
+        /* Nothing changed since the previous incremental snapshot */
+        incr2 = rd_kafka_stats_snapshot(rk, incr);
+        TEST_ASSERT(incr2->incremental && incr2->topic_cnt == 0,
+                    "Expected no changed topics, not %d", incr2->topic_cnt);
+
+        rd_kafka_stats_destroy(incr2);
+        rd_kafka_stats_destroy(incr);
+        rd_kafka_stats_destroy(full);
+
+        rd_kafka_destroy(rk);
+
+        TEST_SAY(_C_GRN "[ Full and incremental snapshots: PASS ]\n");
+}
+
+
+static void do_test_snapshot_bench (const char *bootstraps, int topic_cnt) {
+        const int iterations = 100;
+        rd_kafka_conf_t *conf;
+        rd_kafka_t *rk;
+        const rd_kafka_stats_t *stats, *prev;
+        char **topics;
+        test_timing_t t_full;
+        rd_ts_t incr_dur = 0;
+        int i, partition_cnt = 0;
+
+        TEST_SAY(_C_MAG "[ Snapshot benchmark with %d partitions ]\n",
+                 topic_cnt * _PART_CNT);
+
+        test_conf_init(&conf, NULL, 60);
+        test_conf_set(conf, "bootstrap.servers", bootstraps);
+        rk = test_create_handle(RD_KAFKA_PRODUCER, conf);
+
+        topics = malloc(sizeof(*topics) * topic_cnt);
+        for (i = 0 ; i < topic_cnt ; i++) {
+                topics[i] = rd_strdup(test_mk_topic_name("0116_stats_bench",
+                                                         1));
+                produce_to(rk, topics[i], RD_KAFKA_PARTITION_UA, 1);
+        }
+        test_flush(rk, 60000);
+
+        stats = rd_kafka_stats_snapshot(rk, NULL);
+        for (i = 0 ; i < stats->topic_cnt ; i++)
+                partition_cnt += stats->topics[i].partition_cnt;
+        TEST_ASSERT(partition_cnt >= topic_cnt * _PART_CNT,
+                    "Expected at least %d partitions, not %d",
+                    topic_cnt * _PART_CNT, partition_cnt);
+        TEST_ASSERT(stats->txmsgs == (uint64_t)topic_cnt,
+                    "Expected %d messages sent, not %"PRIu64,
+                    topic_cnt, stats->txmsgs);
+        rd_kafka_stats_destroy(stats);
+
+        TIMING_START(&t_full, "%d full snapshots", iterations);
+        for (i = 0 ; i < iterations ; i++)
+                rd_kafka_stats_destroy(rd_kafka_stats_snapshot(rk, NULL));
+        TIMING_STOP(&t_full);
+
+        /* One partition changes between snapshots */
+        prev = rd_kafka_stats_snapshot(rk, NULL);
+        for (i = 0 ; i < iterations ; i++) {
+                rd_kafka_resp_err_t err;
+                rd_ts_t ts;
+
+                produce_to(rk, topics[i % topic_cnt], 0, 1);
+                err = rd_kafka_flush(rk, 10000);
+                TEST_ASSERT(!err, "flush() failed: %s",
+                            rd_kafka_err2str(err));
+
+                ts = test_clock();
+                stats = rd_kafka_stats_snapshot(rk, prev);
+                incr_dur += test_clock() - ts;
+
+                TEST_ASSERT(stats->topic_cnt == 1 &&
+                            stats->topics[0].partition_cnt == 1,
+                            "Expected one changed partition, "
+                            "not %d topic(s)", stats->topic_cnt);
+
+                rd_kafka_stats_destroy(prev);
+                prev = stats;
+        }
+        rd_kafka_stats_destroy(prev);
+
+        TEST_SAY("%d partitions: full snapshot %.1fus, "
+                 "incremental snapshot %.1fus\n", partition_cnt,
+                 (double)TIMING_DURATION(&t_full) / iterations,
+                 (double)incr_dur / iterations);
+
+        rd_kafka_destroy(rk);
+
+        for (i = 0 ; i < topic_cnt ; i++)
+                rd_free(topics[i]);
+        free(topics);
+
+        TEST_SAY(_C_GRN "[ Snapshot benchmark with %d partitions: PASS ]\n",
+                 topic_cnt * _PART_CNT);
+}
+
+
+int main_0116_stats_snapshot (int argc, char **argv) {
+        rd_kafka_mock_cluster_t *mcluster;
+        const char *bootstraps;
+
+        if (test_needs_auth()) {
+                TEST_SKIP("Mock cluster does not support SSL/SASL\n");
+                return 0;
+        }
+
+        mcluster = test_mock_cluster_new(3, &bootstraps);
+
+        do_test_snapshot(bootstraps);
+        do_test_snapshot_bench(bootstraps, test_quick ? 100 : 500);
+
+        test_mock_cluster_destroy(mcluster);
+
+        return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * librdkafka - Apache Kafka C library
+ *
+ * Copyright (c) 2020, Magnus Edenhill
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "test.h"
+
+
+/**
+ * @name With sparse connections a broker connection is only brought up
+ *       when it is needed. A request that ends up in the broker's output
+ *       queue while the connection is going down must bring the
+ *       connection back up, also when it holds back the producer from
+ *       creating ProduceRequests (queue.buffering.backpressure.threshold).
+ *
+ * Disconnecting all brokers at once makes the first broker to go down
+ * enqueue a metadata refresh on one of the others while it is itself
+ * going down.
+ */
+
+
+#define _PART_CNT   4  /* Partitions auto-created by the mock cluster */
+#define _BROKER_CNT 3
+#define _ROUNDS     10
+
+
+static int is_fatal_cb (rd_kafka_t *rk, rd_kafka_resp_err_t err,
+                        const char *reason) {
+        /* The brokers are disconnected on purpose, ignore the resulting
+         * connectivity errors. */
+        if (err == RD_KAFKA_RESP_ERR__TRANSPORT ||
+            err == RD_KAFKA_RESP_ERR__ALL_BROKERS_DOWN)
+                return 0;
+        return 1;
+}
+
+
+static void produce_all (rd_kafka_t *p, const char *topic, int *remainsp) {
+        int32_t partition;
+
+        for (partition = 0 ; partition < _PART_CNT ; partition++) {
+                rd_kafka_resp_err_t err;
+
+                err = rd_kafka_producev(p,
+                                        RD_KAFKA_V_TOPIC(topic),
+                                        RD_KAFKA_V_PARTITION(partition),
+                                        RD_KAFKA_V_VALUE("hi", 2),
+                                        RD_KAFKA_V_OPAQUE(remainsp),
+                                        RD_KAFKA_V_END);
+                TEST_ASSERT(!err, "producev() failed: %s",
+                            rd_kafka_err2str(err));
+                (*remainsp)++;
+        }
+}
+
+
+static void do_test_reconnect_queued (void) {
+        const char *topic = test_mk_topic_name("0117_reconnect_queued", 1);
+        rd_kafka_mock_cluster_t *mcluster;
+        const char *bootstraps;
+        rd_kafka_conf_t *conf;
+        rd_kafka_t *p;
+        int remains = 0;
+        int round;
+
+        TEST_SAY(_C_MAG "[ Reconnect with a request queued ]\n");
+
+        mcluster = test_mock_cluster_new(_BROKER_CNT, &bootstraps);
+
+        test_conf_init(&conf, NULL, 60);
+        test_conf_set(conf, "bootstrap.servers", bootstraps);
+        test_conf_set(conf, "enable.sparse.connections", "true");
+        test_conf_set(conf, "linger.ms", "0");
+        /* Keep the reconnect backoff from dominating the test time */
+        test_conf_set(conf, "reconnect.backoff.ms", "10");
+        test_conf_set(conf, "reconnect.backoff.max.ms", "100");
+        rd_kafka_conf_set_dr_msg_cb(conf, test_dr_msg_cb);
+        p = test_create_handle(RD_KAFKA_PRODUCER, conf);
+
+        /* Connect to all partition leaders */
+        produce_all(p, topic, &remains);
+        test_flush(p, 10*1000);
+
+        test_curr->is_fatal_cb = is_fatal_cb;
+
+        for (round = 0 ; round < _ROUNDS ; round++) {
+                rd_kafka_resp_err_t err;
+                int32_t broker_id;
+
+                for (broker_id = 1 ; broker_id <= _BROKER_CNT ; broker_id++)
+                        rd_kafka_mock_broker_disconnect(mcluster, broker_id);
+
+                produce_all(p, topic, &remains);
+
+                err = rd_kafka_flush(p, 10*1000);
+                TEST_ASSERT(!err, "Round %d: flush() failed: %s: "
+                            "%d message(s) not delivered",
+                            round, rd_kafka_err2str(err), remains);
+        }
+
+        test_curr->is_fatal_cb = NULL;
+
+        TEST_ASSERT(remains == 0, "%d message(s) not delivered", remains);
+
+        rd_kafka_destroy(p);
+
+        test_mock_cluster_destroy(mcluster);
+
+        TEST_SAY(_C_GRN "[ Reconnect with a request queued: PASS ]\n");
+}
+
+
+int main_0117_produce_reconnect_queued (int argc, char **argv) {
+
+        if (test_needs_auth()) {
+                TEST_SKIP("Mock cluster does not support SSL/SASL\n");
+                return 0;
+        }
+
+        do_test_reconnect_queued();
+
+        return 0;
+}
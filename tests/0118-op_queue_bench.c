@@ -0,0 +1,161 @@
+/*
+ * librdkafka - Apache Kafka C library
+ *
+ * Copyright (c) 2020, Magnus Edenhill
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "test.h"
+
+
+/**
+ * @name Benchmark the reply queue with and without enable.lockfree.enqueue
+ *       with 1 to 32 broker threads enqueuing delivery reports on it
+ *       concurrently, and the application thread dequeuing them.
+ *
+ * Each broker leads one single-partition topic and every message is sent
+ * in its own ProduceRequest, so each message is delivered in its own
+ * delivery report op. The delivery reports of each partition must
+ * arrive in offset order.
+ */
+
+
+struct bench_topic {
+        char name[64];
+        int64_t next_offset;
+};
+
+
+static void dr_msg_cb (rd_kafka_t *rk, const rd_kafka_message_t *rkmessage,
+                       void *opaque) {
+        struct bench_topic *topics = opaque;
+        struct bench_topic *bt = &topics[(intptr_t)rkmessage->_private];
+
+        TEST_ASSERT(!rkmessage->err, "%s: delivery failed: %s",
+                    bt->name, rd_kafka_err2str(rkmessage->err));
+        TEST_ASSERT(rkmessage->offset == bt->next_offset,
+                    "%s: expected delivery report for offset %"PRId64", "
+                    "not %"PRId64,
+                    bt->name, bt->next_offset, rkmessage->offset);
+        bt->next_offset++;
+}
+
+
+static void produce_one (rd_kafka_t *p, struct bench_topic *topics,
+                         intptr_t idx) {
+        rd_kafka_resp_err_t err;
+
+        err = rd_kafka_producev(p,
+                                RD_KAFKA_V_TOPIC(topics[idx].name),
+                                RD_KAFKA_V_PARTITION(0),
+                                RD_KAFKA_V_VALUE("bench", 5),
+                                RD_KAFKA_V_OPAQUE((void *)idx),
+                                RD_KAFKA_V_END);
+        TEST_ASSERT(!err, "producev() failed: %s", rd_kafka_err2str(err));
+}
+
+
+static void do_test_bench (int broker_cnt, rd_bool_t lockfree, int msgcnt) {
+        rd_kafka_mock_cluster_t *mcluster;
+        struct bench_topic *topics;
+        const char *bootstraps;
+        rd_kafka_conf_t *conf;
+        rd_kafka_t *p;
+        test_timing_t t_produce;
+        int64_t delivered = 0;
+        int i;
+
+        mcluster = test_mock_cluster_new(broker_cnt, &bootstraps);
+
+        topics = calloc(broker_cnt, sizeof(*topics));
+        for (i = 0 ; i < broker_cnt ; i++) {
+                rd_snprintf(topics[i].name, sizeof(topics[i].name), "%s_%d",
+                            test_mk_topic_name("0118_op_queue_bench", 1), i);
+                rd_kafka_mock_partition_set_leader(mcluster, topics[i].name,
+                                                   0, i + 1);
+        }
+
+        test_conf_init(&conf, NULL, 60);
+        test_conf_set(conf, "bootstrap.servers", bootstraps);
+        test_conf_set(conf, "enable.lockfree.enqueue",
+                      lockfree ? "true" : "false");
+        test_conf_set(conf, "linger.ms", "0");
+        test_conf_set(conf, "batch.num.messages", "1");
+        rd_kafka_conf_set_dr_msg_cb(conf, dr_msg_cb);
+        rd_kafka_conf_set_opaque(conf, topics);
+        p = test_create_handle(RD_KAFKA_PRODUCER, conf);
+
+        /* Connect to all brokers before the timing starts */
+        for (i = 0 ; i < broker_cnt ; i++)
+                produce_one(p, topics, i);
+        test_flush(p, tmout_multip(10*1000));
+
+        TIMING_START(&t_produce, "%d broker thread(s), %s enqueue",
+                     broker_cnt, lockfree ? "lock-free" : "locked");
+
+        for (i = 0 ; i < msgcnt ; i++) {
+                produce_one(p, topics, i % broker_cnt);
+                rd_kafka_poll(p, 0);
+        }
+
+        test_flush(p, tmout_multip(60*1000));
+
+        TIMING_STOP(&t_produce);
+
+        for (i = 0 ; i < broker_cnt ; i++)
+                delivered += topics[i].next_offset - 1/*connect*/;
+        TEST_ASSERT(delivered == msgcnt,
+                    "expected %d delivery reports, not %"PRId64,
+                    msgcnt, delivered);
+
+        TEST_SAY("%2d broker thread(s), %-9s enqueue: %d delivery reports: "
+                 "%.0f ops/s\n",
+                 broker_cnt, lockfree ? "lock-free" : "locked", msgcnt,
+                 (double)msgcnt /
+                 ((double)TIMING_DURATION(&t_produce) / 1000000.0));
+
+        rd_kafka_destroy(p);
+        free(topics);
+
+        test_mock_cluster_destroy(mcluster);
+}
+
+
+int main_0118_op_queue_bench (int argc, char **argv) {
+        static const int broker_cnts[] = { 1, 2, 4, 8, 16, 32 };
+        const int msgcnt = test_quick ? 2000 : 10000;
+        size_t i;
+
+        if (test_needs_auth()) {
+                TEST_SKIP("Mock cluster does not support SSL/SASL\n");
+                return 0;
+        }
+
+        for (i = 0 ; i < RD_ARRAYSIZE(broker_cnts) ; i++) {
+                do_test_bench(broker_cnts[i], rd_false, msgcnt);
+                do_test_bench(broker_cnts[i], rd_true, msgcnt);
+        }
+
+        return 0;
+}
@@ -0,0 +1,269 @@
+/*
+ * librdkafka - Apache Kafka C library
+ *
+ * Copyright (c) 2020, Magnus Edenhill
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ * AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE
+ * LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ * CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ * SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ * INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ * CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ * ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ * POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "test.h"
+
+
+/**
+ * @name Verify that socket.send.batch.max writes several queued
+ *       ProduceRequests with a single sendmsg(), that a request partially
+ *       written by such a write is resumed correctly, and that a limit
+ *       of 1 writes one request at a time.
+ *
+ * The producer's protocol debug log tells how each request was written:
+ * a request that already has bytes written when it reaches the head of
+ * the output queue was (partially) written along with the preceding
+ * request. The messages are consumed back and compared byte by byte.
+ */
+
+
+#define _PART_CNT 32
+
+
+static struct {
+        mtx_t lock;
+        int last_corrid;  /**< CorrId of the current head request */
+        int batched;      /**< Requests written along with a preceding one */
+        int batched_partial; /**< .. of which only partially */
+        int partial;      /**< Partial writes of the head request */
+} send_stats;
+
+
+static void log_cb (const rd_kafka_t *rk, int level,
+                    const char *fac, const char *buf) {
+        const char *s;
+        int of, len, size, corrid;
+
+        /* The message follows the thread and broker name prefix */
+        if (strcmp(fac, "SEND") || !(s = strstr(buf, ": Sent ")))
+                return;
+
+        if (sscanf(s, ": Sent partial %*s (v%*d, %d+%d/%d bytes, CorrId %d)",
+                   &of, &len, &size, &corrid) == 4) {
+                mtx_lock(&send_stats.lock);
+                send_stats.partial++;
+
+        } else if (sscanf(s, ": Sent %*s (v%*d, %d bytes @ %d, CorrId %d)",
+                          &size, &of, &corrid) == 3) {
+                mtx_lock(&send_stats.lock);
+
+        } else
+                return;
+
+        /* Requests are logged in output queue order, the first line for
+         * a request tells if it was started by a preceding write. */
+        if (corrid != send_stats.last_corrid && of > 0) {
+                send_stats.batched++;
+                if (of < size)
+                        send_stats.batched_partial++;
+        }
+        send_stats.last_corrid = corrid;
+
+        mtx_unlock(&send_stats.lock);
+}
+
+
+/**
+ * @brief Consume all messages from all partitions of \p topic and verify
+ *        their keys and values.
+ */
+static void verify_msgs (rd_kafka_t *c, const char *topic, uint64_t testid,
+                         int msgcnt, size_t msgsize) {
+        rd_kafka_topic_t *rkt = test_create_topic_object(c, topic, NULL);
+        rd_kafka_queue_t *rkqu = rd_kafka_queue_new(c);
+        int next_msgid[_PART_CNT] = RD_ZERO_INIT;
+        char *exp_val = malloc(msgsize);
+        char key[128];
+        int32_t partition;
+        int cnt;
+
+        for (partition = 0 ; partition < _PART_CNT ; partition++)
+                TEST_ASSERT(!rd_kafka_consume_start_queue(
+                                    rkt, partition,
+                                    RD_KAFKA_OFFSET_BEGINNING, rkqu),
+                            "consume_start_queue() failed: %s",
+                            rd_kafka_err2str(rd_kafka_last_error()));
+
+        for (cnt = 0 ; cnt < _PART_CNT * msgcnt ; cnt++) {
+                rd_kafka_message_t *rkm;
+
+                rkm = rd_kafka_consume_queue(rkqu, tmout_multip(10*1000));
+                TEST_ASSERT(rkm, "timed out after %d/%d messages",
+                            cnt, _PART_CNT * msgcnt);
+                TEST_ASSERT(!rkm->err, "consume error: %s",
+                            rd_kafka_message_errstr(rkm));
+                TEST_ASSERT(next_msgid[rkm->partition] < msgcnt,
+                            "unexpected message from partition %"PRId32,
+                            rkm->partition);
+
+                test_prepare_msg(testid, rkm->partition,
+                                 next_msgid[rkm->partition],
+                                 exp_val, msgsize, key, sizeof(key));
+                TEST_ASSERT(rkm->key_len == strlen(key) &&
+                            !memcmp(rkm->key, key, rkm->key_len) &&
+                            rkm->len == msgsize &&
+                            !memcmp(rkm->payload, exp_val, msgsize),
+                            "[%"PRId32"]: message at offset %"PRId64
+                            " is not msg #%d as produced",
+                            rkm->partition, rkm->offset,
+                            next_msgid[rkm->partition]);
+                next_msgid[rkm->partition]++;
+
+                rd_kafka_message_destroy(rkm);
+        }
+
+        for (partition = 0 ; partition < _PART_CNT ; partition++)
+                rd_kafka_consume_stop(rkt, partition);
+
+        rd_kafka_queue_destroy(rkqu);
+        rd_kafka_topic_destroy(rkt);
+        free(exp_val);
+}
+
+
+/**
+ * @param batch_max socket.send.batch.max
+ * @param msgsize Message size: sendmsg() writes at most the socket send
+ *                buffer size, which is set to 64KB, at a time.
+ *                Larger requests are always written partially.
+ */
+static void do_test_send_batch (int batch_max, int msgcnt, size_t msgsize) {
+        const char *topic = test_mk_topic_name("0119_send_batch", 1);
+        rd_kafka_mock_cluster_t *mcluster;
+        const char *bootstraps;
+        rd_kafka_conf_t *conf;
+        rd_kafka_t *p, *c;
+        rd_kafka_topic_t *rkt;
+        uint64_t testid = test_id_generate();
+        rd_bool_t large = msgcnt * msgsize > 64 * 1024;
+        int remains = 0;
+        int32_t partition;
+
+        TEST_SAY(_C_MAG "[ socket.send.batch.max=%d with %s requests ]\n",
+                 batch_max, large ? "large" : "small");
+
+        /* Broker 1 is the bootstrap broker, broker 2 leads all partitions.
+         * The highest partition is set first to create the topic with
+         * all partitions. */
+        mcluster = test_mock_cluster_new(2, &bootstraps);
+        for (partition = _PART_CNT - 1 ; partition >= 0 ; partition--)
+                rd_kafka_mock_partition_set_leader(mcluster, topic,
+                                                   partition, 2);
+
+        memset(&send_stats, 0, sizeof(send_stats));
+        mtx_init(&send_stats.lock, mtx_plain);
+
+        test_conf_init(&conf, NULL, 60);
+        test_conf_set(conf, "bootstrap.servers",
+                      tsprintf("%.*s", (int)strcspn(bootstraps, ","),
+                               bootstraps));
+        test_conf_set(conf, "socket.send.batch.max",
+                      tsprintf("%d", batch_max));
+        test_conf_set(conf, "linger.ms", "0");
+        /* The kernel doubles the configured size */
+        test_conf_set(conf, "socket.send.buffer.bytes", "32768");
+        /* Allow more than one ProduceRequest to be queued */
+        test_conf_set(conf, "queue.buffering.backpressure.threshold", "100");
+        test_conf_set(conf, "debug", "protocol");
+        rd_kafka_conf_set_log_cb(conf, log_cb);
+        rd_kafka_conf_set_dr_msg_cb(conf, test_dr_msg_cb);
+        p = test_create_handle(RD_KAFKA_PRODUCER, conf);
+
+        /* Produce to all partitions before their leader is connected,
+         * the ProduceRequests for all partitions are then created,
+         * and queued, as soon as the connection is up. */
+        rkt = test_create_producer_topic(p, topic, NULL);
+        for (partition = 0 ; partition < _PART_CNT ; partition++)
+                test_produce_msgs_nowait(p, rkt, testid, partition,
+                                         0, msgcnt, NULL, msgsize, 0,
+                                         &remains);
+        rd_kafka_topic_destroy(rkt);
+
+        test_flush(p, tmout_multip(10*1000));
+        TEST_ASSERT(remains == 0, "%d message(s) not delivered", remains);
+
+        rd_kafka_destroy(p);
+
+        TEST_SAY("%d request(s) written along with a preceding request "
+                 "(%d partially), %d partial write(s)\n",
+                 send_stats.batched, send_stats.batched_partial,
+                 send_stats.partial);
+
+        if (batch_max == 1)
+                TEST_ASSERT(send_stats.batched == 0,
+                            "Expected no batched requests with "
+                            "socket.send.batch.max=1, not %d",
+                            send_stats.batched);
+        else if (!large)
+                TEST_ASSERT(send_stats.batched > 0,
+                            "Expected requests to be written along with "
+                            "preceding requests");
+        else
+                TEST_ASSERT(send_stats.batched_partial > 0,
+                            "Expected requests to be partially written "
+                            "along with preceding requests");
+
+        if (large)
+                TEST_ASSERT(send_stats.partial > 0,
+                            "Expected partial writes");
+
+        mtx_destroy(&send_stats.lock);
+
+        test_conf_init(&conf, NULL, 60);
+        test_conf_set(conf, "bootstrap.servers", bootstraps);
+        c = test_create_handle(RD_KAFKA_CONSUMER, conf);
+
+        verify_msgs(c, topic, testid, msgcnt, msgsize);
+
+        rd_kafka_destroy(c);
+
+        test_mock_cluster_destroy(mcluster);
+
+        TEST_SAY(_C_GRN "[ socket.send.batch.max=%d with %s requests: "
+                 "PASS ]\n", batch_max, large ? "large" : "small");
+}
+
+
+int main_0119_send_batch (int argc, char **argv) {
+
+        if (test_needs_auth()) {
+                TEST_SKIP("Mock cluster does not support SSL/SASL\n");
+                return 0;
+        }
+
+        /* Small requests: many are written in full by a single write */
+        do_test_send_batch(64, 10, 100);
+        do_test_send_batch(1, 10, 100);
+
+        /* Large requests: every write is partial, and a batched write
+         * ends in the middle of the following request. */
+        do_test_send_batch(64, 10, 10000);
+        do_test_send_batch(1, 10, 10000);
+
+        return 0;
+}
@@ -206,6 +206,21 @@ _TEST_DECL(0100_thread_interceptors);
 _TEST_DECL(0101_fetch_from_follower);
 _TEST_DECL(0102_static_group_rebalance);
 _TEST_DECL(0104_fetch_from_follower_mock);
+_TEST_DECL(0105_produce_zerocopy);
+_TEST_DECL(0106_lockfree_enqueue);
+_TEST_DECL(0107_compression_threads);
+_TEST_DECL(0108_produce_multi_partition);
+_TEST_DECL(0109_fetch_sessions);
+_TEST_DECL(0110_producev_topic_lookup);
+_TEST_DECL(0111_fetch_large_response);
+_TEST_DECL(0112_fetch_memory_budget);
+_TEST_DECL(0113_adaptive_linger);
+_TEST_DECL(0114_sticky_partitioner);
+_TEST_DECL(0115_sasl_scram_reconnect);
+_TEST_DECL(0116_stats_snapshot);
+_TEST_DECL(0117_produce_reconnect_queued);
+_TEST_DECL(0118_op_queue_bench);
+_TEST_DECL(0119_send_batch);
 
 /* Manual tests */
 _TEST_DECL(8000_idle);
@@ -380,6 +395,21 @@ struct test tests[] = {
               TEST_BRKVER(2,3,0,0)),
         _TEST(0104_fetch_from_follower_mock, TEST_F_LOCAL,
               TEST_BRKVER(2,4,0,0)),
+        _TEST(0105_produce_zerocopy, TEST_F_LOCAL),
+        _TEST(0106_lockfree_enqueue, TEST_F_LOCAL),
+        _TEST(0107_compression_threads, TEST_F_LOCAL),
+        _TEST(0108_produce_multi_partition, TEST_F_LOCAL),
+        _TEST(0109_fetch_sessions, TEST_F_LOCAL),
+        _TEST(0110_producev_topic_lookup, TEST_F_LOCAL),
+        _TEST(0111_fetch_large_response, TEST_F_LOCAL),
+        _TEST(0112_fetch_memory_budget, TEST_F_LOCAL),
+        _TEST(0113_adaptive_linger, TEST_F_LOCAL),
+        _TEST(0114_sticky_partitioner, TEST_F_LOCAL),
+        _TEST(0115_sasl_scram_reconnect, TEST_F_LOCAL),
+        _TEST(0116_stats_snapshot, TEST_F_LOCAL),
+        _TEST(0117_produce_reconnect_queued, TEST_F_LOCAL),
+        _TEST(0118_op_queue_bench, TEST_F_LOCAL),
+        _TEST(0119_send_batch, TEST_F_LOCAL),
 
         /* Manual tests */
         _TEST(8000_idle, TEST_F_MANUAL),